@@ -25,7 +25,8 @@
 
 // Allocates a new alpha decoder instance.
 static ALPHDecoder* ALPHNew(void) {
-  ALPHDecoder* const dec = (ALPHDecoder*)WebPSafeCalloc(1ULL, sizeof(*dec));
+  ALPHDecoder* const dec =
+      (ALPHDecoder*)WebPSafeCallocTransient(1ULL, sizeof(*dec));
   return dec;
 }
 
@@ -153,7 +154,8 @@ static int AllocateAlphaPlane(VP8Decoder* const dec, const VP8Io* const io) {
   const uint64_t alpha_size = (uint64_t)stride * height;
   assert(dec->alpha_plane_mem_ == NULL);
   dec->alpha_plane_mem_ =
-      (uint8_t*)WebPSafeMalloc(alpha_size, sizeof(*dec->alpha_plane_));
+      (uint8_t*)WebPSafeMallocTransient(alpha_size,
+                                        sizeof(*dec->alpha_plane_));
   if (dec->alpha_plane_mem_ == NULL) {
     return 0;
   }
@@ -11,6 +11,7 @@
 //
 // Author: Skal (pascal.massimino@gmail.com)
 
+#include <limits.h>
 #include <stdlib.h>
 #include "src/dec/vp8i_dec.h"
 #include "src/utils/utils.h"
@@ -68,15 +69,41 @@ static void DoUVTransform(uint32_t bits, const int16_t* const src,
   }
 }
 
+// Position reached by a row in the wavefront progress counters, once its
+// first 'num_mb' macroblocks are processed. Always increasing with mb_y.
+static WEBP_INLINE int RowPosition(const VP8Decoder* const dec,
+                                   int mb_y, int num_mb) {
+  return mb_y * (dec->mb_w_ + 1) + num_mb;
+}
+
+// Wait until the first 'num_mb' macroblocks of row 'mb_y' are processed.
+static void WaitForRow(const VP8Decoder* const dec,
+                       WebPWorkerProgress* const progress,
+                       int mb_y, int num_mb) {
+  if (num_mb > dec->mb_w_) num_mb = dec->mb_w_;
+  WebPWorkerProgressWait(progress, RowPosition(dec, mb_y, num_mb));
+}
+
+// Returns the number of macroblocks of the row 'mb_y' that need to be
+// reconstructed, in case of cropping. The macroblocks on the left of the crop
+// window are always needed, since each macroblock is predicted from its left
+// neighbour. On the right, the 4x4 prediction also uses the top-right
+// macroblock, hence each row needs one more column than the row below it.
+static int ReconstructWidth(const VP8Decoder* const dec, int mb_y) {
+  const int mb_end = dec->br_mb_x_ + (dec->br_mb_y_ - 1 - mb_y);
+  return (mb_end < dec->mb_w_) ? mb_end : dec->mb_w_;
+}
+
 static void ReconstructRow(const VP8Decoder* const dec,
-                           const VP8ThreadContext* ctx) {
+                           VP8ThreadContext* const ctx) {
   int j;
   int mb_x;
   const int mb_y = ctx->mb_y_;
+  const int mb_end = ReconstructWidth(dec, mb_y);
   const int cache_id = ctx->id_;
-  uint8_t* const y_dst = dec->yuv_b_ + Y_OFF;
-  uint8_t* const u_dst = dec->yuv_b_ + U_OFF;
-  uint8_t* const v_dst = dec->yuv_b_ + V_OFF;
+  uint8_t* const y_dst = ctx->yuv_b_ + Y_OFF;
+  uint8_t* const u_dst = ctx->yuv_b_ + U_OFF;
+  uint8_t* const v_dst = ctx->yuv_b_ + V_OFF;
 
   // Initialize left-most block.
   for (j = 0; j < 16; ++j) {
@@ -99,9 +126,14 @@ static void ReconstructRow(const VP8Decoder* const dec,
   }
 
   // Reconstruct one row.
-  for (mb_x = 0; mb_x < dec->mb_w_; ++mb_x) {
+  for (mb_x = 0; mb_x < mb_end; ++mb_x) {
     const VP8MBData* const block = ctx->mb_data_ + mb_x;
 
+    if (ctx->top_ctx_ != NULL) {
+      // Wavefront: the top and top-right samples must be available.
+      WaitForRow(dec, &ctx->top_ctx_->recon_, mb_y - 1, mb_x + 2);
+    }
+
     // Rotate in the left samples from previously decoded block. We move four
     // pixels at a time for alignment reason, and because of in-loop filter.
     if (mb_x > 0) {
@@ -187,6 +219,13 @@ static void ReconstructRow(const VP8Decoder* const dec,
         memcpy(v_out + j * dec->cache_uv_stride_, v_dst + j * BPS, 8);
       }
     }
+    if (dec->mt_method_ == 3) {
+      WebPWorkerProgressSet(&ctx->recon_, RowPosition(dec, mb_y, mb_x + 1));
+    }
+  }
+  if (dec->mt_method_ == 3 && mb_end < dec->mb_w_) {
+    // the skipped macroblocks are not waited for either.
+    WebPWorkerProgressSet(&ctx->recon_, RowPosition(dec, mb_y, dec->mb_w_));
   }
 }
 
@@ -200,8 +239,8 @@ static void ReconstructRow(const VP8Decoder* const dec,
 //                 U/V, so it's 8 samples total (because of the 2x upsampling).
 static const uint8_t kFilterExtraRows[3] = { 0, 2, 8 };
 
-static void DoFilter(const VP8Decoder* const dec, int mb_x, int mb_y) {
-  const VP8ThreadContext* const ctx = &dec->thread_ctx_;
+static void DoFilter(const VP8Decoder* const dec,
+                     const VP8ThreadContext* const ctx, int mb_x, int mb_y) {
   const int cache_id = ctx->id_;
   const int y_bps = dec->cache_y_stride_;
   const VP8FInfo* const f_info = ctx->f_info_ + mb_x;
@@ -250,12 +289,13 @@ static void DoFilter(const VP8Decoder* const dec, int mb_x, int mb_y) {
 }
 
 // Filter the decoded macroblock row (if needed)
-static void FilterRow(const VP8Decoder* const dec) {
+static void FilterRow(const VP8Decoder* const dec,
+                      const VP8ThreadContext* const ctx) {
   int mb_x;
-  const int mb_y = dec->thread_ctx_.mb_y_;
-  assert(dec->thread_ctx_.filter_row_);
+  const int mb_y = ctx->mb_y_;
+  assert(ctx->filter_row_);
   for (mb_x = dec->tl_mb_x_; mb_x < dec->br_mb_x_; ++mb_x) {
-    DoFilter(dec, mb_x, mb_y);
+    DoFilter(dec, ctx, mb_x, mb_y);
   }
 }
 
@@ -368,11 +408,11 @@ static void Dither8x8(VP8Random* const rg, uint8_t* dst, int bps, int amp) {
   VP8DitherCombine8x8(dither, dst, bps);
 }
 
-static void DitherRow(VP8Decoder* const dec) {
+static void DitherRow(VP8Decoder* const dec,
+                      const VP8ThreadContext* const ctx) {
   int mb_x;
   assert(dec->dither_);
   for (mb_x = dec->tl_mb_x_; mb_x < dec->br_mb_x_; ++mb_x) {
-    const VP8ThreadContext* const ctx = &dec->thread_ctx_;
     const VP8MBData* const data = ctx->mb_data_ + mb_x;
     const int cache_id = ctx->id_;
     const int uv_bps = dec->cache_uv_stride_;
@@ -385,6 +425,212 @@ static void DitherRow(VP8Decoder* const dec) {
   }
 }
 
+//------------------------------------------------------------------------------
+// DC-only reconstruction, for thumbnails.
+// Each 4x4 block is reduced to a single sample: the mean of its prediction
+// plus the DC part of its residual. The prediction means are approximated
+// from the neighbouring samples, which are flat over each 4x4 block. There's
+// no transform and no loop-filtering. The result is a 1/4-scale picture, to
+// be rescaled to the final size.
+// The AC coefficients can't be skipped in the token partitions, so they are
+// still parsed: this only roughly halves the decoding time.
+
+// Don't bother below this downscaling ratio: the approximation would show.
+#define DC_THUMBNAIL_MIN_RATIO 8
+
+void VP8InitDCThumbnail(const WebPDecoderOptions* const options,
+                        VP8Decoder* const dec, VP8Io* const io) {
+  assert(dec != NULL && io != NULL);
+  dec->dc_only_ = 0;
+  if (options != NULL && options->use_dc_thumbnail &&
+      options->use_scaling && !options->use_cropping &&
+      options->scaled_width > 0 && options->scaled_height > 0 &&
+      options->scaled_width * DC_THUMBNAIL_MIN_RATIO <= io->width &&
+      options->scaled_height * DC_THUMBNAIL_MIN_RATIO <= io->height &&
+      dec->alpha_data_ == NULL) {
+    dec->dc_only_ = 1;
+    dec->mt_method_ = 0;   // fast enough already
+    dec->num_threads_ = 1;
+    io->width = (io->width + 3) >> 2;
+    io->height = (io->height + 3) >> 2;
+  }
+}
+
+static WEBP_INLINE int Clip8(int v) {
+  return (v < 0) ? 0 : (v > 255) ? 255 : v;
+}
+
+// DC part of the residual of a 4x4 block with non-zero 'code'.
+static WEBP_INLINE int DCResidual(uint32_t code, const int16_t* const coeffs) {
+  return code ? (coeffs[0] + 4) >> 3 : 0;
+}
+
+// Mean value of a 4x4 prediction, given the flat top-left, top, top-right
+// and left neighbours.
+static int PredictDC4x4(int mode, int tl, int t, int tr, int l) {
+  switch (mode) {
+    case B_DC_PRED: return (t + l + 1) >> 1;
+    case B_TM_PRED: return Clip8(l + t - tl);
+    case B_VE_PRED: return (tl + 14 * t + tr + 8) >> 4;
+    case B_HE_PRED: return (tl + 15 * l + 8) >> 4;
+    case B_RD_PRED: return (3 * t + 3 * l + 2 * tl + 4) >> 3;
+    case B_VR_PRED: return (5 * t + 2 * l + tl + 4) >> 3;
+    case B_LD_PRED: return (t + tr + 1) >> 1;
+    case B_VL_PRED: return (5 * t + 3 * tr + 4) >> 3;
+    case B_HD_PRED: return (5 * l + 2 * t + tl + 4) >> 3;
+    default:        return l;   // B_HU_PRED
+  }
+}
+
+// Predicts the 'size' x 'size' samples of a 16x16 luma or 8x8 chroma
+// macroblock (one sample per 4x4 block) into 'dst', from the 'top' and 'left'
+// samples, and the 'top_left' one.
+static void PredictDCBlock(int mode, int size, const uint8_t* const top,
+                           const uint8_t* const left, int top_left,
+                           uint8_t* dst, int stride) {
+  int i, j;
+  int dc = 0;
+  if (mode == DC_PRED || mode == B_DC_PRED_NOTOP) {
+    for (j = 0; j < size; ++j) dc += left[j];
+  }
+  if (mode == DC_PRED || mode == B_DC_PRED_NOLEFT) {
+    for (i = 0; i < size; ++i) dc += top[i];
+  }
+  dc = (mode == DC_PRED) ? (dc + size) / (2 * size)
+     : (mode == B_DC_PRED_NOTOPLEFT) ? 0x80
+     : (dc + size / 2) / size;
+  for (j = 0; j < size; ++j, dst += stride) {
+    for (i = 0; i < size; ++i) {
+      dst[i] = (mode == TM_PRED) ? Clip8(left[j] + top[i] - top_left)
+             : (mode == V_PRED) ? top[i]
+             : (mode == H_PRED) ? left[j]
+             : dc;
+    }
+  }
+}
+
+// Same as PredictDCBlock(), for the 8x8 chroma blocks, followed by the
+// addition of the DC residuals.
+static void ReconstructDCChroma(int mode, const uint8_t* const top,
+                                const uint8_t* const left, int top_left,
+                                uint32_t bits, const int16_t* const coeffs,
+                                uint8_t* const dst, int stride) {
+  int n;
+  PredictDCBlock(mode, 2, top, left, top_left, dst, stride);
+  for (n = 0; n < 4; ++n) {
+    uint8_t* const d = dst + (n >> 1) * stride + (n & 1);
+    *d = Clip8(*d + DCResidual((bits >> (6 - 2 * n)) & 3, coeffs + n * 16));
+  }
+}
+
+static void ReconstructRowDC(const VP8Decoder* const dec,
+                             const VP8ThreadContext* const ctx) {
+  const int mb_y = ctx->mb_y_;
+  const int y_bps = dec->cache_y_stride_;
+  const int uv_bps = dec->cache_uv_stride_;
+  // top-left samples of the current macroblock
+  int tl_y = (mb_y > 0) ? 129 : 127;
+  int tl_u = tl_y, tl_v = tl_y;
+  int mb_x;
+  for (mb_x = 0; mb_x < dec->mb_w_; ++mb_x) {
+    const VP8MBData* const block = ctx->mb_data_ + mb_x;
+    VP8TopSamples* const top_yuv = dec->yuv_t_ + mb_x;
+    uint8_t* const y_dst = dec->cache_y_ + 4 * mb_x;
+    uint8_t* const u_dst = dec->cache_u_ + 2 * mb_x;
+    uint8_t* const v_dst = dec->cache_v_ + 2 * mb_x;
+    uint8_t top_y[4 + 1], left_y[4];
+    uint8_t top_u[2], left_u[2], top_v[2], left_v[2];
+    int i, j;
+
+    if (mb_y > 0) {
+      memcpy(top_y, top_yuv[0].y, 4);
+      memcpy(top_u, top_yuv[0].u, 2);
+      memcpy(top_v, top_yuv[0].v, 2);
+      // top-right samples, replicated on the rightmost border
+      top_y[4] = (mb_x < dec->mb_w_ - 1) ? top_yuv[1].y[0] : top_yuv[0].y[3];
+    } else {
+      memset(top_y, 127, sizeof(top_y));
+      memset(top_u, 127, sizeof(top_u));
+      memset(top_v, 127, sizeof(top_v));
+    }
+    for (j = 0; j < 4; ++j) {
+      left_y[j] = (mb_x > 0) ? y_dst[j * y_bps - 1] : 129;
+    }
+    for (j = 0; j < 2; ++j) {
+      left_u[j] = (mb_x > 0) ? u_dst[j * uv_bps - 1] : 129;
+      left_v[j] = (mb_x > 0) ? v_dst[j * uv_bps - 1] : 129;
+    }
+
+    if (block->is_i4x4_) {
+      for (j = 0; j < 4; ++j) {
+        for (i = 0; i < 4; ++i) {
+          const int n = 4 * j + i;
+          uint8_t* const dst = y_dst + j * y_bps + i;
+          const int t = (j > 0) ? dst[-y_bps] : top_y[i];
+          const int l = (i > 0) ? dst[-1] : left_y[j];
+          const int tl = (j > 0) ? ((i > 0) ? dst[-y_bps - 1] : left_y[j - 1])
+                                 : ((i > 0) ? top_y[i - 1] : tl_y);
+          // the top-right samples of the macroblock are replicated below
+          const int tr = (j > 0 && i < 3) ? dst[-y_bps + 1] : top_y[i + 1];
+          const int pred = PredictDC4x4(block->imodes_[n], tl, t, tr, l);
+          const uint32_t code = (block->non_zero_y_ >> (30 - 2 * n)) & 3;
+          *dst = Clip8(pred + DCResidual(code, block->coeffs_ + n * 16));
+        }
+      }
+    } else {
+      const int mode = CheckMode(mb_x, mb_y, block->imodes_[0]);
+      PredictDCBlock(mode, 4, top_y, left_y, tl_y, y_dst, y_bps);
+      for (j = 0; j < 4; ++j) {
+        for (i = 0; i < 4; ++i) {
+          const int n = 4 * j + i;
+          const uint32_t code = (block->non_zero_y_ >> (30 - 2 * n)) & 3;
+          uint8_t* const dst = y_dst + j * y_bps + i;
+          *dst = Clip8(*dst + DCResidual(code, block->coeffs_ + n * 16));
+        }
+      }
+    }
+    {
+      const int mode = CheckMode(mb_x, mb_y, block->uvmode_);
+      ReconstructDCChroma(mode, top_u, left_u, tl_u,
+                          block->non_zero_uv_ >> 0, block->coeffs_ + 16 * 16,
+                          u_dst, uv_bps);
+      ReconstructDCChroma(mode, top_v, left_v, tl_v,
+                          block->non_zero_uv_ >> 8, block->coeffs_ + 20 * 16,
+                          v_dst, uv_bps);
+    }
+
+    // the top samples become the top-left ones of the next macroblock
+    tl_y = top_y[3];
+    tl_u = top_u[1];
+    tl_v = top_v[1];
+    // stash away top samples for next row
+    for (i = 0; i < 4; ++i) top_yuv[0].y[i] = y_dst[3 * y_bps + i];
+    for (i = 0; i < 2; ++i) {
+      top_yuv[0].u[i] = u_dst[uv_bps + i];
+      top_yuv[0].v[i] = v_dst[uv_bps + i];
+    }
+  }
+}
+
+// Transmits the 4 rows (and 2 chroma rows) of samples of a macroblock row.
+static int EmitRowDC(const VP8Decoder* const dec, int mb_y, VP8Io* const io) {
+  const int y_start = 4 * mb_y;
+  int y_end = 4 * (mb_y + 1);
+  if (io->put == NULL) return 1;
+  if (y_end > io->crop_bottom) y_end = io->crop_bottom;
+  if (y_start >= y_end) return 1;
+  io->y = dec->cache_y_;
+  io->u = dec->cache_u_;
+  io->v = dec->cache_v_;
+  io->a = NULL;
+  io->mb_y = y_start;
+  io->mb_w = io->crop_right - io->crop_left;
+  io->mb_h = y_end - y_start;
+  return io->put(io);
+}
+
+#undef DC_THUMBNAIL_MIN_RATIO
+
 //------------------------------------------------------------------------------
 // This function is called after a row of macroblocks is finished decoding.
 // It also takes into account the following restrictions:
@@ -398,12 +644,11 @@ static void DitherRow(VP8Decoder* const dec) {
 
 #define MACROBLOCK_VPOS(mb_y)  ((mb_y) * 16)    // vertical position of a MB
 
-// Finalize and transmit a complete row. Return false in case of user-abort.
-static int FinishRow(void* arg1, void* arg2) {
-  VP8Decoder* const dec = (VP8Decoder*)arg1;
-  VP8Io* const io = (VP8Io*)arg2;
+// Transmit a complete row, once reconstructed and filtered. Return false in
+// case of user-abort.
+static int EmitRow(VP8Decoder* const dec, const VP8ThreadContext* const ctx,
+                   VP8Io* const io) {
   int ok = 1;
-  const VP8ThreadContext* const ctx = &dec->thread_ctx_;
   const int cache_id = ctx->id_;
   const int extra_y_rows = kFilterExtraRows[dec->filter_type_];
   const int ysize = extra_y_rows * dec->cache_y_stride_;
@@ -417,18 +662,6 @@ static int FinishRow(void* arg1, void* arg2) {
   const int is_first_row = (mb_y == 0);
   const int is_last_row = (mb_y >= dec->br_mb_y_ - 1);
 
-  if (dec->mt_method_ == 2) {
-    ReconstructRow(dec, ctx);
-  }
-
-  if (ctx->filter_row_) {
-    FilterRow(dec);
-  }
-
-  if (dec->dither_) {
-    DitherRow(dec);
-  }
-
   if (io->put != NULL) {
     int y_start = MACROBLOCK_VPOS(mb_y);
     int y_end = MACROBLOCK_VPOS(mb_y + 1);
@@ -482,8 +715,8 @@ static int FinishRow(void* arg1, void* arg2) {
       ok = io->put(io);
     }
   }
-  // rotate top samples if needed
-  if (cache_id + 1 == dec->num_caches_) {
+  // rotate top samples if needed (done by RotateColumn() for mt_method_ 3)
+  if (cache_id + 1 == dec->num_caches_ && dec->mt_method_ != 3) {
     if (!is_last_row) {
       memcpy(dec->cache_y_ - ysize, ydst + 16 * dec->cache_y_stride_, ysize);
       memcpy(dec->cache_u_ - uvsize, udst + 8 * dec->cache_uv_stride_, uvsize);
@@ -494,6 +727,95 @@ static int FinishRow(void* arg1, void* arg2) {
   return ok;
 }
 
+// Finalize and transmit a complete row. Return false in case of user-abort.
+static int FinishRow(void* arg1, void* arg2) {
+  VP8Decoder* const dec = (VP8Decoder*)arg1;
+  VP8Io* const io = (VP8Io*)arg2;
+  VP8ThreadContext* const ctx = &dec->thread_ctx_;
+
+  if (dec->mt_method_ == 2) {
+    ReconstructRow(dec, ctx);
+  }
+
+  if (ctx->filter_row_) {
+    FilterRow(dec, ctx);
+  }
+
+  if (dec->dither_) {
+    DitherRow(dec, ctx);
+  }
+
+  return EmitRow(dec, ctx, io);
+}
+
+// Copy the bottom samples of the last cache row above the first cache row,
+// for the macroblock column 'mb_x' only. This is the wavefront equivalent of
+// the whole-row rotation done at the end of EmitRow().
+static void RotateColumn(const VP8Decoder* const dec, int mb_x) {
+  int j;
+  const int extra_y_rows = kFilterExtraRows[dec->filter_type_];
+  const int extra_uv_rows = extra_y_rows / 2;
+  const int y_bps = dec->cache_y_stride_;
+  const int uv_bps = dec->cache_uv_stride_;
+  const int y_src_row = 16 * dec->num_caches_ - extra_y_rows;
+  const int uv_src_row = 8 * dec->num_caches_ - extra_uv_rows;
+  uint8_t* const y_dst = dec->cache_y_ - extra_y_rows * y_bps + mb_x * 16;
+  uint8_t* const u_dst = dec->cache_u_ - extra_uv_rows * uv_bps + mb_x * 8;
+  uint8_t* const v_dst = dec->cache_v_ - extra_uv_rows * uv_bps + mb_x * 8;
+  const uint8_t* const y_src = y_dst + (extra_y_rows + y_src_row) * y_bps;
+  const uint8_t* const u_src = u_dst + (extra_uv_rows + uv_src_row) * uv_bps;
+  const uint8_t* const v_src = v_dst + (extra_uv_rows + uv_src_row) * uv_bps;
+  for (j = 0; j < extra_y_rows; ++j) {
+    memcpy(y_dst + j * y_bps, y_src + j * y_bps, 16);
+  }
+  for (j = 0; j < extra_uv_rows; ++j) {
+    memcpy(u_dst + j * uv_bps, u_src + j * uv_bps, 8);
+    memcpy(v_dst + j * uv_bps, v_src + j * uv_bps, 8);
+  }
+}
+
+// Reconstruct, filter and transmit one row, running as a wavefront with the
+// rows handled by the other workers (mt_method_ == 3):
+//  * the reconstruction of macroblock 'x' needs the unfiltered top samples
+//    of macroblocks 'x' and 'x + 1' from the row above.
+//  * the filtering of macroblock 'x' reads and modifies the bottom samples
+//    of the row above, which the filtering of macroblock 'x + 1' above it
+//    also alters.
+//  * rows are transmitted in order.
+// Return false in case of user-abort.
+static int FinishRowWavefront(void* arg1, void* arg2) {
+  VP8Decoder* const dec = (VP8Decoder*)arg1;
+  VP8ThreadContext* const ctx = (VP8ThreadContext*)arg2;
+  VP8ThreadContext* const top_ctx = ctx->top_ctx_;
+  const int mb_y = ctx->mb_y_;
+  const int rotate = (top_ctx != NULL && ctx->id_ == 0 &&
+                      dec->filter_type_ > 0);
+  int mb_x;
+  int ok;
+
+  ReconstructRow(dec, ctx);
+
+  for (mb_x = 0; mb_x < dec->mb_w_; ++mb_x) {
+    if (top_ctx != NULL) {
+      WaitForRow(dec, &top_ctx->filter_, mb_y - 1, mb_x + 2);
+    }
+    if (rotate) {
+      RotateColumn(dec, mb_x);
+    }
+    if (ctx->filter_row_ && mb_x >= dec->tl_mb_x_ && mb_x < dec->br_mb_x_) {
+      DoFilter(dec, ctx, mb_x, mb_y);
+    }
+    WebPWorkerProgressSet(&ctx->filter_, RowPosition(dec, mb_y, mb_x + 1));
+  }
+
+  if (WebPWorkerProgressWait(&dec->emit_row_, mb_y) != mb_y) {
+    return 0;   // a previous row was aborted.
+  }
+  ok = EmitRow(dec, ctx, &ctx->io_);
+  WebPWorkerProgressSet(&dec->emit_row_, ok ? mb_y + 1 : INT_MAX);
+  return ok;
+}
+
 #undef MACROBLOCK_VPOS
 
 //------------------------------------------------------------------------------
@@ -504,12 +826,43 @@ int VP8ProcessRow(VP8Decoder* const dec, VP8Io* const io) {
   const int filter_row =
       (dec->filter_type_ > 0) &&
       (dec->mb_y_ >= dec->tl_mb_y_) && (dec->mb_y_ <= dec->br_mb_y_);
-  if (dec->mt_method_ == 0) {
+  if (dec->dc_only_) {
+    ctx->mb_y_ = dec->mb_y_;
+    ReconstructRowDC(dec, ctx);
+    ok = EmitRowDC(dec, dec->mb_y_, io);
+  } else if (dec->mt_method_ == 0) {
     // ctx->id_ and ctx->f_info_ are already set
     ctx->mb_y_ = dec->mb_y_;
     ctx->filter_row_ = filter_row;
     ReconstructRow(dec, ctx);
     ok = FinishRow(dec, io);
+  } else if (dec->mt_method_ == 3) {
+    const int id = dec->mb_y_ % dec->num_threads_;
+    WebPWorker* const worker = &dec->row_workers_[id];
+    VP8ThreadContext* const row_ctx = &dec->row_ctx_[id];
+    // Wait for the worker to be done with its previous row.
+    ok &= WebPGetWorkerInterface()->Sync(worker);
+    assert(worker->status_ == OK);
+    if (ok) {   // spawn a new reconstruction/deblocking/output job
+      VP8MBData* const tmp = row_ctx->mb_data_;
+      row_ctx->io_ = *io;
+      row_ctx->id_ = dec->cache_id_;
+      row_ctx->mb_y_ = dec->mb_y_;
+      row_ctx->filter_row_ = filter_row;
+      row_ctx->top_ctx_ = (dec->mb_y_ > 0) ?
+          &dec->row_ctx_[(dec->mb_y_ - 1) % dec->num_threads_] : NULL;
+      row_ctx->mb_data_ = dec->mb_data_;
+      dec->mb_data_ = tmp;
+      if (filter_row) {
+        VP8FInfo* const tmp_f_info = row_ctx->f_info_;
+        row_ctx->f_info_ = dec->f_info_;
+        dec->f_info_ = tmp_f_info;
+      }
+      WebPGetWorkerInterface()->Launch(worker);
+      if (++dec->cache_id_ == dec->num_caches_) {
+        dec->cache_id_ = 0;
+      }
+    }
   } else {
     WebPWorker* const worker = &dec->worker_;
     // Finish previous job *before* updating context
@@ -554,8 +907,8 @@ VP8StatusCode VP8EnterCritical(VP8Decoder* const dec, VP8Io* const io) {
     return dec->status_;
   }
 
-  // Disable filtering per user request
-  if (io->bypass_filtering) {
+  // Disable filtering per user request, or when it's not needed.
+  if (io->bypass_filtering || dec->dc_only_) {
     dec->filter_type_ = 0;
   }
 
@@ -568,7 +921,13 @@ VP8StatusCode VP8EnterCritical(VP8Decoder* const dec, VP8Io* const io) {
   // Means: there's a dependency chain that goes all the way up to the
   // top-left corner of the picture (MB #0). We must filter all the previous
   // macroblocks.
-  {
+  if (dec->dc_only_) {
+    // 'io' describes the reduced picture: everything is needed.
+    dec->tl_mb_x_ = 0;
+    dec->tl_mb_y_ = 0;
+    dec->br_mb_x_ = dec->mb_w_;
+    dec->br_mb_y_ = dec->mb_h_;
+  } else {
     const int extra_pixels = kFilterExtraRows[dec->filter_type_];
     if (dec->filter_type_ == 2) {
       // For complex filter, we need to preserve the dependency chain.
@@ -599,9 +958,9 @@ VP8StatusCode VP8EnterCritical(VP8Decoder* const dec, VP8Io* const io) {
 }
 
 int VP8ExitCritical(VP8Decoder* const dec, VP8Io* const io) {
-  int ok = 1;
-  if (dec->mt_method_ > 0) {
-    ok = WebPGetWorkerInterface()->Sync(&dec->worker_);
+  const int ok = VP8SyncThreads(dec);
+  if (dec->mt_method_ == 3) {
+    VP8EndThreads(dec);   // row workers are only kept for the current frame.
   }
 
   if (io->teardown != NULL) {
@@ -633,14 +992,64 @@ int VP8ExitCritical(VP8Decoder* const dec, VP8Io* const io) {
 // and output process have non-concurrent writing:
 // Decode:  [ 0..15][16..31][ 0..15][16..31][...
 // io->put:         [ 0..15][16..31][ 0..15][...
+//
+// With the wavefront method, each of the N workers reconstructs, filters and
+// outputs a whole row, so that up to N rows are in flight at the same time.
+// A worker only starts a new row once its previous one is transmitted, and
+// the transmission of a row reads the bottom samples of the row above. Hence
+// N + 1 cache lines are the minimum. We use 2 * N lines, which also limits
+// how often the top samples have to be rotated.
 
 #define MT_CACHE_LINES 3
 #define ST_CACHE_LINES 1   // 1 cache row only for single-threaded case
 
+// Start the row workers used by the wavefront method.
+static int InitRowWorkers(VP8Decoder* const dec) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  const int num_threads = dec->num_threads_;
+  int i;
+  assert(dec->row_workers_ == NULL);
+  assert(num_threads > 1 && num_threads <= MAX_NUM_THREADS);
+  dec->row_workers_ =
+      (WebPWorker*)WebPSafeCallocTransient(num_threads,
+                                           sizeof(*dec->row_workers_));
+  dec->row_ctx_ =
+      (VP8ThreadContext*)WebPSafeCallocTransient(num_threads,
+                                                 sizeof(*dec->row_ctx_));
+  if (dec->row_workers_ == NULL || dec->row_ctx_ == NULL) return 0;
+  for (i = 0; i < num_threads; ++i) {
+    winterface->Init(&dec->row_workers_[i]);
+  }
+  if (!WebPWorkerProgressInit(&dec->emit_row_)) return 0;
+  for (i = 0; i < num_threads; ++i) {
+    WebPWorker* const worker = &dec->row_workers_[i];
+    VP8ThreadContext* const ctx = &dec->row_ctx_[i];
+    if (!WebPWorkerProgressInit(&ctx->recon_) ||
+        !WebPWorkerProgressInit(&ctx->filter_) ||
+        !winterface->Reset(worker)) {
+      return 0;
+    }
+    worker->data1 = dec;
+    worker->data2 = (void*)ctx;
+    worker->hook = FinishRowWavefront;
+  }
+  return 1;
+}
+
 // Initialize multi/single-thread worker
 static int InitThreadContext(VP8Decoder* const dec) {
   dec->cache_id_ = 0;
-  if (dec->mt_method_ > 0) {
+  if (dec->mt_method_ == 3 && dec->dither_) {
+    // Dithering needs the rows to be processed in order.
+    dec->mt_method_ = 2;
+  }
+  if (dec->mt_method_ == 3) {
+    if (!InitRowWorkers(dec)) {
+      return VP8SetError(dec, VP8_STATUS_OUT_OF_MEMORY,
+                         "thread initialization failed.");
+    }
+    dec->num_caches_ = 2 * dec->num_threads_;
+  } else if (dec->mt_method_ > 0) {
     WebPWorker* const worker = &dec->worker_;
     if (!WebPGetWorkerInterface()->Reset(worker)) {
       return VP8SetError(dec, VP8_STATUS_OUT_OF_MEMORY,
@@ -668,11 +1077,60 @@ int VP8GetThreadMethod(const WebPDecoderOptions* const options,
   (void)height;
   assert(headers == NULL || !headers->is_lossless);
 #if defined(WEBP_USE_THREAD)
-  if (width >= MIN_WIDTH_FOR_THREADS) return 2;
+  if (width >= MIN_WIDTH_FOR_THREADS) {
+    return (VP8GetNumThreads(options, width, height) > 1) ? 3 : 2;
+  }
 #endif
   return 0;
 }
 
+int VP8GetNumThreads(const WebPDecoderOptions* const options,
+                     int width, int height) {
+  int num_threads = (options != NULL) ? options->use_threads : 0;
+  // With a two-macroblock lag between rows, no more than mb_w / 2 rows can
+  // be processed at the same time.
+  const int max_threads = ((width + 15) >> 4) / 2;
+  const int mb_h = (height + 15) >> 4;
+  if (num_threads > MAX_NUM_THREADS) num_threads = MAX_NUM_THREADS;
+  if (num_threads > max_threads) num_threads = max_threads;
+  if (num_threads > mb_h) num_threads = mb_h;
+  return (num_threads > 1) ? num_threads : 1;
+}
+
+int VP8SyncThreads(VP8Decoder* const dec) {
+  int ok = 1;
+  if (dec->mt_method_ == 3) {
+    int i;
+    if (dec->row_workers_ != NULL) {
+      for (i = 0; i < dec->num_threads_; ++i) {
+        ok &= WebPGetWorkerInterface()->Sync(&dec->row_workers_[i]);
+      }
+    }
+  } else if (dec->mt_method_ > 0) {
+    ok = WebPGetWorkerInterface()->Sync(&dec->worker_);
+  }
+  return ok;
+}
+
+void VP8EndThreads(VP8Decoder* const dec) {
+  WebPGetWorkerInterface()->End(&dec->worker_);
+  if (dec->row_workers_ != NULL) {
+    int i;
+    for (i = 0; i < dec->num_threads_; ++i) {
+      WebPGetWorkerInterface()->End(&dec->row_workers_[i]);
+      if (dec->row_ctx_ != NULL) {
+        WebPWorkerProgressClear(&dec->row_ctx_[i].recon_);
+        WebPWorkerProgressClear(&dec->row_ctx_[i].filter_);
+      }
+    }
+    WebPWorkerProgressClear(&dec->emit_row_);
+  }
+  WebPSafeFree(dec->row_workers_);
+  WebPSafeFree(dec->row_ctx_);
+  dec->row_workers_ = NULL;
+  dec->row_ctx_ = NULL;
+}
+
 #undef MT_CACHE_LINES
 #undef ST_CACHE_LINES
 
@@ -682,17 +1140,19 @@ int VP8GetThreadMethod(const WebPDecoderOptions* const options,
 static int AllocateMemory(VP8Decoder* const dec) {
   const int num_caches = dec->num_caches_;
   const int mb_w = dec->mb_w_;
+  // number of rows processed in parallel with the parsing
+  const int num_rows = (dec->mt_method_ == 3) ? dec->num_threads_ : 1;
   // Note: we use 'size_t' when there's no overflow risk, uint64_t otherwise.
   const size_t intra_pred_mode_size = 4 * mb_w * sizeof(uint8_t);
   const size_t top_size = sizeof(VP8TopSamples) * mb_w;
   const size_t mb_info_size = (mb_w + 1) * sizeof(VP8MB);
   const size_t f_info_size =
       (dec->filter_type_ > 0) ?
-          mb_w * (dec->mt_method_ > 0 ? 2 : 1) * sizeof(VP8FInfo)
+          mb_w * (dec->mt_method_ > 0 ? 1 + num_rows : 1) * sizeof(VP8FInfo)
         : 0;
-  const size_t yuv_size = YUV_SIZE * sizeof(*dec->yuv_b_);
+  const size_t yuv_size = num_rows * YUV_SIZE * sizeof(*dec->yuv_b_);
   const size_t mb_data_size =
-      (dec->mt_method_ == 2 ? 2 : 1) * mb_w * sizeof(*dec->mb_data_);
+      (dec->mt_method_ >= 2 ? 1 + num_rows : 1) * mb_w * sizeof(*dec->mb_data_);
   const size_t cache_height = (16 * num_caches
                             + kFilterExtraRows[dec->filter_type_]) * 3 / 2;
   const size_t cache_size = top_size * cache_height;
@@ -709,12 +1169,12 @@ static int AllocateMemory(VP8Decoder* const dec) {
   if (needed > dec->mem_size_) {
     WebPSafeFree(dec->mem_);
     dec->mem_size_ = 0;
-    dec->mem_ = WebPSafeMalloc(needed, sizeof(uint8_t));
+    dec->mem_ = WebPSafeMallocTransient(needed, sizeof(uint8_t));
     if (dec->mem_ == NULL) {
       return VP8SetError(dec, VP8_STATUS_OUT_OF_MEMORY,
                          "no memory during frame initialization.");
     }
-    // down-cast is ok, thanks to WebPSafeMalloc() above.
+    // down-cast is ok, thanks to WebPSafeMallocTransient() above.
     dec->mem_size_ = (size_t)needed;
   }
 
@@ -742,6 +1202,7 @@ static int AllocateMemory(VP8Decoder* const dec) {
   mem = (uint8_t*)WEBP_ALIGN(mem);
   assert((yuv_size & WEBP_ALIGN_CST) == 0);
   dec->yuv_b_ = mem;
+  dec->thread_ctx_.yuv_b_ = mem;
   mem += yuv_size;
 
   dec->mb_data_ = (VP8MBData*)mem;
@@ -751,6 +1212,19 @@ static int AllocateMemory(VP8Decoder* const dec) {
   }
   mem += mb_data_size;
 
+  if (dec->mt_method_ == 3) {
+    // one set of reconstruction data, filter strengths and scratch block
+    // per row worker.
+    int i;
+    for (i = 0; i < num_rows; ++i) {
+      VP8ThreadContext* const ctx = &dec->row_ctx_[i];
+      ctx->yuv_b_ = dec->yuv_b_ + i * YUV_SIZE;
+      ctx->mb_data_ = dec->mb_data_ + (i + 1) * mb_w;
+      ctx->f_info_ = (dec->f_info_ != NULL) ? dec->f_info_ + (i + 1) * mb_w
+                                            : NULL;
+    }
+  }
+
   dec->cache_y_stride_ = 16 * mb_w;
   dec->cache_uv_stride_ = 8 * mb_w;
   {
@@ -47,9 +47,19 @@ typedef enum {
 typedef enum {
   MEM_MODE_NONE = 0,
   MEM_MODE_APPEND,
-  MEM_MODE_MAP
+  MEM_MODE_MAP,
+  MEM_MODE_SEGMENTS
 } MemBufferMode;
 
+// Caller-owned input segment (MEM_MODE_SEGMENTS).
+typedef struct {
+  const uint8_t* data_;
+  size_t size_;
+  size_t used_;        // number of leading bytes already copied into buf_
+  WebPISegmentReleaseHook release_;
+  void* user_data_;
+} MemSegment;
+
 // storage for partition #0 and partial data (in a rolling fashion)
 typedef struct {
   MemBufferMode mode_;  // Operation mode
@@ -60,6 +70,15 @@ typedef struct {
 
   size_t part0_size_;         // size of partition #0
   const uint8_t* part0_buf_;  // buffer to store partition #0
+
+  // MEM_MODE_SEGMENTS only: queue of pending segments. If 'direct_' is true,
+  // buf_ points to segs_[0] and the internal buffer is parked in own_buf_.
+  MemSegment* segs_;
+  int num_segs_;
+  int max_segs_;
+  int direct_;
+  uint8_t* own_buf_;
+  size_t own_size_;
 } MemBuffer;
 
 struct WebPIDecoder {
@@ -127,7 +146,8 @@ static void DoRemap(WebPIDecoder* const idec, ptrdiff_t offset) {
           VP8RemapBitReader(dec->parts_ + p, offset);
         }
         // Remap partition #0 data pointer to new offset, but only in MAP
-        // mode (in APPEND mode, partition #0 is copied into a fixed memory).
+        // mode (in APPEND and SEGMENTS mode, partition #0 is copied into a
+        // fixed memory).
         if (mem->mode_ == MEM_MODE_MAP) {
           VP8RemapBitReader(&dec->br_, offset);
         }
@@ -171,7 +191,8 @@ static int AppendToMemBuffer(WebPIDecoder* const idec,
   const uint8_t* const old_base =
       need_compressed_alpha ? dec->alpha_data_ : old_start;
   assert(mem->buf_ != NULL || mem->start_ == 0);
-  assert(mem->mode_ == MEM_MODE_APPEND);
+  assert(mem->mode_ == MEM_MODE_APPEND || mem->mode_ == MEM_MODE_SEGMENTS);
+  assert(!mem->direct_);
   if (data_size > MAX_CHUNK_PAYLOAD) {
     // security safeguard: trying to allocate more than what the format
     // allows for a chunk should be considered a smoke smell.
@@ -227,14 +248,24 @@ static void InitMemBuffer(MemBuffer* const mem) {
   mem->buf_size_   = 0;
   mem->part0_buf_  = NULL;
   mem->part0_size_ = 0;
+  mem->segs_       = NULL;
+  mem->num_segs_   = 0;
+  mem->max_segs_   = 0;
+  mem->direct_     = 0;
+  mem->own_buf_    = NULL;
+  mem->own_size_   = 0;
 }
 
+static void ReleaseSegments(MemBuffer* const mem, int num);
+
 static void ClearMemBuffer(MemBuffer* const mem) {
   assert(mem);
-  if (mem->mode_ == MEM_MODE_APPEND) {
-    WebPSafeFree(mem->buf_);
+  if (mem->mode_ == MEM_MODE_APPEND || mem->mode_ == MEM_MODE_SEGMENTS) {
+    WebPSafeFree(mem->direct_ ? mem->own_buf_ : mem->buf_);
     WebPSafeFree((void*)mem->part0_buf_);
   }
+  ReleaseSegments(mem, mem->num_segs_);
+  WebPSafeFree(mem->segs_);
 }
 
 static int CheckMemBufferMode(MemBuffer* const mem, MemBufferMode expected) {
@@ -247,6 +278,174 @@ static int CheckMemBufferMode(MemBuffer* const mem, MemBufferMode expected) {
   return 1;
 }
 
+//------------------------------------------------------------------------------
+// MEM_MODE_SEGMENTS: caller-owned input segments
+//
+// As soon as the decoder only moves forward through the data (lossy bitstream
+// with a single token partition and no pending compressed alpha), segments are
+// decoded in place. Only the unconsumed tail of a segment is copied into buf_,
+// followed by at most MAX_MB_SIZE bytes of the next one, which is enough for
+// the token reader to cross the boundary. Before that, or when the bitstream
+// needs its data to stay contiguous, segments are copied like in
+// MEM_MODE_APPEND and released right away.
+
+static int PushSegment(MemBuffer* const mem,
+                       const uint8_t* const data, size_t data_size,
+                       WebPISegmentReleaseHook release, void* user_data) {
+  MemSegment* seg;
+  if (mem->num_segs_ == mem->max_segs_) {
+    const int new_max = 2 * mem->max_segs_ + 4;
+    MemSegment* const new_segs =
+        (MemSegment*)WebPSafeMalloc(new_max, sizeof(*new_segs));
+    if (new_segs == NULL) return 0;
+    if (mem->num_segs_ > 0) {
+      memcpy(new_segs, mem->segs_, mem->num_segs_ * sizeof(*new_segs));
+    }
+    WebPSafeFree(mem->segs_);
+    mem->segs_ = new_segs;
+    mem->max_segs_ = new_max;
+  }
+  seg = &mem->segs_[mem->num_segs_++];
+  seg->data_ = data;
+  seg->size_ = data_size;
+  seg->used_ = 0;
+  seg->release_ = release;
+  seg->user_data_ = user_data;
+  return 1;
+}
+
+// Releases the first 'num' segments of the queue.
+static void ReleaseSegments(MemBuffer* const mem, int num) {
+  int i;
+  assert(num <= mem->num_segs_);
+  for (i = 0; i < num; ++i) {
+    const MemSegment* const seg = &mem->segs_[i];
+    if (seg->release_ != NULL) {
+      seg->release_(seg->data_, seg->size_, seg->user_data_);
+    }
+  }
+  mem->num_segs_ -= num;
+  if (num > 0 && mem->num_segs_ > 0) {
+    memmove(mem->segs_, mem->segs_ + num, mem->num_segs_ * sizeof(*mem->segs_));
+  }
+}
+
+// Releases all segments once the decoder no longer needs any input.
+static void DropSegments(MemBuffer* const mem) {
+  if (mem->direct_) {
+    mem->buf_ = mem->own_buf_;
+    mem->buf_size_ = mem->own_size_;
+    mem->own_buf_ = NULL;
+    mem->own_size_ = 0;
+    mem->start_ = mem->end_ = 0;
+    mem->direct_ = 0;
+  }
+  ReleaseSegments(mem, mem->num_segs_);
+}
+
+static int CanDecodeInPlace(const WebPIDecoder* const idec) {
+  const VP8Decoder* const dec = (const VP8Decoder*)idec->dec_;
+  if (idec->is_lossless_ || idec->state_ != STATE_VP8_DATA) return 0;
+  assert(dec != NULL);
+  return (dec->num_parts_minus_one_ == 0) && !NeedCompressedAlpha(idec);
+}
+
+// Appends up to 'max_size' bytes of the queued segments to buf_, releasing the
+// ones that were completely copied.
+static int CopySegments(WebPIDecoder* const idec, size_t max_size) {
+  MemBuffer* const mem = &idec->mem_;
+  int ok = 1;
+  int num_done = 0;
+  while (num_done < mem->num_segs_ && max_size > 0) {
+    MemSegment* const seg = &mem->segs_[num_done];
+    const size_t left = seg->size_ - seg->used_;
+    const size_t size = (left < max_size) ? left : max_size;
+    if (!AppendToMemBuffer(idec, seg->data_ + seg->used_, size)) {
+      ok = 0;
+      break;
+    }
+    seg->used_ += size;
+    max_size -= size;
+    if (seg->used_ < seg->size_) break;
+    ++num_done;
+  }
+  ReleaseSegments(mem, num_done);
+  return ok;
+}
+
+// Makes buf_ point to segs_[0], resuming at offset 'pos'.
+static void UseSegment(WebPIDecoder* const idec, size_t pos) {
+  MemBuffer* const mem = &idec->mem_;
+  const MemSegment* const seg = &mem->segs_[0];
+  const uint8_t* const old_start = mem->buf_ + mem->start_;
+  assert(!mem->direct_ && pos <= seg->size_);
+  mem->own_buf_ = mem->buf_;
+  mem->own_size_ = mem->buf_size_;
+  mem->buf_ = (uint8_t*)seg->data_;
+  mem->buf_size_ = mem->end_ = seg->size_;
+  mem->start_ = pos;
+  mem->direct_ = 1;
+  DoRemap(idec, mem->buf_ + mem->start_ - old_start);
+}
+
+// Moves the unconsumed tail of segs_[0] back into the internal buffer and
+// releases the segment.
+static int LeaveSegment(WebPIDecoder* const idec) {
+  MemBuffer* const mem = &idec->mem_;
+  const uint8_t* const old_start = mem->buf_ + mem->start_;
+  const size_t size = MemDataSize(mem);
+  assert(mem->direct_);
+  if (mem->own_size_ < size) {
+    const size_t new_size = (size + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    uint8_t* const new_buf =
+        (uint8_t*)WebPSafeMalloc(new_size, sizeof(*new_buf));
+    if (new_buf == NULL) return 0;
+    WebPSafeFree(mem->own_buf_);
+    mem->own_buf_ = new_buf;
+    mem->own_size_ = new_size;
+  }
+  if (size > 0) memcpy(mem->own_buf_, old_start, size);
+  mem->buf_ = mem->own_buf_;
+  mem->buf_size_ = mem->own_size_;
+  mem->own_buf_ = NULL;
+  mem->own_size_ = 0;
+  mem->start_ = 0;
+  mem->end_ = size;
+  mem->direct_ = 0;
+  ReleaseSegments(mem, 1);
+  DoRemap(idec, mem->buf_ - old_start);
+  return 1;
+}
+
+// Prepares the input for the next decoding pass. '*changed' is set to false
+// if no new data was made available.
+static int FeedSegments(WebPIDecoder* const idec, int* const changed) {
+  MemBuffer* const mem = &idec->mem_;
+  *changed = 0;
+  if (mem->num_segs_ == 0) return 1;
+  if (!CanDecodeInPlace(idec)) {
+    *changed = 1;
+    return CopySegments(idec, ~(size_t)0);
+  }
+  if (mem->direct_) {
+    if (mem->num_segs_ == 1) return 1;   // wait for the next segment
+    // Suspended decoding guarantees the tail is at most MAX_MB_SIZE long.
+    if (!LeaveSegment(idec)) return 0;
+  }
+  *changed = 1;
+  {
+    // The last segs_[0]->used_ bytes of buf_ are copied from segs_[0]. Switch
+    // to the segment itself once the decoder has moved past the others.
+    const size_t size = MemDataSize(mem);
+    const size_t used = mem->segs_[0].used_;
+    if (size <= used) {
+      UseSegment(idec, used - size);
+      return 1;
+    }
+  }
+  return CopySegments(idec, MAX_MB_SIZE);
+}
+
 // To be called last.
 static VP8StatusCode FinishDecoding(WebPIDecoder* const idec) {
   const WebPDecoderOptions* const options = idec->params_.options;
@@ -380,7 +579,7 @@ static VP8StatusCode CopyParts0Data(WebPIDecoder* const idec) {
   if (part_size == 0) {   // can't have zero-size partition #0
     return VP8_STATUS_BITSTREAM_ERROR;
   }
-  if (mem->mode_ == MEM_MODE_APPEND) {
+  if (mem->mode_ != MEM_MODE_MAP) {
     // We copy and grab ownership of the partition #0 data.
     uint8_t* const part0_buf = (uint8_t*)WebPSafeMalloc(1ULL, part_size);
     if (part0_buf == NULL) {
@@ -426,7 +625,10 @@ static VP8StatusCode DecodePartition0(WebPIDecoder* const idec) {
   // This change must be done before calling VP8InitFrame()
   dec->mt_method_ = VP8GetThreadMethod(params->options, NULL,
                                        io->width, io->height);
+  dec->num_threads_ = VP8GetNumThreads(params->options,
+                                       io->width, io->height);
   VP8InitDithering(params->options, dec);
+  VP8InitDCThumbnail(params->options, dec, io);
 
   dec->status_ = CopyParts0Data(idec);
   if (dec->status_ != VP8_STATUS_OK) {
@@ -479,10 +681,8 @@ static VP8StatusCode DecodeRemaining(WebPIDecoder* const idec) {
           return IDecError(idec, VP8_STATUS_BITSTREAM_ERROR);
         }
         // Synchronize the threads.
-        if (dec->mt_method_ > 0) {
-          if (!WebPGetWorkerInterface()->Sync(&dec->worker_)) {
-            return IDecError(idec, VP8_STATUS_BITSTREAM_ERROR);
-          }
+        if (!VP8SyncThreads(dec)) {
+          return IDecError(idec, VP8_STATUS_BITSTREAM_ERROR);
         }
         RestoreContext(&context, dec, token_br);
         return VP8_STATUS_SUSPENDED;
@@ -820,6 +1020,44 @@ VP8StatusCode WebPIUpdate(WebPIDecoder* idec,
   return IDecode(idec);
 }
 
+static VP8StatusCode DecodeSegments(WebPIDecoder* const idec) {
+  VP8StatusCode status = VP8_STATUS_SUSPENDED;
+  int changed = 1;
+  while (status == VP8_STATUS_SUSPENDED && changed) {
+    if (!FeedSegments(idec, &changed)) return VP8_STATUS_OUT_OF_MEMORY;
+    if (changed) status = IDecode(idec);
+  }
+  if (idec->state_ == STATE_DONE || idec->state_ == STATE_ERROR) {
+    DropSegments(&idec->mem_);
+  }
+  return status;
+}
+
+VP8StatusCode WebPIAppendSegment(WebPIDecoder* idec,
+                                 const uint8_t* data, size_t data_size,
+                                 WebPISegmentReleaseHook release,
+                                 void* user_data) {
+  VP8StatusCode status;
+  if (idec == NULL || data == NULL) {
+    return VP8_STATUS_INVALID_PARAM;
+  }
+  if (!PushSegment(&idec->mem_, data, data_size, release, user_data)) {
+    if (release != NULL) release(data, data_size, user_data);
+    return VP8_STATUS_OUT_OF_MEMORY;
+  }
+  status = IDecCheckStatus(idec);
+  // Check mixed calls with WebPIAppend() and WebPIUpdate().
+  if (status == VP8_STATUS_SUSPENDED &&
+      !CheckMemBufferMode(&idec->mem_, MEM_MODE_SEGMENTS)) {
+    status = VP8_STATUS_INVALID_PARAM;
+  }
+  if (status != VP8_STATUS_SUSPENDED) {
+    DropSegments(&idec->mem_);
+    return status;
+  }
+  return DecodeSegments(idec);
+}
+
 //------------------------------------------------------------------------------
 
 static const WebPDecBuffer* GetOutputBuffer(const WebPIDecoder* const idec) {
@@ -254,6 +254,16 @@ static int Rescale(const uint8_t* src, int src_stride,
   return num_lines_out;
 }
 
+// The U/V planes are independent from Y, and can be rescaled in parallel.
+static int RescaleUVHook(void* arg1, void* arg2) {
+  const VP8Io* const io = (const VP8Io*)arg1;
+  WebPDecParams* const p = (WebPDecParams*)arg2;
+  const int uv_mb_h = (io->mb_h + 1) >> 1;
+  Rescale(io->u, io->uv_stride, uv_mb_h, p->scaler_u);
+  Rescale(io->v, io->uv_stride, uv_mb_h, p->scaler_v);
+  return 1;
+}
+
 static int EmitRescaledYUV(const VP8Io* const io, WebPDecParams* const p) {
   const int mb_h = io->mb_h;
   const int uv_mb_h = (mb_h + 1) >> 1;
@@ -267,6 +277,20 @@ static int EmitRescaledYUV(const VP8Io* const io, WebPDecParams* const p) {
     WebPMultRows((uint8_t*)io->y, io->y_stride,
                  io->a, io->width, io->mb_w, mb_h, 0);
   }
+  if (p->use_uv_worker) {
+    const WebPWorkerInterface* const worker_interface =
+        WebPGetWorkerInterface();
+    WebPWorker* const worker = &p->uv_worker;
+    worker->data1 = (void*)io;
+    worker->data2 = p;
+    if (worker_interface->Reset(worker)) {
+      worker_interface->Launch(worker);
+      num_lines_out = Rescale(io->y, io->y_stride, mb_h, scaler);
+      worker_interface->Sync(worker);
+      return num_lines_out;
+    }
+    p->use_uv_worker = 0;
+  }
   num_lines_out = Rescale(io->y, io->y_stride, mb_h, scaler);
   Rescale(io->u, io->uv_stride, uv_mb_h, p->scaler_u);
   Rescale(io->v, io->uv_stride, uv_mb_h, p->scaler_v);
@@ -316,7 +340,7 @@ static int InitYUVRescaler(const VP8Io* const io, WebPDecParams* const p) {
   }
   rescaler_size = num_rescalers * sizeof(*p->scaler_y) + WEBP_ALIGN_CST;
 
-  p->memory = WebPSafeMalloc(1ULL, tmp_size + rescaler_size);
+  p->memory = WebPSafeMallocTransient(1ULL, tmp_size + rescaler_size);
   if (p->memory == NULL) {
     return 0;   // memory error
   }
@@ -338,6 +362,11 @@ static int InitYUVRescaler(const VP8Io* const io, WebPDecParams* const p) {
                    buf->v, uv_out_width, uv_out_height, buf->v_stride, 1,
                    work + work_size + uv_work_size);
   p->emit = EmitRescaledYUV;
+  if (p->options != NULL && p->options->use_threads) {
+    WebPGetWorkerInterface()->Init(&p->uv_worker);
+    p->uv_worker.hook = RescaleUVHook;
+    p->use_uv_worker = 1;
+  }
 
   if (has_alpha) {
     WebPRescalerInit(p->scaler_a, io->mb_w, io->mb_h,
@@ -501,7 +530,7 @@ static int InitRGBRescaler(const VP8Io* const io, WebPDecParams* const p) {
   total_size = tmp_size1 * sizeof(*work) + tmp_size2 * sizeof(*tmp);
   rescaler_size = num_rescalers * sizeof(*p->scaler_y) + WEBP_ALIGN_CST;
 
-  p->memory = WebPSafeMalloc(1ULL, total_size + rescaler_size);
+  p->memory = WebPSafeMallocTransient(1ULL, total_size + rescaler_size);
   if (p->memory == NULL) {
     return 0;   // memory error
   }
@@ -554,6 +583,7 @@ static int CustomSetup(VP8Io* io) {
   const int is_alpha = WebPIsAlphaMode(colorspace);
 
   p->memory = NULL;
+  p->use_uv_worker = 0;
   p->emit = NULL;
   p->emit_alpha = NULL;
   p->emit_alpha_row = NULL;
@@ -579,7 +609,8 @@ static int CustomSetup(VP8Io* io) {
       if (io->fancy_upsampling) {
 #ifdef FANCY_UPSAMPLING
         const int uv_width = (io->mb_w + 1) >> 1;
-        p->memory = WebPSafeMalloc(1ULL, (size_t)(io->mb_w + 2 * uv_width));
+        p->memory =
+            WebPSafeMallocTransient(1ULL, (size_t)(io->mb_w + 2 * uv_width));
         if (p->memory == NULL) {
           return 0;   // memory error.
         }
@@ -632,6 +663,10 @@ static int CustomPut(const VP8Io* io) {
 
 static void CustomTeardown(const VP8Io* io) {
   WebPDecParams* const p = (WebPDecParams*)io->opaque;
+  if (p->use_uv_worker) {
+    WebPGetWorkerInterface()->End(&p->uv_worker);
+    p->use_uv_worker = 0;
+  }
   WebPSafeFree(p->memory);
   p->memory = NULL;
 }
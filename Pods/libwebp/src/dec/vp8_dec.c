@@ -55,7 +55,8 @@ int VP8InitIoInternal(VP8Io* const io, int version) {
 }
 
 VP8Decoder* VP8New(void) {
-  VP8Decoder* const dec = (VP8Decoder*)WebPSafeCalloc(1ULL, sizeof(*dec));
+  VP8Decoder* const dec =
+      (VP8Decoder*)WebPSafeCallocTransient(1ULL, sizeof(*dec));
   if (dec != NULL) {
     SetOk(dec);
     WebPGetWorkerInterface()->Init(&dec->worker_);
@@ -511,13 +512,13 @@ static WEBP_INLINE uint32_t NzCodeBits(uint32_t nz_coeffs, int nz, int dc_nz) {
 }
 
 static int ParseResiduals(VP8Decoder* const dec,
-                          VP8MB* const mb, VP8BitReader* const token_br) {
+                          VP8MB* const mb, VP8MB* const left_mb,
+                          VP8MBData* const block,
+                          VP8BitReader* const token_br) {
   const VP8BandProbas* (* const bands)[16 + 1] = dec->proba_.bands_ptr_;
   const VP8BandProbas* const * ac_proba;
-  VP8MBData* const block = dec->mb_data_ + dec->mb_x_;
   const VP8QuantMatrix* const q = &dec->dqm_[block->segment_];
   int16_t* dst = block->coeffs_;
-  VP8MB* const left_mb = dec->mb_info_ - 1;
   uint8_t tnz, lnz;
   uint32_t non_zero_y = 0;
   uint32_t non_zero_uv = 0;
@@ -604,14 +605,14 @@ static int ParseResiduals(VP8Decoder* const dec,
 //------------------------------------------------------------------------------
 // Main loop
 
-int VP8DecodeMB(VP8Decoder* const dec, VP8BitReader* const token_br) {
-  VP8MB* const left = dec->mb_info_ - 1;
-  VP8MB* const mb = dec->mb_info_ + dec->mb_x_;
-  VP8MBData* const block = dec->mb_data_ + dec->mb_x_;
+// Decode one macroblock, given its top and left contexts.
+static int DecodeMB(VP8Decoder* const dec, VP8MB* const mb,
+                    VP8MB* const left, VP8MBData* const block,
+                    VP8FInfo* const finfo, VP8BitReader* const token_br) {
   int skip = dec->use_skip_proba_ ? block->skip_ : 0;
 
   if (!skip) {
-    skip = ParseResiduals(dec, mb, token_br);
+    skip = ParseResiduals(dec, mb, left, block, token_br);
   } else {
     left->nz_ = mb->nz_ = 0;
     if (!block->is_i4x4_) {
@@ -623,7 +624,6 @@ int VP8DecodeMB(VP8Decoder* const dec, VP8BitReader* const token_br) {
   }
 
   if (dec->filter_type_ > 0) {  // store filter info
-    VP8FInfo* const finfo = dec->f_info_ + dec->mb_x_;
     *finfo = dec->fstrengths_[block->segment_][block->is_i4x4_];
     finfo->f_inner_ |= !skip;
   }
@@ -631,6 +631,15 @@ int VP8DecodeMB(VP8Decoder* const dec, VP8BitReader* const token_br) {
   return !token_br->eof_;
 }
 
+int VP8DecodeMB(VP8Decoder* const dec, VP8BitReader* const token_br) {
+  VP8MB* const left = dec->mb_info_ - 1;
+  VP8MB* const mb = dec->mb_info_ + dec->mb_x_;
+  VP8MBData* const block = dec->mb_data_ + dec->mb_x_;
+  VP8FInfo* const finfo =
+      (dec->filter_type_ > 0) ? dec->f_info_ + dec->mb_x_ : NULL;
+  return DecodeMB(dec, mb, left, block, finfo, token_br);
+}
+
 void VP8InitScanline(VP8Decoder* const dec) {
   VP8MB* const left = dec->mb_info_ - 1;
   left->nz_ = 0;
@@ -639,7 +648,163 @@ void VP8InitScanline(VP8Decoder* const dec) {
   dec->mb_x_ = 0;
 }
 
+//------------------------------------------------------------------------------
+// Parallel parsing of the token partitions.
+//
+// Row 'y' reads its tokens from partition 'y % num_parts', so that the rows
+// using different partitions can be entropy-decoded at the same time, by one
+// worker per partition. The only dependency is the top non-zero context
+// (dec->mb_info_), hence each row lags one macroblock behind the row above.
+// Intra modes are still parsed in order from partition #0, and the rows are
+// reconstructed in order by VP8ProcessRow() once parsed.
+
+typedef struct VP8TokenContext VP8TokenContext;
+struct VP8TokenContext {
+  VP8BitReader* br_;             // token partition of the row
+  int mb_y_;                     // row to parse
+  VP8MBData* mb_data_;           // parsed data for the row
+  VP8FInfo* f_info_;             // filter strengths for the row
+  VP8MB left_;                   // left context
+  VP8TokenContext* top_;         // context of the row above, or NULL
+  WebPWorkerProgress progress_;  // 'mb_y_ * (mb_w + 1) + mb_x' once parsed
+};
+
+static int ParseTokenRow(void* arg1, void* arg2) {
+  VP8Decoder* const dec = (VP8Decoder*)arg1;
+  VP8TokenContext* const ctx = (VP8TokenContext*)arg2;
+  const int mb_w = dec->mb_w_;
+  const int pos = ctx->mb_y_ * (mb_w + 1);
+  int ok = 1;
+  int mb_x;
+  ctx->left_.nz_ = 0;
+  ctx->left_.nz_dc_ = 0;
+  for (mb_x = 0; mb_x < mb_w; ++mb_x) {
+    if (ctx->top_ != NULL) {
+      WebPWorkerProgressWait(&ctx->top_->progress_,
+                             pos - (mb_w + 1) + mb_x + 1);
+    }
+    if (ok) {
+      VP8FInfo* const finfo =
+          (dec->filter_type_ > 0) ? ctx->f_info_ + mb_x : NULL;
+      ok = DecodeMB(dec, dec->mb_info_ + mb_x, &ctx->left_,
+                    ctx->mb_data_ + mb_x, finfo, ctx->br_);
+    }
+    // the rows below are waiting, even in case of error.
+    WebPWorkerProgressSet(&ctx->progress_, pos + mb_x + 1);
+  }
+  return ok;
+}
+
+// Returns true if the frame should be parsed using ParseFrameParallel().
+static int UseParallelParsing(const VP8Decoder* const dec) {
+  return (dec->num_parts_minus_one_ > 0 &&
+          dec->mt_method_ > 0 && dec->num_threads_ > 1);
+}
+
+static int ParseFrameParallel(VP8Decoder* const dec, VP8Io* io) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  const int num_parts = dec->num_parts_minus_one_ + 1;
+  // rows being parsed, plus the one being processed
+  const int num_slots = num_parts + 1;
+  const int mb_w = dec->mb_w_;
+  const size_t f_info_size =
+      (dec->filter_type_ > 0) ? mb_w * sizeof(VP8FInfo) : 0;
+  const size_t slot_size = mb_w * sizeof(VP8MBData) + f_info_size;
+  VP8MBData* const saved_mb_data = dec->mb_data_;
+  VP8FInfo* const saved_f_info = dec->f_info_;
+  WebPWorker workers[MAX_NUM_PARTITIONS];
+  VP8TokenContext ctx[MAX_NUM_PARTITIONS];
+  VP8MBData* mb_data[MAX_NUM_PARTITIONS + 1];
+  VP8FInfo* f_info[MAX_NUM_PARTITIONS + 1];
+  uint8_t* const mem = (uint8_t*)WebPSafeMallocTransient(num_slots, slot_size);
+  int ok = (mem != NULL);
+  int p, y;
+
+  memset(ctx, 0, sizeof(ctx));
+  for (p = 0; p < num_parts; ++p) {
+    winterface->Init(&workers[p]);
+  }
+  if (!ok) {
+    return VP8SetError(dec, VP8_STATUS_OUT_OF_MEMORY,
+                       "no memory for parallel parsing.");
+  }
+  for (y = 0; y < num_slots; ++y) {
+    uint8_t* const slot = mem + y * slot_size;
+    mb_data[y] = (VP8MBData*)slot;
+    f_info[y] = f_info_size ? (VP8FInfo*)(slot + mb_w * sizeof(VP8MBData))
+                            : NULL;
+  }
+  for (p = 0; ok && p < num_parts; ++p) {
+    ctx[p].br_ = &dec->parts_[p];
+    ok = WebPWorkerProgressInit(&ctx[p].progress_) &&
+         winterface->Reset(&workers[p]);
+    workers[p].hook = ParseTokenRow;
+    workers[p].data1 = dec;
+    workers[p].data2 = &ctx[p];
+  }
+  if (!ok) {
+    VP8SetError(dec, VP8_STATUS_OUT_OF_MEMORY, "thread initialization failed.");
+  }
+
+  for (y = 0; ok && y < dec->br_mb_y_ + num_parts; ++y) {
+    WebPWorker* const worker = &workers[y & dec->num_parts_minus_one_];
+    VP8TokenContext* const row_ctx = &ctx[y & dec->num_parts_minus_one_];
+    // Wait for the row 'y - num_parts' to be parsed, and process it.
+    if (!winterface->Sync(worker)) {
+      ok = VP8SetError(dec, VP8_STATUS_NOT_ENOUGH_DATA,
+                       "Premature end-of-file encountered.");
+      break;
+    }
+    if (y >= num_parts) {
+      const int slot = (y - num_parts) % num_slots;
+      dec->mb_y_ = y - num_parts;
+      dec->mb_data_ = mb_data[slot];
+      dec->f_info_ = f_info[slot];
+      if (!VP8ProcessRow(dec, io)) {
+        ok = VP8SetError(dec, VP8_STATUS_USER_ABORT, "Output aborted.");
+        break;
+      }
+      // buffers may have been swapped with the ones of the row workers
+      mb_data[slot] = dec->mb_data_;
+      f_info[slot] = dec->f_info_;
+    }
+    // Parse the intra modes of row 'y' and start parsing its tokens.
+    if (y < dec->br_mb_y_) {
+      const int slot = y % num_slots;
+      dec->mb_y_ = y;
+      dec->mb_data_ = mb_data[slot];
+      if (!VP8ParseIntraModeRow(&dec->br_, dec)) {
+        ok = VP8SetError(dec, VP8_STATUS_NOT_ENOUGH_DATA,
+                         "Premature end-of-partition0 encountered.");
+        break;
+      }
+      VP8InitScanline(dec);
+      row_ctx->mb_y_ = y;
+      row_ctx->mb_data_ = mb_data[slot];
+      row_ctx->f_info_ = f_info[slot];
+      row_ctx->top_ = (y > 0) ? &ctx[(y - 1) & dec->num_parts_minus_one_]
+                              : NULL;
+      winterface->Launch(worker);
+    }
+  }
+  dec->mb_y_ = dec->br_mb_y_;
+
+  // The parsed data must not be in use anymore before being released.
+  for (p = 0; p < num_parts; ++p) {
+    winterface->End(&workers[p]);
+    WebPWorkerProgressClear(&ctx[p].progress_);
+  }
+  ok &= VP8SyncThreads(dec);
+  dec->mb_data_ = saved_mb_data;
+  dec->f_info_ = saved_f_info;
+  WebPSafeFree(mem);
+  return ok;
+}
+
 static int ParseFrame(VP8Decoder* const dec, VP8Io* io) {
+  if (UseParallelParsing(dec)) {
+    return ParseFrameParallel(dec, io);
+  }
   for (dec->mb_y_ = 0; dec->mb_y_ < dec->br_mb_y_; ++dec->mb_y_) {
     // Parse bitstream for this row.
     VP8BitReader* const token_br =
@@ -661,9 +826,7 @@ static int ParseFrame(VP8Decoder* const dec, VP8Io* io) {
       return VP8SetError(dec, VP8_STATUS_USER_ABORT, "Output aborted.");
     }
   }
-  if (dec->mt_method_ > 0) {
-    if (!WebPGetWorkerInterface()->Sync(&dec->worker_)) return 0;
-  }
+  if (!VP8SyncThreads(dec)) return 0;
 
   return 1;
 }
@@ -712,7 +875,7 @@ void VP8Clear(VP8Decoder* const dec) {
   if (dec == NULL) {
     return;
   }
-  WebPGetWorkerInterface()->End(&dec->worker_);
+  VP8EndThreads(dec);
   WebPDeallocateAlphaMemory(dec);
   WebPSafeFree(dec->mem_);
   dec->mem_ = NULL;
@@ -721,4 +884,21 @@ void VP8Clear(VP8Decoder* const dec) {
   dec->ready_ = 0;
 }
 
+void VP8ResetDecoder(VP8Decoder* const dec) {
+  void* mem;
+  size_t mem_size;
+  if (dec == NULL) {
+    return;
+  }
+  mem = dec->mem_;
+  mem_size = dec->mem_size_;
+  dec->mem_ = NULL;   // not released by VP8Clear()
+  VP8Clear(dec);
+  memset(dec, 0, sizeof(*dec));
+  dec->mem_ = mem;
+  dec->mem_size_ = mem_size;
+  SetOk(dec);
+  WebPGetWorkerInterface()->Init(&dec->worker_);
+}
+
 //------------------------------------------------------------------------------
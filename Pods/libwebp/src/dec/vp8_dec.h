@@ -150,6 +150,10 @@ const char* VP8StatusMessage(VP8Decoder* const dec);
 // Not a mandatory call between calls to VP8Decode().
 void VP8Clear(VP8Decoder* const dec);
 
+// Resets the decoder in its initial state, ready for a new picture, but keeps
+// the frame memory around so that it can be reused.
+void VP8ResetDecoder(VP8Decoder* const dec);
+
 // Destroy the decoder object.
 void VP8Delete(VP8Decoder* const dec);
 
@@ -64,6 +64,9 @@ extern "C" {
 // minimal width under which lossy multi-threading is always disabled
 #define MIN_WIDTH_FOR_THREADS 512
 
+// maximum number of row workers for the wavefront multi-threading method
+#define MAX_NUM_THREADS 32
+
 //------------------------------------------------------------------------------
 // Headers
 
@@ -162,14 +165,21 @@ typedef struct {
 } VP8MBData;
 
 // Persistent information needed by the parallel processing
-typedef struct {
-  int id_;              // cache row to process (in [0..2])
+typedef struct VP8ThreadContext VP8ThreadContext;
+struct VP8ThreadContext {
+  int id_;              // cache row to process (in [0..num_caches_-1])
   int mb_y_;            // macroblock position of the row
   int filter_row_;      // true if row-filtering is needed
   VP8FInfo* f_info_;    // filter strengths (swapped with dec->f_info_)
   VP8MBData* mb_data_;  // reconstruction data (swapped with dec->mb_data_)
+  uint8_t* yuv_b_;      // scratch block used for reconstruction
   VP8Io io_;            // copy of the VP8Io to pass to put()
-} VP8ThreadContext;
+
+  // wavefront synchronization (mt_method_ == 3 only)
+  VP8ThreadContext* top_ctx_;   // context of the row above, or NULL
+  WebPWorkerProgress recon_;    // reconstruction progress of the row
+  WebPWorkerProgress filter_;   // filtering progress of the row
+};
 
 // Saved top samples, per macroblock. Fits into a cache-line.
 typedef struct {
@@ -197,10 +207,18 @@ struct VP8Decoder {
   WebPWorker worker_;
   int mt_method_;      // multi-thread method: 0=off, 1=[parse+recon][filter]
                        // 2=[parse][recon+filter]
+                       // 3=[parse][recon+filter]x num_threads_ (wavefront)
   int cache_id_;       // current cache row
-  int num_caches_;     // number of cached rows of 16 pixels (1, 2 or 3)
+  int num_caches_;     // number of cached rows of 16 pixels
   VP8ThreadContext thread_ctx_;  // Thread context
 
+  // Row workers, for mt_method_ == 3. Row 'y' is handled by the worker
+  // number 'y % num_threads_'.
+  int num_threads_;               // number of row workers
+  WebPWorker* row_workers_;       // [num_threads_]
+  VP8ThreadContext* row_ctx_;     // [num_threads_]
+  WebPWorkerProgress emit_row_;   // number of rows sent to io->put()
+
   // dimension, in macroblock units.
   int mb_w_, mb_h_;
 
@@ -217,6 +235,10 @@ struct VP8Decoder {
   int dither_;                // whether to use dithering or not
   VP8Random dithering_rg_;    // random generator for dithering
 
+  // If true, only one sample per 4x4 block is reconstructed, from the
+  // prediction and DC coefficient (see VP8InitDCThumbnail()).
+  int dc_only_;
+
   // dequantization (one set of DC/AC dequant factor per segment)
   VP8QuantMatrix dqm_[NUM_MB_SEGMENTS];
 
@@ -295,9 +317,22 @@ int VP8ExitCritical(VP8Decoder* const dec, VP8Io* const io);
 int VP8GetThreadMethod(const WebPDecoderOptions* const options,
                        const WebPHeaderStructure* const headers,
                        int width, int height);
+// Return the number of row workers to use with the wavefront method.
+int VP8GetNumThreads(const WebPDecoderOptions* const options,
+                     int width, int height);
+// Wait for all pending rows to be processed. Returns false in case of error.
+int VP8SyncThreads(VP8Decoder* const dec);
+// Stop and release the worker threads.
+void VP8EndThreads(VP8Decoder* const dec);
 // Initialize dithering post-process if needed.
 void VP8InitDithering(const WebPDecoderOptions* const options,
                       VP8Decoder* const dec);
+// Switch to the DC-only reconstruction if the options allow it. The picture
+// is then seen as having one pixel per 4x4 block: io->width and io->height
+// are updated accordingly. Must be called after the output buffer is
+// allocated and the threading method is set.
+void VP8InitDCThumbnail(const WebPDecoderOptions* const options,
+                        VP8Decoder* const dec, VP8Io* const io);
 // Process the last decoded row (filtering + output).
 int VP8ProcessRow(VP8Decoder* const dec, VP8Io* const io);
 // To be called at the start of a new scanline, to initialize predictors.
@@ -400,7 +400,8 @@ static int ReadHuffmanCodes(VP8LDecoder* const dec, int xsize, int ysize,
     if (num_htree_groups_max > 1000 || num_htree_groups_max > xsize * ysize) {
       // Create a mapping from the used indices to the minimal set of used
       // values [0, num_htree_groups)
-      mapping = (int*)WebPSafeMalloc(num_htree_groups_max, sizeof(*mapping));
+      mapping = (int*)WebPSafeMallocTransient(num_htree_groups_max,
+                                              sizeof(*mapping));
       if (mapping == NULL) {
         dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
         goto Error;
@@ -432,10 +433,10 @@ static int ReadHuffmanCodes(VP8LDecoder* const dec, int xsize, int ysize,
     }
   }
 
-  code_lengths = (int*)WebPSafeCalloc((uint64_t)max_alphabet_size,
-                                      sizeof(*code_lengths));
-  huffman_tables = (HuffmanCode*)WebPSafeMalloc(num_htree_groups * table_size,
-                                                sizeof(*huffman_tables));
+  code_lengths = (int*)WebPSafeCallocTransient((uint64_t)max_alphabet_size,
+                                               sizeof(*code_lengths));
+  huffman_tables = (HuffmanCode*)WebPSafeMallocTransient(
+      num_htree_groups * table_size, sizeof(*huffman_tables));
   htree_groups = VP8LHtreeGroupsNew(num_htree_groups);
 
   if (htree_groups == NULL || code_lengths == NULL || huffman_tables == NULL) {
@@ -545,7 +546,8 @@ static int AllocateAndInitRescaler(VP8LDecoder* const dec, VP8Io* const io) {
   const uint64_t memory_size = sizeof(*dec->rescaler) +
                                work_size * sizeof(*work) +
                                scaled_data_size * sizeof(*scaled_data);
-  uint8_t* memory = (uint8_t*)WebPSafeMalloc(memory_size, sizeof(*memory));
+  uint8_t* memory =
+      (uint8_t*)WebPSafeMallocTransient(memory_size, sizeof(*memory));
   if (memory == NULL) {
     dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
     return 0;
@@ -821,6 +823,54 @@ static void ProcessRows(VP8LDecoder* const dec, int row) {
   assert(dec->last_row_ <= dec->height_);
 }
 
+static int ProcessRowsHook(void* arg1, void* arg2) {
+  VP8LDecoder* const dec = (VP8LDecoder*)arg1;
+  (void)arg2;
+  ProcessRows(dec, dec->worker_row_);
+  return 1;
+}
+
+// Hands the rows decoded after the previous call over to the worker, once
+// it is done with these previous rows. 'dec->pixels_' holds the whole image,
+// so the decoding can carry on with the next rows in the meantime.
+static void ProcessRowsThreaded(VP8LDecoder* const dec, int row) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  WebPWorker* const worker = &dec->worker_;
+  winterface->Sync(worker);
+  dec->worker_row_ = row;
+  winterface->Launch(worker);
+}
+
+// Waits for the worker to be done with the pending rows.
+static void SyncRowsWorker(VP8LDecoder* const dec) {
+  if (dec->use_worker_) {
+    WebPGetWorkerInterface()->Sync(&dec->worker_);
+  }
+}
+
+// Sets up the worker when rows processing can be overlapped with decoding.
+// Incremental decoding needs the rows to be emitted by the time it returns,
+// hence stays single-threaded.
+static int InitRowsWorker(VP8LDecoder* const dec,
+                          const WebPDecoderOptions* const options) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  WebPWorker* const worker = &dec->worker_;
+  dec->use_worker_ = 0;
+  if (options == NULL || !options->use_threads || dec->incremental_) {
+    return 1;
+  }
+  winterface->Init(worker);
+  worker->hook = ProcessRowsHook;
+  worker->data1 = dec;
+  worker->data2 = NULL;
+  if (!winterface->Reset(worker)) {
+    dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
+    return 0;
+  }
+  dec->use_worker_ = 1;
+  return 1;
+}
+
 // Row-processing for the special case when alpha data contains only one
 // transform (color indexing), and trivial non-green literals.
 static int Is8bOptimizable(const VP8LMetadata* const hdr) {
@@ -1268,8 +1318,8 @@ static int ExpandColorMap(int num_colors, VP8LTransform* const transform) {
   int i;
   const int final_num_colors = 1 << (8 >> transform->bits_);
   uint32_t* const new_color_map =
-      (uint32_t*)WebPSafeMalloc((uint64_t)final_num_colors,
-                                sizeof(*new_color_map));
+      (uint32_t*)WebPSafeMallocTransient((uint64_t)final_num_colors,
+                                         sizeof(*new_color_map));
   if (new_color_map == NULL) {
     return 0;
   } else {
@@ -1365,7 +1415,8 @@ static void ClearMetadata(VP8LMetadata* const hdr) {
 // VP8LDecoder
 
 VP8LDecoder* VP8LNew(void) {
-  VP8LDecoder* const dec = (VP8LDecoder*)WebPSafeCalloc(1ULL, sizeof(*dec));
+  VP8LDecoder* const dec =
+      (VP8LDecoder*)WebPSafeCallocTransient(1ULL, sizeof(*dec));
   if (dec == NULL) return NULL;
   dec->status_ = VP8_STATUS_OK;
   dec->state_ = READ_DIM;
@@ -1380,8 +1431,14 @@ void VP8LClear(VP8LDecoder* const dec) {
   if (dec == NULL) return;
   ClearMetadata(&dec->hdr_);
 
+  // The worker must be done with the rows before they're released.
+  if (dec->use_worker_) {
+    WebPGetWorkerInterface()->End(&dec->worker_);
+    dec->use_worker_ = 0;
+  }
   WebPSafeFree(dec->pixels_);
   dec->pixels_ = NULL;
+  dec->pixels_size_ = 0;
   for (i = 0; i < dec->next_transform_; ++i) {
     ClearTransform(&dec->transforms_[i]);
   }
@@ -1394,6 +1451,21 @@ void VP8LClear(VP8LDecoder* const dec) {
   dec->output_ = NULL;   // leave no trace behind
 }
 
+void VP8LResetDecoder(VP8LDecoder* const dec) {
+  uint32_t* pixels;
+  size_t pixels_size;
+  if (dec == NULL) return;
+  pixels = dec->pixels_;
+  pixels_size = dec->pixels_size_;
+  dec->pixels_ = NULL;   // not released by VP8LClear()
+  VP8LClear(dec);
+  memset(dec, 0, sizeof(*dec));
+  dec->pixels_ = pixels;
+  dec->pixels_size_ = pixels_size;
+  dec->status_ = VP8_STATUS_OK;
+  dec->state_ = READ_DIM;
+}
+
 void VP8LDelete(VP8LDecoder* const dec) {
   if (dec != NULL) {
     VP8LClear(dec);
@@ -1468,7 +1540,7 @@ static int DecodeImageStream(int xsize, int ysize,
 
   {
     const uint64_t total_size = (uint64_t)transform_xsize * transform_ysize;
-    data = (uint32_t*)WebPSafeMalloc(total_size, sizeof(*data));
+    data = (uint32_t*)WebPSafeMallocTransient(total_size, sizeof(*data));
     if (data == NULL) {
       dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
       ok = 0;
@@ -1502,6 +1574,22 @@ static int DecodeImageStream(int xsize, int ysize,
 
 //------------------------------------------------------------------------------
 // Allocate internal buffers dec->pixels_ and dec->argb_cache_.
+
+// (Re)allocates dec->pixels_, unless the one kept from a previous picture is
+// large enough already.
+static int AllocatePixels(VP8LDecoder* const dec,
+                          uint64_t num_pixels, size_t pixel_size) {
+  const uint64_t size = num_pixels * pixel_size;
+  if (dec->pixels_ == NULL || size > dec->pixels_size_) {
+    WebPSafeFree(dec->pixels_);
+    dec->pixels_size_ = 0;
+    dec->pixels_ = (uint32_t*)WebPSafeMallocTransient(num_pixels, pixel_size);
+    if (dec->pixels_ == NULL) return 0;
+    dec->pixels_size_ = (size_t)size;
+  }
+  return 1;
+}
+
 static int AllocateInternalBuffers32b(VP8LDecoder* const dec, int final_width) {
   const uint64_t num_pixels = (uint64_t)dec->width_ * dec->height_;
   // Scratch buffer corresponding to top-prediction row for transforming the
@@ -1513,8 +1601,7 @@ static int AllocateInternalBuffers32b(VP8LDecoder* const dec, int final_width) {
       num_pixels + cache_top_pixels + cache_pixels;
 
   assert(dec->width_ <= final_width);
-  dec->pixels_ = (uint32_t*)WebPSafeMalloc(total_num_pixels, sizeof(uint32_t));
-  if (dec->pixels_ == NULL) {
+  if (!AllocatePixels(dec, total_num_pixels, sizeof(uint32_t))) {
     dec->argb_cache_ = NULL;    // for sanity check
     dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
     return 0;
@@ -1526,8 +1613,7 @@ static int AllocateInternalBuffers32b(VP8LDecoder* const dec, int final_width) {
 static int AllocateInternalBuffers8b(VP8LDecoder* const dec) {
   const uint64_t total_num_pixels = (uint64_t)dec->width_ * dec->height_;
   dec->argb_cache_ = NULL;    // for sanity check
-  dec->pixels_ = (uint32_t*)WebPSafeMalloc(total_num_pixels, sizeof(uint8_t));
-  if (dec->pixels_ == NULL) {
+  if (!AllocatePixels(dec, total_num_pixels, sizeof(uint8_t))) {
     dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
     return 0;
   }
@@ -1690,6 +1776,7 @@ int VP8LDecodeImage(VP8LDecoder* const dec) {
     }
 
     if (!AllocateInternalBuffers32b(dec, io->width)) goto Err;
+    if (!InitRowsWorker(dec, params->options)) goto Err;
 
 #if !defined(WEBP_REDUCE_SIZE)
     if (io->use_scaling && !AllocateAndInitRescaler(dec, io)) goto Err;
@@ -1723,9 +1810,11 @@ int VP8LDecodeImage(VP8LDecoder* const dec) {
 
   // Decode.
   if (!DecodeImageData(dec, dec->pixels_, dec->width_, dec->height_,
-                       io->crop_bottom, ProcessRows)) {
+                       io->crop_bottom,
+                       dec->use_worker_ ? ProcessRowsThreaded : ProcessRows)) {
     goto Err;
   }
+  SyncRowsWorker(dec);
 
   params->last_y = dec->last_out_row_;
   return 1;
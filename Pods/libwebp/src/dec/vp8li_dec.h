@@ -20,6 +20,7 @@
 #include "src/utils/bit_reader_utils.h"
 #include "src/utils/color_cache_utils.h"
 #include "src/utils/huffman_utils.h"
+#include "src/utils/thread_utils.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -64,6 +65,7 @@ struct VP8LDecoder {
 
   uint32_t*        pixels_;        // Internal data: either uint8_t* for alpha
                                    // or uint32_t* for BGRA.
+  size_t           pixels_size_;   // allocated size of pixels_, in bytes.
   uint32_t*        argb_cache_;    // Scratch buffer for temporary BGRA storage.
 
   VP8LBitReader    br_;
@@ -88,6 +90,12 @@ struct VP8LDecoder {
 
   uint8_t*         rescaler_memory;  // Working memory for rescaling work.
   WebPRescaler*    rescaler;         // Common rescaler for all channels.
+
+  // Threading: the rows are transformed and emitted by 'worker_', while the
+  // next rows are being entropy-decoded.
+  int              use_worker_;      // if true, rows are processed by worker_
+  WebPWorker       worker_;
+  int              worker_row_;      // row up to which worker_ processes.
 };
 
 //------------------------------------------------------------------------------
@@ -123,6 +131,10 @@ int VP8LDecodeImage(VP8LDecoder* const dec);
 // Preserves the dec->status_ value.
 void VP8LClear(VP8LDecoder* const dec);
 
+// Resets the decoder in its initial state, ready for a new picture, but keeps
+// the pixel buffer around so that it can be reused.
+void VP8LResetDecoder(VP8LDecoder* const dec);
+
 // Clears and deallocate a lossless decoder instance.
 void VP8LDelete(VP8LDecoder* const dec);
 
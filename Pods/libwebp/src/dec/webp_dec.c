@@ -19,6 +19,8 @@
 #include "src/utils/utils.h"
 #include "src/webp/mux_types.h"  // ALPHA_FLAG
 
+#define MAX_BATCH_THREADS 64  // maximum number of threads of WebPDecodeBatch()
+
 //------------------------------------------------------------------------------
 // RIFF layout is:
 //   Offset  tag
@@ -440,12 +442,65 @@ void WebPResetDecParams(WebPDecParams* const params) {
   }
 }
 
+//------------------------------------------------------------------------------
+// Decoders kept between pictures by a WebPDecoderContext, one set per thread.
+
+typedef struct DecoderSlot DecoderSlot;
+struct DecoderSlot {
+  VP8Decoder* vp8_;      // lossy decoder, created on first use
+  VP8LDecoder* vp8l_;    // lossless decoder, created on first use
+  WebPWorker worker_;    // runs the slot's share of WebPDecodeBatch()
+  // batch job
+  const uint8_t* const* data_;
+  const size_t* data_size_;
+  WebPDecoderConfig* configs_;
+  VP8StatusCode* status_;
+  int first_, step_, num_pictures_;  // pictures first_ + k * step_
+  int num_ok_;                       // number of pictures decoded
+};
+
+struct WebPDecoderContext {
+  int num_slots_;
+  DecoderSlot* slots_;
+};
+
+static VP8Decoder* GetVP8Decoder(DecoderSlot* const slot) {
+  if (slot == NULL) return VP8New();
+  if (slot->vp8_ == NULL) slot->vp8_ = VP8New();
+  return slot->vp8_;
+}
+
+static void ReleaseVP8Decoder(DecoderSlot* const slot, VP8Decoder* const dec) {
+  if (slot == NULL) {
+    VP8Delete(dec);
+  } else {
+    VP8ResetDecoder(dec);
+  }
+}
+
+static VP8LDecoder* GetVP8LDecoder(DecoderSlot* const slot) {
+  if (slot == NULL) return VP8LNew();
+  if (slot->vp8l_ == NULL) slot->vp8l_ = VP8LNew();
+  return slot->vp8l_;
+}
+
+static void ReleaseVP8LDecoder(DecoderSlot* const slot,
+                               VP8LDecoder* const dec) {
+  if (slot == NULL) {
+    VP8LDelete(dec);
+  } else {
+    VP8LResetDecoder(dec);
+  }
+}
+
 //------------------------------------------------------------------------------
 // "Into" decoding variants
 
-// Main flow
-static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
-                                WebPDecParams* const params) {
+// Main flow. The decoders are taken from 'slot', if not NULL.
+static VP8StatusCode DecodeIntoWithSlot(DecoderSlot* const slot,
+                                        const uint8_t* const data,
+                                        size_t data_size,
+                                        WebPDecParams* const params) {
   VP8StatusCode status;
   VP8Io io;
   WebPHeaderStructure headers;
@@ -465,7 +520,7 @@ static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
   WebPInitCustomIo(params, &io);  // Plug the I/O functions.
 
   if (!headers.is_lossless) {
-    VP8Decoder* const dec = VP8New();
+    VP8Decoder* const dec = GetVP8Decoder(slot);
     if (dec == NULL) {
       return VP8_STATUS_OUT_OF_MEMORY;
     }
@@ -483,15 +538,18 @@ static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
         // This change must be done before calling VP8Decode()
         dec->mt_method_ = VP8GetThreadMethod(params->options, &headers,
                                              io.width, io.height);
+        dec->num_threads_ = VP8GetNumThreads(params->options,
+                                             io.width, io.height);
         VP8InitDithering(params->options, dec);
+        VP8InitDCThumbnail(params->options, dec, &io);
         if (!VP8Decode(dec, &io)) {
           status = dec->status_;
         }
       }
     }
-    VP8Delete(dec);
+    ReleaseVP8Decoder(slot, dec);
   } else {
-    VP8LDecoder* const dec = VP8LNew();
+    VP8LDecoder* const dec = GetVP8LDecoder(slot);
     if (dec == NULL) {
       return VP8_STATUS_OUT_OF_MEMORY;
     }
@@ -507,7 +565,7 @@ static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
         }
       }
     }
-    VP8LDelete(dec);
+    ReleaseVP8LDecoder(slot, dec);
   }
 
   if (status != VP8_STATUS_OK) {
@@ -522,6 +580,16 @@ static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
   return status;
 }
 
+static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
+                                WebPDecParams* const params) {
+  WebPMemoryAccount request;
+  VP8StatusCode status;
+  WebPMemoryRequestStart(&request);   // use the thread's arena, if any
+  status = DecodeIntoWithSlot(NULL, data, data_size, params);
+  WebPMemoryRequestEnd(&request);
+  return status;
+}
+
 // Helpers
 static uint8_t* DecodeIntoRGBABuffer(WEBP_CSP_MODE colorspace,
                                      const uint8_t* const data,
@@ -742,23 +810,12 @@ VP8StatusCode WebPGetFeaturesInternal(const uint8_t* data, size_t data_size,
   return GetFeatures(data, data_size, features);
 }
 
-VP8StatusCode WebPDecode(const uint8_t* data, size_t data_size,
-                         WebPDecoderConfig* config) {
+static VP8StatusCode DecodeIntoConfig(DecoderSlot* const slot,
+                                      const uint8_t* data, size_t data_size,
+                                      WebPDecoderConfig* const config) {
   WebPDecParams params;
   VP8StatusCode status;
 
-  if (config == NULL) {
-    return VP8_STATUS_INVALID_PARAM;
-  }
-
-  status = GetFeatures(data, data_size, &config->input);
-  if (status != VP8_STATUS_OK) {
-    if (status == VP8_STATUS_NOT_ENOUGH_DATA) {
-      return VP8_STATUS_BITSTREAM_ERROR;  // Not-enough-data treated as error.
-    }
-    return status;
-  }
-
   WebPResetDecParams(&params);
   params.options = &config->options;
   params.output = &config->output;
@@ -770,18 +827,164 @@ VP8StatusCode WebPDecode(const uint8_t* data, size_t data_size,
     in_mem_buffer.width = config->input.width;
     in_mem_buffer.height = config->input.height;
     params.output = &in_mem_buffer;
-    status = DecodeInto(data, data_size, &params);
+    status = DecodeIntoWithSlot(slot, data, data_size, &params);
     if (status == VP8_STATUS_OK) {  // do the slow-copy
       status = WebPCopyDecBufferPixels(&in_mem_buffer, &config->output);
     }
     WebPFreeDecBuffer(&in_mem_buffer);
   } else {
-    status = DecodeInto(data, data_size, &params);
+    status = DecodeIntoWithSlot(slot, data, data_size, &params);
   }
 
   return status;
 }
 
+static VP8StatusCode DecodeWithSlot(DecoderSlot* const slot,
+                                    const uint8_t* data, size_t data_size,
+                                    WebPDecoderConfig* config) {
+  WebPMemoryAccount request;
+  VP8StatusCode status;
+
+  if (config == NULL) {
+    return VP8_STATUS_INVALID_PARAM;
+  }
+
+  status = GetFeatures(data, data_size, &config->input);
+  if (status != VP8_STATUS_OK) {
+    if (status == VP8_STATUS_NOT_ENOUGH_DATA) {
+      return VP8_STATUS_BITSTREAM_ERROR;  // Not-enough-data treated as error.
+    }
+    return status;
+  }
+
+  // The slots' decoders are kept across calls, and can't use an arena.
+  if (slot == NULL) WebPMemoryRequestStart(&request);
+  if (config->options.track_memory) {
+    WebPMemoryAccount account;
+    // If the account can't be started, the memory is simply not reported.
+    const int tracking = WebPMemoryAccountStart(&account);
+    status = DecodeIntoConfig(slot, data, data_size, config);
+    if (tracking) {
+      WebPMemoryAccountStop(&account);
+      config->output.peak_memory_kb = WebPMemorySizeToKb(account.peak_size);
+      config->output.total_memory_kb = WebPMemorySizeToKb(account.total_size);
+    } else {
+      config->output.peak_memory_kb = 0;
+      config->output.total_memory_kb = 0;
+    }
+  } else {
+    status = DecodeIntoConfig(slot, data, data_size, config);
+  }
+  if (slot == NULL) WebPMemoryRequestEnd(&request);
+  return status;
+}
+
+VP8StatusCode WebPDecode(const uint8_t* data, size_t data_size,
+                         WebPDecoderConfig* config) {
+  return DecodeWithSlot(NULL, data, data_size, config);
+}
+
+//------------------------------------------------------------------------------
+// Decoding with a WebPDecoderContext
+
+WebPDecoderContext* WebPNewDecoderContext(int num_threads) {
+  WebPDecoderContext* context;
+  int i;
+  if (num_threads < 1) num_threads = 1;
+  if (num_threads > MAX_BATCH_THREADS) num_threads = MAX_BATCH_THREADS;
+  context = (WebPDecoderContext*)WebPSafeCalloc(1ULL, sizeof(*context));
+  if (context == NULL) return NULL;
+  context->slots_ =
+      (DecoderSlot*)WebPSafeCalloc(num_threads, sizeof(*context->slots_));
+  if (context->slots_ == NULL) {
+    WebPSafeFree(context);
+    return NULL;
+  }
+  context->num_slots_ = num_threads;
+  for (i = 0; i < num_threads; ++i) {
+    WebPGetWorkerInterface()->Init(&context->slots_[i].worker_);
+  }
+  return context;
+}
+
+void WebPDeleteDecoderContext(WebPDecoderContext* context) {
+  int i;
+  if (context == NULL) return;
+  for (i = 0; i < context->num_slots_; ++i) {
+    DecoderSlot* const slot = &context->slots_[i];
+    WebPGetWorkerInterface()->End(&slot->worker_);
+    VP8Delete(slot->vp8_);
+    VP8LDelete(slot->vp8l_);
+  }
+  WebPSafeFree(context->slots_);
+  WebPSafeFree(context);
+}
+
+VP8StatusCode WebPDecodeWithContext(WebPDecoderContext* context,
+                                    const uint8_t* data, size_t data_size,
+                                    WebPDecoderConfig* config) {
+  if (context == NULL) return VP8_STATUS_INVALID_PARAM;
+  return DecodeWithSlot(&context->slots_[0], data, data_size, config);
+}
+
+static int DecodeBatchHook(void* arg1, void* arg2) {
+  DecoderSlot* const slot = (DecoderSlot*)arg1;
+  int i;
+  (void)arg2;
+  for (i = slot->first_; i < slot->num_pictures_; i += slot->step_) {
+    const VP8StatusCode status =
+        DecodeWithSlot(slot, slot->data_[i], slot->data_size_[i],
+                       &slot->configs_[i]);
+    if (slot->status_ != NULL) slot->status_[i] = status;
+    if (status == VP8_STATUS_OK) ++slot->num_ok_;
+  }
+  return 1;
+}
+
+int WebPDecodeBatch(WebPDecoderContext* context,
+                    const uint8_t* const data[], const size_t data_size[],
+                    WebPDecoderConfig configs[], VP8StatusCode status[],
+                    int num_pictures) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  int num_slots;
+  int num_ok = 0;
+  int i;
+  if (context == NULL || data == NULL || data_size == NULL ||
+      configs == NULL || num_pictures <= 0) {
+    return 0;
+  }
+  num_slots = (num_pictures < context->num_slots_) ? num_pictures
+                                                    : context->num_slots_;
+  for (i = num_slots - 1; i >= 0; --i) {
+    DecoderSlot* const slot = &context->slots_[i];
+    WebPWorker* const worker = &slot->worker_;
+    slot->data_ = data;
+    slot->data_size_ = data_size;
+    slot->configs_ = configs;
+    slot->status_ = status;
+    slot->first_ = i;
+    slot->step_ = num_slots;
+    slot->num_pictures_ = num_pictures;
+    slot->num_ok_ = 0;
+    worker->hook = DecodeBatchHook;
+    worker->data1 = slot;
+    worker->data2 = NULL;
+    // The first slot is run by the calling thread, once the others are
+    // started. So are the others, if their thread can't be started.
+    if (i > 0 && winterface->Reset(worker)) {
+      winterface->Launch(worker);
+    } else {
+      winterface->Execute(worker);
+    }
+  }
+  for (i = 0; i < num_slots; ++i) {
+    DecoderSlot* const slot = &context->slots_[i];
+    if (i > 0) winterface->Sync(&slot->worker_);
+    num_ok += slot->num_ok_;
+  }
+  return num_ok;
+}
+
 //------------------------------------------------------------------------------
 // Cropping and rescaling.
 
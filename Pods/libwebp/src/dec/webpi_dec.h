@@ -19,6 +19,7 @@ extern "C" {
 #endif
 
 #include "src/utils/rescaler_utils.h"
+#include "src/utils/thread_utils.h"
 #include "src/dec/vp8_dec.h"
 
 //------------------------------------------------------------------------------
@@ -41,6 +42,8 @@ struct WebPDecParams {
 
   WebPRescaler* scaler_y, *scaler_u, *scaler_v, *scaler_a;  // rescalers
   void* memory;                  // overall scratch memory for the output work.
+  WebPWorker uv_worker;          // rescales U/V while Y is, if use_threads
+  int use_uv_worker;
 
   OutputFunc emit;               // output RGB or YUV samples
   OutputAlphaFunc emit_alpha;    // output alpha channel
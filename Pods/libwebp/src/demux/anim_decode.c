@@ -17,11 +17,13 @@
 #include <assert.h>
 #include <string.h>
 
+#include "src/utils/thread_utils.h"
 #include "src/utils/utils.h"
 #include "src/webp/decode.h"
 #include "src/webp/demux.h"
 
 #define NUM_CHANNELS 4
+#define MAX_LOOKAHEAD 16   // maximum number of frames decoded ahead
 
 typedef void (*BlendRowFunc)(uint32_t* const, const uint32_t* const, int);
 static void BlendPixelRowNonPremult(uint32_t* const src,
@@ -29,6 +31,17 @@ static void BlendPixelRowNonPremult(uint32_t* const src,
 static void BlendPixelRowPremult(uint32_t* const src, const uint32_t* const dst,
                                  int num_pixels);
 
+// Frame decoded ahead of time, into its own sub-rectangle buffer.
+typedef struct {
+  WebPWorker worker_;
+  int frame_num_;                  // Frame held (or being decoded), 0 if none.
+  const uint8_t* data_;            // Compressed frame.
+  size_t data_size_;
+  WebPDecoderConfig config_;
+  uint8_t* rgba_;                  // Decoded frame, of stride width * 4.
+  size_t rgba_size_;
+} FrameSlot;
+
 struct WebPAnimDecoder {
   WebPDemuxer* demux_;             // Demuxer created from given WebP bitstream.
   WebPDecoderConfig config_;       // Decoder config.
@@ -43,11 +56,25 @@ struct WebPAnimDecoder {
   int prev_frame_was_keyframe_;    // True if previous frame was a keyframe.
   int next_frame_;                 // Index of the next frame to be decoded
                                    // (starting from 1).
+  // Seeking.
+  int num_indexed_;                // Number of frames in the index below.
+  uint8_t* key_frames_;            // key_frames_[i]: true if frame 'i' is a
+                                   // key-frame (i = 0 stands for 'no frame').
+  int* timestamps_;                // timestamps_[i]: timestamp of frame 'i'.
+  int snapshot_interval_;          // Distance between two canvas snapshots.
+  uint8_t** snapshots_;            // snapshots_[i]: disposed canvas after frame
+                                   // '(i + 1) * snapshot_interval_', or NULL.
+  // Look-ahead decoding.
+  int lookahead_;                  // Number of frame slots, 0 if disabled.
+  FrameSlot* slots_;               // Frame 'n' is decoded in slot n % lookahead_.
 };
 
 static void DefaultDecoderOptions(WebPAnimDecoderOptions* const dec_options) {
   dec_options->color_mode = MODE_RGBA;
   dec_options->use_threads = 0;
+  dec_options->snapshot_interval = 0;
+  dec_options->lookahead = 0;
+  dec_options->lazy_demux = 0;
 }
 
 int WebPAnimDecoderOptionsInitInternal(WebPAnimDecoderOptions* dec_options,
@@ -71,6 +98,11 @@ static int ApplyDecoderOptions(const WebPAnimDecoderOptions* const dec_options,
       mode != MODE_rgbA && mode != MODE_bgrA) {
     return 0;
   }
+  if (dec_options->snapshot_interval < 0) return 0;
+  dec->snapshot_interval_ = dec_options->snapshot_interval;
+  if (dec_options->lookahead < 0) return 0;
+  dec->lookahead_ = (dec_options->lookahead > MAX_LOOKAHEAD) ? MAX_LOOKAHEAD
+                                                             : dec_options->lookahead;
   dec->blend_func_ = (mode == MODE_RGBA || mode == MODE_BGRA)
                          ? &BlendPixelRowNonPremult
                          : &BlendPixelRowPremult;
@@ -82,6 +114,114 @@ static int ApplyDecoderOptions(const WebPAnimDecoderOptions* const dec_options,
   return 1;
 }
 
+//------------------------------------------------------------------------------
+// Look-ahead decoding
+
+static int DecodeFrameHook(void* arg1, void* arg2) {
+  FrameSlot* const slot = (FrameSlot*)arg1;
+  (void)arg2;
+  return (WebPDecode(slot->data_, slot->data_size_, &slot->config_) ==
+          VP8_STATUS_OK);
+}
+
+static int InitFrameSlots(WebPAnimDecoder* const dec) {
+  int i;
+  if (dec->lookahead_ == 0) return 1;
+  dec->slots_ =
+      (FrameSlot*)WebPSafeCalloc(dec->lookahead_, sizeof(*dec->slots_));
+  if (dec->slots_ == NULL) return 0;
+  for (i = 0; i < dec->lookahead_; ++i) {
+    FrameSlot* const slot = &dec->slots_[i];
+    WebPGetWorkerInterface()->Init(&slot->worker_);
+    slot->worker_.hook = DecodeFrameHook;
+    slot->worker_.data1 = slot;
+    slot->config_ = dec->config_;
+    if (!WebPGetWorkerInterface()->Reset(&slot->worker_)) {
+      dec->lookahead_ = i + 1;   // so that ClearFrameSlots() stops here
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void ClearFrameSlots(WebPAnimDecoder* const dec) {
+  int i;
+  if (dec->slots_ == NULL) return;
+  for (i = 0; i < dec->lookahead_; ++i) {
+    WebPGetWorkerInterface()->End(&dec->slots_[i].worker_);
+    WebPSafeFree(dec->slots_[i].rgba_);
+  }
+  WebPSafeFree(dec->slots_);
+  dec->slots_ = NULL;
+}
+
+// Makes sure frame 'frame_num' is decoded, or being decoded, in its slot.
+static int StartFrame(WebPAnimDecoder* const dec, int frame_num) {
+  FrameSlot* const slot = &dec->slots_[frame_num % dec->lookahead_];
+  WebPIterator iter;
+  size_t size;
+  if (slot->frame_num_ == frame_num) return 1;
+  // Discard the previous frame, and its decoding error if any.
+  WebPGetWorkerInterface()->Sync(&slot->worker_);
+  WebPGetWorkerInterface()->Reset(&slot->worker_);
+  slot->frame_num_ = 0;
+  if (!WebPDemuxGetFrame(dec->demux_, frame_num, &iter)) return 0;
+  size = (size_t)iter.width * iter.height * NUM_CHANNELS;
+  if (size > slot->rgba_size_) {
+    WebPSafeFree(slot->rgba_);
+    slot->rgba_size_ = 0;
+    slot->rgba_ = (uint8_t*)WebPSafeMalloc(size, sizeof(*slot->rgba_));
+    if (slot->rgba_ == NULL) {
+      WebPDemuxReleaseIterator(&iter);
+      return 0;
+    }
+    slot->rgba_size_ = size;
+  }
+  slot->data_ = iter.fragment.bytes;
+  slot->data_size_ = iter.fragment.size;
+  slot->config_.output.u.RGBA.rgba = slot->rgba_;
+  slot->config_.output.u.RGBA.stride = iter.width * NUM_CHANNELS;
+  slot->config_.output.u.RGBA.size = size;
+  slot->frame_num_ = frame_num;
+  WebPDemuxReleaseIterator(&iter);
+  WebPGetWorkerInterface()->Launch(&slot->worker_);
+  return 1;
+}
+
+// Writes the frame described by 'iter' into the current canvas, and starts
+// decoding the following ones.
+static int GetAheadFrame(WebPAnimDecoder* const dec,
+                         const WebPIterator* const iter) {
+  const int frame_num = iter->frame_num;
+  const int last = (int)dec->info_.frame_count;
+  FrameSlot* const slot = &dec->slots_[frame_num % dec->lookahead_];
+  const size_t canvas_stride = (size_t)dec->info_.canvas_width * NUM_CHANNELS;
+  const size_t stride = (size_t)iter->width * NUM_CHANNELS;
+  const uint8_t* src;
+  uint8_t* dst;
+  int i, y;
+
+  if (!StartFrame(dec, frame_num)) return 0;
+  // The following frames are only prefetched: their errors are reported when
+  // they are actually requested.
+  for (i = 1; i < dec->lookahead_ && frame_num + i <= last; ++i) {
+    if (!StartFrame(dec, frame_num + i)) break;
+  }
+  if (!WebPGetWorkerInterface()->Sync(&slot->worker_)) {
+    slot->frame_num_ = 0;
+    return 0;
+  }
+  src = slot->rgba_;
+  dst = dec->curr_frame_ + iter->y_offset * canvas_stride +
+        iter->x_offset * NUM_CHANNELS;
+  for (y = 0; y < iter->height; ++y) {
+    memcpy(dst, src, stride);
+    src += stride;
+    dst += canvas_stride;
+  }
+  return 1;
+}
+
 WebPAnimDecoder* WebPAnimDecoderNewInternal(
     const WebPData* webp_data, const WebPAnimDecoderOptions* dec_options,
     int abi_version) {
@@ -103,7 +243,8 @@ WebPAnimDecoder* WebPAnimDecoderNewInternal(
   }
   if (!ApplyDecoderOptions(&options, dec)) goto Error;
 
-  dec->demux_ = WebPDemux(webp_data);
+  dec->demux_ = options.lazy_demux ? WebPDemuxLazy(webp_data)
+                                   : WebPDemux(webp_data);
   if (dec->demux_ == NULL) goto Error;
 
   dec->info_.canvas_width = WebPDemuxGetI(dec->demux_, WEBP_FF_CANVAS_WIDTH);
@@ -120,6 +261,8 @@ WebPAnimDecoder* WebPAnimDecoderNewInternal(
       dec->info_.canvas_width * NUM_CHANNELS, dec->info_.canvas_height);
   if (dec->prev_frame_disposed_ == NULL) goto Error;
 
+  if (!InitFrameSlots(dec)) goto Error;
+
   WebPAnimDecoderReset(dec);
   return dec;
 
@@ -306,6 +449,30 @@ static void FindBlendRangeAtRow(const WebPIterator* const src,
   }
 }
 
+// Keeps a copy of the disposed canvas after 'frame_num', if it falls on the
+// snapshot grid. Snapshots are only a cache for WebPAnimDecoderSeek(), hence
+// allocation failures are not reported.
+static void SaveSnapshot(WebPAnimDecoder* const dec, int frame_num) {
+  const int interval = dec->snapshot_interval_;
+  const uint32_t width = dec->info_.canvas_width;
+  const uint32_t height = dec->info_.canvas_height;
+  int idx;
+  if (interval <= 0 || (frame_num % interval) != 0) return;
+  idx = frame_num / interval - 1;
+  if (dec->snapshots_ == NULL) {
+    const int num_snapshots = dec->info_.frame_count / interval;
+    dec->snapshots_ = (uint8_t**)WebPSafeCalloc(num_snapshots,
+                                                sizeof(*dec->snapshots_));
+    if (dec->snapshots_ == NULL) return;
+  }
+  if (dec->snapshots_[idx] == NULL) {
+    dec->snapshots_[idx] =
+        (uint8_t*)WebPSafeMalloc(width * NUM_CHANNELS, height);
+    if (dec->snapshots_[idx] == NULL) return;
+    CopyCanvas(dec->prev_frame_disposed_, dec->snapshots_[idx], width, height);
+  }
+}
+
 int WebPAnimDecoderGetNext(WebPAnimDecoder* dec,
                            uint8_t** buf_ptr, int* timestamp_ptr) {
   WebPIterator iter;
@@ -343,7 +510,9 @@ int WebPAnimDecoderGetNext(WebPAnimDecoder* dec,
   }
 
   // Decode.
-  {
+  if (dec->slots_ != NULL) {
+    if (!GetAheadFrame(dec, &iter)) goto Error;
+  } else {
     const uint8_t* in = iter.fragment.bytes;
     const size_t in_size = iter.fragment.size;
     const size_t out_offset =
@@ -411,6 +580,7 @@ int WebPAnimDecoderGetNext(WebPAnimDecoder* dec,
                       dec->prev_iter_.x_offset, dec->prev_iter_.y_offset,
                       dec->prev_iter_.width, dec->prev_iter_.height);
   }
+  SaveSnapshot(dec, dec->prev_iter_.frame_num);
   ++dec->next_frame_;
 
   // All OK, fill in the values.
@@ -438,6 +608,100 @@ void WebPAnimDecoderReset(WebPAnimDecoder* dec) {
   }
 }
 
+//------------------------------------------------------------------------------
+// Seeking
+
+// Extends the key-frame and timestamp index up to frame 'last'.
+static int IndexFrames(WebPAnimDecoder* const dec, int last) {
+  const int width = dec->info_.canvas_width;
+  const int height = dec->info_.canvas_height;
+  WebPIterator prev, curr;
+  int i;
+
+  if (dec->num_indexed_ >= last) return 1;
+  if (dec->key_frames_ == NULL) {
+    const uint64_t size = dec->info_.frame_count + 1ULL;
+    dec->key_frames_ =
+        (uint8_t*)WebPSafeMalloc(size, sizeof(*dec->key_frames_));
+    dec->timestamps_ = (int*)WebPSafeMalloc(size, sizeof(*dec->timestamps_));
+    if (dec->key_frames_ == NULL || dec->timestamps_ == NULL) return 0;
+    dec->key_frames_[0] = 0;
+    dec->timestamps_[0] = 0;
+  }
+  memset(&prev, 0, sizeof(prev));
+  i = dec->num_indexed_;
+  if (i > 0 && !WebPDemuxGetFrame(dec->demux_, i, &prev)) return 0;
+  for (++i; i <= last; ++i) {
+    if (!WebPDemuxGetFrame(dec->demux_, i, &curr)) break;
+    dec->key_frames_[i] =
+        IsKeyFrame(&curr, &prev, dec->key_frames_[i - 1], width, height);
+    dec->timestamps_[i] = dec->timestamps_[i - 1] + curr.duration;
+    WebPDemuxReleaseIterator(&prev);
+    prev = curr;
+    dec->num_indexed_ = i;
+  }
+  WebPDemuxReleaseIterator(&prev);
+  return (dec->num_indexed_ >= last);
+}
+
+// Sets the decoding state to what it is right after decoding frame 'frame'
+// (0 meaning before the first frame). prev_frame_disposed_ must be set by the
+// caller, unless frame 'frame + 1' is a key-frame.
+static int RestoreFrameState(WebPAnimDecoder* const dec, int frame) {
+  WebPDemuxReleaseIterator(&dec->prev_iter_);
+  memset(&dec->prev_iter_, 0, sizeof(dec->prev_iter_));
+  if (frame > 0 && !WebPDemuxGetFrame(dec->demux_, frame, &dec->prev_iter_)) {
+    return 0;
+  }
+  dec->prev_frame_was_keyframe_ = dec->key_frames_[frame];
+  dec->prev_frame_timestamp_ = dec->timestamps_[frame];
+  dec->next_frame_ = frame + 1;
+  return 1;
+}
+
+int WebPAnimDecoderSeek(WebPAnimDecoder* dec, int frame_index) {
+  int key_frame, snapshot = 0;
+  int start;    // first frame to decode
+
+  if (dec == NULL) return 0;
+  if (frame_index < 1 || frame_index > (int)dec->info_.frame_count) return 0;
+  if (!IndexFrames(dec, frame_index)) return 0;
+
+  // Nearest key-frame. Frame #1 always is one.
+  for (key_frame = frame_index; !dec->key_frames_[key_frame]; --key_frame) {}
+  start = key_frame;
+  // Nearest snapshot past that key-frame, if any.
+  if (dec->snapshots_ != NULL) {
+    const int interval = dec->snapshot_interval_;
+    int s;
+    for (s = (frame_index - 1) / interval; s * interval >= start; --s) {
+      if (dec->snapshots_[s - 1] != NULL) {
+        snapshot = s * interval;
+        start = snapshot + 1;
+        break;
+      }
+    }
+  }
+
+  // Restart from there, unless the current position is already closer.
+  if (dec->next_frame_ < start || dec->next_frame_ > frame_index) {
+    if (snapshot > 0) {
+      CopyCanvas(dec->snapshots_[snapshot / dec->snapshot_interval_ - 1],
+                 dec->prev_frame_disposed_,
+                 dec->info_.canvas_width, dec->info_.canvas_height);
+      if (!RestoreFrameState(dec, snapshot)) return 0;
+    } else {
+      if (!RestoreFrameState(dec, key_frame - 1)) return 0;
+    }
+  }
+  while (dec->next_frame_ < frame_index) {
+    uint8_t* buf;
+    int timestamp;
+    if (!WebPAnimDecoderGetNext(dec, &buf, &timestamp)) return 0;
+  }
+  return 1;
+}
+
 const WebPDemuxer* WebPAnimDecoderGetDemuxer(const WebPAnimDecoder* dec) {
   if (dec == NULL) return NULL;
   return dec->demux_;
@@ -445,10 +709,20 @@ const WebPDemuxer* WebPAnimDecoderGetDemuxer(const WebPAnimDecoder* dec) {
 
 void WebPAnimDecoderDelete(WebPAnimDecoder* dec) {
   if (dec != NULL) {
+    ClearFrameSlots(dec);
     WebPDemuxReleaseIterator(&dec->prev_iter_);
     WebPDemuxDelete(dec->demux_);
     WebPSafeFree(dec->curr_frame_);
     WebPSafeFree(dec->prev_frame_disposed_);
+    WebPSafeFree(dec->key_frames_);
+    WebPSafeFree(dec->timestamps_);
+    if (dec->snapshots_ != NULL) {
+      const int num_snapshots =
+          dec->info_.frame_count / dec->snapshot_interval_;
+      int i;
+      for (i = 0; i < num_snapshots; ++i) WebPSafeFree(dec->snapshots_[i]);
+      WebPSafeFree(dec->snapshots_);
+    }
     WebPSafeFree(dec);
   }
 }
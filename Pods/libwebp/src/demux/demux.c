@@ -15,6 +15,7 @@
 #endif
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -27,6 +28,9 @@
 #define DMUX_MIN_VERSION 1
 #define DMUX_REV_VERSION 0
 
+// 'allow_partial' value of WebPDemuxInternal() selecting lazy demuxing.
+#define DEMUX_LAZY 2
+
 typedef struct {
   size_t start_;        // start location of the data
   size_t end_;          // end location
@@ -58,6 +62,14 @@ typedef struct Chunk {
   struct Chunk* next_;
 } Chunk;
 
+// Chunks sharing the same fourcc, in bitstream order.
+typedef struct {
+  uint32_t fourcc_;
+  int num_chunks_;
+  int size_;             // allocated size of chunks_[]
+  const Chunk** chunks_;
+} ChunkIndex;
+
 struct WebPDemuxer {
   MemBuffer mem_;
   WebPDemuxState state_;
@@ -66,11 +78,25 @@ struct WebPDemuxer {
   int canvas_width_, canvas_height_;
   int loop_count_;
   uint32_t bgcolor_;
-  int num_frames_;
+  int num_frames_;         // number of frames parsed so far
+  int anim_chunks_;        // number of 'ANIM' chunks parsed so far
+  // Lazy demuxing (see ParseLazily()).
+  int is_lazy_;            // true while frames remain to be parsed on demand
+  int lazy_num_frames_;    // number of frames in the whole file
+  int lazy_max_frames_;    // ParseVP8XChunks() pauses past this many frames
+  int lazy_error_;         // true if the frames past 'num_frames_' are invalid
   Frame* frames_;
   Frame** frames_tail_;
   Chunk* chunks_;  // non-image chunks
   Chunk** chunks_tail_;
+  // Lookup arrays filled while parsing, giving constant time access to
+  // frames (by frame number) and chunks (by fourcc and chunk number).
+  const Frame** frame_index_;  // first Frame of each frame number
+  int num_indexed_frames_;
+  int frame_index_size_;
+  ChunkIndex* chunk_index_;    // one entry per distinct fourcc
+  int num_chunk_index_;
+  int chunk_index_size_;
 };
 
 typedef enum {
@@ -171,13 +197,91 @@ static WEBP_INLINE uint32_t ReadLE32(MemBuffer* const mem) {
   return val;
 }
 
+// -----------------------------------------------------------------------------
+// Lookup arrays
+
+// Makes sure '*array' (of 'elem_size' elements) can hold at least 'num'
+// elements, growing it geometrically. Returns false in case of memory error.
+static int GrowArray(void** const array, int* const size, int num,
+                     size_t elem_size) {
+  if (num > *size) {
+    const int new_size = (*size < 4) ? 4 : 2 * *size;
+    void* const new_array = WebPSafeMalloc((uint64_t)new_size, elem_size);
+    if (new_array == NULL) return 0;
+    if (*array != NULL) {
+      memcpy(new_array, *array, (size_t)*size * elem_size);
+      WebPSafeFree(*array);
+    }
+    *array = new_array;
+    *size = new_size;
+  }
+  return 1;
+}
+
+// Records 'frame' if it starts a new frame number.
+static int IndexFrame(WebPDemuxer* const dmux, const Frame* const frame) {
+  const int n = dmux->num_indexed_frames_;
+  if (frame->frame_num_ <= n) return 1;   // not the first one of its number
+  // Frame numbers are allocated sequentially while parsing.
+  if (frame->frame_num_ != n + 1) return 0;
+  if (!GrowArray((void**)&dmux->frame_index_, &dmux->frame_index_size_,
+                 n + 1, sizeof(*dmux->frame_index_))) {
+    return 0;
+  }
+  dmux->frame_index_[n] = frame;
+  dmux->num_indexed_frames_ = n + 1;
+  return 1;
+}
+
+static const ChunkIndex* FindChunkIndex(const WebPDemuxer* const dmux,
+                                        uint32_t fourcc) {
+  int i;
+  // The number of distinct fourccs in a file is small.
+  for (i = 0; i < dmux->num_chunk_index_; ++i) {
+    if (dmux->chunk_index_[i].fourcc_ == fourcc) return &dmux->chunk_index_[i];
+  }
+  return NULL;
+}
+
+static int IndexChunk(WebPDemuxer* const dmux, const Chunk* const chunk) {
+  const uint32_t fourcc = GetLE32(dmux->mem_.buf_ + chunk->data_.offset_);
+  ChunkIndex* idx = (ChunkIndex*)FindChunkIndex(dmux, fourcc);
+  if (idx == NULL) {
+    if (!GrowArray((void**)&dmux->chunk_index_, &dmux->chunk_index_size_,
+                   dmux->num_chunk_index_ + 1, sizeof(*dmux->chunk_index_))) {
+      return 0;
+    }
+    idx = &dmux->chunk_index_[dmux->num_chunk_index_++];
+    memset(idx, 0, sizeof(*idx));
+    idx->fourcc_ = fourcc;
+  }
+  if (!GrowArray((void**)&idx->chunks_, &idx->size_, idx->num_chunks_ + 1,
+                 sizeof(*idx->chunks_))) {
+    return 0;
+  }
+  idx->chunks_[idx->num_chunks_++] = chunk;
+  return 1;
+}
+
+static void ClearIndex(WebPDemuxer* const dmux) {
+  int i;
+  for (i = 0; i < dmux->num_chunk_index_; ++i) {
+    WebPSafeFree((void*)dmux->chunk_index_[i].chunks_);
+  }
+  WebPSafeFree(dmux->chunk_index_);
+  WebPSafeFree((void*)dmux->frame_index_);
+}
+
 // -----------------------------------------------------------------------------
 // Secondary chunk parsing
 
-static void AddChunk(WebPDemuxer* const dmux, Chunk* const chunk) {
+// Returns true on success, false otherwise.
+static int AddChunk(WebPDemuxer* const dmux, Chunk* const chunk) {
+  if (!IndexChunk(dmux, chunk)) return 0;
   *dmux->chunks_tail_ = chunk;
   chunk->next_ = NULL;
   dmux->chunks_tail_ = &chunk->next_;
+  return 1;
 }
 
 // Add a frame to the end of the list, ensuring the last frame is complete.
@@ -185,6 +289,7 @@ static void AddChunk(WebPDemuxer* const dmux, Chunk* const chunk) {
 static int AddFrame(WebPDemuxer* const dmux, Frame* const frame) {
   const Frame* const last_frame = *dmux->frames_tail_;
   if (last_frame != NULL && !last_frame->complete_) return 0;
+  if (!IndexFrame(dmux, frame)) return 0;
 
   *dmux->frames_tail_ = frame;
   frame->next_ = NULL;
@@ -357,7 +462,10 @@ static int StoreChunk(WebPDemuxer* const dmux,
 
   chunk->data_.offset_ = start_offset;
   chunk->data_.size_ = size;
-  AddChunk(dmux, chunk);
+  if (!AddChunk(dmux, chunk)) {
+    WebPSafeFree(chunk);
+    return 0;
+  }
   return 1;
 }
 
@@ -438,7 +546,6 @@ static ParseStatus ParseSingleImage(WebPDemuxer* const dmux) {
 static ParseStatus ParseVP8XChunks(WebPDemuxer* const dmux) {
   const int is_animation = !!(dmux->feature_flags_ & ANIMATION_FLAG);
   MemBuffer* const mem = &dmux->mem_;
-  int anim_chunks = 0;
   ParseStatus status = PARSE_OK;
 
   do {
@@ -459,7 +566,7 @@ static ParseStatus ParseVP8XChunks(WebPDemuxer* const dmux) {
       case MKFOURCC('V', 'P', '8', ' '):
       case MKFOURCC('V', 'P', '8', 'L'): {
         // check that this isn't an animation (all frames should be in an ANMF).
-        if (anim_chunks > 0 || is_animation) return PARSE_ERROR;
+        if (dmux->anim_chunks_ > 0 || is_animation) return PARSE_ERROR;
 
         Rewind(mem, CHUNK_HEADER_SIZE);
         status = ParseSingleImage(dmux);
@@ -470,8 +577,8 @@ static ParseStatus ParseVP8XChunks(WebPDemuxer* const dmux) {
 
         if (MemDataSize(mem) < chunk_size_padded) {
           status = PARSE_NEED_MORE_DATA;
-        } else if (anim_chunks == 0) {
-          ++anim_chunks;
+        } else if (dmux->anim_chunks_ == 0) {
+          ++dmux->anim_chunks_;
           dmux->bgcolor_ = ReadLE32(mem);
           dmux->loop_count_ = ReadLE16s(mem);
           Skip(mem, chunk_size_padded - ANIM_CHUNK_SIZE);
@@ -482,7 +589,8 @@ static ParseStatus ParseVP8XChunks(WebPDemuxer* const dmux) {
         break;
       }
       case MKFOURCC('A', 'N', 'M', 'F'): {
-        if (anim_chunks == 0) return PARSE_ERROR;  // 'ANIM' precedes frames.
+        // 'ANIM' precedes frames.
+        if (dmux->anim_chunks_ == 0) return PARSE_ERROR;
         status = ParseAnimationFrame(dmux, chunk_size_padded);
         break;
       }
@@ -520,12 +628,81 @@ static ParseStatus ParseVP8XChunks(WebPDemuxer* const dmux) {
       break;
     } else if (MemDataSize(mem) < CHUNK_HEADER_SIZE) {
       status = PARSE_NEED_MORE_DATA;
+    } else if (status == PARSE_OK && dmux->is_lazy_ &&
+               dmux->num_frames_ >= dmux->lazy_max_frames_) {
+      break;  // paused, see ParseLazily()
     }
   } while (status == PARSE_OK);
 
   return status;
 }
 
+// -----------------------------------------------------------------------------
+// Lazy parsing
+//
+// A lazy demuxer holds the complete file but only parses the frames which are
+// accessed, so that with a memory mapped file only the corresponding pages are
+// read. As for partial demuxing, ParseVP8XChunks() stops at a top-level chunk
+// boundary, here once 'lazy_max_frames_' frames are parsed, and is called again
+// from there when more frames are needed.
+
+// Returns the number of frames of the animation whose top-level chunks start
+// at 'mem->start_', only reading the chunk headers, or -1 if the chunks do not
+// exactly fill the RIFF payload.
+static int SkimFrames(const MemBuffer* const mem) {
+  size_t pos = mem->start_;
+  int num_frames = 0;
+  while (pos < mem->riff_end_) {
+    const uint8_t* const header = mem->buf_ + pos;
+    uint32_t size;
+    if (mem->riff_end_ - pos < CHUNK_HEADER_SIZE) return -1;
+    size = GetLE32(header + TAG_SIZE);
+    if (size > MAX_CHUNK_PAYLOAD) return -1;
+    size += size & 1;
+    if (size > mem->riff_end_ - pos - CHUNK_HEADER_SIZE) return -1;
+    if (!memcmp(header, "ANMF", TAG_SIZE) &&
+        size >= ANMF_CHUNK_SIZE + CHUNK_HEADER_SIZE) {
+      // Only 'ANMF' chunks starting with an image bearing chunk make a frame.
+      const uint8_t* const image = header + CHUNK_HEADER_SIZE + ANMF_CHUNK_SIZE;
+      if (!memcmp(image, "ALPH", TAG_SIZE) ||
+          !memcmp(image, "VP8 ", TAG_SIZE) ||
+          !memcmp(image, "VP8L", TAG_SIZE)) {
+        ++num_frames;
+      }
+    }
+    pos += CHUNK_HEADER_SIZE + size;
+  }
+  return num_frames;
+}
+
+// Parses the frames of a lazy demuxer, up to 'frame_num' included.
+// Returns PARSE_NEED_MORE_DATA if some frames remain to be parsed, PARSE_OK if
+// the whole file was parsed and PARSE_ERROR otherwise.
+static ParseStatus ParseLazily(WebPDemuxer* const dmux, int frame_num) {
+  ParseStatus status;
+  // Batches of geometrically increasing size amortize the validation of the
+  // frames parsed so far.
+  dmux->lazy_max_frames_ = (frame_num > 2 * dmux->num_frames_)
+                         ? frame_num : 2 * dmux->num_frames_;
+  status = ParseVP8XChunks(dmux);
+  if (status == PARSE_NEED_MORE_DATA) {
+    status = PARSE_ERROR;   // the whole file is available
+  } else if (status == PARSE_OK) {
+    if (dmux->mem_.start_ != dmux->mem_.riff_end_) {
+      status = PARSE_NEED_MORE_DATA;   // paused
+    } else if (dmux->num_frames_ != dmux->lazy_num_frames_) {
+      status = PARSE_ERROR;
+    }
+  }
+  return status;
+}
+
+// Number of frames in the file, including the ones not parsed yet.
+static int NumFrames(const WebPDemuxer* const dmux) {
+  return (dmux->is_lazy_ || dmux->lazy_error_) ? dmux->lazy_num_frames_
+                                               : dmux->num_frames_;
+}
+
 static ParseStatus ParseVP8X(WebPDemuxer* const dmux) {
   MemBuffer* const mem = &dmux->mem_;
   uint32_t vp8x_size;
@@ -554,6 +731,13 @@ static ParseStatus ParseVP8X(WebPDemuxer* const dmux) {
   if (SizeIsInvalid(mem, CHUNK_HEADER_SIZE)) return PARSE_ERROR;
   if (MemDataSize(mem) < CHUNK_HEADER_SIZE) return PARSE_NEED_MORE_DATA;
 
+  if (dmux->is_lazy_) {
+    dmux->lazy_num_frames_ =
+        (dmux->feature_flags_ & ANIMATION_FLAG) ? SkimFrames(mem) : -1;
+    if (dmux->lazy_num_frames_ >= 0) return ParseLazily(dmux, 1);
+    // Still image, or chunk sizes needing the checks of a full parse.
+    dmux->is_lazy_ = 0;
+  }
   return ParseVP8XChunks(dmux);
 }
 
@@ -590,6 +774,43 @@ static int CheckFrameBounds(const Frame* const frame, int exact,
   return 1;
 }
 
+// Checks the properties of the frame 'f'.
+static int IsValidFrame(const WebPDemuxer* const dmux, const Frame* const f,
+                        int is_animation) {
+  const ChunkData* const image = f->img_components_;
+  const ChunkData* const alpha = f->img_components_ + 1;
+
+  if (!is_animation && f->frame_num_ > 1) return 0;
+
+  if (f->complete_) {
+    if (alpha->size_ == 0 && image->size_ == 0) return 0;
+    // Ensure alpha precedes image bitstream.
+    if (alpha->size_ > 0 && alpha->offset_ > image->offset_) {
+      return 0;
+    }
+
+    if (f->width_ <= 0 || f->height_ <= 0) return 0;
+  } else {
+    // There shouldn't be a partial frame in a complete file.
+    if (dmux->state_ == WEBP_DEMUX_DONE) return 0;
+
+    // Ensure alpha precedes image bitstream.
+    if (alpha->size_ > 0 && image->size_ > 0 &&
+        alpha->offset_ > image->offset_) {
+      return 0;
+    }
+    // There shouldn't be any frames after an incomplete one.
+    if (f->next_ != NULL) return 0;
+  }
+
+  if (f->width_ > 0 && f->height_ > 0 &&
+      !CheckFrameBounds(f, !is_animation,
+                        dmux->canvas_width_, dmux->canvas_height_)) {
+    return 0;
+  }
+  return 1;
+}
+
 static int IsValidExtendedFormat(const WebPDemuxer* const dmux) {
   const int is_animation = !!(dmux->feature_flags_ & ANIMATION_FLAG);
   const Frame* f = dmux->frames_;
@@ -601,50 +822,23 @@ static int IsValidExtendedFormat(const WebPDemuxer* const dmux) {
   if (dmux->state_ == WEBP_DEMUX_DONE && dmux->frames_ == NULL) return 0;
   if (dmux->feature_flags_ & ~ALL_VALID_FLAGS) return 0;  // invalid bitstream
 
-  while (f != NULL) {
-    const int cur_frame_set = f->frame_num_;
-    int frame_count = 0;
-
-    // Check frame properties.
-    for (; f != NULL && f->frame_num_ == cur_frame_set; f = f->next_) {
-      const ChunkData* const image = f->img_components_;
-      const ChunkData* const alpha = f->img_components_ + 1;
-
-      if (!is_animation && f->frame_num_ > 1) return 0;
-
-      if (f->complete_) {
-        if (alpha->size_ == 0 && image->size_ == 0) return 0;
-        // Ensure alpha precedes image bitstream.
-        if (alpha->size_ > 0 && alpha->offset_ > image->offset_) {
-          return 0;
-        }
-
-        if (f->width_ <= 0 || f->height_ <= 0) return 0;
-      } else {
-        // There shouldn't be a partial frame in a complete file.
-        if (dmux->state_ == WEBP_DEMUX_DONE) return 0;
-
-        // Ensure alpha precedes image bitstream.
-        if (alpha->size_ > 0 && image->size_ > 0 &&
-            alpha->offset_ > image->offset_) {
-          return 0;
-        }
-        // There shouldn't be any frames after an incomplete one.
-        if (f->next_ != NULL) return 0;
-      }
-
-      if (f->width_ > 0 && f->height_ > 0 &&
-          !CheckFrameBounds(f, !is_animation,
-                            dmux->canvas_width_, dmux->canvas_height_)) {
-        return 0;
-      }
-
-      ++frame_count;
-    }
+  for (; f != NULL; f = f->next_) {
+    if (!IsValidFrame(dmux, f, is_animation)) return 0;
   }
   return 1;
 }
 
+// Returns the number of valid frames parsed before the first invalid one.
+// The file-level properties were validated along with the first frame.
+static int NumValidFrames(const WebPDemuxer* const dmux) {
+  const int is_animation = !!(dmux->feature_flags_ & ANIMATION_FLAG);
+  int n;
+  for (n = 0; n < dmux->num_indexed_frames_; ++n) {
+    if (!IsValidFrame(dmux, dmux->frame_index_[n], is_animation)) break;
+  }
+  return n;
+}
+
 // -----------------------------------------------------------------------------
 // WebPDemuxer object
 
@@ -727,23 +921,27 @@ WebPDemuxer* WebPDemuxInternal(const WebPData* data, int allow_partial,
   }
 
   partial = (mem.buf_size_ < mem.riff_end_);
-  if (!allow_partial && partial) return NULL;
+  if ((!allow_partial || allow_partial == DEMUX_LAZY) && partial) return NULL;
 
   dmux = (WebPDemuxer*)WebPSafeCalloc(1ULL, sizeof(*dmux));
   if (dmux == NULL) return NULL;
   InitDemux(dmux, &mem);
+  dmux->is_lazy_ = (allow_partial == DEMUX_LAZY);
 
   status = PARSE_ERROR;
   for (parser = kMasterChunks; parser->parse != NULL; ++parser) {
     if (!memcmp(parser->id, GetBuffer(&dmux->mem_), TAG_SIZE)) {
       status = parser->parse(dmux);
       if (status == PARSE_OK) dmux->state_ = WEBP_DEMUX_DONE;
-      if (status == PARSE_NEED_MORE_DATA && !partial) status = PARSE_ERROR;
+      if (status == PARSE_NEED_MORE_DATA && !partial && !dmux->is_lazy_) {
+        status = PARSE_ERROR;
+      }
       if (status != PARSE_ERROR && !parser->valid(dmux)) status = PARSE_ERROR;
       if (status == PARSE_ERROR) dmux->state_ = WEBP_DEMUX_PARSE_ERROR;
       break;
     }
   }
+  if (status != PARSE_NEED_MORE_DATA) dmux->is_lazy_ = 0;
   if (state != NULL) *state = dmux->state_;
 
   if (status == PARSE_ERROR) {
@@ -768,6 +966,7 @@ void WebPDemuxDelete(WebPDemuxer* dmux) {
     c = c->next_;
     WebPSafeFree(cur_chunk);
   }
+  ClearIndex(dmux);
   WebPSafeFree(dmux);
 }
 
@@ -782,7 +981,7 @@ uint32_t WebPDemuxGetI(const WebPDemuxer* dmux, WebPFormatFeature feature) {
     case WEBP_FF_CANVAS_HEIGHT:    return (uint32_t)dmux->canvas_height_;
     case WEBP_FF_LOOP_COUNT:       return (uint32_t)dmux->loop_count_;
     case WEBP_FF_BACKGROUND_COLOR: return dmux->bgcolor_;
-    case WEBP_FF_FRAME_COUNT:      return (uint32_t)dmux->num_frames_;
+    case WEBP_FF_FRAME_COUNT:      return (uint32_t)NumFrames(dmux);
   }
   return 0;
 }
@@ -790,12 +989,34 @@ uint32_t WebPDemuxGetI(const WebPDemuxer* dmux, WebPFormatFeature feature) {
 // -----------------------------------------------------------------------------
 // Frame iteration
 
-static const Frame* GetFrame(const WebPDemuxer* const dmux, int frame_num) {
-  const Frame* f;
-  for (f = dmux->frames_; f != NULL; f = f->next_) {
-    if (frame_num == f->frame_num_) break;
+// Parses the frames of a lazy demuxer up to 'frame_num', if needed. The object
+// is logically const: this only fills in what WebPDemux() would have parsed.
+// Returns false if a parsing error was found before frame 'frame_num' (now or
+// before), the frames preceding the error remaining accessible.
+static int ParseOnDemand(const WebPDemuxer* const const_dmux, int frame_num) {
+  WebPDemuxer* const dmux = (WebPDemuxer*)const_dmux;
+  ParseStatus status;
+  if (frame_num <= dmux->num_frames_) return 1;
+  if (!dmux->is_lazy_) return !dmux->lazy_error_;
+
+  status = ParseLazily(dmux, frame_num);
+  if (status == PARSE_OK) dmux->state_ = WEBP_DEMUX_DONE;
+  if (status != PARSE_ERROR && !IsValidExtendedFormat(dmux)) {
+    status = PARSE_ERROR;
+  }
+  if (status == PARSE_ERROR) {
+    // The batch may have parsed past the error: only keep the frames before it.
+    dmux->lazy_error_ = 1;
+    dmux->num_frames_ = NumValidFrames(dmux);
+    dmux->num_indexed_frames_ = dmux->num_frames_;
   }
-  return f;
+  if (status != PARSE_NEED_MORE_DATA) dmux->is_lazy_ = 0;
+  return (status != PARSE_ERROR || frame_num <= dmux->num_frames_);
+}
+
+static const Frame* GetFrame(const WebPDemuxer* const dmux, int frame_num) {
+  if (frame_num < 1 || frame_num > dmux->num_indexed_frames_) return NULL;
+  return dmux->frame_index_[frame_num - 1];
 }
 
 static const uint8_t* GetFramePayload(const uint8_t* const mem_buf,
@@ -833,7 +1054,7 @@ static int SynthesizeFrame(const WebPDemuxer* const dmux,
   assert(frame != NULL);
 
   iter->frame_num      = frame->frame_num_;
-  iter->num_frames     = dmux->num_frames_;
+  iter->num_frames     = NumFrames(dmux);
   iter->x_offset       = frame->x_offset_;
   iter->y_offset       = frame->y_offset_;
   iter->width          = frame->width_;
@@ -852,9 +1073,10 @@ static int SetFrame(int frame_num, WebPIterator* const iter) {
   const Frame* frame;
   const WebPDemuxer* const dmux = (WebPDemuxer*)iter->private_;
   if (dmux == NULL || frame_num < 0) return 0;
-  if (frame_num > dmux->num_frames_) return 0;
-  if (frame_num == 0) frame_num = dmux->num_frames_;
+  if (frame_num > NumFrames(dmux)) return 0;
+  if (frame_num == 0) frame_num = NumFrames(dmux);
 
+  if (!ParseOnDemand(dmux, frame_num)) return 0;
   frame = GetFrame(dmux, frame_num);
   if (frame == NULL) return 0;
 
@@ -888,27 +1110,19 @@ void WebPDemuxReleaseIterator(WebPIterator* iter) {
 // Chunk iteration
 
 static int ChunkCount(const WebPDemuxer* const dmux, const char fourcc[4]) {
-  const uint8_t* const mem_buf = dmux->mem_.buf_;
-  const Chunk* c;
-  int count = 0;
-  for (c = dmux->chunks_; c != NULL; c = c->next_) {
-    const uint8_t* const header = mem_buf + c->data_.offset_;
-    if (!memcmp(header, fourcc, TAG_SIZE)) ++count;
-  }
-  return count;
+  const ChunkIndex* const idx =
+      FindChunkIndex(dmux, GetLE32((const uint8_t*)fourcc));
+  return (idx != NULL) ? idx->num_chunks_ : 0;
 }
 
 static const Chunk* GetChunk(const WebPDemuxer* const dmux,
                              const char fourcc[4], int chunk_num) {
-  const uint8_t* const mem_buf = dmux->mem_.buf_;
-  const Chunk* c;
-  int count = 0;
-  for (c = dmux->chunks_; c != NULL; c = c->next_) {
-    const uint8_t* const header = mem_buf + c->data_.offset_;
-    if (!memcmp(header, fourcc, TAG_SIZE)) ++count;
-    if (count == chunk_num) break;
+  const ChunkIndex* const idx =
+      FindChunkIndex(dmux, GetLE32((const uint8_t*)fourcc));
+  if (idx == NULL || chunk_num < 1 || chunk_num > idx->num_chunks_) {
+    return NULL;
   }
-  return c;
+  return idx->chunks_[chunk_num - 1];
 }
 
 static int SetChunk(const char fourcc[4], int chunk_num,
@@ -917,6 +1131,8 @@ static int SetChunk(const char fourcc[4], int chunk_num,
   int count;
 
   if (dmux == NULL || fourcc == NULL || chunk_num < 0) return 0;
+  // Chunks may follow the last frame.
+  if (!ParseOnDemand(dmux, INT_MAX)) return 0;
   count = ChunkCount(dmux, fourcc);
   if (count == 0) return 0;
   if (chunk_num == 0) chunk_num = count;
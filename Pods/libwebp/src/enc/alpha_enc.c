@@ -244,7 +244,8 @@ static int ApplyFiltersAndEncode(const uint8_t* alpha, int width, int height,
   InitFilterTrial(&best);
 
   if (try_map != FILTER_TRY_NONE) {
-    uint8_t* filtered_alpha =  (uint8_t*)WebPSafeMalloc(1ULL, data_size);
+    uint8_t* filtered_alpha =
+        (uint8_t*)WebPSafeMallocTransient(1ULL, data_size);
     if (filtered_alpha == NULL) return 0;
 
     for (filter = WEBP_FILTER_NONE; ok && try_map; ++filter, try_map >>= 1) {
@@ -324,7 +325,7 @@ static int EncodeAlpha(VP8Encoder* const enc,
     filter = WEBP_FILTER_NONE;
   }
 
-  quant_alpha = (uint8_t*)WebPSafeMalloc(1ULL, data_size);
+  quant_alpha = (uint8_t*)WebPSafeMallocTransient(1ULL, data_size);
   if (quant_alpha == NULL) {
     return 0;
   }
@@ -387,7 +388,8 @@ static int CompressAlphaJob(void* arg1, void* dummy) {
 
 void VP8EncInitAlpha(VP8Encoder* const enc) {
   WebPInitAlphaProcessing();
-  enc->has_alpha_ = WebPPictureHasTransparency(enc->pic_);
+  enc->has_alpha_ = (enc->pic_->row_source == NULL) &&  // row sources are RGB
+                    WebPPictureHasTransparency(enc->pic_);
   enc->alpha_data_ = NULL;
   enc->alpha_data_size_ = 0;
   if (enc->thread_level_ > 0) {
@@ -30,7 +30,7 @@ static void SmoothSegmentMap(VP8Encoder* const enc) {
   const int w = enc->mb_w_;
   const int h = enc->mb_h_;
   const int majority_cnt_3_x_3_grid = 5;
-  uint8_t* const tmp = (uint8_t*)WebPSafeMalloc(w * h, sizeof(*tmp));
+  uint8_t* const tmp = (uint8_t*)WebPSafeMallocTransient(w * h, sizeof(*tmp));
   assert((uint64_t)(w * h) == (uint64_t)w * h);   // no overflow, as per spec
 
   if (tmp == NULL) return;
@@ -91,8 +91,8 @@ static void SetSegmentAlphas(VP8Encoder* const enc,
   for (n = 0; n < nb; ++n) {
     const int alpha = 255 * (centers[n] - mid) / (max - min);
     const int beta = 255 * (centers[n] - min) / (max - min);
-    enc->dqm_[n].alpha_ = clip(alpha, -127, 127);
-    enc->dqm_[n].beta_ = clip(beta, 0, 255);
+    enc->pass_.dqm_[n].alpha_ = clip(alpha, -127, 127);
+    enc->pass_.dqm_[n].beta_ = clip(beta, 0, 255);
   }
 }
 
@@ -416,8 +416,8 @@ static void ResetAllMBInfo(VP8Encoder* const enc) {
     DefaultMBInfo(&enc->mb_info_[n]);
   }
   // Default susceptibilities.
-  enc->dqm_[0].alpha_ = 0;
-  enc->dqm_[0].beta_ = 0;
+  enc->pass_.dqm_[0].alpha_ = 0;
+  enc->pass_.dqm_[0].beta_ = 0;
   // Note: we can't compute this alpha_ / uv_alpha_ -> set to default value.
   enc->alpha_ = 0;
   enc->uv_alpha_ = 0;
@@ -443,7 +443,8 @@ static int DoSegmentsJob(void* arg1, void* arg2) {
     uint8_t* const scratch = (uint8_t*)WEBP_ALIGN(tmp);
     do {
       // Let's pretend we have perfect lossless reconstruction.
-      VP8IteratorImport(it, scratch);
+      ok = VP8IteratorImport(it, scratch);
+      if (!ok) break;
       MBAnalyze(it, job->alphas, &job->alpha, &job->uv_alpha);
       ok = VP8IteratorProgress(it, job->delta_progress);
     } while (ok && VP8IteratorNext(it));
@@ -277,7 +277,7 @@ static int CostManagerInit(CostManager* const manager,
   // different cost, hence MAX_LENGTH but that is impossible with the current
   // implementation that spirals around a pixel.
   assert(manager->cache_intervals_size_ <= MAX_LENGTH);
-  manager->cache_intervals_ = (CostCacheInterval*)WebPSafeMalloc(
+  manager->cache_intervals_ = (CostCacheInterval*)WebPSafeMallocTransient(
       manager->cache_intervals_size_, sizeof(*manager->cache_intervals_));
   if (manager->cache_intervals_ == NULL) {
     CostManagerClear(manager);
@@ -305,7 +305,8 @@ static int CostManagerInit(CostManager* const manager,
     }
   }
 
-  manager->costs_ = (float*)WebPSafeMalloc(pix_count, sizeof(*manager->costs_));
+  manager->costs_ =
+      (float*)WebPSafeMallocTransient(pix_count, sizeof(*manager->costs_));
   if (manager->costs_ == NULL) {
     CostManagerClear(manager);
     return 0;
@@ -435,7 +436,8 @@ static WEBP_INLINE void InsertInterval(CostManager* const manager,
     interval_new = manager->recycled_intervals_;
     manager->recycled_intervals_ = interval_new->next_;
   } else {  // malloc for good
-    interval_new = (CostInterval*)WebPSafeMalloc(1, sizeof(*interval_new));
+    interval_new =
+        (CostInterval*)WebPSafeMallocTransient(1, sizeof(*interval_new));
     if (interval_new == NULL) {
       // Write down the interval if we cannot create it.
       UpdateCostPerInterval(manager, start, end, position, cost);
@@ -574,10 +576,10 @@ static int BackwardReferencesHashChainDistanceOnly(
                         ((cache_bits > 0) ? (1 << cache_bits) : 0));
   const size_t cost_model_size = sizeof(CostModel) + literal_array_size;
   CostModel* const cost_model =
-      (CostModel*)WebPSafeCalloc(1ULL, cost_model_size);
+      (CostModel*)WebPSafeCallocTransient(1ULL, cost_model_size);
   VP8LColorCache hashers;
   CostManager* cost_manager =
-      (CostManager*)WebPSafeMalloc(1ULL, sizeof(*cost_manager));
+      (CostManager*)WebPSafeMallocTransient(1ULL, sizeof(*cost_manager));
   int offset_prev = -1, len_prev = -1;
   double offset_cost = -1;
   int first_offset_is_constant = -1;  // initialized with 'impossible' value
@@ -769,7 +771,7 @@ int VP8LBackwardReferencesTraceBackwards(int xsize, int ysize,
   uint16_t* chosen_path = NULL;
   int chosen_path_size = 0;
   uint16_t* dist_array =
-      (uint16_t*)WebPSafeMalloc(dist_array_size, sizeof(*dist_array));
+      (uint16_t*)WebPSafeMallocTransient(dist_array_size, sizeof(*dist_array));
 
   if (dist_array == NULL) goto Error;
 
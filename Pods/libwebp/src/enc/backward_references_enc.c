@@ -19,6 +19,7 @@
 #include "src/dsp/lossless_common.h"
 #include "src/dsp/dsp.h"
 #include "src/utils/color_cache_utils.h"
+#include "src/utils/thread_utils.h"
 #include "src/utils/utils.h"
 
 #define MIN_BLOCK_SIZE 256  // minimum block size for backward references
@@ -137,7 +138,7 @@ static PixOrCopyBlock* BackwardRefsNewBlock(VP8LBackwardRefs* const refs) {
   if (b == NULL) {   // allocate new memory chunk
     const size_t total_size =
         sizeof(*b) + refs->block_size_ * sizeof(*b->start_);
-    b = (PixOrCopyBlock*)WebPSafeMalloc(1ULL, total_size);
+    b = (PixOrCopyBlock*)WebPSafeMallocTransient(1ULL, total_size);
     if (b == NULL) {
       refs->error_ |= 1;
       return NULL;
@@ -174,7 +175,7 @@ int VP8LHashChainInit(VP8LHashChain* const p, int size) {
   assert(p->offset_length_ == NULL);
   assert(size > 0);
   p->offset_length_ =
-      (uint32_t*)WebPSafeMalloc(size, sizeof(*p->offset_length_));
+      (uint32_t*)WebPSafeMallocTransient(size, sizeof(*p->offset_length_));
   if (p->offset_length_ == NULL) return 0;
   p->size_ = size;
 
@@ -222,18 +223,257 @@ static WEBP_INLINE int MaxFindCopyLength(int len) {
   return (len < MAX_LENGTH) ? len : MAX_LENGTH;
 }
 
+// Parameters of the longest-match search.
+typedef struct {
+  const uint32_t* argb_;
+  const int32_t* chain_;    // hash chain linking pixels with the same hash
+  uint32_t* offset_length_;
+  uint8_t* starts_;         // if not NULL, flags the searched positions
+  int xsize_;
+  int size_;
+  int iter_max_;
+  uint32_t window_size_;
+  int low_effort_;
+} MatchSearch;
+
+// Current match, and whether it is being extended to the left.
+typedef struct {
+  int length_;
+  uint32_t distance_;
+  uint32_t max_base_position_;
+  int extend_;
+} MatchState;
+
+// Finds the best match at 'base_position' by walking the hash chain.
+static void FindBestMatch(const MatchSearch* const m, uint32_t base_position,
+                          MatchState* const s) {
+  const uint32_t* const argb = m->argb_;
+  const int32_t* const chain = m->chain_;
+  const int xsize = m->xsize_;
+  const uint32_t window_size = m->window_size_;
+  const int max_len = MaxFindCopyLength(m->size_ - 1 - base_position);
+  const uint32_t* const argb_start = argb + base_position;
+  int iter = m->iter_max_;
+  int best_length = 0;
+  uint32_t best_distance = 0;
+  uint32_t best_argb;
+  const int min_pos =
+      (base_position > window_size) ? base_position - window_size : 0;
+  const int length_max = (max_len < 256) ? max_len : 256;
+  int pos = chain[base_position];
+
+  if (!m->low_effort_) {
+    int curr_length;
+    // Heuristic: use the comparison with the above line as an initialization.
+    if (base_position >= (uint32_t)xsize) {
+      curr_length = FindMatchLength(argb_start - xsize, argb_start,
+                                    best_length, max_len);
+      if (curr_length > best_length) {
+        best_length = curr_length;
+        best_distance = xsize;
+      }
+      --iter;
+    }
+    // Heuristic: compare to the previous pixel.
+    curr_length =
+        FindMatchLength(argb_start - 1, argb_start, best_length, max_len);
+    if (curr_length > best_length) {
+      best_length = curr_length;
+      best_distance = 1;
+    }
+    --iter;
+    // Skip the for loop if we already have the maximum.
+    if (best_length == MAX_LENGTH) pos = min_pos - 1;
+  }
+  best_argb = argb_start[best_length];
+
+  for (; pos >= min_pos && --iter; pos = chain[pos]) {
+    int curr_length;
+    assert(base_position > (uint32_t)pos);
+
+    if (argb[pos + best_length] != best_argb) continue;
+
+    curr_length = VP8LVectorMismatch(argb + pos, argb_start, max_len);
+    if (best_length < curr_length) {
+      best_length = curr_length;
+      best_distance = base_position - pos;
+      best_argb = argb_start[best_length];
+      // Stop if we have reached a good enough length.
+      if (best_length >= length_max) break;
+    }
+  }
+  s->length_ = best_length;
+  s->distance_ = best_distance;
+  s->max_base_position_ = base_position;
+}
+
+// Stores the match at 'base_position'. In case the two intervals continue
+// matching to the left, we have the best matches for the left-extended pixels
+// too, down to 'end' excluded. Returns the next position to process, which
+// continues the match if s->extend_ is set on return.
+static uint32_t ExtendMatch(const MatchSearch* const m, uint32_t base_position,
+                            uint32_t end, MatchState* const s) {
+  const uint32_t* const argb = m->argb_;
+  int best_length = s->length_;
+  const uint32_t best_distance = s->distance_;
+  uint32_t max_base_position = s->max_base_position_;
+  s->extend_ = 0;
+  while (1) {
+    assert(best_length <= MAX_LENGTH);
+    assert(best_distance <= WINDOW_SIZE);
+    m->offset_length_[base_position] =
+        (best_distance << MAX_LENGTH_BITS) | (uint32_t)best_length;
+    --base_position;
+    // Stop if we don't have a match or if we are out of bounds.
+    if (best_distance == 0 || base_position == 0) break;
+    // Stop if we cannot extend the matching intervals to the left.
+    if (base_position < best_distance ||
+        argb[base_position - best_distance] != argb[base_position]) {
+      break;
+    }
+    // Stop if we are matching at its limit because there could be a closer
+    // matching interval with the same maximum length. Then again, if the
+    // matching interval is as close as possible (best_distance == 1), we will
+    // never find anything better so let's continue.
+    if (best_length == MAX_LENGTH && best_distance != 1 &&
+        base_position + MAX_LENGTH < max_base_position) {
+      break;
+    }
+    if (best_length < MAX_LENGTH) {
+      ++best_length;
+      max_base_position = base_position;
+    }
+    if (base_position < end) {
+      s->length_ = best_length;
+      s->max_base_position_ = max_base_position;
+      s->extend_ = 1;
+      break;
+    }
+  }
+  return base_position;
+}
+
+// Finds the matches from 'base_position' down to 'end' (>= 1) included, and
+// returns the state for position 'end - 1'.
+static void FindMatches(const MatchSearch* const m, uint32_t base_position,
+                        uint32_t end, MatchState* const s) {
+  assert(end >= 1);
+  s->extend_ = 0;
+  while (base_position >= end) {
+    FindBestMatch(m, base_position, s);
+    if (m->starts_ != NULL) m->starts_[base_position] = 1;
+    base_position = ExtendMatch(m, base_position, end, s);
+    if (s->extend_) break;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Striped search. Each stripe is first processed on its own. The state at the
+// bottom of a stripe is then propagated to the next one serially, until it
+// reaches a position that was searched within the stripe: from there on, the
+// stripe matches the single-threaded result.
+
+#define MAX_HASH_THREADS 16
+// Minimum number of pixels per stripe.
+#define MIN_HASH_STRIPE_SIZE (1 << 14)
+
+typedef struct {
+  WebPWorker worker_;
+  const MatchSearch* search_;
+  uint32_t top_, end_;    // the stripe is [end_, top_]
+  MatchState state_;      // state below the stripe
+} HashStripe;
+
+static int HashStripeHook(void* arg1, void* arg2) {
+  HashStripe* const stripe = (HashStripe*)arg1;
+  (void)arg2;
+  FindMatches(stripe->search_, stripe->top_, stripe->end_, &stripe->state_);
+  return 1;
+}
+
+static int GetNumHashStripes(int thread_level, int size) {
+#ifdef WEBP_USE_THREAD
+  int num_stripes = thread_level;
+  const int max_stripes = size / MIN_HASH_STRIPE_SIZE;
+  if (num_stripes > MAX_HASH_THREADS) num_stripes = MAX_HASH_THREADS;
+  if (num_stripes > max_stripes) num_stripes = max_stripes;
+  return (num_stripes > 1) ? num_stripes : 1;
+#else
+  (void)thread_level;
+  (void)size;
+  return 1;
+#endif
+}
+
+// Returns false in case of memory error, in which case nothing was computed.
+static int FindMatchesStriped(MatchSearch* const m, int num_stripes) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  HashStripe stripes[MAX_HASH_THREADS];
+  int launched[MAX_HASH_THREADS];
+  const uint32_t num_pixels = m->size_ - 2;   // positions [1, size - 2]
+  MatchState state;
+  uint32_t base_position;
+  int k;
+
+  m->starts_ = (uint8_t*)WebPSafeCallocTransient(m->size_, sizeof(*m->starts_));
+  if (m->starts_ == NULL) return 0;
+  for (k = 0; k < num_stripes; ++k) {
+    HashStripe* const stripe = &stripes[k];
+    stripe->search_ = m;
+    stripe->top_ =
+        (uint32_t)((uint64_t)num_pixels * (num_stripes - k) / num_stripes);
+    stripe->end_ =
+        1 + (uint32_t)((uint64_t)num_pixels * (num_stripes - k - 1) /
+                       num_stripes);
+    worker_interface->Init(&stripe->worker_);
+    stripe->worker_.hook = HashStripeHook;
+    stripe->worker_.data1 = stripe;
+    stripe->worker_.data2 = NULL;
+    launched[k] = (k > 0) && worker_interface->Reset(&stripe->worker_);
+    if (launched[k]) worker_interface->Launch(&stripe->worker_);
+  }
+  for (k = 0; k < num_stripes; ++k) {
+    if (!launched[k]) worker_interface->Execute(&stripes[k].worker_);
+  }
+  for (k = 0; k < num_stripes; ++k) {
+    if (launched[k]) worker_interface->Sync(&stripes[k].worker_);
+    worker_interface->End(&stripes[k].worker_);
+  }
+
+  // The first stripe is exact. Fix the top of the following ones.
+  state = stripes[0].state_;
+  for (k = 1; k < num_stripes; ++k) {
+    const uint32_t end = stripes[k].end_;
+    base_position = stripes[k].top_;
+    while (1) {
+      if (!state.extend_) {
+        if (m->starts_[base_position]) {
+          state = stripes[k].state_;
+          break;
+        }
+        FindBestMatch(m, base_position, &state);
+      }
+      base_position = ExtendMatch(m, base_position, end, &state);
+      if (base_position < end) break;
+    }
+  }
+  WebPSafeFree(m->starts_);
+  m->starts_ = NULL;
+  return 1;
+}
+
 int VP8LHashChainFill(VP8LHashChain* const p, int quality,
                       const uint32_t* const argb, int xsize, int ysize,
-                      int low_effort) {
+                      int low_effort, int thread_level) {
   const int size = xsize * ysize;
-  const int iter_max = GetMaxItersForQuality(quality);
-  const uint32_t window_size = GetWindowSizeForHashChain(quality, xsize);
+  const int num_stripes = GetNumHashStripes(thread_level, size);
   int pos;
   int argb_comp;
-  uint32_t base_position;
   int32_t* hash_to_first_index;
-  // Temporarily use the p->offset_length_ as a hash chain.
+  // Temporarily use the p->offset_length_ as a hash chain, unless the search
+  // is striped: the stripes need the chain to stay intact.
   int32_t* chain = (int32_t*)p->offset_length_;
+  MatchSearch search;
   assert(size > 0);
   assert(p->size_ != 0);
   assert(p->offset_length_ != NULL);
@@ -244,8 +484,13 @@ int VP8LHashChainFill(VP8LHashChain* const p, int quality,
   }
 
   hash_to_first_index =
-      (int32_t*)WebPSafeMalloc(HASH_SIZE, sizeof(*hash_to_first_index));
+      (int32_t*)WebPSafeMallocTransient(HASH_SIZE,
+                                        sizeof(*hash_to_first_index));
   if (hash_to_first_index == NULL) return 0;
+  if (num_stripes > 1) {
+    int32_t* const tmp = (int32_t*)WebPSafeMallocTransient(size, sizeof(*tmp));
+    if (tmp != NULL) chain = tmp;   // otherwise, do a regular search
+  }
 
   // Set the int32_t array to -1.
   memset(hash_to_first_index, 0xff, HASH_SIZE * sizeof(*hash_to_first_index));
@@ -298,95 +543,28 @@ int VP8LHashChainFill(VP8LHashChain* const p, int quality,
 
   WebPSafeFree(hash_to_first_index);
 
+  search.argb_ = argb;
+  search.chain_ = chain;
+  search.offset_length_ = p->offset_length_;
+  search.starts_ = NULL;
+  search.xsize_ = xsize;
+  search.size_ = size;
+  search.iter_max_ = GetMaxItersForQuality(quality);
+  search.window_size_ = GetWindowSizeForHashChain(quality, xsize);
+  search.low_effort_ = low_effort;
+
   // Find the best match interval at each pixel, defined by an offset to the
   // pixel and a length. The right-most pixel cannot match anything to the right
   // (hence a best length of 0) and the left-most pixel nothing to the left
   // (hence an offset of 0).
   assert(size > 2);
   p->offset_length_[0] = p->offset_length_[size - 1] = 0;
-  for (base_position = size - 2; base_position > 0;) {
-    const int max_len = MaxFindCopyLength(size - 1 - base_position);
-    const uint32_t* const argb_start = argb + base_position;
-    int iter = iter_max;
-    int best_length = 0;
-    uint32_t best_distance = 0;
-    uint32_t best_argb;
-    const int min_pos =
-        (base_position > window_size) ? base_position - window_size : 0;
-    const int length_max = (max_len < 256) ? max_len : 256;
-    uint32_t max_base_position;
-
-    pos = chain[base_position];
-    if (!low_effort) {
-      int curr_length;
-      // Heuristic: use the comparison with the above line as an initialization.
-      if (base_position >= (uint32_t)xsize) {
-        curr_length = FindMatchLength(argb_start - xsize, argb_start,
-                                      best_length, max_len);
-        if (curr_length > best_length) {
-          best_length = curr_length;
-          best_distance = xsize;
-        }
-        --iter;
-      }
-      // Heuristic: compare to the previous pixel.
-      curr_length =
-          FindMatchLength(argb_start - 1, argb_start, best_length, max_len);
-      if (curr_length > best_length) {
-        best_length = curr_length;
-        best_distance = 1;
-      }
-      --iter;
-      // Skip the for loop if we already have the maximum.
-      if (best_length == MAX_LENGTH) pos = min_pos - 1;
-    }
-    best_argb = argb_start[best_length];
-
-    for (; pos >= min_pos && --iter; pos = chain[pos]) {
-      int curr_length;
-      assert(base_position > (uint32_t)pos);
-
-      if (argb[pos + best_length] != best_argb) continue;
-
-      curr_length = VP8LVectorMismatch(argb + pos, argb_start, max_len);
-      if (best_length < curr_length) {
-        best_length = curr_length;
-        best_distance = base_position - pos;
-        best_argb = argb_start[best_length];
-        // Stop if we have reached a good enough length.
-        if (best_length >= length_max) break;
-      }
-    }
-    // We have the best match but in case the two intervals continue matching
-    // to the left, we have the best matches for the left-extended pixels.
-    max_base_position = base_position;
-    while (1) {
-      assert(best_length <= MAX_LENGTH);
-      assert(best_distance <= WINDOW_SIZE);
-      p->offset_length_[base_position] =
-          (best_distance << MAX_LENGTH_BITS) | (uint32_t)best_length;
-      --base_position;
-      // Stop if we don't have a match or if we are out of bounds.
-      if (best_distance == 0 || base_position == 0) break;
-      // Stop if we cannot extend the matching intervals to the left.
-      if (base_position < best_distance ||
-          argb[base_position - best_distance] != argb[base_position]) {
-        break;
-      }
-      // Stop if we are matching at its limit because there could be a closer
-      // matching interval with the same maximum length. Then again, if the
-      // matching interval is as close as possible (best_distance == 1), we will
-      // never find anything better so let's continue.
-      if (best_length == MAX_LENGTH && best_distance != 1 &&
-          base_position + MAX_LENGTH < max_base_position) {
-        break;
-      }
-      if (best_length < MAX_LENGTH) {
-        ++best_length;
-        max_base_position = base_position;
-      }
-    }
+  if (chain == (int32_t*)p->offset_length_ ||
+      !FindMatchesStriped(&search, num_stripes)) {
+    MatchState state;
+    FindMatches(&search, size - 2, 1, &state);
   }
+  if (chain != (int32_t*)p->offset_length_) WebPSafeFree(chain);
   return 1;
 }
 
@@ -536,7 +714,7 @@ static int BackwardReferencesLz77Box(int xsize, int ysize,
   int window_offsets_size = 0;
   int window_offsets_new_size = 0;
   uint16_t* const counts_ini =
-      (uint16_t*)WebPSafeMalloc(xsize * ysize, sizeof(*counts_ini));
+      (uint16_t*)WebPSafeMallocTransient(xsize * ysize, sizeof(*counts_ini));
   int best_offset_prev = -1, best_length_prev = -1;
   if (counts_ini == NULL) return 0;
 
@@ -206,9 +206,9 @@ const uint16_t VP8FixedCostsI4[NUM_BMODES][NUM_BMODES][NUM_BMODES] = {
 void VP8InitResidual(int first, int coeff_type,
                      VP8Encoder* const enc, VP8Residual* const res) {
   res->coeff_type = coeff_type;
-  res->prob  = enc->proba_.coeffs_[coeff_type];
-  res->stats = enc->proba_.stats_[coeff_type];
-  res->costs = enc->proba_.remapped_costs_[coeff_type];
+  res->prob  = enc->pass_.proba_.coeffs_[coeff_type];
+  res->stats = enc->pass_.proba_.stats_[coeff_type];
+  res->costs = enc->pass_.proba_.remapped_costs_[coeff_type];
   res->first = first;
 }
 
@@ -158,11 +158,11 @@ void VP8StoreFilterStats(VP8EncIterator* const it) {
   int d;
   VP8Encoder* const enc = it->enc_;
   const int s = it->mb_->segment_;
-  const int level0 = enc->dqm_[s].fstrength_;
+  const int level0 = enc->pass_.dqm_[s].fstrength_;
 
   // explore +/-quant range of values around level0
-  const int delta_min = -enc->dqm_[s].quant_;
-  const int delta_max = enc->dqm_[s].quant_;
+  const int delta_min = -enc->pass_.dqm_[s].quant_;
+  const int delta_max = enc->pass_.dqm_[s].quant_;
   const int step_size = (delta_max - delta_min >= 4) ? 4 : 1;
 
   if (it->lf_stats_ == NULL) return;
@@ -207,7 +207,7 @@ void VP8AdjustFilterStrength(VP8EncIterator* const it) {
           best_level = i;
         }
       }
-      enc->dqm_[s].fstrength_ = best_level;
+      enc->pass_.dqm_[s].fstrength_ = best_level;
     }
     return;
   }
@@ -216,7 +216,7 @@ void VP8AdjustFilterStrength(VP8EncIterator* const it) {
     int max_level = 0;
     int s;
     for (s = 0; s < NUM_MB_SEGMENTS; s++) {
-      VP8SegmentInfo* const dqm = &enc->dqm_[s];
+      VP8SegmentInfo* const dqm = &enc->pass_.dqm_[s];
       // this '>> 3' accounts for some inverse WHT scaling
       const int delta = (dqm->max_edge_ * dqm->y2_.q_[1]) >> 3;
       const int level =
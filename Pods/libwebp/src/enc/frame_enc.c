@@ -92,7 +92,7 @@ const uint8_t VP8Cat6[] =
 // Reset the statistics about: number of skips, token proba, level cost,...
 
 static void ResetStats(VP8Encoder* const enc) {
-  VP8EncProba* const proba = &enc->proba_;
+  VP8EncProba* const proba = &enc->pass_.proba_;
   VP8CalculateLevelCosts(proba);
   proba->nb_skip_ = 0;
 }
@@ -108,7 +108,7 @@ static int CalcSkipProba(uint64_t nb, uint64_t total) {
 
 // Returns the bit-cost for coding the skip probability.
 static int FinalizeSkipProba(VP8Encoder* const enc) {
-  VP8EncProba* const proba = &enc->proba_;
+  VP8EncProba* const proba = &enc->pass_.proba_;
   const int nb_mbs = enc->mb_w_ * enc->mb_h_;
   const int nb_events = proba->nb_skip_;
   int size;
@@ -136,7 +136,7 @@ static int BranchCost(int nb, int total, int proba) {
 }
 
 static void ResetTokenStats(VP8Encoder* const enc) {
-  VP8EncProba* const proba = &enc->proba_;
+  VP8EncProba* const proba = &enc->pass_.proba_;
   memset(proba->stats_, 0, sizeof(proba->stats_));
 }
 
@@ -208,7 +208,7 @@ static void SetSegmentProbas(VP8Encoder* const enc) {
   }
 #endif
   if (enc->segment_hdr_.num_segments_ > 1) {
-    uint8_t* const probas = enc->proba_.segments_;
+    uint8_t* const probas = enc->pass_.proba_.segments_;
     probas[0] = GetProba(p[0] + p[1], p[2] + p[3]);
     probas[1] = GetProba(p[0], p[1]);
     probas[2] = GetProba(p[2], p[3]);
@@ -405,22 +405,30 @@ static void RecordResiduals(VP8EncIterator* const it,
 
 #if !defined(DISABLE_TOKEN_BUFFER)
 
+// Same as VP8InitResidual(), but records the statistics in the iterator's
+// token stats.
+static void InitTokenResidual(int first, int coeff_type,
+                              const VP8EncIterator* const it,
+                              VP8Residual* const res) {
+  VP8InitResidual(first, coeff_type, it->enc_, res);
+  res->stats = it->stats_[coeff_type];
+}
+
 static int RecordTokens(VP8EncIterator* const it, const VP8ModeScore* const rd,
                         VP8TBuffer* const tokens) {
   int x, y, ch;
   VP8Residual res;
-  VP8Encoder* const enc = it->enc_;
 
   VP8IteratorNzToBytes(it);
   if (it->mb_->type_ == 1) {   // i16x16
     const int ctx = it->top_nz_[8] + it->left_nz_[8];
-    VP8InitResidual(0, 1, enc, &res);
+    InitTokenResidual(0, 1, it, &res);
     VP8SetResidualCoeffs(rd->y_dc_levels, &res);
     it->top_nz_[8] = it->left_nz_[8] =
         VP8RecordCoeffTokens(ctx, &res, tokens);
-    VP8InitResidual(1, 0, enc, &res);
+    InitTokenResidual(1, 0, it, &res);
   } else {
-    VP8InitResidual(0, 3, enc, &res);
+    InitTokenResidual(0, 3, it, &res);
   }
 
   // luma-AC
@@ -434,7 +442,7 @@ static int RecordTokens(VP8EncIterator* const it, const VP8ModeScore* const rd,
   }
 
   // U/V
-  VP8InitResidual(0, 2, enc, &res);
+  InitTokenResidual(0, 2, it, &res);
   for (ch = 0; ch <= 2; ch += 2) {
     for (y = 0; y < 2; ++y) {
       for (x = 0; x < 2; ++x) {
@@ -474,27 +482,30 @@ static void ResetSSE(VP8Encoder* const enc) {
   enc->sse_count_ = 0;
 }
 
-static void StoreSSE(const VP8EncIterator* const it) {
-  VP8Encoder* const enc = it->enc_;
+static void StoreSSE(const VP8EncIterator* const it, uint64_t sse[3],
+                     uint64_t* const sse_count) {
   const uint8_t* const in = it->yuv_in_;
   const uint8_t* const out = it->yuv_out_;
   // Note: not totally accurate at boundary. And doesn't include in-loop filter.
-  enc->sse_[0] += VP8SSE16x16(in + Y_OFF_ENC, out + Y_OFF_ENC);
-  enc->sse_[1] += VP8SSE8x8(in + U_OFF_ENC, out + U_OFF_ENC);
-  enc->sse_[2] += VP8SSE8x8(in + V_OFF_ENC, out + V_OFF_ENC);
-  enc->sse_count_ += 16 * 16;
+  sse[0] += VP8SSE16x16(in + Y_OFF_ENC, out + Y_OFF_ENC);
+  sse[1] += VP8SSE8x8(in + U_OFF_ENC, out + U_OFF_ENC);
+  sse[2] += VP8SSE8x8(in + V_OFF_ENC, out + V_OFF_ENC);
+  *sse_count += 16 * 16;
 }
 
-static void StoreSideInfo(const VP8EncIterator* const it) {
+// Accumulates the distortion and block counts into 'sse', 'sse_count' and
+// 'block_count' (usually the encoder's own).
+static void StoreSideInfo(const VP8EncIterator* const it, uint64_t sse[3],
+                          uint64_t* const sse_count, int block_count[3]) {
   VP8Encoder* const enc = it->enc_;
   const VP8MBInfo* const mb = it->mb_;
   WebPPicture* const pic = enc->pic_;
 
   if (pic->stats != NULL) {
-    StoreSSE(it);
-    enc->block_count_[0] += (mb->type_ == 0);
-    enc->block_count_[1] += (mb->type_ == 1);
-    enc->block_count_[2] += (mb->skip_ != 0);
+    StoreSSE(it, sse, sse_count);
+    block_count[0] += (mb->type_ == 0);
+    block_count[1] += (mb->type_ == 1);
+    block_count[2] += (mb->skip_ != 0);
   }
 
   if (pic->extra_info != NULL) {
@@ -502,7 +513,7 @@ static void StoreSideInfo(const VP8EncIterator* const it) {
     switch (pic->extra_info_type) {
       case 1: *info = mb->type_; break;
       case 2: *info = mb->segment_; break;
-      case 3: *info = enc->dqm_[mb->segment_].quant_; break;
+      case 3: *info = enc->pass_.dqm_[mb->segment_].quant_; break;
       case 4: *info = (mb->type_ == 1) ? it->preds_[0] : 0xff; break;
       case 5: *info = mb->uv_mode_; break;
       case 6: {
@@ -532,9 +543,13 @@ static void ResetSideInfo(const VP8EncIterator* const it) {
 static void ResetSSE(VP8Encoder* const enc) {
   (void)enc;
 }
-static void StoreSideInfo(const VP8EncIterator* const it) {
+static void StoreSideInfo(const VP8EncIterator* const it, uint64_t sse[3],
+                          uint64_t* const sse_count, int block_count[3]) {
   VP8Encoder* const enc = it->enc_;
   WebPPicture* const pic = enc->pic_;
+  (void)sse;
+  (void)sse_count;
+  (void)block_count;
   if (pic->extra_info != NULL) {
     if (it->x_ == 0 && it->y_ == 0) {   // only do it once, at start
       memset(pic->extra_info, 0,
@@ -581,10 +596,10 @@ static uint64_t OneStatPass(VP8Encoder* const enc, VP8RDLevel rd_opt,
   SetLoopParams(enc, s->q);
   do {
     VP8ModeScore info;
-    VP8IteratorImport(&it, NULL);
+    if (!VP8IteratorImport(&it, NULL)) return 0;
     if (VP8Decimate(&it, &info, rd_opt)) {
       // Just record the number of skips and act like skip_proba is not used.
-      ++enc->proba_.nb_skip_;
+      ++enc->pass_.proba_.nb_skip_;
     }
     RecordResiduals(&it, &info);
     size += info.R + info.H;
@@ -599,7 +614,7 @@ static uint64_t OneStatPass(VP8Encoder* const enc, VP8RDLevel rd_opt,
   size_p0 += enc->segment_hdr_.size_;
   if (s->do_size_search) {
     size += FinalizeSkipProba(enc);
-    size += FinalizeTokenProbas(&enc->proba_);
+    size += FinalizeTokenProbas(&enc->pass_.proba_);
     size = ((size + size_p0 + 1024) >> 11) + HEADER_SIZE_ESTIMATE;
     s->value = (double)size;
   } else {
@@ -608,6 +623,232 @@ static uint64_t OneStatPass(VP8Encoder* const enc, VP8RDLevel rd_opt,
   return size_p0;
 }
 
+//------------------------------------------------------------------------------
+// Speculative search, used when thread_level > 1 and a target size or PSNR is
+// set. Each round evaluates several quantizers at once, each on its own copy
+// of the encoder, and narrows down the bracket around the target. The state
+// of the candidate closest to the target is copied back into the encoder, and
+// the next round starts from it.
+
+#define MAX_SEARCH_JOBS 8
+
+typedef struct {
+  WebPWorker worker_;
+  VP8Encoder* enc_;    // private copy of the encoder
+  WebPPicture pic_;    // shallow copy of the picture, without stats
+  VP8RDLevel rd_opt_;
+  int nb_mbs_;
+  PassStats stats_;    // candidate 'q' on input, resulting 'value' on output
+  uint64_t size_p0_;
+} SearchJob;
+
+static int GetNumSearchJobs(const VP8Encoder* const enc) {
+#ifdef WEBP_USE_THREAD
+  return (enc->thread_level_ > MAX_SEARCH_JOBS) ? MAX_SEARCH_JOBS
+                                                : enc->thread_level_;
+#else
+  (void)enc;
+  return 1;
+#endif
+}
+
+// Copies the state which results from a pass (quantizers, headers,
+// probabilities and segment map) from 'src' to 'dst'.
+static void CopyPassState(VP8Encoder* const dst, const VP8Encoder* const src) {
+  dst->filter_hdr_ = src->filter_hdr_;
+  dst->segment_hdr_ = src->segment_hdr_;
+  // Note: segments may have been merged by VP8SetSegmentParams().
+  memcpy(dst->mb_info_, src->mb_info_,
+         src->mb_w_ * src->mb_h_ * sizeof(*src->mb_info_));
+  dst->pass_ = src->pass_;
+  dst->max_i4_header_bits_ = src->max_i4_header_bits_;
+  // The cost tables are pointed to by 'remapped_costs_', which must be
+  // re-targeted to dst's own tables.
+  dst->pass_.proba_.dirty_ = 1;
+  VP8CalculateLevelCosts(&dst->pass_.proba_);
+}
+
+// Returns a copy of 'enc' with its own working memory and picture 'pic',
+// suitable for OneStatPass(). Returns NULL in case of memory error.
+static VP8Encoder* NewSearchEncoder(const VP8Encoder* const enc,
+                                    WebPPicture* const pic) {
+  const int mb_w = enc->mb_w_, mb_h = enc->mb_h_;
+  const size_t info_size = mb_w * mb_h * sizeof(*enc->mb_info_);
+  const size_t preds_size =
+      enc->preds_w_ * (4 * mb_h + 1) * sizeof(*enc->preds_);
+  const size_t nz_size = (mb_w + 1) * sizeof(*enc->nz_) + WEBP_ALIGN_CST;
+  const size_t samples_size = 2 * mb_w * 16 + WEBP_ALIGN_CST;
+  const size_t top_derr_size =
+      (enc->top_derr_ != NULL) ? mb_w * sizeof(*enc->top_derr_) : 0;
+  const uint64_t size = (uint64_t)sizeof(*enc) + WEBP_ALIGN_CST + info_size
+                      + preds_size + nz_size + samples_size + top_derr_size;
+  uint8_t* mem = (uint8_t*)WebPSafeMallocTransient(size, sizeof(*mem));
+  VP8Encoder* const copy = (VP8Encoder*)mem;
+  if (mem == NULL) return NULL;
+  // Only the settings used by the stat loop are copied. Everything else is
+  // cleared, in particular the buffers owned by 'enc' (bit-writers, tokens,
+  // alpha and row source samples), and the statistics.
+  memset(copy, 0, sizeof(*copy));
+  copy->config_ = enc->config_;
+  copy->pic_ = pic;
+  copy->profile_ = enc->profile_;
+  copy->mb_w_ = mb_w;
+  copy->mb_h_ = mb_h;
+  copy->preds_w_ = enc->preds_w_;
+  copy->num_parts_ = enc->num_parts_;
+  VP8TBufferInit(&copy->tokens_, 0);   // not used by the stat loop
+  copy->percent_ = enc->percent_;
+  copy->alpha_ = enc->alpha_;
+  copy->uv_alpha_ = enc->uv_alpha_;
+  copy->method_ = enc->method_;
+  copy->rd_opt_level_ = enc->rd_opt_level_;
+  copy->mb_header_limit_ = enc->mb_header_limit_;
+  copy->thread_level_ = enc->thread_level_;
+  copy->do_search_ = enc->do_search_;
+  copy->use_tokens_ = enc->use_tokens_;
+  copy->lf_stats_ = NULL;
+  WebPPictureInit(&copy->rows_);
+  copy->rows_mb_y_ = -1;
+  copy->rows_rgb_ = NULL;
+
+  mem = (uint8_t*)WEBP_ALIGN(mem + sizeof(*copy));
+  copy->mb_info_ = (VP8MBInfo*)mem;
+  mem += info_size;
+  memcpy(mem, enc->preds_ - 1 - enc->preds_w_, preds_size);   // borders
+  copy->preds_ = mem + 1 + copy->preds_w_;
+  mem += preds_size;
+  copy->nz_ = 1 + (uint32_t*)WEBP_ALIGN(mem);
+  copy->nz_[-1] = 0;   // constant
+  mem += nz_size;
+  mem = (uint8_t*)WEBP_ALIGN(mem);
+  copy->y_top_ = mem;
+  copy->uv_top_ = copy->y_top_ + mb_w * 16;
+  mem += 2 * mb_w * 16;
+  copy->top_derr_ = top_derr_size ? (DError*)mem : NULL;
+  mem += top_derr_size;
+  assert(mem <= (uint8_t*)copy + size);
+  CopyPassState(copy, enc);
+  return copy;
+}
+
+static int SearchPassHook(void* arg1, void* arg2) {
+  SearchJob* const job = (SearchJob*)arg1;
+  (void)arg2;
+  job->size_p0_ =
+      OneStatPass(job->enc_, job->rd_opt_, job->nb_mbs_, 0, &job->stats_);
+  return 1;
+}
+
+static void DeleteSearchJobs(SearchJob* const jobs, int num_jobs) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  int i;
+  for (i = 0; i < num_jobs; ++i) {
+    winterface->End(&jobs[i].worker_);
+    WebPSafeFree(jobs[i].enc_);
+  }
+}
+
+// Returns false in case of error.
+static int InitSearchJobs(VP8Encoder* const enc, SearchJob* const jobs,
+                          int num_jobs, VP8RDLevel rd_opt, int nb_mbs,
+                          const PassStats* const stats) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  int i;
+  for (i = 0; i < num_jobs; ++i) {
+    SearchJob* const job = &jobs[i];
+    winterface->Init(&job->worker_);
+    job->worker_.hook = SearchPassHook;
+    job->worker_.data1 = job;
+    job->pic_ = *enc->pic_;
+    job->pic_.stats = NULL;
+    job->pic_.extra_info = NULL;
+    job->pic_.progress_hook = NULL;
+    job->enc_ = NewSearchEncoder(enc, &job->pic_);
+    job->rd_opt_ = rd_opt;
+    job->nb_mbs_ = nb_mbs;
+    job->stats_ = *stats;
+    job->size_p0_ = 0;
+    if (job->enc_ == NULL || !winterface->Reset(&job->worker_)) {
+      DeleteSearchJobs(jobs, i + 1);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Runs up to 'num_rounds' rounds of the search. 's' is updated with the
+// retained candidate. Returns false if the user aborted.
+static int SpeculativeSearch(VP8Encoder* const enc, SearchJob* const jobs,
+                             int num_jobs, int num_rounds, int percent_per_pass,
+                             PassStats* const s) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  float lo = 0.f, hi = 100.f;   // bracket around the target
+  int has_lo = 0, has_hi = 0;
+  double best_dist = -1.;
+  int round, i;
+
+  for (round = 0; round < num_rounds; ++round) {
+    int best = -1;
+    int too_big = 0;
+    if (has_lo && has_hi && hi - lo <= DQ_LIMIT) break;   // converged
+    if ((has_lo && lo >= 100.f) || (has_hi && hi <= 0.f)) break;  // can't do
+    for (i = 0; i < num_jobs; ++i) {
+      float q;
+      if (!has_lo && !has_hi) {   // around the initial quality
+        q = s->q + s->dq * (2.f * i / (num_jobs - 1) - 1.f);
+      } else if (has_lo && has_hi) {
+        q = lo + (hi - lo) * (i + 1) / (num_jobs + 1);
+      } else if (has_lo) {        // still below the target
+        q = lo + 30.f * (i + 1) / num_jobs;
+      } else {
+        q = hi - 30.f * (i + 1) / num_jobs;
+      }
+      CopyPassState(jobs[i].enc_, enc);
+      jobs[i].stats_.q = Clamp(q, 0.f, 100.f);
+      if (i + 1 < num_jobs) {
+        winterface->Launch(&jobs[i].worker_);
+      } else {
+        winterface->Execute(&jobs[i].worker_);
+      }
+    }
+    for (i = 0; i < num_jobs; ++i) {
+      winterface->Sync(&jobs[i].worker_);
+      too_big |= (jobs[i].size_p0_ > PARTITION0_SIZE_LIMIT);
+    }
+    if (!WebPReportProgress(enc->pic_, enc->percent_ + percent_per_pass,
+                            &enc->percent_)) {
+      return 0;
+    }
+    if (enc->max_i4_header_bits_ > 0 && too_big) {
+      ++num_rounds;
+      enc->max_i4_header_bits_ >>= 1;  // strengthen header bit limitation...
+      continue;                        // ...and start over
+    }
+    for (i = 0; i < num_jobs; ++i) {
+      const PassStats* const stats = &jobs[i].stats_;
+      const double dist = fabs(stats->value - s->target);
+      if (stats->value < s->target) {
+        if (!has_lo || stats->q > lo) lo = stats->q;
+        has_lo = 1;
+      } else {
+        if (!has_hi || stats->q < hi) hi = stats->q;
+        has_hi = 1;
+      }
+      if (best_dist < 0. || dist < best_dist) {
+        best_dist = dist;
+        best = i;
+      }
+    }
+    if (best >= 0) {
+      CopyPassState(enc, jobs[best].enc_);
+      s->q = jobs[best].stats_.q;
+      s->value = jobs[best].stats_.value;
+    }
+    if (has_lo && has_hi && lo > hi) break;   // not monotonic. Stop here.
+  }
+  return 1;
+}
+
 static int StatLoop(VP8Encoder* const enc) {
   const int method = enc->method_;
   const int do_search = enc->do_search_;
@@ -634,6 +875,20 @@ static int StatLoop(VP8Encoder* const enc) {
     }
   }
 
+  if (do_search && GetNumSearchJobs(enc) > 1) {
+    SearchJob jobs[MAX_SEARCH_JOBS];
+    const int num_jobs = GetNumSearchJobs(enc);
+    // If memory is short, just fall back to the regular search below.
+    if (InitSearchJobs(enc, jobs, num_jobs, rd_opt, nb_mbs, &stats)) {
+      const int ok = SpeculativeSearch(enc, jobs, num_jobs, num_pass_left,
+                                       percent_per_pass, &stats);
+      DeleteSearchJobs(jobs, num_jobs);
+      if (!ok) return 0;
+      SetSegmentProbas(enc);   // for the picture's stats
+      num_pass_left = 0;
+    }
+  }
+
   while (num_pass_left-- > 0) {
     const int is_last_pass = (fabs(stats.dq) <= DQ_LIMIT) ||
                              (num_pass_left == 0) ||
@@ -662,9 +917,9 @@ static int StatLoop(VP8Encoder* const enc) {
   if (!do_search || !stats.do_size_search) {
     // Need to finalize probas now, since it wasn't done during the search.
     FinalizeSkipProba(enc);
-    FinalizeTokenProbas(&enc->proba_);
+    FinalizeTokenProbas(&enc->pass_.proba_);
   }
-  VP8CalculateLevelCosts(&enc->proba_);  // finalize costs
+  VP8CalculateLevelCosts(&enc->pass_.proba_);  // finalize costs
   return WebPReportProgress(enc->pic_, final_percent, &enc->percent_);
 }
 
@@ -677,8 +932,11 @@ static const uint8_t kAverageBytesPerMB[8] = { 50, 24, 16, 9, 7, 5, 3, 2 };
 static int PreLoopInitialize(VP8Encoder* const enc) {
   int p;
   int ok = 1;
-  const int average_bytes_per_MB = kAverageBytesPerMB[enc->base_quant_ >> 4];
-  const int bytes_per_parts =
+  const int average_bytes_per_MB =
+      kAverageBytesPerMB[enc->pass_.base_quant_ >> 4];
+  // Streamed tokens are only coded by VP8EncWrite(), chunk by chunk: there's
+  // no need to reserve room for the whole partition.
+  const int bytes_per_parts = enc->stream_tokens_ ? 0 :
       enc->mb_w_ * enc->mb_h_ * average_bytes_per_MB / enc->num_parts_;
   // Initialize the bit-writers
   for (p = 0; ok && p < enc->num_parts_; ++p) {
@@ -743,10 +1001,11 @@ int VP8EncLoop(VP8Encoder* const enc) {
   VP8InitFilter(&it);
   do {
     VP8ModeScore info;
-    const int dont_use_skip = !enc->proba_.use_skip_proba_;
+    const int dont_use_skip = !enc->pass_.proba_.use_skip_proba_;
     const VP8RDLevel rd_opt = enc->rd_opt_level_;
 
-    VP8IteratorImport(&it, NULL);
+    ok = VP8IteratorImport(&it, NULL);
+    if (!ok) break;
     // Warning! order is important: first call VP8Decimate() and
     // *then* decide how to code the skip decision if there's one.
     if (!VP8Decimate(&it, &info, rd_opt) || dont_use_skip) {
@@ -754,7 +1013,7 @@ int VP8EncLoop(VP8Encoder* const enc) {
     } else {   // reset predictors after a skip
       ResetAfterSkip(&it);
     }
-    StoreSideInfo(&it);
+    StoreSideInfo(&it, enc->sse_, &enc->sse_count_, enc->block_count_);
     VP8StoreFilterStats(&it);
     VP8IteratorExport(&it);
     ok = VP8IteratorProgress(&it, 20);
@@ -771,15 +1030,253 @@ int VP8EncLoop(VP8Encoder* const enc) {
 
 #define MIN_COUNT 96  // minimum number of macroblocks before updating stats
 
+//------------------------------------------------------------------------------
+// Wavefront token loop, used when thread_level > 1.
+//
+// Each macroblock row is a job given to one of the row workers, which has its
+// own iterator. Row 'y' processes macroblock 'x' only once row 'y - 1' is done
+// with 'x + 1': the top samples, non-zero contexts and prediction modes are then
+// exactly those of a raster-order scan. Tokens and statistics are collected per
+// row and merged in row order when a row completes, so the output doesn't
+// depend on the number of threads. Contrary to the serial loop, level costs
+// are refreshed between whole groups of rows, when all workers are idle.
+
+#define MAX_ROW_THREADS 32
+
+typedef struct {
+  WebPWorker worker_;
+  VP8EncIterator it_;
+  VP8TBuffer tokens_;                        // tokens of the current row
+  StatsArray stats_[NUM_TYPES][NUM_BANDS];   // token statistics of the row
+  LFStats lf_stats_;                         // filter statistics of the row
+  int max_edge_[NUM_MB_SEGMENTS];            // max edge deltas of the row
+  WebPWorkerProgress progress_;   // raster index + 1 of the last macroblock done
+  WebPWorkerProgress* prev_;      // progress of the previous row, if any
+  int y_;
+  int is_last_pass_;
+  // accumulated over the whole pass, and merged in the encoder at the end
+  uint64_t size_p0_, distortion_;
+  uint64_t sse_[3];
+  uint64_t sse_count_;
+  int block_count_[3];
+} RowJob;
+
+static int GetNumRowThreads(const VP8Encoder* const enc) {
+#ifdef WEBP_USE_THREAD
+  int num_threads = enc->thread_level_;
+  // With a two-macroblock lag, there can't be more than mb_w / 2 active rows.
+  const int max_threads = enc->mb_w_ / 2;
+  if (num_threads > MAX_ROW_THREADS) num_threads = MAX_ROW_THREADS;
+  if (num_threads > max_threads) num_threads = max_threads;
+  if (num_threads > enc->mb_h_) num_threads = enc->mb_h_;
+  return (num_threads > 1) ? num_threads : 1;
+#else
+  (void)enc;
+  return 1;   // rows can't overlap
+#endif
+}
+
+// Adds the token statistics 'src' to 'dst', halving them when they get too
+// large, similarly to VP8RecordStats().
+static void MergeTokenStats(proba_t* const dst, const proba_t* const src,
+                            int num) {
+  int i;
+  for (i = 0; i < num; ++i) {
+    uint32_t total = (dst[i] >> 16) + (src[i] >> 16);
+    uint32_t nb = (dst[i] & 0xffffu) + (src[i] & 0xffffu);
+    while (total >= 0xfffeu) {
+      total = (total + 1u) >> 1;
+      nb = (nb + 1u) >> 1;
+    }
+    dst[i] = (total << 16) | nb;
+  }
+}
+
+// Appends the row's tokens and statistics to the encoder's.
+static int MergeRow(VP8Encoder* const enc, RowJob* const job) {
+  const int ok = VP8TBufferAppend(&enc->tokens_, &job->tokens_);
+  int s, i;
+  VP8TBufferClear(&job->tokens_);
+  MergeTokenStats(&enc->pass_.proba_.stats_[0][0][0][0],
+                  &job->stats_[0][0][0][0],
+                  sizeof(job->stats_) / sizeof(job->stats_[0][0][0][0]));
+  for (s = 0; s < NUM_MB_SEGMENTS; ++s) {
+    VP8SegmentInfo* const dqm = &enc->pass_.dqm_[s];
+    if (job->max_edge_[s] > dqm->max_edge_) dqm->max_edge_ = job->max_edge_[s];
+  }
+  if (job->is_last_pass_ && enc->lf_stats_ != NULL) {
+    for (s = 0; s < NUM_MB_SEGMENTS; ++s) {
+      for (i = 0; i < MAX_LF_LEVELS; ++i) {
+        (*enc->lf_stats_)[s][i] += job->lf_stats_[s][i];
+      }
+    }
+  }
+  return ok;
+}
+
+static int EncodeRowHook(void* arg1, void* arg2) {
+  VP8Encoder* const enc = (VP8Encoder*)arg1;
+  RowJob* const job = (RowJob*)arg2;
+  VP8EncIterator* const it = &job->it_;
+  const int mb_w = enc->mb_w_;
+  const int start = job->y_ * mb_w;   // raster index of the row's first mb
+  int ok = 1;
+  int x;
+
+  memset(job->stats_, 0, sizeof(job->stats_));
+  memset(job->max_edge_, 0, sizeof(job->max_edge_));
+  if (job->is_last_pass_) {
+    memset(job->lf_stats_, 0, sizeof(job->lf_stats_));
+  }
+  VP8IteratorSetRow(it, job->y_);
+  for (x = 0; x < mb_w; ++x) {
+    if (job->prev_ != NULL) {   // wait for the top and top-right macroblocks
+      WebPWorkerProgressWait(job->prev_,
+                             start - mb_w + ((x + 2 < mb_w) ? x + 2 : mb_w));
+    }
+    if (ok) {
+      VP8ModeScore info;
+      VP8IteratorImport(it, NULL);   // row sources are single-threaded
+      VP8Decimate(it, &info, enc->rd_opt_level_);
+      ok = RecordTokens(it, &info, &job->tokens_);
+      job->size_p0_ += info.H;
+      job->distortion_ += info.D;
+      if (job->is_last_pass_) {
+        StoreSideInfo(it, job->sse_, &job->sse_count_, job->block_count_);
+        VP8StoreFilterStats(it);
+        VP8IteratorExport(it);
+      }
+      VP8IteratorSaveBoundary(it);
+    }
+    // The last macroblock is only signaled once the row is merged.
+    if (x + 1 < mb_w) WebPWorkerProgressSet(&job->progress_, start + x + 1);
+    VP8IteratorNext(it);
+  }
+  // The previous row is complete, and thus merged already.
+  ok = ok && MergeRow(enc, job);
+  // Signal the completion even on error, so that the next row doesn't stall.
+  WebPWorkerProgressSet(&job->progress_, start + mb_w);
+  return ok;
+}
+
+static void DeleteRowJobs(RowJob* const jobs, int num_jobs) {
+  if (jobs != NULL) {
+    const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+    int i;
+    for (i = 0; i < num_jobs; ++i) {
+      winterface->End(&jobs[i].worker_);
+      VP8TBufferClear(&jobs[i].tokens_);
+    }
+    WebPSafeFree(jobs);
+  }
+}
+
+// Returns NULL in case of memory error.
+static RowJob* NewRowJobs(VP8Encoder* const enc, int num_jobs) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  RowJob* const jobs =
+      (RowJob*)WebPSafeCallocTransient((uint64_t)num_jobs, sizeof(*jobs));
+  int i;
+  if (jobs == NULL) return NULL;
+  for (i = 0; i < num_jobs; ++i) {
+    RowJob* const job = &jobs[i];
+    winterface->Init(&job->worker_);
+    job->worker_.hook = EncodeRowHook;
+    job->worker_.data1 = enc;
+    job->worker_.data2 = job;
+    VP8TBufferInit(&job->tokens_, enc->mb_w_ * 4 * 16);
+    if (!winterface->Reset(&job->worker_)) {
+      DeleteRowJobs(jobs, i + 1);
+      return NULL;
+    }
+  }
+  return jobs;
+}
+
+// Encodes all the rows with the 'num_jobs' row workers, refreshing the level
+// costs every 'max_count' macroblocks or so.
+static int RowJobsPass(VP8Encoder* const enc, RowJob* const jobs, int num_jobs,
+                       int is_last_pass, int max_count,
+                       uint64_t* const size_p0, uint64_t* const distortion) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  const int mb_w = enc->mb_w_, mb_h = enc->mb_h_;
+  const int group_rows = (max_count + mb_w - 1) / mb_w;
+  const int percent0 = enc->percent_;
+  int num_ready;
+  int ok = 1;         // false in case of memory error
+  int aborted = 0;
+  int i, y;
+
+  for (i = 0; i < num_jobs; ++i) {
+    RowJob* const job = &jobs[i];
+    // Note: this resets the shared top samples once again, which is harmless.
+    VP8IteratorInit(enc, &job->it_);
+    job->it_.stats_ = job->stats_;
+    job->it_.lf_stats_ = (enc->lf_stats_ != NULL) ? &job->lf_stats_ : NULL;
+    job->it_.max_edge_ = job->max_edge_;
+    job->is_last_pass_ = is_last_pass;
+    job->size_p0_ = job->distortion_ = 0;
+    memset(job->sse_, 0, sizeof(job->sse_));
+    job->sse_count_ = 0;
+    memset(job->block_count_, 0, sizeof(job->block_count_));
+    if (!WebPWorkerProgressInit(&job->progress_)) break;
+  }
+  num_ready = i;
+  ok = (num_ready == num_jobs);
+
+  // Rows are launched in order, and only ever wait for previously launched
+  // ones. This can't dead-lock, even if some workers share a thread.
+  for (y = 0; ok && y < mb_h; ++y) {
+    RowJob* const job = &jobs[y % num_jobs];
+    if (y > 0 && y % group_rows == 0) {
+      for (i = 0; i < num_jobs; ++i) ok &= winterface->Sync(&jobs[i].worker_);
+      if (!ok) break;
+      FinalizeTokenProbas(&enc->pass_.proba_);
+      // refresh cost tables for rd-opt
+      VP8CalculateLevelCosts(&enc->pass_.proba_);
+    }
+    ok &= winterface->Sync(&job->worker_);   // wait for row y - num_jobs
+    if (!ok) break;
+    if (is_last_pass &&
+        !WebPReportProgress(enc->pic_, percent0 + 20 * y / mb_h,
+                            &enc->percent_)) {
+      aborted = 1;
+      break;
+    }
+    job->y_ = y;
+    job->prev_ = (y > 0) ? &jobs[(y - 1) % num_jobs].progress_ : NULL;
+    winterface->Launch(&job->worker_);
+  }
+  for (i = 0; i < num_jobs; ++i) ok &= winterface->Sync(&jobs[i].worker_);
+  for (i = 0; i < num_jobs; ++i) {
+    RowJob* const job = &jobs[i];
+    if (i < num_ready) WebPWorkerProgressClear(&job->progress_);
+    *size_p0 += job->size_p0_;
+    *distortion += job->distortion_;
+    if (is_last_pass) {
+      int k;
+      for (k = 0; k < 3; ++k) {
+        enc->sse_[k] += job->sse_[k];
+        enc->block_count_[k] += job->block_count_[k];
+      }
+      enc->sse_count_ += job->sse_count_;
+    }
+  }
+  if (!ok) return WebPEncodingSetError(enc->pic_, VP8_ENC_ERROR_OUT_OF_MEMORY);
+  return !aborted;
+}
+
 int VP8EncTokenLoop(VP8Encoder* const enc) {
   // Roughly refresh the proba eight times per pass
   int max_count = (enc->mb_w_ * enc->mb_h_) >> 3;
   int num_pass_left = enc->config_->pass;
   const int do_search = enc->do_search_;
   VP8EncIterator it;
-  VP8EncProba* const proba = &enc->proba_;
+  VP8EncProba* const proba = &enc->pass_.proba_;
   const VP8RDLevel rd_opt = enc->rd_opt_level_;
   const uint64_t pixel_count = enc->mb_w_ * enc->mb_h_ * 384;
+  const int num_row_jobs = GetNumRowThreads(enc);
+  RowJob* row_jobs = NULL;
   PassStats stats;
   int ok;
 
@@ -788,6 +1285,13 @@ int VP8EncTokenLoop(VP8Encoder* const enc) {
   if (!ok) return 0;
 
   if (max_count < MIN_COUNT) max_count = MIN_COUNT;
+  if (num_row_jobs > 1) {
+    row_jobs = NewRowJobs(enc, num_row_jobs);
+    if (row_jobs == NULL) {
+      VP8EncFreeBitWriters(enc);
+      return WebPEncodingSetError(enc->pic_, VP8_ENC_ERROR_OUT_OF_MEMORY);
+    }
+  }
 
   assert(enc->num_parts_ == 1);
   assert(enc->use_tokens_);
@@ -809,35 +1313,41 @@ int VP8EncTokenLoop(VP8Encoder* const enc) {
       VP8InitFilter(&it);  // don't collect stats until last pass (too costly)
     }
     VP8TBufferClear(&enc->tokens_);
-    do {
-      VP8ModeScore info;
-      VP8IteratorImport(&it, NULL);
-      if (--cnt < 0) {
-        FinalizeTokenProbas(proba);
-        VP8CalculateLevelCosts(proba);  // refresh cost tables for rd-opt
-        cnt = max_count;
-      }
-      VP8Decimate(&it, &info, rd_opt);
-      ok = RecordTokens(&it, &info, &enc->tokens_);
-      if (!ok) {
-        WebPEncodingSetError(enc->pic_, VP8_ENC_ERROR_OUT_OF_MEMORY);
-        break;
-      }
-      size_p0 += info.H;
-      distortion += info.D;
-      if (is_last_pass) {
-        StoreSideInfo(&it);
-        VP8StoreFilterStats(&it);
-        VP8IteratorExport(&it);
-        ok = VP8IteratorProgress(&it, 20);
-      }
-      VP8IteratorSaveBoundary(&it);
-    } while (ok && VP8IteratorNext(&it));
+    if (row_jobs != NULL) {
+      ok = RowJobsPass(enc, row_jobs, num_row_jobs, is_last_pass, max_count,
+                       &size_p0, &distortion);
+    } else {
+      do {
+        VP8ModeScore info;
+        ok = VP8IteratorImport(&it, NULL);
+        if (!ok) break;
+        if (--cnt < 0) {
+          FinalizeTokenProbas(proba);
+          VP8CalculateLevelCosts(proba);  // refresh cost tables for rd-opt
+          cnt = max_count;
+        }
+        VP8Decimate(&it, &info, rd_opt);
+        ok = RecordTokens(&it, &info, &enc->tokens_);
+        if (!ok) {
+          WebPEncodingSetError(enc->pic_, VP8_ENC_ERROR_OUT_OF_MEMORY);
+          break;
+        }
+        size_p0 += info.H;
+        distortion += info.D;
+        if (is_last_pass) {
+          StoreSideInfo(&it, enc->sse_, &enc->sse_count_, enc->block_count_);
+          VP8StoreFilterStats(&it);
+          VP8IteratorExport(&it);
+          ok = VP8IteratorProgress(&it, 20);
+        }
+        VP8IteratorSaveBoundary(&it);
+      } while (ok && VP8IteratorNext(&it));
+    }
     if (!ok) break;
 
     size_p0 += enc->segment_hdr_.size_;
     if (stats.do_size_search) {
-      uint64_t size = FinalizeTokenProbas(&enc->proba_);
+      uint64_t size = FinalizeTokenProbas(&enc->pass_.proba_);
       size += VP8EstimateTokenSize(&enc->tokens_,
                                    (const uint8_t*)proba->coeffs_);
       size = (size + size_p0 + 1024) >> 11;  // -> size in bytes
@@ -869,12 +1379,15 @@ int VP8EncTokenLoop(VP8Encoder* const enc) {
   }
   if (ok) {
     if (!stats.do_size_search) {
-      FinalizeTokenProbas(&enc->proba_);
+      FinalizeTokenProbas(&enc->pass_.proba_);
+    }
+    if (!enc->stream_tokens_) {   // otherwise, VP8EncWrite() emits them
+      ok = VP8EmitTokens(&enc->tokens_, enc->parts_ + 0,
+                         (const uint8_t*)proba->coeffs_, 1);
     }
-    ok = VP8EmitTokens(&enc->tokens_, enc->parts_ + 0,
-                       (const uint8_t*)proba->coeffs_, 1);
   }
   ok = ok && WebPReportProgress(enc->pic_, enc->percent_ + 20, &enc->percent_);
+  DeleteRowJobs(row_jobs, num_row_jobs);
   return PostLoopFinalize(&it, ok);
 }
 
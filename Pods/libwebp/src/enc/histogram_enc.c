@@ -19,6 +19,7 @@
 #include "src/enc/histogram_enc.h"
 #include "src/dsp/lossless.h"
 #include "src/dsp/lossless_common.h"
+#include "src/utils/thread_utils.h"
 #include "src/utils/utils.h"
 
 #define MAX_COST 1.e38
@@ -30,6 +31,8 @@
 #define BIN_SIZE (NUM_PARTITIONS * NUM_PARTITIONS * NUM_PARTITIONS)
 // Maximum number of histograms allowed in greedy combining algorithm.
 #define MAX_HISTO_GREEDY 100
+// Maximum number of threads used for the clustering.
+#define MAX_HISTO_THREADS 16
 
 static void HistogramClear(VP8LHistogram* const p) {
   uint32_t* const literal = p->literal_;
@@ -111,7 +114,8 @@ void VP8LHistogramInit(VP8LHistogram* const p, int palette_code_bits,
 VP8LHistogram* VP8LAllocateHistogram(int cache_bits) {
   VP8LHistogram* histo = NULL;
   const int total_size = VP8LGetHistogramSize(cache_bits);
-  uint8_t* const memory = (uint8_t*)WebPSafeMalloc(total_size, sizeof(*memory));
+  uint8_t* const memory =
+      (uint8_t*)WebPSafeMallocTransient(total_size, sizeof(*memory));
   if (memory == NULL) return NULL;
   histo = (VP8LHistogram*)memory;
   // literal_ won't necessary be aligned.
@@ -147,7 +151,8 @@ VP8LHistogramSet* VP8LAllocateHistogramSet(int size, int cache_bits) {
   int i;
   VP8LHistogramSet* set;
   const size_t total_size = HistogramSetTotalSize(size, cache_bits);
-  uint8_t* memory = (uint8_t*)WebPSafeMalloc(total_size, sizeof(*memory));
+  uint8_t* memory =
+      (uint8_t*)WebPSafeMallocTransient(total_size, sizeof(*memory));
   if (memory == NULL) return NULL;
 
   set = (VP8LHistogramSet*)memory;
@@ -745,7 +750,7 @@ static int HistoQueueInit(HistoQueue* const histo_queue, const int max_size) {
   histo_queue->max_size = max_size;
   // We allocate max_size + 1 because the last element at index "size" is
   // used as temporary data (and it could be up to max_size).
-  histo_queue->queue = (HistogramPair*)WebPSafeMalloc(
+  histo_queue->queue = (HistogramPair*)WebPSafeMallocTransient(
       histo_queue->max_size + 1, sizeof(*histo_queue->queue));
   return histo_queue->queue != NULL;
 }
@@ -830,14 +835,146 @@ static double HistoQueuePush(HistoQueue* const histo_queue,
 }
 
 // -----------------------------------------------------------------------------
+// Parallel jobs. Each job only writes its own part of the output, so that the
+// result does not depend on the number of threads.
+
+typedef void (*HistoJobFunc)(void* data, int idx, int num_jobs);
+
+typedef struct {
+  HistoJobFunc func_;
+  void* data_;
+  int idx_;
+  int num_jobs_;
+} HistoJob;
+
+static int HistoJobHook(void* arg1, void* arg2) {
+  const HistoJob* const job = (const HistoJob*)arg1;
+  (void)arg2;
+  job->func_(job->data_, job->idx_, job->num_jobs_);
+  return 1;
+}
+
+static int GetNumHistoJobs(int thread_level, int num_items) {
+#ifdef WEBP_USE_THREAD
+  int num_jobs = thread_level;
+  if (num_jobs > MAX_HISTO_THREADS) num_jobs = MAX_HISTO_THREADS;
+  if (num_jobs > num_items) num_jobs = num_items;
+  return (num_jobs > 1) ? num_jobs : 1;
+#else
+  (void)thread_level;
+  (void)num_items;
+  return 1;
+#endif
+}
+
+// Calls func(data, idx, num_jobs) for each idx in [0, num_jobs). Job #0 runs
+// in the calling thread, as do the ones whose worker could not be started.
+static void HistoRunJobs(HistoJobFunc func, void* data, int num_jobs) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  WebPWorker workers[MAX_HISTO_THREADS];
+  HistoJob jobs[MAX_HISTO_THREADS];
+  int launched[MAX_HISTO_THREADS];
+  int idx;
+  assert(num_jobs >= 1 && num_jobs <= MAX_HISTO_THREADS);
+  for (idx = 0; idx < num_jobs; ++idx) {
+    WebPWorker* const worker = &workers[idx];
+    jobs[idx].func_ = func;
+    jobs[idx].data_ = data;
+    jobs[idx].idx_ = idx;
+    jobs[idx].num_jobs_ = num_jobs;
+    worker_interface->Init(worker);
+    worker->hook = HistoJobHook;
+    worker->data1 = &jobs[idx];
+    worker->data2 = NULL;
+    launched[idx] = (idx > 0) && worker_interface->Reset(worker);
+    if (launched[idx]) worker_interface->Launch(worker);
+  }
+  for (idx = 0; idx < num_jobs; ++idx) {
+    if (!launched[idx]) worker_interface->Execute(&workers[idx]);
+  }
+  for (idx = 0; idx < num_jobs; ++idx) {
+    if (launched[idx]) worker_interface->Sync(&workers[idx]);
+    worker_interface->End(&workers[idx]);
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+typedef struct {
+  VP8LHistogram** histograms_;
+  const int* indices_;    // non-NULL histograms
+  int num_indices_;
+  HistogramPair* pairs_;  // all the (i < j) pairs, in row-major order
+} GreedyInitParams;
+
+// Evaluates the pairs of rows idx, idx + num_jobs, ... (interleaved to even
+// out the triangular workload).
+static void GreedyInitJob(void* data, int idx, int num_jobs) {
+  const GreedyInitParams* const p = (const GreedyInitParams*)data;
+  const int n = p->num_indices_;
+  int i, j;
+  for (i = idx; i < n; i += num_jobs) {
+    HistogramPair* pair = p->pairs_ + (size_t)i * (2 * n - i - 1) / 2;
+    for (j = i + 1; j < n; ++j, ++pair) {
+      pair->idx1 = p->indices_[i];
+      pair->idx2 = p->indices_[j];
+      HistoQueueUpdatePair(p->histograms_[pair->idx1],
+                           p->histograms_[pair->idx2], 0., pair);
+    }
+  }
+}
+
+// Fills the queue with all the pairs improving the entropy. The pair costs
+// are evaluated in parallel, and pushed in the same order as a serial
+// HistoQueuePush() loop would.
+static int HistoQueueInitPairs(HistoQueue* const histo_queue,
+                               VP8LHistogramSet* const image_histo,
+                               int thread_level) {
+  const int image_histo_size = image_histo->size;
+  VP8LHistogram** const histograms = image_histo->histograms;
+  GreedyInitParams params;
+  int* indices;
+  size_t num_pairs, k;
+  int i, n;
+
+  indices = (int*)WebPSafeMallocTransient(image_histo_size, sizeof(*indices));
+  if (indices == NULL) return 0;
+  for (i = 0, n = 0; i < image_histo_size; ++i) {
+    if (histograms[i] != NULL) indices[n++] = i;
+  }
+  num_pairs = (size_t)n * (n - 1) / 2;
+  params.histograms_ = histograms;
+  params.indices_ = indices;
+  params.num_indices_ = n;
+  params.pairs_ = (HistogramPair*)WebPSafeMallocTransient(
+      num_pairs + 1, sizeof(*params.pairs_));
+  if (params.pairs_ == NULL) {
+    WebPSafeFree(indices);
+    return 0;
+  }
+  HistoRunJobs(GreedyInitJob, &params, GetNumHistoJobs(thread_level, n));
+
+  for (k = 0; k < num_pairs; ++k) {
+    const HistogramPair* const pair = &params.pairs_[k];
+    // Do not even consider the pair if it does not improve the entropy.
+    if (pair->cost_diff >= 0.) continue;
+    if (histo_queue->size == histo_queue->max_size) break;
+    histo_queue->queue[histo_queue->size++] = *pair;
+    HistoQueueUpdateHead(histo_queue,
+                         &histo_queue->queue[histo_queue->size - 1]);
+  }
+  WebPSafeFree(params.pairs_);
+  WebPSafeFree(indices);
+  return 1;
+}
 
 // Combines histograms by continuously choosing the one with the highest cost
 // reduction.
 static int HistogramCombineGreedy(VP8LHistogramSet* const image_histo,
-                                  int* const num_used) {
+                                  int* const num_used, int thread_level) {
   int ok = 0;
   const int image_histo_size = image_histo->size;
-  int i, j;
+  int i;
   VP8LHistogram** const histograms = image_histo->histograms;
   // Priority queue of histogram pairs.
   HistoQueue histo_queue;
@@ -849,19 +986,11 @@ static int HistogramCombineGreedy(VP8LHistogramSet* const image_histo,
   // - image_histo_size - 1 in the last for loop at the first iteration of
   //   the while loop, image_histo_size - 2 at the second iteration ...
   //   therefore image_histo_size*(image_histo_size-1)/2 overall too
-  if (!HistoQueueInit(&histo_queue, image_histo_size * image_histo_size)) {
+  if (!HistoQueueInit(&histo_queue, image_histo_size * image_histo_size) ||
+      !HistoQueueInitPairs(&histo_queue, image_histo, thread_level)) {
     goto End;
   }
 
-  for (i = 0; i < image_histo_size; ++i) {
-    if (image_histo->histograms[i] == NULL) continue;
-    for (j = i + 1; j < image_histo_size; ++j) {
-      // Initialize queue.
-      if (image_histo->histograms[j] == NULL) continue;
-      HistoQueuePush(&histo_queue, histograms, i, j, 0.);
-    }
-  }
-
   while (histo_queue.size > 0) {
     const int idx1 = histo_queue.queue[0].idx1;
     const int idx2 = histo_queue.queue[0].idx2;
@@ -928,7 +1057,7 @@ static int HistogramCombineStochastic(VP8LHistogramSet* const image_histo,
     return 1;
   }
 
-  mappings = (int*) WebPSafeMalloc(*num_used, sizeof(*mappings));
+  mappings = (int*) WebPSafeMallocTransient(*num_used, sizeof(*mappings));
   if (mappings == NULL) return 0;
   if (!HistoQueueInit(&histo_queue, kHistoQueueSize)) goto End;
   // Fill the initial mapping.
@@ -1042,36 +1171,62 @@ End:
 // -----------------------------------------------------------------------------
 // Histogram refinement
 
+typedef struct {
+  const VP8LHistogramSet* in_;
+  const VP8LHistogramSet* out_;
+  uint16_t* symbols_;
+} RemapParams;
+
+// Finds the best 'out' histogram for the stripe #idx of the 'in' histograms.
+static void HistogramRemapJob(void* data, int idx, int num_jobs) {
+  const RemapParams* const p = (const RemapParams*)data;
+  VP8LHistogram** const in_histo = p->in_->histograms;
+  VP8LHistogram** const out_histo = p->out_->histograms;
+  const int in_size = p->out_->max_size;
+  const int out_size = p->out_->size;
+  const int start = (int)((int64_t)in_size * idx / num_jobs);
+  const int end = (int)((int64_t)in_size * (idx + 1) / num_jobs);
+  int i;
+  for (i = start; i < end; ++i) {
+    int best_out = 0;
+    double best_bits = MAX_COST;
+    int k;
+    if (in_histo[i] == NULL) continue;
+    for (k = 0; k < out_size; ++k) {
+      double cur_bits;
+      cur_bits = HistogramAddThresh(out_histo[k], in_histo[i], best_bits);
+      if (k == 0 || cur_bits < best_bits) {
+        best_bits = cur_bits;
+        best_out = k;
+      }
+    }
+    p->symbols_[i] = best_out;
+  }
+}
+
 // Find the best 'out' histogram for each of the 'in' histograms.
 // At call-time, 'out' contains the histograms of the clusters.
 // Note: we assume that out[]->bit_cost_ is already up-to-date.
 static void HistogramRemap(const VP8LHistogramSet* const in,
                            VP8LHistogramSet* const out,
-                           uint16_t* const symbols) {
+                           uint16_t* const symbols, int thread_level) {
   int i;
   VP8LHistogram** const in_histo = in->histograms;
   VP8LHistogram** const out_histo = out->histograms;
   const int in_size = out->max_size;
   const int out_size = out->size;
   if (out_size > 1) {
+    RemapParams params;
+    params.in_ = in;
+    params.out_ = out;
+    params.symbols_ = symbols;
+    HistoRunJobs(HistogramRemapJob, &params,
+                 GetNumHistoJobs(thread_level, in_size));
     for (i = 0; i < in_size; ++i) {
-      int best_out = 0;
-      double best_bits = MAX_COST;
-      int k;
       if (in_histo[i] == NULL) {
         // Arbitrarily set to the previous value if unused to help future LZ77.
         symbols[i] = symbols[i - 1];
-        continue;
-      }
-      for (k = 0; k < out_size; ++k) {
-        double cur_bits;
-        cur_bits = HistogramAddThresh(out_histo[k], in_histo[i], best_bits);
-        if (k == 0 || cur_bits < best_bits) {
-          best_bits = cur_bits;
-          best_out = k;
-        }
       }
-      symbols[i] = best_out;
     }
   } else {
     assert(out_size == 1);
@@ -1170,7 +1325,7 @@ static void RemoveEmptyHistograms(VP8LHistogramSet* const image_histo) {
 int VP8LGetHistoImageSymbols(int xsize, int ysize,
                              const VP8LBackwardRefs* const refs,
                              int quality, int low_effort,
-                             int histo_bits, int cache_bits,
+                             int histo_bits, int cache_bits, int thread_level,
                              VP8LHistogramSet* const image_histo,
                              VP8LHistogram* const tmp_histo,
                              uint16_t* const histogram_symbols) {
@@ -1186,7 +1341,7 @@ int VP8LGetHistoImageSymbols(int xsize, int ysize,
   const int entropy_combine_num_bins = low_effort ? NUM_PARTITIONS : BIN_SIZE;
   int entropy_combine;
   uint16_t* const map_tmp =
-      WebPSafeMalloc(2 * image_histo_raw_size, sizeof(map_tmp));
+      WebPSafeMallocTransient(2 * image_histo_raw_size, sizeof(map_tmp));
   uint16_t* const cluster_mappings = map_tmp + image_histo_raw_size;
   int num_used = image_histo_raw_size;
   if (orig_histo == NULL || map_tmp == NULL) goto Error;
@@ -1230,7 +1385,7 @@ int VP8LGetHistoImageSymbols(int xsize, int ysize,
     }
     if (do_greedy) {
       RemoveEmptyHistograms(image_histo);
-      if (!HistogramCombineGreedy(image_histo, &num_used)) {
+      if (!HistogramCombineGreedy(image_histo, &num_used, thread_level)) {
         goto Error;
       }
     }
@@ -1238,7 +1393,7 @@ int VP8LGetHistoImageSymbols(int xsize, int ysize,
 
   // Find the optimal map from original histograms to the final ones.
   RemoveEmptyHistograms(image_histo);
-  HistogramRemap(orig_histo, image_histo, histogram_symbols);
+  HistogramRemap(orig_histo, image_histo, histogram_symbols, thread_level);
 
   ok = 1;
 
@@ -105,11 +105,13 @@ static WEBP_INLINE int VP8LHistogramNumCodes(int palette_code_bits) {
       ((palette_code_bits > 0) ? (1 << palette_code_bits) : 0);
 }
 
-// Builds the histogram image.
+// Builds the histogram image. If 'thread_level' is above 1, up to that many
+// threads are used for the clustering. The result doesn't depend on it.
 int VP8LGetHistoImageSymbols(int xsize, int ysize,
                              const VP8LBackwardRefs* const refs,
                              int quality, int low_effort,
                              int histogram_bits, int cache_bits,
+                             int thread_level,
                              VP8LHistogramSet* const image_in,
                              VP8LHistogram* const tmp_histo,
                              uint16_t* const histogram_symbols);
@@ -78,6 +78,8 @@ void VP8IteratorInit(VP8Encoder* const enc, VP8EncIterator* const it) {
   it->yuv_out2_ = it->yuv_out_ + YUV_SIZE_ENC;
   it->yuv_p_    = it->yuv_out2_ + YUV_SIZE_ENC;
   it->lf_stats_ = enc->lf_stats_;
+  it->stats_ = enc->pass_.proba_.stats_;
+  it->max_edge_ = NULL;
   it->percent0_ = enc->percent_;
   it->y_left_ = (uint8_t*)WEBP_ALIGN(it->yuv_left_mem_ + 1);
   it->u_left_ = it->y_left_ + 16 + 16;
@@ -128,23 +130,76 @@ static void ImportLine(const uint8_t* src, int src_stride,
   for (; i < total_len; ++i) dst[i] = dst[len - 1];
 }
 
-void VP8IteratorImport(VP8EncIterator* const it, uint8_t* const tmp_32) {
-  const VP8Encoder* const enc = it->enc_;
+// Pulls the rows of macroblock row 'mb_y', and the two rows above it (for the
+// boundary samples), from the picture's row source. These are converted to YUV
+// in enc->rows_, just like WebPPictureImportRGB() would do.
+#define ROWS_ABOVE 2   // must be even, to keep the U/V rows aligned
+
+static int FetchSourceRows(VP8Encoder* const enc, int mb_y) {
+  const WebPPicture* const pic = enc->pic_;
+  const int width = pic->width;
+  const int y_start = (mb_y > 0) ? mb_y * 16 - ROWS_ABOVE : 0;
+  const int y_end = MinSize(pic->height, mb_y * 16 + 16);
+  if (enc->rows_mb_y_ == mb_y) return 1;   // already there
+  // Don't pull any more rows after a failure.
+  if (pic->error_code != VP8_ENC_OK) return 0;
+  enc->rows_mb_y_ = -1;
+  if (enc->rows_rgb_ == NULL) {
+    enc->rows_rgb_ = (uint8_t*)WebPSafeMallocTransient(
+        (uint64_t)(16 + ROWS_ABOVE) * 3, width);
+    if (enc->rows_rgb_ == NULL) {
+      return WebPEncodingSetError(pic, VP8_ENC_ERROR_OUT_OF_MEMORY);
+    }
+  }
+  if (!pic->row_source(y_start, y_end - y_start, enc->rows_rgb_, 3 * width,
+                       pic)) {
+    return WebPEncodingSetError(pic, VP8_ENC_ERROR_USER_ABORT);
+  }
+  enc->rows_.width = width;
+  enc->rows_.height = y_end - y_start;
+  if (!WebPPictureImportRGB(&enc->rows_, enc->rows_rgb_, 3 * width)) {
+    return WebPEncodingSetError(pic, enc->rows_.error_code);
+  }
+  enc->rows_y_ = y_start;
+  enc->rows_mb_y_ = mb_y;
+  return 1;
+}
+
+void VP8IteratorFreeSourceRows(VP8Encoder* const enc) {
+  WebPPictureFree(&enc->rows_);
+  WebPSafeFree(enc->rows_rgb_);
+  enc->rows_rgb_ = NULL;
+  enc->rows_mb_y_ = -1;
+}
+
+int VP8IteratorImport(VP8EncIterator* const it, uint8_t* const tmp_32) {
+  VP8Encoder* const enc = it->enc_;
   const int x = it->x_, y = it->y_;
   const WebPPicture* const pic = enc->pic_;
-  const uint8_t* const ysrc = pic->y + (y * pic->y_stride  + x) * 16;
-  const uint8_t* const usrc = pic->u + (y * pic->uv_stride + x) * 8;
-  const uint8_t* const vsrc = pic->v + (y * pic->uv_stride + x) * 8;
+  const WebPPicture* src = pic;   // picture holding the samples
+  int src_y = y * 16;             // first row of the macroblock in 'src'
+  const uint8_t* ysrc;
+  const uint8_t* usrc;
+  const uint8_t* vsrc;
   const int w = MinSize(pic->width - x * 16, 16);
   const int h = MinSize(pic->height - y * 16, 16);
   const int uv_w = (w + 1) >> 1;
   const int uv_h = (h + 1) >> 1;
 
-  ImportBlock(ysrc, pic->y_stride,  it->yuv_in_ + Y_OFF_ENC, w, h, 16);
-  ImportBlock(usrc, pic->uv_stride, it->yuv_in_ + U_OFF_ENC, uv_w, uv_h, 8);
-  ImportBlock(vsrc, pic->uv_stride, it->yuv_in_ + V_OFF_ENC, uv_w, uv_h, 8);
+  if (pic->row_source != NULL) {
+    if (!FetchSourceRows(enc, y)) return 0;
+    src = &enc->rows_;
+    src_y -= enc->rows_y_;
+  }
+  ysrc = src->y + src_y * src->y_stride + x * 16;
+  usrc = src->u + (src_y >> 1) * src->uv_stride + x * 8;
+  vsrc = src->v + (src_y >> 1) * src->uv_stride + x * 8;
+
+  ImportBlock(ysrc, src->y_stride,  it->yuv_in_ + Y_OFF_ENC, w, h, 16);
+  ImportBlock(usrc, src->uv_stride, it->yuv_in_ + U_OFF_ENC, uv_w, uv_h, 8);
+  ImportBlock(vsrc, src->uv_stride, it->yuv_in_ + V_OFF_ENC, uv_w, uv_h, 8);
 
-  if (tmp_32 == NULL) return;
+  if (tmp_32 == NULL) return 1;
 
   // Import source (uncompressed) samples into boundary.
   if (x == 0) {
@@ -153,13 +208,13 @@ void VP8IteratorImport(VP8EncIterator* const it, uint8_t* const tmp_32) {
     if (y == 0) {
       it->y_left_[-1] = it->u_left_[-1] = it->v_left_[-1] = 127;
     } else {
-      it->y_left_[-1] = ysrc[- 1 - pic->y_stride];
-      it->u_left_[-1] = usrc[- 1 - pic->uv_stride];
-      it->v_left_[-1] = vsrc[- 1 - pic->uv_stride];
+      it->y_left_[-1] = ysrc[- 1 - src->y_stride];
+      it->u_left_[-1] = usrc[- 1 - src->uv_stride];
+      it->v_left_[-1] = vsrc[- 1 - src->uv_stride];
     }
-    ImportLine(ysrc - 1, pic->y_stride,  it->y_left_, h,   16);
-    ImportLine(usrc - 1, pic->uv_stride, it->u_left_, uv_h, 8);
-    ImportLine(vsrc - 1, pic->uv_stride, it->v_left_, uv_h, 8);
+    ImportLine(ysrc - 1, src->y_stride,  it->y_left_, h,   16);
+    ImportLine(usrc - 1, src->uv_stride, it->u_left_, uv_h, 8);
+    ImportLine(vsrc - 1, src->uv_stride, it->v_left_, uv_h, 8);
   }
 
   it->y_top_  = tmp_32 + 0;
@@ -167,10 +222,11 @@ void VP8IteratorImport(VP8EncIterator* const it, uint8_t* const tmp_32) {
   if (y == 0) {
     memset(tmp_32, 127, 32 * sizeof(*tmp_32));
   } else {
-    ImportLine(ysrc - pic->y_stride,  1, tmp_32,          w,   16);
-    ImportLine(usrc - pic->uv_stride, 1, tmp_32 + 16,     uv_w, 8);
-    ImportLine(vsrc - pic->uv_stride, 1, tmp_32 + 16 + 8, uv_w, 8);
+    ImportLine(ysrc - src->y_stride,  1, tmp_32,          w,   16);
+    ImportLine(usrc - src->uv_stride, 1, tmp_32 + 16,     uv_w, 8);
+    ImportLine(vsrc - src->uv_stride, 1, tmp_32 + 16 + 8, uv_w, 8);
   }
+  return 1;
 }
 
 //------------------------------------------------------------------------------
@@ -187,7 +243,7 @@ static void ExportBlock(const uint8_t* src, uint8_t* dst, int dst_stride,
 
 void VP8IteratorExport(const VP8EncIterator* const it) {
   const VP8Encoder* const enc = it->enc_;
-  if (enc->config_->show_compressed) {
+  if (enc->config_->show_compressed && enc->pic_->row_source == NULL) {
     const int x = it->x_, y = it->y_;
     const uint8_t* const ysrc = it->yuv_out_ + Y_OFF_ENC;
     const uint8_t* const usrc = it->yuv_out_ + U_OFF_ENC;
@@ -397,18 +397,19 @@ static WEBP_INLINE uint8_t ConvertRGBToV(int r, int g, int b) {
   return clip_8b(128 + (v >> (YUV_FIX + SFIX)));
 }
 
-static int ConvertWRGBToYUV(const fixed_y_t* best_y, const fixed_t* best_uv,
-                            WebPPicture* const picture) {
+// Converts the row pairs [first, last) to the final YUV samples.
+static void ConvertWRGBToYUV(const fixed_y_t* best_y, const fixed_t* best_uv,
+                             WebPPicture* const picture, int first, int last) {
   int i, j;
-  uint8_t* dst_y = picture->y;
-  uint8_t* dst_u = picture->u;
-  uint8_t* dst_v = picture->v;
-  const fixed_t* const best_uv_base = best_uv;
   const int w = (picture->width + 1) & ~1;
-  const int h = (picture->height + 1) & ~1;
   const int uv_w = w >> 1;
-  const int uv_h = h >> 1;
-  for (best_uv = best_uv_base, j = 0; j < picture->height; ++j) {
+  const int y_end = (2 * last < picture->height) ? 2 * last : picture->height;
+  uint8_t* dst_y = picture->y + 2 * first * picture->y_stride;
+  uint8_t* dst_u = picture->u + first * picture->uv_stride;
+  uint8_t* dst_v = picture->v + first * picture->uv_stride;
+  const fixed_t* const best_uv_base = best_uv + (size_t)first * 3 * uv_w;
+  best_y += (size_t)first * 2 * w;
+  for (best_uv = best_uv_base, j = 2 * first; j < y_end; ++j) {
     for (i = 0; i < picture->width; ++i) {
       const int off = (i >> 1);
       const int W = best_y[i];
@@ -421,7 +422,7 @@ static int ConvertWRGBToYUV(const fixed_y_t* best_y, const fixed_t* best_uv,
     best_uv += (j & 1) * 3 * uv_w;
     dst_y += picture->y_stride;
   }
-  for (best_uv = best_uv_base, j = 0; j < uv_h; ++j) {
+  for (best_uv = best_uv_base, j = first; j < last; ++j) {
     for (i = 0; i < uv_w; ++i) {
       const int off = i;
       const int r = best_uv[off + 0 * uv_w];
@@ -434,66 +435,82 @@ static int ConvertWRGBToYUV(const fixed_y_t* best_y, const fixed_t* best_uv,
     dst_u += picture->uv_stride;
     dst_v += picture->uv_stride;
   }
-  return 1;
 }
 
 //------------------------------------------------------------------------------
 // Main function
 
-#define SAFE_ALLOC(W, H, T) ((T*)WebPSafeMalloc((W) * (H), sizeof(T)))
-
-static int PreprocessARGB(const uint8_t* r_ptr,
-                          const uint8_t* g_ptr,
-                          const uint8_t* b_ptr,
-                          int step, int rgb_stride,
-                          WebPPicture* const picture) {
-  // we expand the right/bottom border if needed
-  const int w = (picture->width + 1) & ~1;
-  const int h = (picture->height + 1) & ~1;
+#define SAFE_ALLOC(W, H, T) \
+    ((T*)WebPSafeMallocTransient((W) * (H), sizeof(T)))
+
+// Maximum number of refinement passes in flight. Each one needs its own copy
+// of best_y / best_uv, hence the low value.
+#define MAX_SHARP_PASSES 2
+// Maximum number of bands of row pairs for the import and final conversion.
+#define MAX_SHARP_BANDS 16
+
+typedef struct {
+  fixed_y_t* tmp_buffer_;   // two rows of R/G/B
+  fixed_y_t* best_rgb_y_;   // two rows of W
+  fixed_t* best_rgb_uv_;    // one row of R/G/B
+} SharpScratch;
+
+typedef struct {
+  const uint8_t* r_ptr_;
+  const uint8_t* g_ptr_;
+  const uint8_t* b_ptr_;
+  int step_, rgb_stride_;
+  WebPPicture* picture_;
+  int w_, h_, uv_w_;        // dimensions, expanded to even values
+  fixed_y_t* target_y_;
+  fixed_t* target_uv_;
+  // Set #0 receives the imported samples. The others are only used when
+  // several passes are run at once.
+  fixed_y_t* best_y_[MAX_SHARP_PASSES + 1];
+  fixed_t* best_uv_[MAX_SHARP_PASSES + 1];
+  SharpScratch scratch_[MAX_SHARP_BANDS];
+} SharpContext;
+
+static int AllocSharpScratch(SharpScratch* const scratch, int w) {
   const int uv_w = w >> 1;
-  const int uv_h = h >> 1;
-  uint64_t prev_diff_y_sum = ~0;
-  int j, iter;
-
-  // TODO(skal): allocate one big memory chunk. But for now, it's easier
-  // for valgrind debugging to have several chunks.
-  fixed_y_t* const tmp_buffer = SAFE_ALLOC(w * 3, 2, fixed_y_t);   // scratch
-  fixed_y_t* const best_y_base = SAFE_ALLOC(w, h, fixed_y_t);
-  fixed_y_t* const target_y_base = SAFE_ALLOC(w, h, fixed_y_t);
-  fixed_y_t* const best_rgb_y = SAFE_ALLOC(w, 2, fixed_y_t);
-  fixed_t* const best_uv_base = SAFE_ALLOC(uv_w * 3, uv_h, fixed_t);
-  fixed_t* const target_uv_base = SAFE_ALLOC(uv_w * 3, uv_h, fixed_t);
-  fixed_t* const best_rgb_uv = SAFE_ALLOC(uv_w * 3, 1, fixed_t);
-  fixed_y_t* best_y = best_y_base;
-  fixed_y_t* target_y = target_y_base;
-  fixed_t* best_uv = best_uv_base;
-  fixed_t* target_uv = target_uv_base;
-  const uint64_t diff_y_threshold = (uint64_t)(3.0 * w * h);
-  int ok;
-
-  if (best_y_base == NULL || best_uv_base == NULL ||
-      target_y_base == NULL || target_uv_base == NULL ||
-      best_rgb_y == NULL || best_rgb_uv == NULL ||
-      tmp_buffer == NULL) {
-    ok = WebPEncodingSetError(picture, VP8_ENC_ERROR_OUT_OF_MEMORY);
-    goto End;
-  }
-  assert(picture->width >= kMinDimensionIterativeConversion);
-  assert(picture->height >= kMinDimensionIterativeConversion);
+  scratch->tmp_buffer_ = SAFE_ALLOC(w * 3, 2, fixed_y_t);
+  scratch->best_rgb_y_ = SAFE_ALLOC(w, 2, fixed_y_t);
+  scratch->best_rgb_uv_ = SAFE_ALLOC(uv_w * 3, 1, fixed_t);
+  return (scratch->tmp_buffer_ != NULL && scratch->best_rgb_y_ != NULL &&
+          scratch->best_rgb_uv_ != NULL);
+}
 
-  WebPInitConvertARGBToYUV();
+static void FreeSharpScratch(SharpScratch* const scratch) {
+  WebPSafeFree(scratch->tmp_buffer_);
+  WebPSafeFree(scratch->best_rgb_y_);
+  WebPSafeFree(scratch->best_rgb_uv_);
+}
 
-  // Import RGB samples to W/RGB representation.
-  for (j = 0; j < picture->height; j += 2) {
-    const int is_last_row = (j == picture->height - 1);
-    fixed_y_t* const src1 = tmp_buffer + 0 * w;
-    fixed_y_t* const src2 = tmp_buffer + 3 * w;
+// Imports the row pairs [first, last) to W/RGB representation.
+static void ImportRowPairs(const SharpContext* const s,
+                           const SharpScratch* const scratch,
+                           int first, int last) {
+  const int w = s->w_;
+  const int uv_w = s->uv_w_;
+  fixed_y_t* const src1 = scratch->tmp_buffer_ + 0 * w;
+  fixed_y_t* const src2 = scratch->tmp_buffer_ + 3 * w;
+  int k;
+  for (k = first; k < last; ++k) {
+    const int j = 2 * k;
+    const int is_last_row = (j == s->picture_->height - 1);
+    const uint8_t* const r_ptr = s->r_ptr_ + j * s->rgb_stride_;
+    const uint8_t* const g_ptr = s->g_ptr_ + j * s->rgb_stride_;
+    const uint8_t* const b_ptr = s->b_ptr_ + j * s->rgb_stride_;
+    fixed_y_t* const best_y = s->best_y_[0] + (size_t)j * w;
+    fixed_y_t* const target_y = s->target_y_ + (size_t)j * w;
+    fixed_t* const best_uv = s->best_uv_[0] + (size_t)k * 3 * uv_w;
+    fixed_t* const target_uv = s->target_uv_ + (size_t)k * 3 * uv_w;
 
     // prepare two rows of input
-    ImportOneRow(r_ptr, g_ptr, b_ptr, step, picture->width, src1);
+    ImportOneRow(r_ptr, g_ptr, b_ptr, s->step_, s->picture_->width, src1);
     if (!is_last_row) {
-      ImportOneRow(r_ptr + rgb_stride, g_ptr + rgb_stride, b_ptr + rgb_stride,
-                   step, picture->width, src2);
+      ImportOneRow(r_ptr + s->rgb_stride_, g_ptr + s->rgb_stride_,
+                   b_ptr + s->rgb_stride_, s->step_, s->picture_->width, src2);
     } else {
       memcpy(src2, src1, 3 * w * sizeof(*src2));
     }
@@ -504,66 +521,337 @@ static int PreprocessARGB(const uint8_t* r_ptr,
     UpdateW(src2, target_y + w, w);
     UpdateChroma(src1, src2, target_uv, uv_w);
     memcpy(best_uv, target_uv, 3 * uv_w * sizeof(*best_uv));
-    best_y += 2 * w;
-    best_uv += 3 * uv_w;
-    target_y += 2 * w;
-    target_uv += 3 * uv_w;
-    r_ptr += 2 * rgb_stride;
-    g_ptr += 2 * rgb_stride;
-    b_ptr += 2 * rgb_stride;
   }
+}
 
-  // Iterate and resolve clipping conflicts.
-  for (iter = 0; iter < kNumIterations; ++iter) {
-    const fixed_t* cur_uv = best_uv_base;
-    const fixed_t* prev_uv = best_uv_base;
-    uint64_t diff_y_sum = 0;
-
-    best_y = best_y_base;
-    best_uv = best_uv_base;
-    target_y = target_y_base;
-    target_uv = target_uv_base;
-    for (j = 0; j < h; j += 2) {
-      fixed_y_t* const src1 = tmp_buffer + 0 * w;
-      fixed_y_t* const src2 = tmp_buffer + 3 * w;
-      {
-        const fixed_t* const next_uv = cur_uv + ((j < h - 2) ? 3 * uv_w : 0);
-        InterpolateTwoRows(best_y, prev_uv, cur_uv, next_uv, w, src1, src2);
-        prev_uv = cur_uv;
-        cur_uv = next_uv;
-      }
-
-      UpdateW(src1, best_rgb_y + 0 * w, w);
-      UpdateW(src2, best_rgb_y + 1 * w, w);
-      UpdateChroma(src1, src2, best_rgb_uv, uv_w);
+// One refinement pass, from the buffer set 'src_' to 'dst_' (which can be the
+// same one).
+typedef struct {
+  const SharpContext* ctx_;
+  const SharpScratch* scratch_;
+  int src_, dst_;
+  // If not NULL, 'wait_' tracks the row pairs of 'src_' done by the previous
+  // pass, and 'done_' receives the ones of 'dst_' done by this pass. Both
+  // positions are offset by their '*_base_' value.
+  WebPWorkerProgress* wait_;
+  int wait_base_;
+  WebPWorkerProgress* done_;
+  int done_base_;
+  uint64_t diff_y_sum_;     // output
+} SharpPass;
+
+static void RefineRowPairs(SharpPass* const pass) {
+  const SharpContext* const s = pass->ctx_;
+  const int w = s->w_;
+  const int uv_w = s->uv_w_;
+  const int num_pairs = s->h_ >> 1;
+  const fixed_y_t* const src_y = s->best_y_[pass->src_];
+  const fixed_t* const src_uv = s->best_uv_[pass->src_];
+  fixed_y_t* const dst_y = s->best_y_[pass->dst_];
+  fixed_t* const dst_uv = s->best_uv_[pass->dst_];
+  fixed_y_t* const src1 = pass->scratch_->tmp_buffer_ + 0 * w;
+  fixed_y_t* const src2 = pass->scratch_->tmp_buffer_ + 3 * w;
+  fixed_y_t* const best_rgb_y = pass->scratch_->best_rgb_y_;
+  fixed_t* const best_rgb_uv = pass->scratch_->best_rgb_uv_;
+  uint64_t diff_y_sum = 0;
+  int k;
+
+  for (k = 0; k < num_pairs; ++k) {
+    const size_t y_off = (size_t)k * 2 * w;
+    const size_t uv_off = (size_t)k * 3 * uv_w;
+    const fixed_t* const cur_uv = src_uv + uv_off;
+    // The previous row was already updated by this pass, the next one not.
+    const fixed_t* const prev_uv =
+        (k > 0) ? dst_uv + uv_off - 3 * uv_w : cur_uv;
+    const fixed_t* const next_uv =
+        (k < num_pairs - 1) ? cur_uv + 3 * uv_w : cur_uv;
+
+    if (pass->wait_ != NULL) {
+      const int needed = (k + 2 < num_pairs) ? k + 2 : num_pairs;
+      WebPWorkerProgressWait(pass->wait_, pass->wait_base_ + needed);
+    }
+    InterpolateTwoRows(src_y + y_off, prev_uv, cur_uv, next_uv, w, src1, src2);
 
-      // update two rows of Y and one row of RGB
-      diff_y_sum += WebPSharpYUVUpdateY(target_y, best_rgb_y, best_y, 2 * w);
-      WebPSharpYUVUpdateRGB(target_uv, best_rgb_uv, best_uv, 3 * uv_w);
+    UpdateW(src1, best_rgb_y + 0 * w, w);
+    UpdateW(src2, best_rgb_y + 1 * w, w);
+    UpdateChroma(src1, src2, best_rgb_uv, uv_w);
 
-      best_y += 2 * w;
-      best_uv += 3 * uv_w;
-      target_y += 2 * w;
-      target_uv += 3 * uv_w;
+    if (pass->dst_ != pass->src_) {
+      memcpy(dst_y + y_off, src_y + y_off, 2 * w * sizeof(*dst_y));
+      memcpy(dst_uv + uv_off, cur_uv, 3 * uv_w * sizeof(*dst_uv));
+    }
+    // update two rows of Y and one row of RGB
+    diff_y_sum += WebPSharpYUVUpdateY(s->target_y_ + y_off, best_rgb_y,
+                                      dst_y + y_off, 2 * w);
+    WebPSharpYUVUpdateRGB(s->target_uv_ + uv_off, best_rgb_uv,
+                          dst_uv + uv_off, 3 * uv_w);
+    if (pass->done_ != NULL) {
+      WebPWorkerProgressSet(pass->done_, pass->done_base_ + k + 1);
     }
+  }
+  pass->diff_y_sum_ = diff_y_sum;
+}
+
+static int SharpPassHook(void* arg1, void* arg2) {
+  (void)arg2;
+  RefineRowPairs((SharpPass*)arg1);
+  return 1;
+}
+
+static int GetNumSharpJobs(int thread_level, int max_jobs) {
+#ifdef WEBP_USE_THREAD
+  const int num_jobs = (thread_level < max_jobs) ? thread_level : max_jobs;
+  return (num_jobs > 1) ? num_jobs : 1;
+#else
+  (void)thread_level;
+  (void)max_jobs;
+  return 1;
+#endif
+}
+
+// Returns true if the refinement should stop after the pass 'iter'.
+static int StopRefining(int iter, uint64_t diff_y_sum,
+                        uint64_t* const prev_diff_y_sum, uint64_t threshold) {
+  if (iter > 0) {
+    if (diff_y_sum < threshold) return 1;
+    if (diff_y_sum > *prev_diff_y_sum) return 1;
+  }
+  *prev_diff_y_sum = diff_y_sum;
+  return 0;
+}
+
+// Runs the passes in turn, in place in buffer set #0, which is returned.
+static int RefineInTurn(const SharpContext* const s,
+                        uint64_t diff_y_threshold) {
+  uint64_t prev_diff_y_sum = ~0;
+  SharpPass pass;
+  int iter;
+  pass.ctx_ = s;
+  pass.scratch_ = &s->scratch_[0];
+  pass.src_ = pass.dst_ = 0;
+  pass.wait_ = pass.done_ = NULL;
+  for (iter = 0; iter < kNumIterations; ++iter) {
+    RefineRowPairs(&pass);
     // test exit condition
-    if (iter > 0) {
-      if (diff_y_sum < diff_y_threshold) break;
-      if (diff_y_sum > prev_diff_y_sum) break;
+    if (StopRefining(iter, pass.diff_y_sum_, &prev_diff_y_sum,
+                     diff_y_threshold)) {
+      break;
     }
-    prev_diff_y_sum = diff_y_sum;
   }
+  return 0;
+}
+
+// Runs the passes, 'num_passes' of them at once. Pass #i+1 trails pass #i by
+// two row pairs and uses the updated rows it needs, so the result is the same
+// as running them in turn. Since the exit condition is only known at the end
+// of a pass, the next ones are run speculatively into other buffer sets and
+// discarded if needed. Returns the index of the buffer set holding the result.
+static int RefinePipelined(SharpContext* const s, int num_passes,
+                           uint64_t diff_y_threshold) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  const int num_sets = num_passes + 1;
+  const int num_pairs = s->h_ >> 1;
+  WebPWorker workers[MAX_SHARP_PASSES];
+  SharpPass passes[MAX_SHARP_PASSES];
+  int launched[MAX_SHARP_PASSES];
+  WebPWorkerProgress progress[MAX_SHARP_PASSES + 1];
+  uint64_t prev_diff_y_sum = ~0;
+  int num_iterations = kNumIterations;
+  int num_launched = 0;
+  int iter, i;
+
+  for (i = 0; i < num_passes; ++i) {
+    worker_interface->Init(&workers[i]);
+    workers[i].hook = SharpPassHook;
+    workers[i].data1 = &passes[i];
+    workers[i].data2 = NULL;
+    launched[i] = 0;
+  }
+  for (i = 0; i < num_sets; ++i) {
+    if (!WebPWorkerProgressInit(&progress[i])) {
+      while (i-- > 0) WebPWorkerProgressClear(&progress[i]);
+      return RefineInTurn(s, diff_y_threshold);
+    }
+  }
+
+  for (iter = 0; iter < num_iterations; ++iter) {
+    SharpPass* pass;
+    // Pass #i writes over the input of pass #i - num_passes, which is synced,
+    // and over the output of pass #i - num_passes - 1, which is known not to
+    // be the final one.
+    while (num_launched < num_iterations &&
+           num_launched < iter + num_passes) {
+      const int slot = num_launched % num_passes;
+      pass = &passes[slot];
+      pass->ctx_ = s;
+      pass->scratch_ = &s->scratch_[slot];
+      pass->src_ = num_launched % num_sets;
+      pass->dst_ = (num_launched + 1) % num_sets;
+      pass->wait_ =
+          (num_launched > 0) ? &progress[(num_launched - 1) % num_sets] : NULL;
+      pass->wait_base_ = ((num_launched - 1) / num_sets) * num_pairs;
+      pass->done_ = &progress[num_launched % num_sets];
+      pass->done_base_ = (num_launched / num_sets) * num_pairs;
+      launched[slot] = worker_interface->Reset(&workers[slot]);
+      if (launched[slot]) {
+        worker_interface->Launch(&workers[slot]);
+      } else {
+        worker_interface->Execute(&workers[slot]);
+      }
+      ++num_launched;
+    }
+    pass = &passes[iter % num_passes];
+    if (launched[iter % num_passes]) {
+      worker_interface->Sync(&workers[iter % num_passes]);
+    }
+    if (StopRefining(iter, pass->diff_y_sum_, &prev_diff_y_sum,
+                     diff_y_threshold)) {
+      num_iterations = iter + 1;
+    }
+  }
+  // Wait for the discarded passes.
+  for (; iter < num_launched; ++iter) {
+    if (launched[iter % num_passes]) {
+      worker_interface->Sync(&workers[iter % num_passes]);
+    }
+  }
+  for (i = 0; i < num_passes; ++i) worker_interface->End(&workers[i]);
+  for (i = 0; i < num_sets; ++i) WebPWorkerProgressClear(&progress[i]);
+  return num_iterations % num_sets;
+}
+
+typedef struct {
+  const SharpContext* ctx_;
+  const SharpScratch* scratch_;
+  int first_, last_;        // range of row pairs
+  int best_;                // for the conversion: buffer set to use
+} SharpBand;
+
+static int ImportBandHook(void* arg1, void* arg2) {
+  const SharpBand* const band = (const SharpBand*)arg1;
+  (void)arg2;
+  ImportRowPairs(band->ctx_, band->scratch_, band->first_, band->last_);
+  return 1;
+}
+
+static int ConvertBandHook(void* arg1, void* arg2) {
+  const SharpBand* const band = (const SharpBand*)arg1;
+  const SharpContext* const s = band->ctx_;
+  (void)arg2;
+  ConvertWRGBToYUV(s->best_y_[band->best_], s->best_uv_[band->best_],
+                   s->picture_, band->first_, band->last_);
+  return 1;
+}
+
+// Splits the row pairs in 'num_bands' bands and calls 'hook' on each of them.
+// The first band is processed in the calling thread.
+static void RunSharpBands(const SharpContext* const s, WebPWorkerHook hook,
+                          int best, int num_bands) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  const int num_pairs = s->h_ >> 1;
+  WebPWorker workers[MAX_SHARP_BANDS];
+  SharpBand bands[MAX_SHARP_BANDS];
+  int launched[MAX_SHARP_BANDS];
+  int i;
+  assert(num_bands >= 1 && num_bands <= MAX_SHARP_BANDS);
+  for (i = 0; i < num_bands; ++i) {
+    WebPWorker* const worker = &workers[i];
+    bands[i].ctx_ = s;
+    bands[i].scratch_ = &s->scratch_[i];
+    bands[i].first_ = (int)((int64_t)num_pairs * i / num_bands);
+    bands[i].last_ = (int)((int64_t)num_pairs * (i + 1) / num_bands);
+    bands[i].best_ = best;
+    worker_interface->Init(worker);
+    worker->hook = hook;
+    worker->data1 = &bands[i];
+    worker->data2 = NULL;
+    launched[i] = (i > 0) && worker_interface->Reset(worker);
+    if (launched[i]) worker_interface->Launch(worker);
+  }
+  for (i = 0; i < num_bands; ++i) {
+    if (!launched[i]) worker_interface->Execute(&workers[i]);
+  }
+  for (i = 0; i < num_bands; ++i) {
+    if (launched[i]) worker_interface->Sync(&workers[i]);
+    worker_interface->End(&workers[i]);
+  }
+}
+
+static int PreprocessARGB(const uint8_t* r_ptr,
+                          const uint8_t* g_ptr,
+                          const uint8_t* b_ptr,
+                          int step, int rgb_stride, int thread_level,
+                          WebPPicture* const picture) {
+  // we expand the right/bottom border if needed
+  const int w = (picture->width + 1) & ~1;
+  const int h = (picture->height + 1) & ~1;
+  const int uv_w = w >> 1;
+  const int uv_h = h >> 1;
+  const uint64_t diff_y_threshold = (uint64_t)(3.0 * w * h);
+  int num_bands = GetNumSharpJobs(thread_level, MAX_SHARP_BANDS);
+  int num_passes = GetNumSharpJobs(thread_level, MAX_SHARP_PASSES);
+  int best = 0;
+  int i, ok;
+  SharpContext s;
+
+  memset(&s, 0, sizeof(s));
+  s.r_ptr_ = r_ptr;
+  s.g_ptr_ = g_ptr;
+  s.b_ptr_ = b_ptr;
+  s.step_ = step;
+  s.rgb_stride_ = rgb_stride;
+  s.picture_ = picture;
+  s.w_ = w;
+  s.h_ = h;
+  s.uv_w_ = uv_w;
+  if (num_bands > uv_h) num_bands = uv_h;
+  if (num_passes > num_bands) num_passes = num_bands;
+
+  // TODO(skal): allocate one big memory chunk. But for now, it's easier
+  // for valgrind debugging to have several chunks.
+  s.best_y_[0] = SAFE_ALLOC(w, h, fixed_y_t);
+  s.target_y_ = SAFE_ALLOC(w, h, fixed_y_t);
+  s.best_uv_[0] = SAFE_ALLOC(uv_w * 3, uv_h, fixed_t);
+  s.target_uv_ = SAFE_ALLOC(uv_w * 3, uv_h, fixed_t);
+  if (s.best_y_[0] == NULL || s.best_uv_[0] == NULL ||
+      s.target_y_ == NULL || s.target_uv_ == NULL ||
+      !AllocSharpScratch(&s.scratch_[0], w)) {
+    ok = WebPEncodingSetError(picture, VP8_ENC_ERROR_OUT_OF_MEMORY);
+    goto End;
+  }
+  // The extra memory for the threads is optional.
+  for (i = 1; i < num_bands; ++i) {
+    if (!AllocSharpScratch(&s.scratch_[i], w)) break;
+  }
+  if (i < num_bands) num_bands = num_passes = 1;
+  for (i = 1; i <= num_passes && num_passes > 1; ++i) {
+    s.best_y_[i] = SAFE_ALLOC(w, h, fixed_y_t);
+    s.best_uv_[i] = SAFE_ALLOC(uv_w * 3, uv_h, fixed_t);
+    if (s.best_y_[i] == NULL || s.best_uv_[i] == NULL) num_passes = 1;
+  }
+  assert(picture->width >= kMinDimensionIterativeConversion);
+  assert(picture->height >= kMinDimensionIterativeConversion);
+
+  WebPInitConvertARGBToYUV();
+
+  // Import RGB samples to W/RGB representation.
+  RunSharpBands(&s, ImportBandHook, 0, num_bands);
+
+  // Iterate and resolve clipping conflicts.
+  best = (num_passes > 1) ? RefinePipelined(&s, num_passes, diff_y_threshold)
+                          : RefineInTurn(&s, diff_y_threshold);
   // final reconstruction
-  ok = ConvertWRGBToYUV(best_y_base, best_uv_base, picture);
+  RunSharpBands(&s, ConvertBandHook, best, num_bands);
+  ok = 1;
 
  End:
-  WebPSafeFree(best_y_base);
-  WebPSafeFree(best_uv_base);
-  WebPSafeFree(target_y_base);
-  WebPSafeFree(target_uv_base);
-  WebPSafeFree(best_rgb_y);
-  WebPSafeFree(best_rgb_uv);
-  WebPSafeFree(tmp_buffer);
+  for (i = 0; i <= MAX_SHARP_PASSES; ++i) {
+    WebPSafeFree(s.best_y_[i]);
+    WebPSafeFree(s.best_uv_[i]);
+  }
+  WebPSafeFree(s.target_y_);
+  WebPSafeFree(s.target_uv_);
+  for (i = 0; i < MAX_SHARP_BANDS; ++i) FreeSharpScratch(&s.scratch_[i]);
   return ok;
 }
 #undef SAFE_ALLOC
@@ -847,6 +1135,7 @@ static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
                               int rgb_stride,   // bytes per scanline
                               float dithering,
                               int use_iterative_conversion,
+                              int thread_level,
                               WebPPicture* const picture) {
   int y;
   const int width = picture->width;
@@ -875,7 +1164,8 @@ static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
 
   if (use_iterative_conversion) {
     InitGammaTablesS();
-    if (!PreprocessARGB(r_ptr, g_ptr, b_ptr, step, rgb_stride, picture)) {
+    if (!PreprocessARGB(r_ptr, g_ptr, b_ptr, step, rgb_stride, thread_level,
+                        picture)) {
       return 0;
     }
     if (has_alpha) {
@@ -887,7 +1177,7 @@ static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
     int use_dsp = (step == 3);  // use special function in this case
     // temporary storage for accumulated R/G/B values during conversion to U/V
     uint16_t* const tmp_rgb =
-        (uint16_t*)WebPSafeMalloc(4 * uv_width, sizeof(*tmp_rgb));
+        (uint16_t*)WebPSafeMallocTransient(4 * uv_width, sizeof(*tmp_rgb));
     uint8_t* dst_y = picture->y;
     uint8_t* dst_u = picture->u;
     uint8_t* dst_v = picture->v;
@@ -993,7 +1283,8 @@ static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
 // call for ARGB->YUVA conversion
 
 static int PictureARGBToYUVA(WebPPicture* picture, WebPEncCSP colorspace,
-                             float dithering, int use_iterative_conversion) {
+                             float dithering, int use_iterative_conversion,
+                             int thread_level) {
   if (picture == NULL) return 0;
   if (picture->argb == NULL) {
     return WebPEncodingSetError(picture, VP8_ENC_ERROR_NULL_PARAMETER);
@@ -1008,21 +1299,27 @@ static int PictureARGBToYUVA(WebPPicture* picture, WebPEncCSP colorspace,
 
     picture->colorspace = WEBP_YUV420;
     return ImportYUVAFromRGBA(r, g, b, a, 4, 4 * picture->argb_stride,
-                              dithering, use_iterative_conversion, picture);
+                              dithering, use_iterative_conversion,
+                              thread_level, picture);
   }
 }
 
 int WebPPictureARGBToYUVADithered(WebPPicture* picture, WebPEncCSP colorspace,
                                   float dithering) {
-  return PictureARGBToYUVA(picture, colorspace, dithering, 0);
+  return PictureARGBToYUVA(picture, colorspace, dithering, 0, 0);
 }
 
 int WebPPictureARGBToYUVA(WebPPicture* picture, WebPEncCSP colorspace) {
-  return PictureARGBToYUVA(picture, colorspace, 0.f, 0);
+  return PictureARGBToYUVA(picture, colorspace, 0.f, 0, 0);
 }
 
 int WebPPictureSharpARGBToYUVA(WebPPicture* picture) {
-  return PictureARGBToYUVA(picture, WEBP_YUV420, 0.f, 1);
+  return PictureARGBToYUVA(picture, WEBP_YUV420, 0.f, 1, 0);
+}
+
+int WebPPictureSharpARGBToYUVAThreaded(WebPPicture* const picture,
+                                       int thread_level) {
+  return PictureARGBToYUVA(picture, WEBP_YUV420, 0.f, 1, thread_level);
 }
 // for backward compatibility
 int WebPPictureSmartARGBToYUVA(WebPPicture* picture) {
@@ -1109,7 +1406,7 @@ static int Import(WebPPicture* const picture,
   if (!picture->use_argb) {
     const uint8_t* a_ptr = import_alpha ? rgb + 3 : NULL;
     return ImportYUVAFromRGBA(r_ptr, g_ptr, b_ptr, a_ptr, step, rgb_stride,
-                              0.f /* no dithering */, 0, picture);
+                              0.f /* no dithering */, 0, 0, picture);
   }
   if (!WebPPictureAlloc(picture)) return 0;
 
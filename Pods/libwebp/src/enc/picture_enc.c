@@ -183,30 +183,37 @@ void WebPMemoryWriterInit(WebPMemoryWriter* writer) {
   writer->max_size = 0;
 }
 
+// Grows the buffer of 'w' so that it holds at least 'next_size' bytes. The
+// capacity is doubled, unless 'exact' is true.
+static int MemoryWriterGrow(WebPMemoryWriter* const w, uint64_t next_size,
+                            int exact) {
+  uint8_t* new_mem;
+  uint64_t next_max_size = exact ? 0 : 2ULL * w->max_size;
+  if (next_size <= w->max_size) return 1;
+  if (next_max_size < next_size) next_max_size = next_size;
+  if (next_max_size < 8192ULL) next_max_size = 8192ULL;
+  new_mem = (uint8_t*)WebPSafeMalloc(next_max_size, 1);
+  if (new_mem == NULL) {
+    return 0;
+  }
+  if (w->size > 0) {
+    memcpy(new_mem, w->mem, w->size);
+  }
+  WebPSafeFree(w->mem);
+  w->mem = new_mem;
+  // down-cast is ok, thanks to WebPSafeMalloc
+  w->max_size = (size_t)next_max_size;
+  return 1;
+}
+
 int WebPMemoryWrite(const uint8_t* data, size_t data_size,
                     const WebPPicture* picture) {
   WebPMemoryWriter* const w = (WebPMemoryWriter*)picture->custom_ptr;
-  uint64_t next_size;
   if (w == NULL) {
     return 1;
   }
-  next_size = (uint64_t)w->size + data_size;
-  if (next_size > w->max_size) {
-    uint8_t* new_mem;
-    uint64_t next_max_size = 2ULL * w->max_size;
-    if (next_max_size < next_size) next_max_size = next_size;
-    if (next_max_size < 8192ULL) next_max_size = 8192ULL;
-    new_mem = (uint8_t*)WebPSafeMalloc(next_max_size, 1);
-    if (new_mem == NULL) {
-      return 0;
-    }
-    if (w->size > 0) {
-      memcpy(new_mem, w->mem, w->size);
-    }
-    WebPSafeFree(w->mem);
-    w->mem = new_mem;
-    // down-cast is ok, thanks to WebPSafeMalloc
-    w->max_size = (size_t)next_max_size;
+  if (!MemoryWriterGrow(w, (uint64_t)w->size + data_size, 0)) {
+    return 0;
   }
   if (data_size > 0) {
     memcpy(w->mem + w->size, data, data_size);
@@ -215,6 +222,14 @@ int WebPMemoryWrite(const uint8_t* data, size_t data_size,
   return 1;
 }
 
+int WebPReserveOutput(const WebPPicture* const picture, size_t size) {
+  WebPMemoryWriter* const w = (WebPMemoryWriter*)picture->custom_ptr;
+  if (picture->writer != WebPMemoryWrite || w == NULL) {
+    return 1;
+  }
+  return MemoryWriterGrow(w, (uint64_t)w->size + size, 1);
+}
+
 void WebPMemoryWriterClear(WebPMemoryWriter* writer) {
   if (writer != NULL) {
     WebPSafeFree(writer->mem);
@@ -20,6 +20,7 @@
 
 #include "src/enc/vp8i_enc.h"
 #include "src/utils/rescaler_utils.h"
+#include "src/utils/thread_utils.h"
 #include "src/utils/utils.h"
 
 #define HALVE(x) (((x) + 1) >> 1)
@@ -164,24 +165,126 @@ int WebPPictureCrop(WebPPicture* pic,
 //------------------------------------------------------------------------------
 // Simple picture rescaler
 
-static void RescalePlane(const uint8_t* src,
-                         int src_width, int src_height, int src_stride,
-                         uint8_t* dst,
-                         int dst_width, int dst_height, int dst_stride,
-                         rescaler_t* const work,
-                         int num_channels) {
+// Maximum number of threads, hence of bands per plane.
+#define MAX_RESCALE_THREADS 16
+#define MAX_RESCALE_JOBS (4 * MAX_RESCALE_THREADS)   // for Y, U, V and A
+
+// Rescaling of the output rows [first_row, last_row) of a plane.
+typedef struct {
+  const uint8_t* src_;
+  int src_width_, src_height_, src_stride_;
+  uint8_t* dst_;
+  int dst_width_, dst_height_, dst_stride_;
+  int num_channels_;
+  int first_row_, last_row_;
+} RescaleJob;
+
+static void RescalePlane(const RescaleJob* const job, rescaler_t* const work) {
   WebPRescaler rescaler;
-  int y = 0;
-  WebPRescalerInit(&rescaler, src_width, src_height,
-                   dst, dst_width, dst_height, dst_stride,
-                   num_channels, work);
-  while (y < src_height) {
-    y += WebPRescalerImport(&rescaler, src_height - y,
-                            src + y * src_stride, src_stride);
+  int y;
+  WebPRescalerInit(&rescaler, job->src_width_, job->src_height_,
+                   job->dst_, job->dst_width_, job->dst_height_,
+                   job->dst_stride_, job->num_channels_, work);
+  y = WebPRescalerSetOutputBand(&rescaler, job->first_row_, job->last_row_,
+                                job->src_, job->src_stride_);
+  WebPRescalerExport(&rescaler);   // rows already pending, if any
+  while (y < job->src_height_ && !WebPRescalerOutputDone(&rescaler)) {
+    y += WebPRescalerImport(&rescaler, job->src_height_ - y,
+                            job->src_ + y * job->src_stride_,
+                            job->src_stride_);
     WebPRescalerExport(&rescaler);
   }
 }
 
+// Appends the jobs rescaling a plane in 'num_bands' bands.
+static void AddRescaleJobs(const uint8_t* src,
+                           int src_width, int src_height, int src_stride,
+                           uint8_t* dst,
+                           int dst_width, int dst_height, int dst_stride,
+                           int num_channels, int num_bands,
+                           RescaleJob* const jobs, int* const num_jobs) {
+  int i;
+  if (num_bands > dst_height) num_bands = dst_height;
+  for (i = 0; i < num_bands; ++i) {
+    RescaleJob* const job = &jobs[(*num_jobs)++];
+    assert(*num_jobs <= MAX_RESCALE_JOBS);
+    job->src_ = src;
+    job->src_width_ = src_width;
+    job->src_height_ = src_height;
+    job->src_stride_ = src_stride;
+    job->dst_ = dst;
+    job->dst_width_ = dst_width;
+    job->dst_height_ = dst_height;
+    job->dst_stride_ = dst_stride;
+    job->num_channels_ = num_channels;
+    job->first_row_ = dst_height * i / num_bands;
+    job->last_row_ = dst_height * (i + 1) / num_bands;
+  }
+}
+
+typedef struct {
+  const RescaleJob* jobs_;
+  int num_jobs_;
+  int idx_, num_workers_;
+  rescaler_t* work_;     // scratch memory of this worker
+} RescaleWorkerData;
+
+// Runs the jobs idx, idx + num_workers, ... Planes have as many bands as
+// there are workers, so that each worker gets a band of every plane.
+static int RescaleHook(void* arg1, void* arg2) {
+  const RescaleWorkerData* const data = (const RescaleWorkerData*)arg1;
+  int i;
+  (void)arg2;
+  for (i = data->idx_; i < data->num_jobs_; i += data->num_workers_) {
+    RescalePlane(&data->jobs_[i], data->work_);
+  }
+  return 1;
+}
+
+static int GetNumRescaleThreads(int num_threads) {
+#ifdef WEBP_USE_THREAD
+  if (num_threads > MAX_RESCALE_THREADS) num_threads = MAX_RESCALE_THREADS;
+  return (num_threads > 1) ? num_threads : 1;
+#else
+  (void)num_threads;
+  return 1;
+#endif
+}
+
+// Worker #0 runs in the calling thread, as do the ones that could not be
+// started.
+static void RunRescaleJobs(const RescaleJob* const jobs, int num_jobs,
+                           rescaler_t* const work, size_t work_size,
+                           int num_workers) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  WebPWorker workers[MAX_RESCALE_THREADS];
+  RescaleWorkerData data[MAX_RESCALE_THREADS];
+  int launched[MAX_RESCALE_THREADS];
+  int i;
+  assert(num_workers >= 1 && num_workers <= MAX_RESCALE_THREADS);
+  for (i = 0; i < num_workers; ++i) {
+    WebPWorker* const worker = &workers[i];
+    data[i].jobs_ = jobs;
+    data[i].num_jobs_ = num_jobs;
+    data[i].idx_ = i;
+    data[i].num_workers_ = num_workers;
+    data[i].work_ = work + i * work_size;
+    worker_interface->Init(worker);
+    worker->hook = RescaleHook;
+    worker->data1 = &data[i];
+    worker->data2 = NULL;
+    launched[i] = (i > 0) && worker_interface->Reset(worker);
+    if (launched[i]) worker_interface->Launch(worker);
+  }
+  for (i = 0; i < num_workers; ++i) {
+    if (!launched[i]) worker_interface->Execute(&workers[i]);
+  }
+  for (i = 0; i < num_workers; ++i) {
+    if (launched[i]) worker_interface->Sync(&workers[i]);
+    worker_interface->End(&workers[i]);
+  }
+}
+
 static void AlphaMultiplyARGB(WebPPicture* const pic, int inverse) {
   assert(pic->argb != NULL);
   WebPMultARGBRows((uint8_t*)pic->argb, pic->argb_stride * sizeof(*pic->argb),
@@ -195,10 +298,15 @@ static void AlphaMultiplyY(WebPPicture* const pic, int inverse) {
   }
 }
 
-int WebPPictureRescale(WebPPicture* pic, int width, int height) {
+int WebPPictureRescaleThreaded(WebPPicture* pic, int width, int height,
+                               int num_threads) {
   WebPPicture tmp;
   int prev_width, prev_height;
   rescaler_t* work;
+  size_t work_size;
+  RescaleJob jobs[MAX_RESCALE_JOBS];
+  int num_jobs = 0;
+  const int num_workers = GetNumRescaleThreads(num_threads);
 
   if (pic == NULL) return 0;
   prev_width = pic->width;
@@ -213,50 +321,54 @@ int WebPPictureRescale(WebPPicture* pic, int width, int height) {
   tmp.height = height;
   if (!WebPPictureAlloc(&tmp)) return 0;
 
+  // scratch memory for each worker, sized for the widest plane
+  work_size = 2 * (size_t)width * (pic->use_argb ? 4 : 1);
+  work = (rescaler_t*)WebPSafeMallocTransient(
+      (uint64_t)num_workers * work_size, sizeof(*work));
+  if (work == NULL) {
+    WebPPictureFree(&tmp);
+    return 0;
+  }
+  WebPInitAlphaProcessing();
+
   if (!pic->use_argb) {
-    work = (rescaler_t*)WebPSafeMalloc(2ULL * width, sizeof(*work));
-    if (work == NULL) {
-      WebPPictureFree(&tmp);
-      return 0;
-    }
-    // If present, we need to rescale alpha first (for AlphaMultiplyY).
+    // If present, alpha is rescaled along the other planes, as it is needed
+    // by AlphaMultiplyY() afterward.
     if (pic->a != NULL) {
-      WebPInitAlphaProcessing();
-      RescalePlane(pic->a, prev_width, prev_height, pic->a_stride,
-                   tmp.a, width, height, tmp.a_stride, work, 1);
+      AddRescaleJobs(pic->a, prev_width, prev_height, pic->a_stride,
+                     tmp.a, width, height, tmp.a_stride, 1, num_workers,
+                     jobs, &num_jobs);
     }
 
     // We take transparency into account on the luma plane only. That's not
     // totally exact blending, but still is a good approximation.
     AlphaMultiplyY(pic, 0);
-    RescalePlane(pic->y, prev_width, prev_height, pic->y_stride,
-                 tmp.y, width, height, tmp.y_stride, work, 1);
+    AddRescaleJobs(pic->y, prev_width, prev_height, pic->y_stride,
+                   tmp.y, width, height, tmp.y_stride, 1, num_workers,
+                   jobs, &num_jobs);
+    AddRescaleJobs(pic->u,
+                   HALVE(prev_width), HALVE(prev_height), pic->uv_stride,
+                   tmp.u,
+                   HALVE(width), HALVE(height), tmp.uv_stride, 1, num_workers,
+                   jobs, &num_jobs);
+    AddRescaleJobs(pic->v,
+                   HALVE(prev_width), HALVE(prev_height), pic->uv_stride,
+                   tmp.v,
+                   HALVE(width), HALVE(height), tmp.uv_stride, 1, num_workers,
+                   jobs, &num_jobs);
+    RunRescaleJobs(jobs, num_jobs, work, work_size, num_workers);
     AlphaMultiplyY(&tmp, 1);
-
-    RescalePlane(pic->u,
-                 HALVE(prev_width), HALVE(prev_height), pic->uv_stride,
-                 tmp.u,
-                 HALVE(width), HALVE(height), tmp.uv_stride, work, 1);
-    RescalePlane(pic->v,
-                 HALVE(prev_width), HALVE(prev_height), pic->uv_stride,
-                 tmp.v,
-                 HALVE(width), HALVE(height), tmp.uv_stride, work, 1);
   } else {
-    work = (rescaler_t*)WebPSafeMalloc(2ULL * width * 4, sizeof(*work));
-    if (work == NULL) {
-      WebPPictureFree(&tmp);
-      return 0;
-    }
     // In order to correctly interpolate colors, we need to apply the alpha
     // weighting first (black-matting), scale the RGB values, and remove
     // the premultiplication afterward (while preserving the alpha channel).
-    WebPInitAlphaProcessing();
     AlphaMultiplyARGB(pic, 0);
-    RescalePlane((const uint8_t*)pic->argb, prev_width, prev_height,
-                 pic->argb_stride * 4,
-                 (uint8_t*)tmp.argb, width, height,
-                 tmp.argb_stride * 4,
-                 work, 4);
+    AddRescaleJobs((const uint8_t*)pic->argb, prev_width, prev_height,
+                   pic->argb_stride * 4,
+                   (uint8_t*)tmp.argb, width, height,
+                   tmp.argb_stride * 4,
+                   4, num_workers, jobs, &num_jobs);
+    RunRescaleJobs(jobs, num_jobs, work, work_size, num_workers);
     AlphaMultiplyARGB(&tmp, 1);
   }
   WebPPictureFree(pic);
@@ -265,6 +377,10 @@ int WebPPictureRescale(WebPPicture* pic, int width, int height) {
   return 1;
 }
 
+int WebPPictureRescale(WebPPicture* pic, int width, int height) {
+  return WebPPictureRescaleThreaded(pic, width, height, 0);
+}
+
 #else  // defined(WEBP_REDUCE_SIZE)
 
 int WebPPictureCopy(const WebPPicture* src, WebPPicture* dst) {
@@ -306,4 +422,13 @@ int WebPPictureRescale(WebPPicture* pic, int width, int height) {
   (void)height;
   return 0;
 }
+
+int WebPPictureRescaleThreaded(WebPPicture* pic, int width, int height,
+                               int num_threads) {
+  (void)pic;
+  (void)width;
+  (void)height;
+  (void)num_threads;
+  return 0;
+}
 #endif  // !defined(WEBP_REDUCE_SIZE)
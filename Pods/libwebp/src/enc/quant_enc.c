@@ -244,17 +244,17 @@ static void SetupMatrices(VP8Encoder* enc) {
                         : 0;
   const int num_segments = enc->segment_hdr_.num_segments_;
   for (i = 0; i < num_segments; ++i) {
-    VP8SegmentInfo* const m = &enc->dqm_[i];
+    VP8SegmentInfo* const m = &enc->pass_.dqm_[i];
     const int q = m->quant_;
     int q_i4, q_i16, q_uv;
-    m->y1_.q_[0] = kDcTable[clip(q + enc->dq_y1_dc_, 0, 127)];
+    m->y1_.q_[0] = kDcTable[clip(q + enc->pass_.dq_y1_dc_, 0, 127)];
     m->y1_.q_[1] = kAcTable[clip(q,                  0, 127)];
 
-    m->y2_.q_[0] = kDcTable[ clip(q + enc->dq_y2_dc_, 0, 127)] * 2;
-    m->y2_.q_[1] = kAcTable2[clip(q + enc->dq_y2_ac_, 0, 127)];
+    m->y2_.q_[0] = kDcTable[ clip(q + enc->pass_.dq_y2_dc_, 0, 127)] * 2;
+    m->y2_.q_[1] = kAcTable2[clip(q + enc->pass_.dq_y2_ac_, 0, 127)];
 
-    m->uv_.q_[0] = kDcTable[clip(q + enc->dq_uv_dc_, 0, 117)];
-    m->uv_.q_[1] = kAcTable[clip(q + enc->dq_uv_ac_, 0, 127)];
+    m->uv_.q_[0] = kDcTable[clip(q + enc->pass_.dq_uv_dc_, 0, 117)];
+    m->uv_.q_[1] = kAcTable[clip(q + enc->pass_.dq_uv_ac_, 0, 127)];
 
     q_i4  = ExpandMatrix(&m->y1_, 0);
     q_i16 = ExpandMatrix(&m->y2_, 1);
@@ -298,7 +298,7 @@ static void SetupFilterStrength(VP8Encoder* const enc) {
   // level0 is in [0..500]. Using '-f 50' as filter_strength is mid-filtering.
   const int level0 = 5 * enc->config_->filter_strength;
   for (i = 0; i < NUM_MB_SEGMENTS; ++i) {
-    VP8SegmentInfo* const m = &enc->dqm_[i];
+    VP8SegmentInfo* const m = &enc->pass_.dqm_[i];
     // We focus on the quantization of AC coeffs.
     const int qstep = kAcTable[clip(m->quant_, 0, 127)] >> 2;
     const int base_strength =
@@ -308,7 +308,7 @@ static void SetupFilterStrength(VP8Encoder* const enc) {
     m->fstrength_ = (f < FSTRENGTH_CUTOFF) ? 0 : (f > 63) ? 63 : f;
   }
   // We record the initial strength (mainly for the case of 1-segment only).
-  enc->filter_hdr_.level_ = enc->dqm_[0].fstrength_;
+  enc->filter_hdr_.level_ = enc->pass_.dqm_[0].fstrength_;
   enc->filter_hdr_.simple_ = (enc->config_->filter_type == 0);
   enc->filter_hdr_.sharpness_ = enc->config_->filter_sharpness;
 }
@@ -370,11 +370,11 @@ static void SimplifySegments(VP8Encoder* const enc) {
   int num_final_segments = 1;
   int s1, s2;
   for (s1 = 1; s1 < num_segments; ++s1) {    // find similar segments
-    const VP8SegmentInfo* const S1 = &enc->dqm_[s1];
+    const VP8SegmentInfo* const S1 = &enc->pass_.dqm_[s1];
     int found = 0;
     // check if we already have similar segment
     for (s2 = 0; s2 < num_final_segments; ++s2) {
-      const VP8SegmentInfo* const S2 = &enc->dqm_[s2];
+      const VP8SegmentInfo* const S2 = &enc->pass_.dqm_[s2];
       if (SegmentsAreEquivalent(S1, S2)) {
         found = 1;
         break;
@@ -383,7 +383,7 @@ static void SimplifySegments(VP8Encoder* const enc) {
     map[s1] = s2;
     if (!found) {
       if (num_final_segments != s1) {
-        enc->dqm_[num_final_segments] = enc->dqm_[s1];
+        enc->pass_.dqm_[num_final_segments] = enc->pass_.dqm_[s1];
       }
       ++num_final_segments;
     }
@@ -394,7 +394,7 @@ static void SimplifySegments(VP8Encoder* const enc) {
     enc->segment_hdr_.num_segments_ = num_final_segments;
     // Replicate the trailing segment infos (it's mostly cosmetics)
     for (i = num_final_segments; i < num_segments; ++i) {
-      enc->dqm_[i] = enc->dqm_[num_final_segments - 1];
+      enc->pass_.dqm_[i] = enc->pass_.dqm_[num_final_segments - 1];
     }
   }
 }
@@ -411,19 +411,19 @@ void VP8SetSegmentParams(VP8Encoder* const enc, float quality) {
   for (i = 0; i < num_segments; ++i) {
     // We modulate the base coefficient to accommodate for the quantization
     // susceptibility and allow denser segments to be quantized more.
-    const double expn = 1. - amp * enc->dqm_[i].alpha_;
+    const double expn = 1. - amp * enc->pass_.dqm_[i].alpha_;
     const double c = pow(c_base, expn);
     const int q = (int)(127. * (1. - c));
     assert(expn > 0.);
-    enc->dqm_[i].quant_ = clip(q, 0, 127);
+    enc->pass_.dqm_[i].quant_ = clip(q, 0, 127);
   }
 
   // purely indicative in the bitstream (except for the 1-segment case)
-  enc->base_quant_ = enc->dqm_[0].quant_;
+  enc->pass_.base_quant_ = enc->pass_.dqm_[0].quant_;
 
   // fill-in values for the unused segments (required by the syntax)
   for (i = num_segments; i < NUM_MB_SEGMENTS; ++i) {
-    enc->dqm_[i].quant_ = enc->base_quant_;
+    enc->pass_.dqm_[i].quant_ = enc->pass_.base_quant_;
   }
 
   // uv_alpha_ is normally spread around ~60. The useful range is
@@ -441,11 +441,11 @@ void VP8SetSegmentParams(VP8Encoder* const enc, float quality) {
   dq_uv_dc = -4 * enc->config_->sns_strength / 100;
   dq_uv_dc = clip(dq_uv_dc, -15, 15);   // 4bit-signed max allowed
 
-  enc->dq_y1_dc_ = 0;       // TODO(skal): dq-lum
-  enc->dq_y2_dc_ = 0;
-  enc->dq_y2_ac_ = 0;
-  enc->dq_uv_dc_ = dq_uv_dc;
-  enc->dq_uv_ac_ = dq_uv_ac;
+  enc->pass_.dq_y1_dc_ = 0;       // TODO(skal): dq-lum
+  enc->pass_.dq_y2_dc_ = 0;
+  enc->pass_.dq_y2_ac_ = 0;
+  enc->pass_.dq_uv_dc_ = dq_uv_dc;
+  enc->pass_.dq_uv_ac_ = dq_uv_ac;
 
   SetupFilterStrength(enc);   // initialize segments' filtering, eventually
 
@@ -590,9 +590,9 @@ static int TrellisQuantizeBlock(const VP8Encoder* const enc,
                                 int ctx0, int coeff_type,
                                 const VP8Matrix* const mtx,
                                 int lambda) {
-  const ProbaArray* const probas = enc->proba_.coeffs_[coeff_type];
+  const ProbaArray* const probas = enc->pass_.proba_.coeffs_[coeff_type];
   CostArrayPtr const costs =
-      (CostArrayPtr)enc->proba_.remapped_costs_[coeff_type];
+      (CostArrayPtr)enc->pass_.proba_.remapped_costs_[coeff_type];
   const int first = (coeff_type == 0) ? 1 : 0;
   Node nodes[16][NUM_NODES];
   ScoreState score_states[2][NUM_NODES];
@@ -758,7 +758,7 @@ static int ReconstructIntra16(VP8EncIterator* const it,
   const VP8Encoder* const enc = it->enc_;
   const uint8_t* const ref = it->yuv_p_ + VP8I16ModeOffsets[mode];
   const uint8_t* const src = it->yuv_in_ + Y_OFF_ENC;
-  const VP8SegmentInfo* const dqm = &enc->dqm_[it->mb_->segment_];
+  const VP8SegmentInfo* const dqm = &enc->pass_.dqm_[it->mb_->segment_];
   int nz = 0;
   int n;
   int16_t tmp[16][16], dc_tmp[16];
@@ -810,7 +810,7 @@ static int ReconstructIntra4(VP8EncIterator* const it,
                              int mode) {
   const VP8Encoder* const enc = it->enc_;
   const uint8_t* const ref = it->yuv_p_ + VP8I4ModeOffsets[mode];
-  const VP8SegmentInfo* const dqm = &enc->dqm_[it->mb_->segment_];
+  const VP8SegmentInfo* const dqm = &enc->pass_.dqm_[it->mb_->segment_];
   int nz = 0;
   int16_t tmp[16];
 
@@ -911,7 +911,7 @@ static int ReconstructUV(VP8EncIterator* const it, VP8ModeScore* const rd,
   const VP8Encoder* const enc = it->enc_;
   const uint8_t* const ref = it->yuv_p_ + VP8UVModeOffsets[mode];
   const uint8_t* const src = it->yuv_in_ + U_OFF_ENC;
-  const VP8SegmentInfo* const dqm = &enc->dqm_[it->mb_->segment_];
+  const VP8SegmentInfo* const dqm = &enc->pass_.dqm_[it->mb_->segment_];
   int nz = 0;
   int n;
   int16_t tmp[8][16];
@@ -951,15 +951,18 @@ static int ReconstructUV(VP8EncIterator* const it, VP8ModeScore* const rd,
 // RD-opt decision. Reconstruct each modes, evalue distortion and bit-cost.
 // Pick the mode is lower RD-cost = Rate + lambda * Distortion.
 
-static void StoreMaxDelta(VP8SegmentInfo* const dqm, const int16_t DCs[16]) {
+static void StoreMaxDelta(VP8EncIterator* const it,
+                          VP8SegmentInfo* const dqm, const int16_t DCs[16]) {
   // We look at the first three AC coefficients to determine what is the average
   // delta between each sub-4x4 block.
   const int v0 = abs(DCs[1]);
   const int v1 = abs(DCs[2]);
   const int v2 = abs(DCs[4]);
   int max_v = (v1 > v0) ? v1 : v0;
+  int* const max_edge = (it->max_edge_ != NULL)
+                      ? &it->max_edge_[it->mb_->segment_] : &dqm->max_edge_;
   max_v = (v2 > max_v) ? v2 : max_v;
-  if (max_v > dqm->max_edge_) dqm->max_edge_ = max_v;
+  if (max_v > *max_edge) *max_edge = max_v;
 }
 
 static void SwapModeScore(VP8ModeScore** a, VP8ModeScore** b) {
@@ -980,7 +983,7 @@ static void SwapOut(VP8EncIterator* const it) {
 
 static void PickBestIntra16(VP8EncIterator* const it, VP8ModeScore* rd) {
   const int kNumBlocks = 16;
-  VP8SegmentInfo* const dqm = &it->enc_->dqm_[it->mb_->segment_];
+  VP8SegmentInfo* const dqm = &it->enc_->pass_.dqm_[it->mb_->segment_];
   const int lambda = dqm->lambda_i16_;
   const int tlambda = dqm->tlambda_;
   const uint8_t* const src = it->yuv_in_ + Y_OFF_ENC;
@@ -1031,7 +1034,7 @@ static void PickBestIntra16(VP8EncIterator* const it, VP8ModeScore* rd) {
   // distortion, record max delta so we can later adjust the minimal filtering
   // strength needed to smooth these blocks out.
   if ((rd->nz & 0x100ffff) == 0x1000000 && rd->D > dqm->min_disto_) {
-    StoreMaxDelta(dqm, rd->y_dc_levels);
+    StoreMaxDelta(it, dqm, rd->y_dc_levels);
   }
 }
 
@@ -1049,7 +1052,7 @@ static const uint16_t* GetCostModeI4(VP8EncIterator* const it,
 
 static int PickBestIntra4(VP8EncIterator* const it, VP8ModeScore* const rd) {
   const VP8Encoder* const enc = it->enc_;
-  const VP8SegmentInfo* const dqm = &enc->dqm_[it->mb_->segment_];
+  const VP8SegmentInfo* const dqm = &enc->pass_.dqm_[it->mb_->segment_];
   const int lambda = dqm->lambda_i4_;
   const int tlambda = dqm->tlambda_;
   const uint8_t* const src0 = it->yuv_in_ + Y_OFF_ENC;
@@ -1145,7 +1148,7 @@ static int PickBestIntra4(VP8EncIterator* const it, VP8ModeScore* const rd) {
 
 static void PickBestUV(VP8EncIterator* const it, VP8ModeScore* const rd) {
   const int kNumBlocks = 8;
-  const VP8SegmentInfo* const dqm = &it->enc_->dqm_[it->mb_->segment_];
+  const VP8SegmentInfo* const dqm = &it->enc_->pass_.dqm_[it->mb_->segment_];
   const int lambda = dqm->lambda_uv_;
   const uint8_t* const src = it->yuv_in_ + U_OFF_ENC;
   uint8_t* tmp_dst = it->yuv_out2_ + U_OFF_ENC;  // scratch buffer
@@ -1228,7 +1231,7 @@ static void RefineUsingDistortion(VP8EncIterator* const it,
   int mode;
   int is_i16 = try_both_modes || (it->mb_->type_ == 1);
 
-  const VP8SegmentInfo* const dqm = &it->enc_->dqm_[it->mb_->segment_];
+  const VP8SegmentInfo* const dqm = &it->enc_->pass_.dqm_[it->mb_->segment_];
   // Some empiric constants, of approximate order of magnitude.
   const int lambda_d_i16 = 106;
   const int lambda_d_i4 = 11;
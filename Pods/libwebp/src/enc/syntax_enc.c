@@ -187,7 +187,7 @@ static int PutWebPHeaders(const VP8Encoder* const enc, size_t size0,
 static void PutSegmentHeader(VP8BitWriter* const bw,
                              const VP8Encoder* const enc) {
   const VP8EncSegmentHeader* const hdr = &enc->segment_hdr_;
-  const VP8EncProba* const proba = &enc->proba_;
+  const VP8EncProba* const proba = &enc->pass_.proba_;
   if (VP8PutBitUniform(bw, (hdr->num_segments_ > 1))) {
     // We always 'update' the quant and filter strength values
     const int update_data = 1;
@@ -197,10 +197,10 @@ static void PutSegmentHeader(VP8BitWriter* const bw,
       // we always use absolute values, not relative ones
       VP8PutBitUniform(bw, 1);   // (segment_feature_mode = 1. Paragraph 9.3.)
       for (s = 0; s < NUM_MB_SEGMENTS; ++s) {
-        VP8PutSignedBits(bw, enc->dqm_[s].quant_, 7);
+        VP8PutSignedBits(bw, enc->pass_.dqm_[s].quant_, 7);
       }
       for (s = 0; s < NUM_MB_SEGMENTS; ++s) {
-        VP8PutSignedBits(bw, enc->dqm_[s].fstrength_, 6);
+        VP8PutSignedBits(bw, enc->pass_.dqm_[s].fstrength_, 6);
       }
     }
     if (hdr->update_map_) {
@@ -236,12 +236,12 @@ static void PutFilterHeader(VP8BitWriter* const bw,
 // Nominal quantization parameters
 static void PutQuant(VP8BitWriter* const bw,
                      const VP8Encoder* const enc) {
-  VP8PutBits(bw, enc->base_quant_, 7);
-  VP8PutSignedBits(bw, enc->dq_y1_dc_, 4);
-  VP8PutSignedBits(bw, enc->dq_y2_dc_, 4);
-  VP8PutSignedBits(bw, enc->dq_y2_ac_, 4);
-  VP8PutSignedBits(bw, enc->dq_uv_dc_, 4);
-  VP8PutSignedBits(bw, enc->dq_uv_ac_, 4);
+  VP8PutBits(bw, enc->pass_.base_quant_, 7);
+  VP8PutSignedBits(bw, enc->pass_.dq_y1_dc_, 4);
+  VP8PutSignedBits(bw, enc->pass_.dq_y2_dc_, 4);
+  VP8PutSignedBits(bw, enc->pass_.dq_y2_ac_, 4);
+  VP8PutSignedBits(bw, enc->pass_.dq_uv_dc_, 4);
+  VP8PutSignedBits(bw, enc->pass_.dq_uv_ac_, 4);
 }
 
 // Partition sizes
@@ -282,7 +282,7 @@ static int GeneratePartition0(VP8Encoder* const enc) {
                  enc->num_parts_ == 2 ? 1 : 0, 2);
   PutQuant(bw, enc);
   VP8PutBitUniform(bw, 0);   // no proba update
-  VP8WriteProbas(bw, &enc->proba_);
+  VP8WriteProbas(bw, &enc->pass_.proba_);
   pos2 = VP8BitWriterPos(bw);
   VP8CodeIntraModes(enc);
   VP8BitWriterFinish(bw);
@@ -314,6 +314,52 @@ void VP8EncFreeBitWriters(VP8Encoder* const enc) {
   }
 }
 
+//------------------------------------------------------------------------------
+// Streamed token partition
+
+#define STREAM_CHUNK_SIZE (64 * 1024)   // bytes handed to the writer at once
+
+#if !defined(DISABLE_TOKEN_BUFFER)
+
+// Codes the recorded tokens into the (single) token partition. If 'pic' is
+// NULL, the partition is only measured and the tokens are kept for the next
+// call. Otherwise, it is sent to the writer chunk by chunk and the tokens are
+// released along the way.
+static int StreamTokenPartition(VP8Encoder* const enc,
+                                const WebPPicture* const pic,
+                                uint64_t* const size) {
+  VP8BitWriter* const bw = enc->parts_ + 0;
+  int ok, oom;
+  assert(enc->num_parts_ == 1);
+  VP8BitWriterWipeOut(bw);
+  ok = VP8BitWriterInit(bw, STREAM_CHUNK_SIZE) &&
+       VP8StreamTokens(&enc->tokens_, bw,
+                       (const uint8_t*)enc->pass_.proba_.coeffs_,
+                       (pic != NULL), STREAM_CHUNK_SIZE, pic, size);
+  oom = bw->error_;
+  VP8BitWriterWipeOut(bw);
+  if (!ok) {
+    return WebPEncodingSetError(enc->pic_, oom ? VP8_ENC_ERROR_OUT_OF_MEMORY
+                                               : VP8_ENC_ERROR_BAD_WRITE);
+  }
+  return 1;
+}
+
+#else
+
+static int StreamTokenPartition(VP8Encoder* const enc,
+                                const WebPPicture* const pic,
+                                uint64_t* const size) {
+  (void)enc;
+  (void)pic;
+  (void)size;
+  return 0;   // we shouldn't be here.
+}
+
+#endif    // DISABLE_TOKEN_BUFFER
+
+//------------------------------------------------------------------------------
+
 int VP8EncWrite(VP8Encoder* const enc) {
   WebPPicture* const pic = enc->pic_;
   VP8BitWriter* const bw = &enc->bw_;
@@ -322,16 +368,28 @@ int VP8EncWrite(VP8Encoder* const enc) {
   const int final_percent = enc->percent_ + task_percent;
   int ok = 0;
   size_t vp8_size, pad, riff_size;
+  uint64_t stream_size = 0;
   int p;
 
   // Partition #0 with header and partition sizes
   ok = GeneratePartition0(enc);
   if (!ok) return 0;
 
+  // The headers need the size of the token partition before any of it can be
+  // written: measure it first, without keeping the coded bytes.
+  if (enc->stream_tokens_) {
+    ok = StreamTokenPartition(enc, NULL, &stream_size);
+    if (!ok) return 0;
+    if (stream_size > 0xfffffffeU) {
+      return WebPEncodingSetError(pic, VP8_ENC_ERROR_FILE_TOO_BIG);
+    }
+  }
+
   // Compute VP8 size
   vp8_size = VP8_FRAME_HEADER_SIZE +
              VP8BitWriterSize(bw) +
-             3 * (enc->num_parts_ - 1);
+             3 * (enc->num_parts_ - 1) +
+             (size_t)stream_size;
   for (p = 0; p < enc->num_parts_; ++p) {
     vp8_size += VP8BitWriterSize(enc->parts_ + p);
   }
@@ -354,6 +412,10 @@ int VP8EncWrite(VP8Encoder* const enc) {
     return WebPEncodingSetError(pic, VP8_ENC_ERROR_FILE_TOO_BIG);
   }
 
+  if (!WebPReserveOutput(pic, CHUNK_HEADER_SIZE + riff_size)) {
+    return WebPEncodingSetError(pic, VP8_ENC_ERROR_OUT_OF_MEMORY);
+  }
+
   // Emit headers and partition #0
   {
     const uint8_t* const part0 = VP8BitWriterBuf(bw);
@@ -365,13 +427,21 @@ int VP8EncWrite(VP8Encoder* const enc) {
   }
 
   // Token partitions
-  for (p = 0; p < enc->num_parts_; ++p) {
-    const uint8_t* const buf = VP8BitWriterBuf(enc->parts_ + p);
-    const size_t size = VP8BitWriterSize(enc->parts_ + p);
-    if (size) ok = ok && pic->writer(buf, size, pic);
-    VP8BitWriterWipeOut(enc->parts_ + p);    // will free the internal buffer.
+  if (enc->stream_tokens_) {
+    uint64_t size = 0;
+    ok = ok && StreamTokenPartition(enc, pic, &size);
+    assert(!ok || size == stream_size);
     ok = ok && WebPReportProgress(pic, enc->percent_ + percent_per_part,
                                   &enc->percent_);
+  } else {
+    for (p = 0; p < enc->num_parts_; ++p) {
+      const uint8_t* const buf = VP8BitWriterBuf(enc->parts_ + p);
+      const size_t size = VP8BitWriterSize(enc->parts_ + p);
+      if (size) ok = ok && pic->writer(buf, size, pic);
+      VP8BitWriterWipeOut(enc->parts_ + p);  // will free the internal buffer.
+      ok = ok && WebPReportProgress(pic, enc->percent_ + percent_per_part,
+                                    &enc->percent_);
+    }
   }
 
   // Padding byte
@@ -67,7 +67,7 @@ static int TBufferNewPage(VP8TBuffer* const b) {
   VP8Tokens* page = NULL;
   if (!b->error_) {
     const size_t size = sizeof(*page) + b->page_size_ * sizeof(token_t);
-    page = (VP8Tokens*)WebPSafeMalloc(1ULL, size);
+    page = (VP8Tokens*)WebPSafeMallocTransient(1ULL, size);
   }
   if (page == NULL) {
     b->error_ = 1;
@@ -194,9 +194,47 @@ int VP8RecordCoeffTokens(int ctx, const struct VP8Residual* const res,
 
 #undef TOKEN_ID
 
+//------------------------------------------------------------------------------
+
+int VP8TBufferAppend(VP8TBuffer* const dst, const VP8TBuffer* const src) {
+  const VP8Tokens* p = src->pages_;
+  assert(!src->error_);
+  while (p != NULL) {
+    const VP8Tokens* const next = p->next_;
+    const int N = (next == NULL) ? src->left_ : 0;
+    int n = src->page_size_;
+    const token_t* const tokens = TOKEN_DATA(p);
+    while (n > N) {
+      // Both buffers are filled backward, so tokens can be copied as blocks.
+      int num = n - N;
+      if (dst->left_ == 0 && !TBufferNewPage(dst)) return 0;
+      if (num > dst->left_) num = dst->left_;
+      dst->left_ -= num;
+      n -= num;
+      memcpy(dst->tokens_ + dst->left_, tokens + n, num * sizeof(*tokens));
+    }
+    p = next;
+  }
+  return 1;
+}
+
 //------------------------------------------------------------------------------
 // Final coding pass, with known probabilities
 
+static void PutPageTokens(const token_t* const tokens, int n, int N,
+                          VP8BitWriter* const bw,
+                          const uint8_t* const probas) {
+  while (n-- > N) {
+    const token_t token = tokens[n];
+    const int bit = (token >> 15) & 1;
+    if (token & FIXED_PROBA_BIT) {
+      VP8PutBit(bw, bit, token & 0xffu);  // constant proba
+    } else {
+      VP8PutBit(bw, bit, probas[token & 0x3fffu]);
+    }
+  }
+}
+
 int VP8EmitTokens(VP8TBuffer* const b, VP8BitWriter* const bw,
                   const uint8_t* const probas, int final_pass) {
   const VP8Tokens* p = b->pages_;
@@ -204,17 +242,7 @@ int VP8EmitTokens(VP8TBuffer* const b, VP8BitWriter* const bw,
   while (p != NULL) {
     const VP8Tokens* const next = p->next_;
     const int N = (next == NULL) ? b->left_ : 0;
-    int n = b->page_size_;
-    const token_t* const tokens = TOKEN_DATA(p);
-    while (n-- > N) {
-      const token_t token = tokens[n];
-      const int bit = (token >> 15) & 1;
-      if (token & FIXED_PROBA_BIT) {
-        VP8PutBit(bw, bit, token & 0xffu);  // constant proba
-      } else {
-        VP8PutBit(bw, bit, probas[token & 0x3fffu]);
-      }
-    }
+    PutPageTokens(TOKEN_DATA(p), b->page_size_, N, bw, probas);
     if (final_pass) WebPSafeFree((void*)p);
     p = next;
   }
@@ -222,6 +250,44 @@ int VP8EmitTokens(VP8TBuffer* const b, VP8BitWriter* const bw,
   return 1;
 }
 
+// Hands the first 'size' bytes of 'bw' over to the picture's writer (if any).
+static int DrainBytes(VP8BitWriter* const bw, size_t size,
+                      const WebPPicture* const pic, uint64_t* const total) {
+  if (pic != NULL && !pic->writer(VP8BitWriterBuf(bw), size, pic)) return 0;
+  VP8BitWriterDrop(bw, size);
+  *total += size;
+  return 1;
+}
+
+int VP8StreamTokens(VP8TBuffer* const b, VP8BitWriter* const bw,
+                    const uint8_t* const probas, int final_pass,
+                    size_t chunk_size, const WebPPicture* const pic,
+                    uint64_t* const size) {
+  const VP8Tokens* p = b->pages_;
+  int ok = 1;
+  assert(!b->error_);
+  assert(chunk_size > 0);
+  *size = 0;
+  while (p != NULL) {
+    const VP8Tokens* const next = p->next_;
+    const int N = (next == NULL) ? b->left_ : 0;
+    PutPageTokens(TOKEN_DATA(p), b->page_size_, N, bw, probas);
+    if (final_pass) WebPSafeFree((void*)p);
+    p = next;
+    while (ok && !bw->error_ && VP8BitWriterFinalSize(bw) >= chunk_size) {
+      ok = DrainBytes(bw, chunk_size, pic, size);
+    }
+    if (final_pass) b->pages_ = (VP8Tokens*)p;
+    if (!ok || bw->error_) return 0;
+  }
+  VP8BitWriterFinish(bw);
+  while (ok && !bw->error_ && VP8BitWriterSize(bw) > 0) {
+    const size_t left = VP8BitWriterSize(bw);
+    ok = DrainBytes(bw, (left < chunk_size) ? left : chunk_size, pic, size);
+  }
+  return ok && !bw->error_;
+}
+
 // Size estimation
 size_t VP8EstimateTokenSize(VP8TBuffer* const b, const uint8_t* const probas) {
   size_t size = 0;
@@ -154,7 +154,7 @@ const uint8_t
 };
 
 void VP8DefaultProbas(VP8Encoder* const enc) {
-  VP8EncProba* const probas = &enc->proba_;
+  VP8EncProba* const probas = &enc->pass_.proba_;
   probas->use_skip_proba_ = 0;
   memset(probas->segments_, 255u, sizeof(probas->segments_));
   memcpy(probas->coeffs_, VP8CoeffsProba0, sizeof(VP8CoeffsProba0));
@@ -318,10 +318,10 @@ void VP8CodeIntraModes(VP8Encoder* const enc) {
     const VP8MBInfo* const mb = it.mb_;
     const uint8_t* preds = it.preds_;
     if (enc->segment_hdr_.update_map_) {
-      PutSegment(bw, mb->segment_, enc->proba_.segments_);
+      PutSegment(bw, mb->segment_, enc->pass_.proba_.segments_);
     }
-    if (enc->proba_.use_skip_proba_) {
-      VP8PutBit(bw, mb->skip_, enc->proba_.skip_proba_);
+    if (enc->pass_.proba_.use_skip_proba_) {
+      VP8PutBit(bw, mb->skip_, enc->pass_.proba_.skip_proba_);
     }
     if (VP8PutBit(bw, (mb->type_ != 0), 145)) {  // i16x16
       PutI16Mode(bw, preds[0]);
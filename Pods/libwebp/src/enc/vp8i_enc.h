@@ -204,6 +204,21 @@ typedef struct {
   score_t i4_penalty_;   // penalty for using Intra4
 } VP8SegmentInfo;
 
+// State resulting from a coding pass: the quantizers it used and the
+// probabilities it collected. The search passes hand it over from one copy of
+// the encoder to another (see frame_enc.c).
+typedef struct {
+  // quantization info (one set of DC/AC dequant factor per segment)
+  VP8SegmentInfo dqm_[NUM_MB_SEGMENTS];
+  int base_quant_;                 // nominal quantizer value. Only used
+                                   // for relative coding of segments' quant.
+  // global offset of quantizers, shared by all segments
+  int dq_y1_dc_;
+  int dq_y2_dc_, dq_y2_ac_;
+  int dq_uv_dc_, dq_uv_ac_;
+  VP8EncProba proba_;              // probabilities and statistics
+} VP8EncPassState;
+
 typedef int8_t DError[2 /* u/v */][2 /* top or left */];
 
 // Handy transient struct to accumulate score and info during RD-optimization
@@ -243,6 +258,9 @@ typedef struct {
   uint64_t      luma_bits_;        // macroblock bit-cost for luma
   uint64_t      uv_bits_;          // macroblock bit-cost for chroma
   LFStats*      lf_stats_;         // filter stats (borrowed from enc_)
+  StatsArray  (*stats_)[NUM_BANDS];  // token stats (borrowed from enc_)
+  int*          max_edge_;         // if not NULL, per-segment max edge deltas
+                                   // to update instead of enc_->pass_.dqm_[]'s
   int           do_trellis_;       // if true, perform extra level optimisation
   int           count_down_;       // number of mb still to be processed
   int           count_down0_;      // starting counter value (for progress)
@@ -278,7 +296,8 @@ int VP8IteratorIsDone(const VP8EncIterator* const it);
 // Import uncompressed samples from source.
 // If tmp_32 is not NULL, import boundary samples too.
 // tmp_32 is a 32-bytes scratch buffer that must be aligned in memory.
-void VP8IteratorImport(VP8EncIterator* const it, uint8_t* const tmp_32);
+// Returns false in case of error (only possible with a row source).
+int VP8IteratorImport(VP8EncIterator* const it, uint8_t* const tmp_32);
 // export decimated samples
 void VP8IteratorExport(const VP8EncIterator* const it);
 // go to next macroblock. Returns false if not finished.
@@ -288,6 +307,8 @@ void VP8IteratorSaveBoundary(VP8EncIterator* const it);
 // Report progression based on macroblock rows. Return 0 for user-abort request.
 int VP8IteratorProgress(const VP8EncIterator* const it,
                         int final_delta_percent);
+// Releases the samples fetched from the picture's row source, if any.
+void VP8IteratorFreeSourceRows(VP8Encoder* const enc);
 // Intra4x4 iterations
 void VP8IteratorStartI4(VP8EncIterator* const it);
 // returns true if not done.
@@ -327,11 +348,26 @@ void VP8TBufferClear(VP8TBuffer* const b);   // de-allocate pages memory
 
 #if !defined(DISABLE_TOKEN_BUFFER)
 
+// Appends the tokens of 'src' at the end of 'dst'. Returns false in case of
+// memory error.
+int VP8TBufferAppend(VP8TBuffer* const dst, const VP8TBuffer* const src);
+
 // Finalizes bitstream when probabilities are known.
 // Deletes the allocated token memory if final_pass is true.
 int VP8EmitTokens(VP8TBuffer* const b, VP8BitWriter* const bw,
                   const uint8_t* const probas, int final_pass);
 
+// Same as VP8EmitTokens(), but hands the bytes of 'bw' over to 'pic->writer'
+// in chunks of 'chunk_size' as soon as they are final, so that 'bw' never
+// holds much more than that. If 'pic' is NULL, the bytes are only counted.
+// 'bw' is finished, and '*size' is set to the total number of bytes produced.
+// Returns false in case of memory error (bw->error_ is then set) or if the
+// writer failed.
+int VP8StreamTokens(VP8TBuffer* const b, VP8BitWriter* const bw,
+                    const uint8_t* const probas, int final_pass,
+                    size_t chunk_size, const WebPPicture* const pic,
+                    uint64_t* const size);
+
 // record the coding of coefficients without knowing the probabilities yet
 int VP8RecordCoeffTokens(int ctx, const struct VP8Residual* const res,
                          VP8TBuffer* const tokens);
@@ -374,19 +410,12 @@ struct VP8Encoder {
   uint32_t alpha_data_size_;
   WebPWorker alpha_worker_;
 
-  // quantization info (one set of DC/AC dequant factor per segment)
-  VP8SegmentInfo dqm_[NUM_MB_SEGMENTS];
-  int base_quant_;                 // nominal quantizer value. Only used
-                                   // for relative coding of segments' quant.
+  // quantizers and probabilities
+  VP8EncPassState pass_;
   int alpha_;                      // global susceptibility (<=> complexity)
   int uv_alpha_;                   // U/V quantization susceptibility
-  // global offset of quantizers, shared by all segments
-  int dq_y1_dc_;
-  int dq_y2_dc_, dq_y2_ac_;
-  int dq_uv_dc_, dq_uv_ac_;
 
-  // probabilities and statistics
-  VP8EncProba proba_;
+  // statistics
   uint64_t    sse_[4];      // sum of Y/U/V/A squared errors for all macroblocks
   uint64_t    sse_count_;   // pixel count for the sse_[] stats
   int         coded_size_;
@@ -401,6 +430,7 @@ struct VP8Encoder {
   int thread_level_;         // derived from config->thread_level
   int do_search_;            // derived from config->target_XXX
   int use_tokens_;           // if true, use token buffer
+  int stream_tokens_;        // if true, tokens are only coded when writing
 
   // Memory
   VP8MBInfo* mb_info_;   // contextual macroblock infos (mb_w_ + 1)
@@ -411,6 +441,12 @@ struct VP8Encoder {
                          // U and V are packed into 16 bytes (8 U + 8 V)
   LFStats*   lf_stats_;  // autofilter stats (if NULL, autofilter is off)
   DError*    top_derr_;  // diffusion error (NULL if disabled)
+
+  // Row source (see pic_->row_source): samples of one macroblock row
+  WebPPicture rows_;       // YUV samples of rows [rows_y_, rows_y_ + height)
+  int         rows_y_;
+  int         rows_mb_y_;  // macroblock row held in rows_, or -1
+  uint8_t*    rows_rgb_;   // RGB samples, as filled by the row source
 };
 
 //------------------------------------------------------------------------------
@@ -505,6 +541,16 @@ int WebPPictureAllocARGB(WebPPicture* const picture, int width, int height);
 // Returns false in case of error (invalid param, out-of-memory).
 int WebPPictureAllocYUVA(WebPPicture* const picture, int width, int height);
 
+// Same as WebPPictureSharpARGBToYUVA(), spreading the work over up to
+// 'thread_level' threads when it is above 1. The result does not depend on it.
+int WebPPictureSharpARGBToYUVAThreaded(WebPPicture* const picture,
+                                       int thread_level);
+
+// If 'picture' writes to a WebPMemoryWriter, grows its buffer in one step so
+// that 'size' more bytes fit without any reallocation. Returns false in case of
+// memory error.
+int WebPReserveOutput(const WebPPicture* const picture, size_t size);
+
 // Clean-up the RGB samples under fully transparent area, to help lossless
 // compressibility (no guarantee, though). Assumes that pic->use_argb is true.
 void WebPCleanupTransparentAreaLossless(WebPPicture* const pic);
@@ -201,7 +201,7 @@ static int AnalyzeEntropy(const uint32_t* argb,
     *red_and_blue_always_zero = 1;
     return 1;
   }
-  histo = (uint32_t*)WebPSafeCalloc(kHistoTotal, sizeof(*histo) * 256);
+  histo = (uint32_t*)WebPSafeCallocTransient(kHistoTotal, sizeof(*histo) * 256);
   if (histo != NULL) {
     int i, x, y;
     const uint32_t* prev_row = NULL;
@@ -476,8 +476,8 @@ static int GetHuffBitLengthsAndCodes(
   {
     uint16_t* codes;
     uint8_t* lengths;
-    mem_buf = (uint8_t*)WebPSafeCalloc(total_length_size,
-                                       sizeof(*lengths) + sizeof(*codes));
+    mem_buf = (uint8_t*)WebPSafeCallocTransient(
+        total_length_size, sizeof(*lengths) + sizeof(*codes));
     if (mem_buf == NULL) goto End;
 
     codes = (uint16_t*)mem_buf;
@@ -494,9 +494,9 @@ static int GetHuffBitLengthsAndCodes(
     }
   }
 
-  buf_rle = (uint8_t*)WebPSafeMalloc(1ULL, max_num_symbols);
-  huff_tree = (HuffmanTree*)WebPSafeMalloc(3ULL * max_num_symbols,
-                                           sizeof(*huff_tree));
+  buf_rle = (uint8_t*)WebPSafeMallocTransient(1ULL, max_num_symbols);
+  huff_tree = (HuffmanTree*)WebPSafeMallocTransient(3ULL * max_num_symbols,
+                                                    sizeof(*huff_tree));
   if (buf_rle == NULL || huff_tree == NULL) goto End;
 
   // Create Huffman trees.
@@ -785,7 +785,7 @@ static WebPEncodingError EncodeImageNoHuffman(VP8LBitWriter* const bw,
   const uint16_t histogram_symbols[1] = { 0 };    // only one tree, one symbol
   int cache_bits = 0;
   VP8LHistogramSet* histogram_image = NULL;
-  HuffmanTree* const huff_tree = (HuffmanTree*)WebPSafeMalloc(
+  HuffmanTree* const huff_tree = (HuffmanTree*)WebPSafeMallocTransient(
         3ULL * CODE_LENGTH_CODES, sizeof(*huff_tree));
   if (huff_tree == NULL) {
     err = VP8_ENC_ERROR_OUT_OF_MEMORY;
@@ -794,7 +794,7 @@ static WebPEncodingError EncodeImageNoHuffman(VP8LBitWriter* const bw,
 
   // Calculate backward references from ARGB image.
   if (!VP8LHashChainFill(hash_chain, quality, argb, width, height,
-                         low_effort)) {
+                         low_effort, 0 /* thread_level */)) {
     err = VP8_ENC_ERROR_OUT_OF_MEMORY;
     goto Error;
   }
@@ -833,7 +833,8 @@ static WebPEncodingError EncodeImageNoHuffman(VP8LBitWriter* const bw,
     }
   }
 
-  tokens = (HuffmanTreeToken*)WebPSafeMalloc(max_tokens, sizeof(*tokens));
+  tokens =
+      (HuffmanTreeToken*)WebPSafeMallocTransient(max_tokens, sizeof(*tokens));
   if (tokens == NULL) {
     err = VP8_ENC_ERROR_OUT_OF_MEMORY;
     goto Error;
@@ -863,7 +864,8 @@ static WebPEncodingError EncodeImageInternal(
     VP8LHashChain* const hash_chain, VP8LBackwardRefs refs_array[3], int width,
     int height, int quality, int low_effort, int use_cache,
     const CrunchConfig* const config, int* cache_bits, int histogram_bits,
-    size_t init_byte_position, int* const hdr_size, int* const data_size) {
+    int thread_level, size_t init_byte_position, int* const hdr_size,
+    int* const data_size) {
   WebPEncodingError err = VP8_ENC_OK;
   const uint32_t histogram_image_xysize =
       VP8LSubSampleSize(width, histogram_bits) *
@@ -872,15 +874,15 @@ static WebPEncodingError EncodeImageInternal(
   VP8LHistogram* tmp_histo = NULL;
   int histogram_image_size = 0;
   size_t bit_array_size = 0;
-  HuffmanTree* const huff_tree = (HuffmanTree*)WebPSafeMalloc(
+  HuffmanTree* const huff_tree = (HuffmanTree*)WebPSafeMallocTransient(
       3ULL * CODE_LENGTH_CODES, sizeof(*huff_tree));
   HuffmanTreeToken* tokens = NULL;
   HuffmanTreeCode* huffman_codes = NULL;
   VP8LBackwardRefs* refs_best;
   VP8LBackwardRefs* refs_tmp;
   uint16_t* const histogram_symbols =
-      (uint16_t*)WebPSafeMalloc(histogram_image_xysize,
-                                sizeof(*histogram_symbols));
+      (uint16_t*)WebPSafeMallocTransient(histogram_image_xysize,
+                                         sizeof(*histogram_symbols));
   int lz77s_idx;
   VP8LBitWriter bw_init = *bw, bw_best;
   int hdr_size_tmp;
@@ -906,7 +908,7 @@ static WebPEncodingError EncodeImageInternal(
   // Calculate backward references from ARGB image.
   if (huff_tree == NULL ||
       !VP8LHashChainFill(hash_chain, quality, argb, width, height,
-                         low_effort) ||
+                         low_effort, thread_level) ||
       !VP8LBitWriterInit(&bw_best, 0) ||
       (config->lz77s_types_to_try_size_ > 1 &&
        !VP8LBitWriterClone(bw, &bw_best))) {
@@ -937,16 +939,17 @@ static WebPEncodingError EncodeImageInternal(
 
     // Build histogram image and symbols from backward references.
     if (!VP8LGetHistoImageSymbols(width, height, refs_best, quality, low_effort,
-                                  histogram_bits, *cache_bits, histogram_image,
-                                  tmp_histo, histogram_symbols)) {
+                                  histogram_bits, *cache_bits, thread_level,
+                                  histogram_image, tmp_histo,
+                                  histogram_symbols)) {
       err = VP8_ENC_ERROR_OUT_OF_MEMORY;
       goto Error;
     }
     // Create Huffman bit lengths and codes for each histogram image.
     histogram_image_size = histogram_image->size;
     bit_array_size = 5 * histogram_image_size;
-    huffman_codes = (HuffmanTreeCode*)WebPSafeCalloc(bit_array_size,
-                                                     sizeof(*huffman_codes));
+    huffman_codes = (HuffmanTreeCode*)WebPSafeCallocTransient(
+        bit_array_size, sizeof(*huffman_codes));
     // Note: some histogram_image entries may point to tmp_histos[], so the
     // latter need to outlive the following call to GetHuffBitLengthsAndCodes().
     if (huffman_codes == NULL ||
@@ -976,8 +979,8 @@ static WebPEncodingError EncodeImageInternal(
       VP8LPutBits(bw, write_histogram_image, 1);
       if (write_histogram_image) {
         uint32_t* const histogram_argb =
-            (uint32_t*)WebPSafeMalloc(histogram_image_xysize,
-                                      sizeof(*histogram_argb));
+            (uint32_t*)WebPSafeMallocTransient(histogram_image_xysize,
+                                               sizeof(*histogram_argb));
         int max_index = 0;
         uint32_t i;
         if (histogram_argb == NULL) {
@@ -1014,7 +1017,8 @@ static WebPEncodingError EncodeImageInternal(
           max_tokens = codes->num_symbols;
         }
       }
-      tokens = (HuffmanTreeToken*)WebPSafeMalloc(max_tokens, sizeof(*tokens));
+      tokens = (HuffmanTreeToken*)WebPSafeMallocTransient(max_tokens,
+                                                          sizeof(*tokens));
       if (tokens == NULL) {
         err = VP8_ENC_ERROR_OUT_OF_MEMORY;
         goto Error;
@@ -1225,7 +1229,7 @@ static WebPEncodingError AllocateTransformBuffer(VP8LEncoder* const enc,
   uint32_t* mem = enc->transform_mem_;
   if (mem == NULL || mem_size > enc->transform_mem_size_) {
     ClearTransformBuffer(enc);
-    mem = (uint32_t*)WebPSafeMalloc(mem_size, sizeof(*mem));
+    mem = (uint32_t*)WebPSafeMallocTransient(mem_size, sizeof(*mem));
     if (mem == NULL) {
       err = VP8_ENC_ERROR_OUT_OF_MEMORY;
       goto Error;
@@ -1362,7 +1366,8 @@ static WebPEncodingError ApplyPalette(const uint32_t* src, uint32_t src_stride,
                                       int width, int height, int xbits) {
   // TODO(skal): this tmp buffer is not needed if VP8LBundleColorMap() can be
   // made to work in-place.
-  uint8_t* const tmp_row = (uint8_t*)WebPSafeMalloc(width, sizeof(*tmp_row));
+  uint8_t* const tmp_row =
+      (uint8_t*)WebPSafeMallocTransient(width, sizeof(*tmp_row));
   int x, y;
 
   if (tmp_row == NULL) return VP8_ENC_ERROR_OUT_OF_MEMORY;
@@ -1473,7 +1478,8 @@ static WebPEncodingError EncodePalette(VP8LBitWriter* const bw, int low_effort,
 
 static VP8LEncoder* VP8LEncoderNew(const WebPConfig* const config,
                                    const WebPPicture* const picture) {
-  VP8LEncoder* const enc = (VP8LEncoder*)WebPSafeCalloc(1ULL, sizeof(*enc));
+  VP8LEncoder* const enc =
+      (VP8LEncoder*)WebPSafeCallocTransient(1ULL, sizeof(*enc));
   if (enc == NULL) {
     WebPEncodingSetError(picture, VP8_ENC_ERROR_OUT_OF_MEMORY);
     return NULL;
@@ -1636,7 +1642,8 @@ static int EncodeStreamHook(void* input, void* data2) {
                               enc->current_width_, height, quality, low_effort,
                               use_cache, &crunch_configs[idx],
                               &enc->cache_bits_, enc->histo_bits_,
-                              byte_position, &hdr_size, &data_size);
+                              enc->thread_level_, byte_position, &hdr_size,
+                              &data_size);
     if (err != VP8_ENC_OK) goto Error;
 
     // If we are better than what we already have.
@@ -1680,138 +1687,141 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
                                    int use_cache) {
   WebPEncodingError err = VP8_ENC_OK;
   VP8LEncoder* const enc_main = VP8LEncoderNew(config, picture);
-  VP8LEncoder* enc_side = NULL;
   CrunchConfig crunch_configs[CRUNCH_CONFIGS_MAX];
-  int num_crunch_configs_main, num_crunch_configs_side = 0;
-  int idx;
+  int num_crunch_configs;
+  int num_workers = 1;
+  int thread_level;      // per worker
+  int num_ready = 0;     // number of initialized workers
+  int idx, first, best;
   int red_and_blue_always_zero = 0;
-  WebPWorker worker_main, worker_side;
-  StreamEncodeContext params_main, params_side;
-  // The main thread uses picture->stats, the side thread uses stats_side.
-  WebPAuxStats stats_side;
-  VP8LBitWriter bw_side;
+  // Worker #0 is run by the calling thread, with enc_main and bw_main. The
+  // other ones have their own encoder, bit writer and stats.
+  WebPWorker workers[CRUNCH_CONFIGS_MAX];
+  StreamEncodeContext params[CRUNCH_CONFIGS_MAX];
+  VP8LEncoder* enc_side[CRUNCH_CONFIGS_MAX];
+  VP8LBitWriter bw_side[CRUNCH_CONFIGS_MAX];
+  WebPAuxStats stats_side[CRUNCH_CONFIGS_MAX];
   const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
-  int ok_main;
+
+  memset(enc_side, 0, sizeof(enc_side));
+  memset(bw_side, 0, sizeof(bw_side));
 
   // Analyze image (entropy, num_palettes etc)
   if (enc_main == NULL ||
-      !EncoderAnalyze(enc_main, crunch_configs, &num_crunch_configs_main,
+      !EncoderAnalyze(enc_main, crunch_configs, &num_crunch_configs,
                       &red_and_blue_always_zero) ||
-      !EncoderInit(enc_main) || !VP8LBitWriterInit(&bw_side, 0)) {
+      !EncoderInit(enc_main)) {
     err = VP8_ENC_ERROR_OUT_OF_MEMORY;
     goto Error;
   }
 
-  // Split the configs between the main and side threads (if any).
+  // Split the configs between the workers: two for thread_level 1, and up to
+  // thread_level above that. Each worker gets a contiguous range, and the
+  // first best result wins, so that the output is the same as when trying all
+  // the configs in a row.
   if (config->thread_level > 0) {
-    num_crunch_configs_side = num_crunch_configs_main / 2;
-    for (idx = 0; idx < num_crunch_configs_side; ++idx) {
-      params_side.crunch_configs_[idx] =
-          crunch_configs[num_crunch_configs_main - num_crunch_configs_side +
-                         idx];
-    }
-    params_side.num_crunch_configs_ = num_crunch_configs_side;
-  }
-  num_crunch_configs_main -= num_crunch_configs_side;
-  for (idx = 0; idx < num_crunch_configs_main; ++idx) {
-    params_main.crunch_configs_[idx] = crunch_configs[idx];
-  }
-  params_main.num_crunch_configs_ = num_crunch_configs_main;
-
-  // Fill in the parameters for the thread workers.
-  {
-    const int params_size = (num_crunch_configs_side > 0) ? 2 : 1;
-    for (idx = 0; idx < params_size; ++idx) {
-      // Create the parameters for each worker.
-      WebPWorker* const worker = (idx == 0) ? &worker_main : &worker_side;
-      StreamEncodeContext* const param =
-          (idx == 0) ? &params_main : &params_side;
-      param->config_ = config;
-      param->picture_ = picture;
-      param->use_cache_ = use_cache;
-      param->red_and_blue_always_zero_ = red_and_blue_always_zero;
-      if (idx == 0) {
-        param->stats_ = picture->stats;
-        param->bw_ = bw_main;
-        param->enc_ = enc_main;
-      } else {
-        param->stats_ = (picture->stats == NULL) ? NULL : &stats_side;
-        // Create a side bit writer.
-        if (!VP8LBitWriterClone(bw_main, &bw_side)) {
-          err = VP8_ENC_ERROR_OUT_OF_MEMORY;
-          goto Error;
-        }
-        param->bw_ = &bw_side;
-        // Create a side encoder.
-        enc_side = VP8LEncoderNew(config, picture);
-        if (enc_side == NULL || !EncoderInit(enc_side)) {
-          err = VP8_ENC_ERROR_OUT_OF_MEMORY;
-          goto Error;
-        }
-        // Copy the values that were computed for the main encoder.
-        enc_side->histo_bits_ = enc_main->histo_bits_;
-        enc_side->transform_bits_ = enc_main->transform_bits_;
-        enc_side->palette_size_ = enc_main->palette_size_;
-        memcpy(enc_side->palette_, enc_main->palette_,
-               sizeof(enc_main->palette_));
-        param->enc_ = enc_side;
+    num_workers = (config->thread_level > 1) ? config->thread_level : 2;
+    if (num_workers > num_crunch_configs) num_workers = num_crunch_configs;
+  }
+  // The threads left over by the split go to the hash chain and the
+  // histogram clustering.
+  thread_level = (config->thread_level > 1) ? config->thread_level / num_workers
+                                            : 0;
+  first = 0;
+  for (idx = 0; idx < num_workers; ++idx) {
+    WebPWorker* const worker = &workers[idx];
+    StreamEncodeContext* const param = &params[idx];
+    const int num = num_crunch_configs / num_workers +
+                    (idx < num_crunch_configs % num_workers);
+    memcpy(param->crunch_configs_, crunch_configs + first,
+           num * sizeof(*crunch_configs));
+    param->num_crunch_configs_ = num;
+    first += num;
+    param->config_ = config;
+    param->picture_ = picture;
+    param->use_cache_ = use_cache;
+    param->red_and_blue_always_zero_ = red_and_blue_always_zero;
+    param->err_ = VP8_ENC_OK;
+    if (idx == 0) {
+      param->stats_ = picture->stats;
+      param->bw_ = bw_main;
+      param->enc_ = enc_main;
+    } else {
+      VP8LEncoder* enc;
+      param->stats_ = (picture->stats == NULL) ? NULL : &stats_side[idx];
+#if !defined(WEBP_DISABLE_STATS)
+      if (picture->stats != NULL) {
+        memcpy(&stats_side[idx], picture->stats, sizeof(stats_side[idx]));
+      }
+#endif
+      // Create a side bit writer.
+      if (!VP8LBitWriterClone(bw_main, &bw_side[idx])) {
+        err = VP8_ENC_ERROR_OUT_OF_MEMORY;
+        goto Error;
       }
-      // Create the workers.
-      worker_interface->Init(worker);
-      worker->data1 = param;
-      worker->data2 = NULL;
-      worker->hook = EncodeStreamHook;
+      param->bw_ = &bw_side[idx];
+      // Create a side encoder.
+      enc = enc_side[idx] = VP8LEncoderNew(config, picture);
+      if (enc == NULL || !EncoderInit(enc)) {
+        err = VP8_ENC_ERROR_OUT_OF_MEMORY;
+        goto Error;
+      }
+      // Copy the values that were computed for the main encoder.
+      enc->histo_bits_ = enc_main->histo_bits_;
+      enc->transform_bits_ = enc_main->transform_bits_;
+      enc->palette_size_ = enc_main->palette_size_;
+      memcpy(enc->palette_, enc_main->palette_, sizeof(enc_main->palette_));
+      param->enc_ = enc;
     }
-  }
-
-  // Start the second thread if needed.
-  if (num_crunch_configs_side != 0) {
-    if (!worker_interface->Reset(&worker_side)) {
+    param->enc_->thread_level_ = thread_level;
+    // Create the workers.
+    worker_interface->Init(worker);
+    worker->data1 = param;
+    worker->data2 = NULL;
+    worker->hook = EncodeStreamHook;
+    ++num_ready;
+  }
+  assert(first == num_crunch_configs);
+
+  // Start the side workers, and execute the main one.
+  for (idx = 1; idx < num_workers; ++idx) {
+    if (!worker_interface->Reset(&workers[idx])) {
       err = VP8_ENC_ERROR_OUT_OF_MEMORY;
-      goto Error;
+      break;
+    }
+    worker_interface->Launch(&workers[idx]);
+  }
+  if (err == VP8_ENC_OK) worker_interface->Execute(&workers[0]);
+
+  // Wait for everyone, and keep the first smallest output.
+  best = 0;
+  for (idx = 0; idx < num_workers; ++idx) {
+    const int ok = worker_interface->Sync(&workers[idx]);
+    worker_interface->End(&workers[idx]);
+    if (!ok && err == VP8_ENC_OK) err = params[idx].err_;
+    if (idx > 0 && VP8LBitWriterNumBytes(&bw_side[idx]) <
+                   VP8LBitWriterNumBytes(params[best].bw_)) {
+      best = idx;
     }
+  }
+  num_ready = 0;
+  if (err != VP8_ENC_OK) goto Error;
+  if (best > 0) {
+    VP8LBitWriterSwap(bw_main, &bw_side[best]);
 #if !defined(WEBP_DISABLE_STATS)
-    // This line is here and not in the param initialization above to remove a
-    // Clang static analyzer warning.
     if (picture->stats != NULL) {
-      memcpy(&stats_side, picture->stats, sizeof(stats_side));
+      memcpy(picture->stats, &stats_side[best], sizeof(*picture->stats));
     }
 #endif
-    // This line is only useful to remove a Clang static analyzer warning.
-    params_side.err_ = VP8_ENC_OK;
-    worker_interface->Launch(&worker_side);
-  }
-  // Execute the main thread.
-  worker_interface->Execute(&worker_main);
-  ok_main = worker_interface->Sync(&worker_main);
-  worker_interface->End(&worker_main);
-  if (num_crunch_configs_side != 0) {
-    // Wait for the second thread.
-    const int ok_side = worker_interface->Sync(&worker_side);
-    worker_interface->End(&worker_side);
-    if (!ok_main || !ok_side) {
-      err = ok_main ? params_side.err_ : params_main.err_;
-      goto Error;
-    }
-    if (VP8LBitWriterNumBytes(&bw_side) < VP8LBitWriterNumBytes(bw_main)) {
-      VP8LBitWriterSwap(bw_main, &bw_side);
-#if !defined(WEBP_DISABLE_STATS)
-      if (picture->stats != NULL) {
-        memcpy(picture->stats, &stats_side, sizeof(*picture->stats));
-      }
-#endif
-    }
-  } else {
-    if (!ok_main) {
-      err = params_main.err_;
-      goto Error;
-    }
   }
 
 Error:
-  VP8LBitWriterWipeOut(&bw_side);
+  for (idx = 0; idx < num_ready; ++idx) worker_interface->End(&workers[idx]);
+  for (idx = 1; idx < CRUNCH_CONFIGS_MAX; ++idx) {
+    VP8LBitWriterWipeOut(&bw_side[idx]);
+    VP8LEncoderDelete(enc_side[idx]);
+  }
   VP8LEncoderDelete(enc_main);
-  VP8LEncoderDelete(enc_side);
   return err;
 }
 
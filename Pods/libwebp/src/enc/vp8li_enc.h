@@ -61,6 +61,8 @@ typedef struct {
   int histo_bits_;
   int transform_bits_;    // <= MAX_TRANSFORM_BITS.
   int cache_bits_;        // If equal to 0, don't use color cache.
+  int thread_level_;      // Number of threads for the hash chain and the
+                          // histogram clustering.
 
   // Encoding parameters derived from image characteristics.
   int use_cross_color_;
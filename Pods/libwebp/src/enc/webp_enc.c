@@ -109,7 +109,9 @@ static void MapConfigToTools(VP8Encoder* const enc) {
   enc->mb_header_limit_ =
       (score_t)256 * 510 * 8 * 1024 / (enc->mb_w_ * enc->mb_h_);
 
-  enc->thread_level_ = config->thread_level;
+  // The rows of a row source are pulled one macroblock row at a time.
+  enc->thread_level_ =
+      (enc->pic_->row_source != NULL) ? 0 : config->thread_level;
 
   enc->do_search_ = (config->target_size > 0 || config->target_PSNR > 0);
   if (!config->low_memory) {
@@ -118,6 +120,7 @@ static void MapConfigToTools(VP8Encoder* const enc) {
 #endif
     if (enc->use_tokens_) {
       enc->num_parts_ = 1;   // doesn't work with multi-partition
+      enc->stream_tokens_ = config->stream_output;
     }
   }
 }
@@ -198,7 +201,7 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
          mb_w * mb_h * 384 * sizeof(uint8_t));
   printf("===================================\n");
 #endif
-  mem = (uint8_t*)WebPSafeMalloc(size, sizeof(*mem));
+  mem = (uint8_t*)WebPSafeMallocTransient(size, sizeof(*mem));
   if (mem == NULL) {
     WebPEncodingSetError(picture, VP8_ENC_ERROR_OUT_OF_MEMORY);
     return NULL;
@@ -232,6 +235,8 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
   enc->profile_ = use_filter ? ((config->filter_type == 1) ? 0 : 1) : 2;
   enc->pic_ = picture;
   enc->percent_ = 0;
+  WebPPictureInit(&enc->rows_);
+  enc->rows_mb_y_ = -1;
 
   MapConfigToTools(enc);
   VP8EncDspInit();
@@ -256,6 +261,7 @@ static int DeleteVP8Encoder(VP8Encoder* enc) {
   if (enc != NULL) {
     ok = VP8EncDeleteAlpha(enc);
     VP8TBufferClear(&enc->tokens_);
+    VP8IteratorFreeSourceRows(enc);
     WebPSafeFree(enc);
   }
   return ok;
@@ -286,8 +292,8 @@ static void StoreStats(VP8Encoder* const enc) {
   if (stats != NULL) {
     int i, s;
     for (i = 0; i < NUM_MB_SEGMENTS; ++i) {
-      stats->segment_level[i] = enc->dqm_[i].fstrength_;
-      stats->segment_quant[i] = enc->dqm_[i].quant_;
+      stats->segment_level[i] = enc->pass_.dqm_[i].fstrength_;
+      stats->segment_quant[i] = enc->pass_.dqm_[i].quant_;
       for (s = 0; s <= 2; ++s) {
         stats->residual_bytes[s][i] = enc->residual_bytes_[s][i];
       }
@@ -325,33 +331,18 @@ int WebPReportProgress(const WebPPicture* const pic,
 }
 //------------------------------------------------------------------------------
 
-int WebPEncode(const WebPConfig* config, WebPPicture* pic) {
+static int EncodePicture(const WebPConfig* const config,
+                         WebPPicture* const pic) {
   int ok = 0;
-  if (pic == NULL) return 0;
-
-  WebPEncodingSetError(pic, VP8_ENC_OK);  // all ok so far
-  if (config == NULL) {  // bad params
-    return WebPEncodingSetError(pic, VP8_ENC_ERROR_NULL_PARAMETER);
-  }
-  if (!WebPValidateConfig(config)) {
-    return WebPEncodingSetError(pic, VP8_ENC_ERROR_INVALID_CONFIGURATION);
-  }
-  if (pic->width <= 0 || pic->height <= 0) {
-    return WebPEncodingSetError(pic, VP8_ENC_ERROR_BAD_DIMENSION);
-  }
-  if (pic->width > WEBP_MAX_DIMENSION || pic->height > WEBP_MAX_DIMENSION) {
-    return WebPEncodingSetError(pic, VP8_ENC_ERROR_BAD_DIMENSION);
-  }
-
-  if (pic->stats != NULL) memset(pic->stats, 0, sizeof(*pic->stats));
-
   if (!config->lossless) {
     VP8Encoder* enc = NULL;
 
-    if (pic->use_argb || pic->y == NULL || pic->u == NULL || pic->v == NULL) {
+    // Samples of a row source are only pulled (and converted) while encoding.
+    if (pic->row_source == NULL &&
+        (pic->use_argb || pic->y == NULL || pic->u == NULL || pic->v == NULL)) {
       // Make sure we have YUVA samples.
       if (config->use_sharp_yuv || (config->preprocessing & 4)) {
-        if (!WebPPictureSharpARGBToYUVA(pic)) {
+        if (!WebPPictureSharpARGBToYUVAThreaded(pic, config->thread_level)) {
           return 0;
         }
       } else {
@@ -369,7 +360,7 @@ int WebPEncode(const WebPConfig* config, WebPPicture* pic) {
       }
     }
 
-    if (!config->exact) {
+    if (!config->exact && pic->row_source == NULL) {
       WebPCleanupTransparentArea(pic);
     }
 
@@ -393,6 +384,8 @@ int WebPEncode(const WebPConfig* config, WebPPicture* pic) {
       VP8EncFreeBitWriters(enc);
     }
     ok &= DeleteVP8Encoder(enc);  // must always be called, even if !ok
+  } else if (pic->row_source != NULL) {
+    return WebPEncodingSetError(pic, VP8_ENC_ERROR_INVALID_CONFIGURATION);
   } else {
     // Make sure we have ARGB samples.
     if (pic->argb == NULL && !WebPPictureYUVAToARGB(pic)) {
@@ -408,3 +401,42 @@ int WebPEncode(const WebPConfig* config, WebPPicture* pic) {
 
   return ok;
 }
+
+int WebPEncode(const WebPConfig* config, WebPPicture* pic) {
+  WebPMemoryAccount request;
+  int ok = 0;
+  if (pic == NULL) return 0;
+
+  WebPEncodingSetError(pic, VP8_ENC_OK);  // all ok so far
+  if (config == NULL) {  // bad params
+    return WebPEncodingSetError(pic, VP8_ENC_ERROR_NULL_PARAMETER);
+  }
+  if (!WebPValidateConfig(config)) {
+    return WebPEncodingSetError(pic, VP8_ENC_ERROR_INVALID_CONFIGURATION);
+  }
+  if (pic->width <= 0 || pic->height <= 0) {
+    return WebPEncodingSetError(pic, VP8_ENC_ERROR_BAD_DIMENSION);
+  }
+  if (pic->width > WEBP_MAX_DIMENSION || pic->height > WEBP_MAX_DIMENSION) {
+    return WebPEncodingSetError(pic, VP8_ENC_ERROR_BAD_DIMENSION);
+  }
+
+  WebPMemoryRequestStart(&request);   // use the thread's arena, if any
+  if (pic->stats != NULL) memset(pic->stats, 0, sizeof(*pic->stats));
+  if (pic->stats != NULL && config->track_memory) {
+    WebPMemoryAccount account;
+    // If the account can't be started, the memory is simply not reported.
+    const int tracking = WebPMemoryAccountStart(&account);
+    ok = EncodePicture(config, pic);
+    if (tracking) {
+      WebPMemoryAccountStop(&account);
+      pic->stats->peak_memory_kb = WebPMemorySizeToKb(account.peak_size);
+      pic->stats->total_memory_kb = WebPMemorySizeToKb(account.total_size);
+    }
+  } else {
+    ok = EncodePicture(config, pic);
+  }
+  WebPMemoryRequestEnd(&request);
+  return ok;
+}
+
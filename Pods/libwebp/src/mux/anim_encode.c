@@ -17,6 +17,7 @@
 #include <stdlib.h>  // for abs()
 
 #include "src/mux/animi.h"
+#include "src/utils/thread_utils.h"
 #include "src/utils/utils.h"
 #include "src/webp/decode.h"
 #include "src/webp/encode.h"
@@ -775,24 +776,127 @@ static int EncodeFrame(const WebPConfig* const config, WebPPicture* const pic,
   return 1;
 }
 
+enum {
+  LL_DISP_NONE = 0,
+  LL_DISP_BG,
+  LOSSY_DISP_NONE,
+  LOSSY_DISP_BG,
+  CANDIDATE_COUNT
+};
+
 // Struct representing a candidate encoded frame including its metadata.
 typedef struct {
   WebPMemoryWriter  mem_;
   WebPMuxFrameInfo  info_;
   FrameRectangle    rect_;
   int               evaluate_;  // True if this candidate should be evaluated.
+
+  // Encoding in the background.
+  int               pending_;   // True until the result has been collected.
+  int               launched_;  // True if 'worker_' runs in its own thread.
+  WebPWorker        worker_;
+  WebPConfig        config_;
+  WebPPicture       pic_;       // Copy of the sub-frame.
+  WebPEncodingError error_code_;
 } Candidate;
 
+// Returns true if the candidates should be encoded concurrently.
+static int UseBackgroundEncoding(const WebPConfig* const config) {
+#ifdef WEBP_USE_THREAD
+  return (config->thread_level > 0);
+#else
+  (void)config;
+  return 0;
+#endif
+}
+
+static int EncodeCandidateHook(void* arg1, void* arg2) {
+  Candidate* const candidate = (Candidate*)arg1;
+  (void)arg2;
+  candidate->evaluate_ =
+      EncodeFrame(&candidate->config_, &candidate->pic_, &candidate->mem_);
+  candidate->error_code_ = candidate->pic_.error_code;
+  return candidate->evaluate_;
+}
+
+// Encodes a copy of 'sub_frame' in a worker thread, since the canvas keeps
+// changing while the next candidates are prepared.
+static WebPEncodingError LaunchCandidate(WebPPicture* const sub_frame,
+                                         Candidate* const candidate) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  if (!WebPPictureCopy(sub_frame, &candidate->pic_)) {
+    return VP8_ENC_ERROR_OUT_OF_MEMORY;
+  }
+  if (candidate->config_.lossless && !candidate->config_.exact) {
+    // Make the change to 'sub_frame' that encoding it directly would have
+    // made (cf. WebPEncode()), so that the next candidates see the same canvas.
+    int x, y;
+    uint32_t* argb = sub_frame->argb;
+    for (y = 0; y < sub_frame->height; ++y) {
+      for (x = 0; x < sub_frame->width; ++x) {
+        if ((argb[x] & 0xff000000) == 0) argb[x] = 0x00000000;
+      }
+      argb += sub_frame->argb_stride;
+    }
+  }
+  worker_interface->Init(&candidate->worker_);
+  candidate->worker_.hook = EncodeCandidateHook;
+  candidate->worker_.data1 = candidate;
+  candidate->worker_.data2 = NULL;
+  candidate->pending_ = 1;
+  candidate->launched_ = worker_interface->Reset(&candidate->worker_);
+  if (candidate->launched_) {
+    worker_interface->Launch(&candidate->worker_);
+  } else {
+    worker_interface->Execute(&candidate->worker_);
+  }
+  return VP8_ENC_OK;
+}
+
+// Waits for the candidates encoded in the background. Returns the error of the
+// first one that failed, if any.
+static WebPEncodingError SyncCandidates(Candidate candidates[]) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  WebPEncodingError error_code = VP8_ENC_OK;
+  int i;
+  for (i = 0; i < CANDIDATE_COUNT; ++i) {
+    Candidate* const candidate = &candidates[i];
+    if (!candidate->pending_) continue;
+    if (candidate->launched_) worker_interface->Sync(&candidate->worker_);
+    worker_interface->End(&candidate->worker_);
+    WebPPictureFree(&candidate->pic_);
+    candidate->pending_ = 0;
+    if (!candidate->evaluate_) {
+      WebPMemoryWriterClear(&candidate->mem_);
+      if (error_code == VP8_ENC_OK) error_code = candidate->error_code_;
+    }
+  }
+  return error_code;
+}
+
+// Waits for the candidates and releases them.
+static void ReleaseCandidates(Candidate candidates[]) {
+  int i;
+  SyncCandidates(candidates);
+  for (i = 0; i < CANDIDATE_COUNT; ++i) {
+    if (candidates[i].evaluate_) {
+      WebPMemoryWriterClear(&candidates[i].mem_);
+    }
+  }
+  memset(candidates, 0, CANDIDATE_COUNT * sizeof(*candidates));
+}
+
 // Generates a candidate encoded frame given a picture and metadata.
 static WebPEncodingError EncodeCandidate(WebPPicture* const sub_frame,
                                          const FrameRectangle* const rect,
                                          const WebPConfig* const encoder_config,
-                                         int use_blending,
+                                         int use_blending, int in_background,
                                          Candidate* const candidate) {
-  WebPConfig config = *encoder_config;
+  WebPConfig* const config = &candidate->config_;
   WebPEncodingError error_code = VP8_ENC_OK;
   assert(candidate != NULL);
   memset(candidate, 0, sizeof(*candidate));
+  *config = *encoder_config;
 
   // Set frame rect and info.
   candidate->rect_ = *rect;
@@ -807,13 +911,18 @@ static WebPEncodingError EncodeCandidate(WebPPicture* const sub_frame,
   // Encode picture.
   WebPMemoryWriterInit(&candidate->mem_);
 
-  if (!config.lossless && use_blending) {
+  if (!config->lossless && use_blending) {
     // Disable filtering to avoid blockiness in reconstructed frames at the
     // time of decoding.
-    config.autofilter = 0;
-    config.filter_strength = 0;
+    config->autofilter = 0;
+    config->filter_strength = 0;
+  }
+  if (in_background) {
+    error_code = LaunchCandidate(sub_frame, candidate);
+    if (error_code != VP8_ENC_OK) goto Err;
+    return error_code;
   }
-  if (!EncodeFrame(&config, sub_frame, &candidate->mem_)) {
+  if (!EncodeFrame(config, sub_frame, &candidate->mem_)) {
     error_code = sub_frame->error_code;
     goto Err;
   }
@@ -835,14 +944,6 @@ static void CopyCurrentCanvas(WebPAnimEncoder* const enc) {
   }
 }
 
-enum {
-  LL_DISP_NONE = 0,
-  LL_DISP_BG,
-  LOSSY_DISP_NONE,
-  LOSSY_DISP_BG,
-  CANDIDATE_COUNT
-};
-
 #define MIN_COLORS_LOSSY     31  // Don't try lossy below this threshold.
 #define MAX_COLORS_LOSSLESS 194  // Don't try lossless above this threshold.
 
@@ -863,6 +964,7 @@ static WebPEncodingError GenerateCandidates(
   WebPPicture* const curr_canvas = &enc->curr_canvas_copy_;
   const WebPPicture* const prev_canvas =
       is_dispose_none ? &enc->prev_canvas_ : &enc->prev_canvas_disposed_;
+  const int in_background = UseBackgroundEncoding(config_ll);
   int use_blending_ll, use_blending_lossy;
   int evaluate_ll, evaluate_lossy;
 
@@ -896,7 +998,8 @@ static WebPEncodingError GenerateCandidates(
           IncreaseTransparency(prev_canvas, &params->rect_ll_, curr_canvas);
     }
     error_code = EncodeCandidate(&params->sub_frame_ll_, &params->rect_ll_,
-                                 config_ll, use_blending_ll, candidate_ll);
+                                 config_ll, use_blending_ll, in_background,
+                                 candidate_ll);
     if (error_code != VP8_ENC_OK) return error_code;
   }
   if (evaluate_lossy) {
@@ -908,7 +1011,8 @@ static WebPEncodingError GenerateCandidates(
     }
     error_code =
         EncodeCandidate(&params->sub_frame_lossy_, &params->rect_lossy_,
-                        config_lossy, use_blending_lossy, candidate_lossy);
+                        config_lossy, use_blending_lossy, in_background,
+                        candidate_lossy);
     if (error_code != VP8_ENC_OK) return error_code;
     enc->curr_canvas_copy_modified_ = 1;
   }
@@ -1053,18 +1157,17 @@ static void PickBestCandidate(WebPAnimEncoder* const enc,
 
 // Depending on the configuration, tries different compressions
 // (lossy/lossless), dispose methods, blending methods etc to encode the current
-// frame and outputs the best one in 'encoded_frame'.
+// frame into 'candidates'. They may still be encoding on return, and
+// FinishFrame() must be called to pick the best one.
 // 'frame_skipped' will be set to true if this frame should actually be skipped.
 static WebPEncodingError SetFrame(WebPAnimEncoder* const enc,
                                   const WebPConfig* const config,
                                   int is_key_frame,
-                                  EncodedFrame* const encoded_frame,
+                                  Candidate candidates[CANDIDATE_COUNT],
                                   int* const frame_skipped) {
-  int i;
   WebPEncodingError error_code = VP8_ENC_OK;
   const WebPPicture* const curr_canvas = &enc->curr_canvas_copy_;
   const WebPPicture* const prev_canvas = &enc->prev_canvas_;
-  Candidate candidates[CANDIDATE_COUNT];
   const int is_lossless = config->lossless;
   const int consider_lossless = is_lossless || enc->options_.allow_mixed;
   const int consider_lossy = !is_lossless || enc->options_.allow_mixed;
@@ -1105,7 +1208,7 @@ static WebPEncodingError SetFrame(WebPAnimEncoder* const enc,
     return VP8_ENC_ERROR_INVALID_CONFIGURATION;
   }
 
-  memset(candidates, 0, sizeof(candidates));
+  memset(candidates, 0, CANDIDATE_COUNT * sizeof(*candidates));
 
   // Change-rectangle assuming previous frame was DISPOSE_NONE.
   if (!GetSubRects(prev_canvas, curr_canvas, is_key_frame, is_first_frame,
@@ -1169,16 +1272,10 @@ static WebPEncodingError SetFrame(WebPAnimEncoder* const enc,
     if (error_code != VP8_ENC_OK) goto Err;
   }
 
-  PickBestCandidate(enc, candidates, is_key_frame, encoded_frame);
-
   goto End;
 
  Err:
-  for (i = 0; i < CANDIDATE_COUNT; ++i) {
-    if (candidates[i].evaluate_) {
-      WebPMemoryWriterClear(&candidates[i].mem_);
-    }
-  }
+  ReleaseCandidates(candidates);
 
  End:
   SubFrameParamsFree(&dispose_none_params);
@@ -1186,6 +1283,23 @@ static WebPEncodingError SetFrame(WebPAnimEncoder* const enc,
   return error_code;
 }
 
+// Waits for the 'candidates' generated by SetFrame() and outputs the best one
+// in 'encoded_frame'.
+static WebPEncodingError FinishFrame(WebPAnimEncoder* const enc,
+                                     Candidate candidates[CANDIDATE_COUNT],
+                                     int is_key_frame,
+                                     EncodedFrame* const encoded_frame) {
+  const WebPEncodingError error_code = SyncCandidates(candidates);
+  if (error_code != VP8_ENC_OK) {
+    ReleaseCandidates(candidates);
+    return error_code;
+  }
+  PickBestCandidate(enc, candidates, is_key_frame, encoded_frame);
+  // The data of the best candidate now belongs to 'encoded_frame'.
+  memset(candidates, 0, CANDIDATE_COUNT * sizeof(*candidates));
+  return error_code;
+}
+
 // Calculate the penalty incurred if we encode given frame as a key frame
 // instead of a sub-frame.
 static int64_t KeyFramePenalty(const EncodedFrame* const encoded_frame) {
@@ -1200,11 +1314,17 @@ static int CacheFrame(WebPAnimEncoder* const enc,
   WebPEncodingError error_code = VP8_ENC_OK;
   const size_t position = enc->count_;
   EncodedFrame* const encoded_frame = GetFrame(enc, position);
+  Candidate candidates[CANDIDATE_COUNT];
+  Candidate key_candidates[CANDIDATE_COUNT];
 
+  memset(candidates, 0, sizeof(candidates));
+  memset(key_candidates, 0, sizeof(key_candidates));
   ++enc->count_;
 
   if (enc->is_first_frame_) {  // Add this as a key-frame.
-    error_code = SetFrame(enc, config, 1, encoded_frame, &frame_skipped);
+    error_code = SetFrame(enc, config, 1, candidates, &frame_skipped);
+    if (error_code != VP8_ENC_OK) goto End;
+    error_code = FinishFrame(enc, candidates, 1, encoded_frame);
     if (error_code != VP8_ENC_OK) goto End;
     assert(frame_skipped == 0);  // First frame can't be skipped, even if empty.
     assert(position == 0 && enc->count_ == 1);
@@ -1216,9 +1336,11 @@ static int CacheFrame(WebPAnimEncoder* const enc,
     ++enc->count_since_key_frame_;
     if (enc->count_since_key_frame_ <= enc->options_.kmin) {
       // Add this as a frame rectangle.
-      error_code = SetFrame(enc, config, 0, encoded_frame, &frame_skipped);
+      error_code = SetFrame(enc, config, 0, candidates, &frame_skipped);
       if (error_code != VP8_ENC_OK) goto End;
       if (frame_skipped) goto Skip;
+      error_code = FinishFrame(enc, candidates, 0, encoded_frame);
+      if (error_code != VP8_ENC_OK) goto End;
       encoded_frame->is_key_frame_ = 0;
       enc->flush_count_ = enc->count_ - 1;
       enc->prev_candidate_undecided_ = 0;
@@ -1226,17 +1348,21 @@ static int CacheFrame(WebPAnimEncoder* const enc,
       int64_t curr_delta;
       FrameRectangle prev_rect_key, prev_rect_sub;
 
-      // Add this as a frame rectangle to enc.
-      error_code = SetFrame(enc, config, 0, encoded_frame, &frame_skipped);
+      // Add this as a frame rectangle to enc, and as a key-frame too. The two
+      // variants don't depend on each other, so they are encoded at the same
+      // time when using threads.
+      error_code = SetFrame(enc, config, 0, candidates, &frame_skipped);
       if (error_code != VP8_ENC_OK) goto End;
       if (frame_skipped) goto Skip;
-      prev_rect_sub = enc->prev_rect_;
-
-
-      // Add this as a key-frame to enc, too.
-      error_code = SetFrame(enc, config, 1, encoded_frame, &frame_skipped);
+      error_code = SetFrame(enc, config, 1, key_candidates, &frame_skipped);
       if (error_code != VP8_ENC_OK) goto End;
       assert(frame_skipped == 0);  // Key-frame cannot be an empty rectangle.
+
+      error_code = FinishFrame(enc, candidates, 0, encoded_frame);
+      if (error_code != VP8_ENC_OK) goto End;
+      prev_rect_sub = enc->prev_rect_;
+      error_code = FinishFrame(enc, key_candidates, 1, encoded_frame);
+      if (error_code != VP8_ENC_OK) goto End;
       prev_rect_key = enc->prev_rect_;
 
       // Analyze size difference of the two variants.
@@ -1281,6 +1407,8 @@ static int CacheFrame(WebPAnimEncoder* const enc,
 
  End:
   if (!ok || frame_skipped) {
+    ReleaseCandidates(candidates);
+    ReleaseCandidates(key_candidates);
     FrameRelease(encoded_frame);
     // We reset some counters, as the frame addition failed/was skipped.
     --enc->count_;
@@ -597,6 +597,20 @@ static uint8_t* ImageListEmit(const WebPMuxImage* wpi_list, uint8_t* dst) {
   return dst;
 }
 
+// Finalizes 'mux' for assembly and returns the size of the RIFF data.
+static WebPMuxError MuxFinalize(WebPMux* const mux, size_t* const size) {
+  WebPMuxError err = MuxCleanup(mux);
+  if (err != WEBP_MUX_OK) return err;
+  err = CreateVP8XChunk(mux);
+  if (err != WEBP_MUX_OK) return err;
+
+  *size = ChunkListDiskSize(mux->vp8x_) + ChunkListDiskSize(mux->iccp_)
+        + ChunkListDiskSize(mux->anim_) + ImageListDiskSize(mux->images_)
+        + ChunkListDiskSize(mux->exif_) + ChunkListDiskSize(mux->xmp_)
+        + ChunkListDiskSize(mux->unknown_) + RIFF_HEADER_SIZE;
+  return WEBP_MUX_OK;
+}
+
 WebPMuxError WebPMuxAssemble(WebPMux* mux, WebPData* assembled_data) {
   size_t size = 0;
   uint8_t* data = NULL;
@@ -614,17 +628,10 @@ WebPMuxError WebPMuxAssemble(WebPMux* mux, WebPData* assembled_data) {
   }
 
   // Finalize mux.
-  err = MuxCleanup(mux);
-  if (err != WEBP_MUX_OK) return err;
-  err = CreateVP8XChunk(mux);
+  err = MuxFinalize(mux, &size);
   if (err != WEBP_MUX_OK) return err;
 
   // Allocate data.
-  size = ChunkListDiskSize(mux->vp8x_) + ChunkListDiskSize(mux->iccp_)
-       + ChunkListDiskSize(mux->anim_) + ImageListDiskSize(mux->images_)
-       + ChunkListDiskSize(mux->exif_) + ChunkListDiskSize(mux->xmp_)
-       + ChunkListDiskSize(mux->unknown_) + RIFF_HEADER_SIZE;
-
   data = (uint8_t*)WebPSafeMalloc(1ULL, size);
   if (data == NULL) return WEBP_MUX_MEMORY_ERROR;
 
@@ -655,3 +662,157 @@ WebPMuxError WebPMuxAssemble(WebPMux* mux, WebPData* assembled_data) {
 }
 
 //------------------------------------------------------------------------------
+// Scatter-gather assembly.
+
+// Chunk payloads smaller than this are copied after their generated header
+// rather than given a segment of their own.
+#define SEGMENT_COPY_SIZE 64
+
+typedef struct {
+  WebPData* segments_;
+  int num_segments_;
+  uint8_t* dst_;        // where the next generated bytes go
+} SegmentWriter;
+
+// Appends 'size' bytes at 'bytes', extending the last segment if contiguous.
+static void PutSegment(SegmentWriter* const w, const uint8_t* bytes,
+                       size_t size) {
+  WebPData* const last =
+      (w->num_segments_ > 0) ? &w->segments_[w->num_segments_ - 1] : NULL;
+  if (size == 0) return;
+  if (last != NULL && last->bytes + last->size == bytes) {
+    last->size += size;
+  } else {
+    w->segments_[w->num_segments_].bytes = bytes;
+    w->segments_[w->num_segments_].size = size;
+    ++w->num_segments_;
+  }
+}
+
+// Appends 'size' generated bytes and returns where to write them.
+static uint8_t* ReserveSegment(SegmentWriter* const w, size_t size) {
+  uint8_t* const dst = w->dst_;
+  PutSegment(w, dst, size);
+  w->dst_ += size;
+  return dst;
+}
+
+// Appends 'chunk', whose header holds 'chunk_size' (which is larger than the
+// payload for ANMF chunks, see ChunkEmitSpecial()).
+static void ChunkEmitSegments(const WebPChunk* const chunk, size_t chunk_size,
+                              SegmentWriter* const w) {
+  const size_t size = chunk->data_.size;
+  const int copy = (size < SEGMENT_COPY_SIZE);
+  uint8_t* const header =
+      ReserveSegment(w, CHUNK_HEADER_SIZE + (copy ? size : 0));
+  assert(chunk->tag_ != NIL_TAG);
+  assert(chunk_size == (uint32_t)chunk_size);
+  PutLE32(header + 0, chunk->tag_);
+  PutLE32(header + TAG_SIZE, (uint32_t)chunk_size);
+  if (!copy) {
+    PutSegment(w, chunk->data_.bytes, size);
+  } else if (size > 0) {
+    memcpy(header + CHUNK_HEADER_SIZE, chunk->data_.bytes, size);
+  }
+  if (size & 1) *ReserveSegment(w, 1) = 0;  // Add padding.
+}
+
+static void ChunkListEmitSegments(const WebPChunk* chunk_list,
+                                  SegmentWriter* const w) {
+  for (; chunk_list != NULL; chunk_list = chunk_list->next_) {
+    ChunkEmitSegments(chunk_list, chunk_list->data_.size, w);
+  }
+}
+
+// Same chunk order as MuxImageEmit().
+static void ImageListEmitSegments(const WebPMuxImage* wpi_list,
+                                  SegmentWriter* const w) {
+  for (; wpi_list != NULL; wpi_list = wpi_list->next_) {
+    if (wpi_list->header_ != NULL) {
+      ChunkEmitSegments(wpi_list->header_,
+                        MuxImageDiskSize(wpi_list) - CHUNK_HEADER_SIZE, w);
+    }
+    if (wpi_list->alpha_ != NULL) {
+      ChunkEmitSegments(wpi_list->alpha_, wpi_list->alpha_->data_.size, w);
+    }
+    if (wpi_list->img_ != NULL) {
+      ChunkEmitSegments(wpi_list->img_, wpi_list->img_->data_.size, w);
+    }
+    ChunkListEmitSegments(wpi_list->unknown_, w);
+  }
+}
+
+// Adds to 'num_chunks' and 'copy_size' the number of chunks in 'chunk_list'
+// and the size of the payloads which will be copied.
+static void ChunkListCount(const WebPChunk* chunk_list,
+                           int* const num_chunks, size_t* const copy_size) {
+  for (; chunk_list != NULL; chunk_list = chunk_list->next_) {
+    ++*num_chunks;
+    if (chunk_list->data_.size < SEGMENT_COPY_SIZE) {
+      *copy_size += chunk_list->data_.size;
+    }
+  }
+}
+
+WebPMuxError WebPMuxAssembleSegments(WebPMux* mux, WebPData** segments,
+                                     int* num_segments) {
+  size_t size = 0, copy_size = 0, generated_size;
+  int num_chunks = 0, max_segments;
+  const WebPMuxImage* wpi;
+  SegmentWriter w;
+  WebPMuxError err;
+
+  if (segments == NULL || num_segments == NULL) {
+    return WEBP_MUX_INVALID_ARGUMENT;
+  }
+  *segments = NULL;
+  *num_segments = 0;
+  if (mux == NULL) return WEBP_MUX_INVALID_ARGUMENT;
+
+  err = MuxFinalize(mux, &size);
+  if (err != WEBP_MUX_OK) return err;
+  err = MuxValidate(mux);
+  if (err != WEBP_MUX_OK) return err;
+  assert(size == (uint32_t)size);
+
+  ChunkListCount(mux->vp8x_, &num_chunks, &copy_size);
+  ChunkListCount(mux->iccp_, &num_chunks, &copy_size);
+  ChunkListCount(mux->anim_, &num_chunks, &copy_size);
+  for (wpi = mux->images_; wpi != NULL; wpi = wpi->next_) {
+    ChunkListCount(wpi->header_, &num_chunks, &copy_size);
+    ChunkListCount(wpi->alpha_, &num_chunks, &copy_size);
+    ChunkListCount(wpi->img_, &num_chunks, &copy_size);
+    ChunkListCount(wpi->unknown_, &num_chunks, &copy_size);
+  }
+  ChunkListCount(mux->exif_, &num_chunks, &copy_size);
+  ChunkListCount(mux->xmp_, &num_chunks, &copy_size);
+  ChunkListCount(mux->unknown_, &num_chunks, &copy_size);
+
+  // Worst case: the RIFF header, then header, payload and padding for each
+  // chunk. The generated bytes are stored after the segments.
+  max_segments = 1 + 3 * num_chunks;
+  generated_size = RIFF_HEADER_SIZE + copy_size +
+                   (size_t)num_chunks * (CHUNK_HEADER_SIZE + 1);
+  w.segments_ = (WebPData*)WebPSafeMalloc(
+      1ULL, max_segments * sizeof(*w.segments_) + generated_size);
+  if (w.segments_ == NULL) return WEBP_MUX_MEMORY_ERROR;
+  w.num_segments_ = 0;
+  w.dst_ = (uint8_t*)(w.segments_ + max_segments);
+
+  MuxEmitRiffHeader(ReserveSegment(&w, RIFF_HEADER_SIZE), size);
+  ChunkListEmitSegments(mux->vp8x_, &w);
+  ChunkListEmitSegments(mux->iccp_, &w);
+  ChunkListEmitSegments(mux->anim_, &w);
+  ImageListEmitSegments(mux->images_, &w);
+  ChunkListEmitSegments(mux->exif_, &w);
+  ChunkListEmitSegments(mux->xmp_, &w);
+  ChunkListEmitSegments(mux->unknown_, &w);
+  assert(w.num_segments_ <= max_segments);
+  assert(w.dst_ <= (uint8_t*)(w.segments_ + max_segments) + generated_size);
+
+  *segments = w.segments_;
+  *num_segments = w.num_segments_;
+  return WEBP_MUX_OK;
+}
+
+//------------------------------------------------------------------------------
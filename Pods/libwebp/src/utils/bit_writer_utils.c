@@ -37,7 +37,7 @@ static int BitWriterResize(VP8BitWriter* const bw, size_t extra_size) {
   new_size = 2 * bw->max_pos_;
   if (new_size < needed_size) new_size = needed_size;
   if (new_size < 1024) new_size = 1024;
-  new_buf = (uint8_t*)WebPSafeMalloc(1ULL, new_size);
+  new_buf = (uint8_t*)WebPSafeMallocTransient(1ULL, new_size);
   if (new_buf == NULL) {
     bw->error_ = 1;
     return 0;
@@ -188,6 +188,14 @@ int VP8BitWriterAppend(VP8BitWriter* const bw,
   return 1;
 }
 
+void VP8BitWriterDrop(VP8BitWriter* const bw, size_t size) {
+  assert(size <= bw->pos_);
+  if (size > 0) {
+    memmove(bw->buf_, bw->buf_ + size, bw->pos_ - size);
+    bw->pos_ -= size;
+  }
+}
+
 void VP8BitWriterWipeOut(VP8BitWriter* const bw) {
   if (bw != NULL) {
     WebPSafeFree(bw->buf_);
@@ -219,7 +227,7 @@ static int VP8LBitWriterResize(VP8LBitWriter* const bw, size_t extra_size) {
   if (allocated_size < size_required) allocated_size = size_required;
   // make allocated size multiple of 1k
   allocated_size = (((allocated_size >> 10) + 1) << 10);
-  allocated_buf = (uint8_t*)WebPSafeMalloc(1ULL, allocated_size);
+  allocated_buf = (uint8_t*)WebPSafeMallocTransient(1ULL, allocated_size);
   if (allocated_buf == NULL) {
     bw->error_ = 1;
     return 0;
@@ -67,6 +67,16 @@ static WEBP_INLINE size_t VP8BitWriterSize(const VP8BitWriter* const bw) {
   return bw->pos_;
 }
 
+// Returns the number of leading bytes of the buffer that won't change anymore.
+// Only the last byte written can still be modified, by a carry.
+static WEBP_INLINE size_t VP8BitWriterFinalSize(const VP8BitWriter* const bw) {
+  return (bw->pos_ > 0) ? bw->pos_ - 1 : 0;
+}
+// Removes the first 'size' bytes of the buffer, once they have been consumed.
+// They should be final (see VP8BitWriterFinalSize()), unless the writer is
+// finished. This keeps the buffer bounded while streaming the output.
+void VP8BitWriterDrop(VP8BitWriter* const bw, size_t size);
+
 //------------------------------------------------------------------------------
 // VP8LBitWriter
 
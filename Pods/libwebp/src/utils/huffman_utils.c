@@ -24,7 +24,8 @@
 
 HTreeGroup* VP8LHtreeGroupsNew(int num_htree_groups) {
   HTreeGroup* const htree_groups =
-      (HTreeGroup*)WebPSafeMalloc(num_htree_groups, sizeof(*htree_groups));
+      (HTreeGroup*)WebPSafeMallocTransient(num_htree_groups,
+                                           sizeof(*htree_groups));
   if (htree_groups == NULL) {
     return NULL;
   }
@@ -225,7 +226,7 @@ int VP8LBuildHuffmanTable(HuffmanCode* const root_table, int root_bits,
                                    code_lengths, code_lengths_size, sorted);
   } else {   // rare case. Use heap allocation.
     uint16_t* const sorted =
-        (uint16_t*)WebPSafeMalloc(code_lengths_size, sizeof(*sorted));
+        (uint16_t*)WebPSafeMallocTransient(code_lengths_size, sizeof(*sorted));
     if (sorted == NULL) return 0;
     total_size = BuildHuffmanTable(root_table, root_bits,
                                    code_lengths, code_lengths_size, sorted);
@@ -74,6 +74,57 @@ void WebPRescalerInit(WebPRescaler* const wrk, int src_width, int src_height,
   WebPRescalerDspInit();
 }
 
+int WebPRescalerSetOutputBand(WebPRescaler* const wrk,
+                              int first_row, int last_row,
+                              const uint8_t* src, int src_stride) {
+  // When shrinking, the fractional contribution carried over to 'first_row'
+  // is set while exporting the previous row. When expanding, exporting a row
+  // only needs the last two source rows imported.
+  const int target = wrk->y_expand ? first_row : first_row - 1;
+  uint8_t* const dst = wrk->dst + first_row * wrk->dst_stride;
+  int src_y = 0, dst_y = 0, y_accum = wrk->y_accum;
+  int first_src_row;
+  assert(wrk->src_y == 0 && wrk->dst_y == 0);
+  assert(0 <= first_row && first_row < last_row);
+  assert(last_row <= wrk->dst_height);
+
+  wrk->dst = dst;
+  wrk->dst_height = last_row;
+  if (first_row == 0) return 0;
+
+  // Replay the row counters up to the export of the row 'target'.
+  while (1) {
+    if (y_accum > 0) {
+      const int num_lines = (y_accum + wrk->y_sub - 1) / wrk->y_sub;
+      src_y += num_lines;
+      y_accum -= num_lines * wrk->y_sub;
+    }
+    if (dst_y == target) break;
+    y_accum += wrk->y_add;
+    ++dst_y;
+  }
+  assert(src_y >= 1 && src_y <= wrk->src_height);
+
+  // Import the source rows this export depends on. Marking the output as done
+  // meanwhile prevents WebPRescalerImport() from stopping on pending rows.
+  first_src_row = src_y - 1;
+  if (wrk->y_expand && first_src_row > 0) --first_src_row;
+  wrk->src_y = first_src_row;
+  wrk->dst_y = wrk->dst_height;
+  WebPRescalerImport(wrk, src_y - first_src_row,
+                     src + first_src_row * src_stride, src_stride);
+  assert(wrk->src_y == src_y);
+  wrk->y_accum = y_accum;
+  wrk->dst_y = target;
+  if (!wrk->y_expand) {
+    // The row is exported over 'first_row', which is overwritten later.
+    WebPRescalerExportRow(wrk);
+    wrk->dst = dst;
+  }
+  assert(wrk->dst_y == first_row);
+  return src_y;
+}
+
 int WebPRescalerGetScaledDimensions(int src_width, int src_height,
                                     int* const scaled_width,
                                     int* const scaled_height) {
@@ -54,6 +54,16 @@ void WebPRescalerInit(WebPRescaler* const rescaler,
                       int num_channels,
                       rescaler_t* const work);
 
+// Restricts the output of a rescaler freshly initialized by WebPRescalerInit()
+// to the rows [first_row, last_row). The rescaler is primed with the source
+// rows preceding the band that contribute to it, so that the band is the same
+// as when rescaling the whole picture. This allows rescaling separate bands in
+// parallel. 'src' points to the first row of the whole source. Returns the
+// index of the next source row to import.
+int WebPRescalerSetOutputBand(WebPRescaler* const rescaler,
+                              int first_row, int last_row,
+                              const uint8_t* src, int src_stride);
+
 // If either 'scaled_width' or 'scaled_height' (but not both) is 0 the value
 // will be calculated preserving the aspect ratio, otherwise the values are
 // left unmodified. Returns true on success, false if either value is 0 after
@@ -47,15 +47,32 @@ typedef struct {
 #else  // !_WIN32
 
 #include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
 
 #endif  // _WIN32
 
+#if !defined(_WIN32) || defined(USE_WINDOWS_CONDITION_VARIABLE)
+// the pool needs conditions supporting several waiting threads.
+#define USE_WORKER_POOL
+#endif
+
 typedef struct {
   pthread_mutex_t mutex_;
   pthread_cond_t  condition_;
   pthread_t       thread_;
+  WebPMemoryAccount* account_;   // account of the thread that launched the job
 } WebPWorkerImpl;
 
+typedef struct {
+  pthread_mutex_t mutex_;
+  pthread_cond_t  condition_;
+} WebPWorkerProgressImpl;
+
+typedef struct {
+  pthread_mutex_t mutex_;
+} WebPWorkerLockImpl;
+
 #if defined(_WIN32)
 
 //------------------------------------------------------------------------------
@@ -175,6 +192,20 @@ static int pthread_cond_signal(pthread_cond_t* const condition) {
   return !ok;
 }
 
+static int pthread_cond_broadcast(pthread_cond_t* const condition) {
+#ifdef USE_WINDOWS_CONDITION_VARIABLE
+  WakeAllConditionVariable(condition);
+  return 0;
+#else
+  // the emulation only supports one waiting thread.
+  return pthread_cond_signal(condition);
+#endif
+}
+
+static void sched_yield(void) {
+  Sleep(0);
+}
+
 static int pthread_cond_wait(pthread_cond_t* const condition,
                              pthread_mutex_t* const mutex) {
   int ok;
@@ -211,7 +242,10 @@ static THREADFN ThreadLoop(void* ptr) {
       pthread_cond_wait(&impl->condition_, &impl->mutex_);
     }
     if (worker->status_ == WORK) {
+      WebPMemoryAccount* const account = WebPGetMemoryAccount();
+      WebPSetMemoryAccount(impl->account_);
       WebPGetWorkerInterface()->Execute(worker);
+      WebPSetMemoryAccount(account);
       worker->status_ = OK;
     } else if (worker->status_ == NOT_OK) {   // finish the worker
       done = 1;
@@ -244,6 +278,7 @@ static void ChangeState(WebPWorker* const worker, WebPWorkerStatus new_status) {
     // assign new status and release the working thread if needed
     if (new_status != OK) {
       worker->status_ = new_status;
+      impl->account_ = WebPGetMemoryAccount();
       // Note the associated mutex does not need to be held when signaling the
       // condition. Unlocking the mutex first may improve performance in some
       // implementations, avoiding the case where the waiting thread can't
@@ -367,3 +402,397 @@ const WebPWorkerInterface* WebPGetWorkerInterface(void) {
 }
 
 //------------------------------------------------------------------------------
+// Worker pool
+
+#ifdef USE_WORKER_POOL
+
+#define MAX_POOL_THREADS 64
+
+// Per-worker state, attached to WebPWorker::impl_
+typedef struct WebPPoolJob WebPPoolJob;
+struct WebPPoolJob {
+  WebPWorker* worker_;
+  WebPPoolJob* next_;     // next job in the queue
+  int queued_;            // true if waiting in the queue
+  uint64_t launch_time_;  // time of the last Launch(), in us
+  WebPMemoryAccount* account_;   // account of the thread that launched the job
+};
+
+typedef struct {
+  pthread_mutex_t mutex_;
+  pthread_cond_t  work_;   // signaled when a job is queued
+  pthread_cond_t  done_;   // signaled when a job is finished
+  pthread_t threads_[MAX_POOL_THREADS];
+  int num_threads_;
+  int shutdown_;
+  WebPPoolJob* head_;      // queue of launched jobs, in launch order
+  WebPPoolJob* tail_;
+  WebPWorkerPoolStats stats_;
+  WebPWorkerInterface previous_interface_;   // restored by WebPWorkerPoolEnd()
+} WebPWorkerPool;
+
+static WebPWorkerPool* g_pool = NULL;
+
+static uint64_t GetTimeUs(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (uint64_t)(count.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+// Must be called with the pool's mutex held.
+static void PoolDequeue(WebPWorkerPool* const pool, WebPPoolJob* const job) {
+  const uint64_t wait = GetTimeUs() - job->launch_time_;
+  WebPPoolJob* prev = NULL;
+  WebPPoolJob* cur = pool->head_;
+  while (cur != job) {
+    assert(cur != NULL);
+    prev = cur;
+    cur = cur->next_;
+  }
+  if (prev == NULL) {
+    pool->head_ = job->next_;
+  } else {
+    prev->next_ = job->next_;
+  }
+  if (pool->tail_ == job) pool->tail_ = prev;
+  job->next_ = NULL;
+  job->queued_ = 0;
+  --pool->stats_.num_queued;
+  ++pool->stats_.num_jobs;
+  pool->stats_.total_wait_us += wait;
+  if (wait > pool->stats_.max_wait_us) pool->stats_.max_wait_us = wait;
+}
+
+// Runs the job outside of the lock, then marks it as done.
+static void PoolRun(WebPWorkerPool* const pool, WebPWorker* const worker) {
+  const WebPPoolJob* const job = (const WebPPoolJob*)worker->impl_;
+  WebPMemoryAccount* const job_account = job->account_;
+  WebPMemoryAccount* const account = WebPGetMemoryAccount();
+  if (++pool->stats_.num_busy > pool->stats_.max_busy) {
+    pool->stats_.max_busy = pool->stats_.num_busy;
+  }
+  pthread_mutex_unlock(&pool->mutex_);
+  WebPSetMemoryAccount(job_account);
+  WebPGetWorkerInterface()->Execute(worker);
+  WebPSetMemoryAccount(account);
+  pthread_mutex_lock(&pool->mutex_);
+  --pool->stats_.num_busy;
+  worker->status_ = OK;
+  pthread_cond_broadcast(&pool->done_);
+}
+
+static THREADFN PoolThreadLoop(void* ptr) {
+  WebPWorkerPool* const pool = (WebPWorkerPool*)ptr;
+  pthread_mutex_lock(&pool->mutex_);
+  while (1) {
+    WebPPoolJob* job;
+    while (pool->head_ == NULL && !pool->shutdown_) {
+      pthread_cond_wait(&pool->work_, &pool->mutex_);
+    }
+    if (pool->head_ == NULL) break;   // shutting down, with an empty queue
+    job = pool->head_;
+    PoolDequeue(pool, job);
+    PoolRun(pool, job->worker_);
+  }
+  pthread_mutex_unlock(&pool->mutex_);
+  return THREAD_RETURN(NULL);
+}
+
+// Waits for the worker's job, or runs it directly if it's still queued.
+// Must be called with the pool's mutex held.
+static void PoolWait(WebPWorkerPool* const pool, WebPWorker* const worker) {
+  WebPPoolJob* const job = (WebPPoolJob*)worker->impl_;
+  if (worker->status_ == WORK && job->queued_) {
+    PoolDequeue(pool, job);
+    PoolRun(pool, worker);
+  }
+  while (worker->status_ == WORK) {
+    pthread_cond_wait(&pool->done_, &pool->mutex_);
+  }
+}
+
+static int PoolSync(WebPWorker* const worker) {
+  WebPWorkerPool* const pool = g_pool;
+  if (worker->impl_ != NULL) {
+    assert(pool != NULL);
+    pthread_mutex_lock(&pool->mutex_);
+    PoolWait(pool, worker);
+    pthread_mutex_unlock(&pool->mutex_);
+  }
+  assert(worker->status_ <= OK);
+  return !worker->had_error;
+}
+
+static int PoolReset(WebPWorker* const worker) {
+  int ok = 1;
+  worker->had_error = 0;
+  if (worker->status_ < OK) {
+    WebPPoolJob* const job =
+        (WebPPoolJob*)WebPSafeCalloc(1, sizeof(WebPPoolJob));
+    if (job == NULL) return 0;
+    job->worker_ = worker;
+    worker->impl_ = (void*)job;
+    worker->status_ = OK;
+  } else if (worker->status_ > OK) {
+    ok = PoolSync(worker);
+  }
+  assert(!ok || (worker->status_ == OK));
+  return ok;
+}
+
+static void PoolLaunch(WebPWorker* const worker) {
+  WebPWorkerPool* const pool = g_pool;
+  WebPPoolJob* const job = (WebPPoolJob*)worker->impl_;
+  if (job == NULL) return;   // worker wasn't Reset()
+  pthread_mutex_lock(&pool->mutex_);
+  PoolWait(pool, worker);   // finish the previous job first
+  worker->status_ = WORK;
+  job->queued_ = 1;
+  job->launch_time_ = GetTimeUs();
+  job->account_ = WebPGetMemoryAccount();
+  if (pool->tail_ != NULL) {
+    pool->tail_->next_ = job;
+  } else {
+    pool->head_ = job;
+  }
+  pool->tail_ = job;
+  ++pool->stats_.num_queued;
+  pthread_mutex_unlock(&pool->mutex_);
+  pthread_cond_signal(&pool->work_);
+}
+
+static void PoolEnd(WebPWorker* const worker) {
+  if (worker->impl_ != NULL) {
+    PoolSync(worker);
+    WebPSafeFree(worker->impl_);
+    worker->impl_ = NULL;
+  }
+  worker->status_ = NOT_OK;
+}
+
+static void PoolDelete(WebPWorkerPool* const pool) {
+  int i;
+  pthread_mutex_lock(&pool->mutex_);
+  pool->shutdown_ = 1;
+  pthread_mutex_unlock(&pool->mutex_);
+  pthread_cond_broadcast(&pool->work_);
+  for (i = 0; i < pool->num_threads_; ++i) {
+    pthread_join(pool->threads_[i], NULL);
+  }
+  pthread_mutex_destroy(&pool->mutex_);
+  pthread_cond_destroy(&pool->work_);
+  pthread_cond_destroy(&pool->done_);
+  WebPSafeFree(pool);
+}
+
+#endif  // USE_WORKER_POOL
+
+int WebPWorkerPoolInit(int num_threads) {
+#ifdef USE_WORKER_POOL
+  static const WebPWorkerInterface kPoolInterface = {
+    Init, PoolReset, PoolSync, PoolLaunch, Execute, PoolEnd
+  };
+  WebPWorkerPool* pool;
+  if (g_pool != NULL || num_threads < 1) return 0;
+  if (num_threads > MAX_POOL_THREADS) num_threads = MAX_POOL_THREADS;
+  pool = (WebPWorkerPool*)WebPSafeCalloc(1, sizeof(*pool));
+  if (pool == NULL) return 0;
+  if (pthread_mutex_init(&pool->mutex_, NULL)) {
+    WebPSafeFree(pool);
+    return 0;
+  }
+  if (pthread_cond_init(&pool->work_, NULL)) {
+    pthread_mutex_destroy(&pool->mutex_);
+    WebPSafeFree(pool);
+    return 0;
+  }
+  if (pthread_cond_init(&pool->done_, NULL)) {
+    pthread_cond_destroy(&pool->work_);
+    pthread_mutex_destroy(&pool->mutex_);
+    WebPSafeFree(pool);
+    return 0;
+  }
+  for (; pool->num_threads_ < num_threads; ++pool->num_threads_) {
+    if (pthread_create(&pool->threads_[pool->num_threads_], NULL,
+                       PoolThreadLoop, pool)) {
+      PoolDelete(pool);
+      return 0;
+    }
+  }
+  pool->stats_.num_threads = num_threads;
+  pool->previous_interface_ = g_worker_interface;
+  g_pool = pool;
+  if (!WebPSetWorkerInterface(&kPoolInterface)) {
+    WebPWorkerPoolEnd();
+    return 0;
+  }
+  return 1;
+#else
+  (void)num_threads;
+  return 0;
+#endif
+}
+
+void WebPWorkerPoolEnd(void) {
+#ifdef USE_WORKER_POOL
+  if (g_pool != NULL) {
+    g_worker_interface = g_pool->previous_interface_;
+    PoolDelete(g_pool);
+    g_pool = NULL;
+  }
+#endif
+}
+
+int WebPWorkerPoolGetStats(WebPWorkerPoolStats* const stats) {
+#ifdef USE_WORKER_POOL
+  if (stats == NULL || g_pool == NULL) return 0;
+  pthread_mutex_lock(&g_pool->mutex_);
+  *stats = g_pool->stats_;
+  pthread_mutex_unlock(&g_pool->mutex_);
+  return 1;
+#else
+  (void)stats;
+  return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+int WebPWorkerProgressInit(WebPWorkerProgress* const progress) {
+  progress->value_ = 0;
+  progress->impl_ = NULL;
+#ifdef WEBP_USE_THREAD
+  {
+    WebPWorkerProgressImpl* const impl =
+        (WebPWorkerProgressImpl*)WebPSafeCalloc(1, sizeof(*impl));
+    if (impl == NULL) return 0;
+    if (pthread_mutex_init(&impl->mutex_, NULL)) {
+      WebPSafeFree(impl);
+      return 0;
+    }
+    if (pthread_cond_init(&impl->condition_, NULL)) {
+      pthread_mutex_destroy(&impl->mutex_);
+      WebPSafeFree(impl);
+      return 0;
+    }
+    progress->impl_ = (void*)impl;
+  }
+#endif
+  return 1;
+}
+
+void WebPWorkerProgressSet(WebPWorkerProgress* const progress, int value) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerProgressImpl* const impl =
+      (WebPWorkerProgressImpl*)progress->impl_;
+  assert(impl != NULL);
+  pthread_mutex_lock(&impl->mutex_);
+  assert(value >= progress->value_);
+  progress->value_ = value;
+  pthread_mutex_unlock(&impl->mutex_);
+  pthread_cond_broadcast(&impl->condition_);
+#else
+  assert(value >= progress->value_);
+  progress->value_ = value;
+#endif
+}
+
+int WebPWorkerProgressWait(WebPWorkerProgress* const progress, int value) {
+  int reached;
+#ifdef WEBP_USE_THREAD
+  WebPWorkerProgressImpl* const impl =
+      (WebPWorkerProgressImpl*)progress->impl_;
+  assert(impl != NULL);
+  pthread_mutex_lock(&impl->mutex_);
+  while (progress->value_ < value) {
+    if (pthread_cond_wait(&impl->condition_, &impl->mutex_)) {
+      // The wait could not be registered (too many waiters for the condition
+      // emulation): let the other threads run and poll again.
+      pthread_mutex_unlock(&impl->mutex_);
+      sched_yield();
+      pthread_mutex_lock(&impl->mutex_);
+    }
+  }
+  reached = progress->value_;
+  pthread_mutex_unlock(&impl->mutex_);
+#else
+  // without threads, jobs are run in order and can't be waited for.
+  (void)value;
+  assert(progress->value_ >= value);
+  reached = progress->value_;
+#endif
+  return reached;
+}
+
+void WebPWorkerProgressClear(WebPWorkerProgress* const progress) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerProgressImpl* const impl =
+      (WebPWorkerProgressImpl*)progress->impl_;
+  if (impl != NULL) {
+    pthread_mutex_destroy(&impl->mutex_);
+    pthread_cond_destroy(&impl->condition_);
+    WebPSafeFree(impl);
+  }
+#endif
+  progress->impl_ = NULL;
+  progress->value_ = 0;
+}
+
+//------------------------------------------------------------------------------
+
+int WebPWorkerLockInit(WebPWorkerLock* const lock) {
+  lock->impl_ = NULL;
+#ifdef WEBP_USE_THREAD
+  {
+    WebPWorkerLockImpl* const impl =
+        (WebPWorkerLockImpl*)WebPSafeCalloc(1, sizeof(*impl));
+    if (impl == NULL) return 0;
+    if (pthread_mutex_init(&impl->mutex_, NULL)) {
+      WebPSafeFree(impl);
+      return 0;
+    }
+    lock->impl_ = (void*)impl;
+  }
+#endif
+  return 1;
+}
+
+void WebPWorkerLockAcquire(WebPWorkerLock* const lock) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerLockImpl* const impl = (WebPWorkerLockImpl*)lock->impl_;
+  assert(impl != NULL);
+  pthread_mutex_lock(&impl->mutex_);
+#else
+  (void)lock;
+#endif
+}
+
+void WebPWorkerLockRelease(WebPWorkerLock* const lock) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerLockImpl* const impl = (WebPWorkerLockImpl*)lock->impl_;
+  assert(impl != NULL);
+  pthread_mutex_unlock(&impl->mutex_);
+#else
+  (void)lock;
+#endif
+}
+
+void WebPWorkerLockClear(WebPWorkerLock* const lock) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerLockImpl* const impl = (WebPWorkerLockImpl*)lock->impl_;
+  if (impl != NULL) {
+    pthread_mutex_destroy(&impl->mutex_);
+    WebPSafeFree(impl);
+  }
+#endif
+  lock->impl_ = NULL;
+}
+
+//------------------------------------------------------------------------------
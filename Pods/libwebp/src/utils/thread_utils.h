@@ -81,6 +81,80 @@ WEBP_EXTERN int WebPSetWorkerInterface(
 // Retrieve the currently set thread worker interface.
 WEBP_EXTERN const WebPWorkerInterface* WebPGetWorkerInterface(void);
 
+//------------------------------------------------------------------------------
+// Worker pool.
+// A fixed set of threads, created once, that runs the jobs of all the
+// workers. Once installed, WebPWorkerInterface's Reset() no longer spawns a
+// thread: Launch() queues the job and Sync() waits for its completion (or
+// runs it directly if no thread has picked it up yet).
+
+typedef struct {
+  int num_threads;          // number of threads in the pool
+  int num_busy;             // number of jobs currently running (including
+                            // the ones run directly by Sync())
+  int max_busy;             // highest value reached by num_busy
+  int num_queued;           // number of jobs waiting for a thread
+  uint64_t num_jobs;        // number of jobs started since the pool creation
+  uint64_t total_wait_us;   // cumulated time spent by the jobs in the queue
+  uint64_t max_wait_us;     // longest time spent by a job in the queue
+} WebPWorkerPoolStats;
+
+// Creates a pool of 'num_threads' threads and installs the corresponding
+// worker interface (see WebPSetWorkerInterface()). Like the latter, this
+// function is not thread-safe and should be called before any encoding or
+// decoding takes place. Returns false in case of error or if threads are not
+// supported.
+WEBP_EXTERN int WebPWorkerPoolInit(int num_threads);
+
+// Restores the previous worker interface and terminates the threads of the
+// pool. No worker may be in use when this function is called.
+WEBP_EXTERN void WebPWorkerPoolEnd(void);
+
+// Retrieves the current occupancy and timing counters of the pool. Returns
+// false if no pool is running.
+WEBP_EXTERN int WebPWorkerPoolGetStats(WebPWorkerPoolStats* const stats);
+
+//------------------------------------------------------------------------------
+// Progress counter shared between several workers.
+// One worker publishes an increasing position with WebPWorkerProgressSet(),
+// while others block in WebPWorkerProgressWait() until the position they
+// depend on is reached. This is used to run wavefront-style jobs.
+
+typedef struct {
+  void* impl_;    // platform-dependent implementation details
+  int value_;     // current position. Should only increase.
+} WebPWorkerProgress;
+
+// Initializes the object, with a starting position of 0. Returns false in
+// case of error.
+WEBP_EXTERN int WebPWorkerProgressInit(WebPWorkerProgress* const progress);
+// Sets the new position and wakes up the waiting threads.
+WEBP_EXTERN void WebPWorkerProgressSet(WebPWorkerProgress* const progress,
+                                       int value);
+// Blocks until the position is at least 'value'. Returns the position reached.
+WEBP_EXTERN int WebPWorkerProgressWait(WebPWorkerProgress* const progress,
+                                       int value);
+// Releases the resources. WebPWorkerProgressInit() must be called again
+// before reusing the object.
+WEBP_EXTERN void WebPWorkerProgressClear(WebPWorkerProgress* const progress);
+
+//------------------------------------------------------------------------------
+// Lock protecting data shared between several workers.
+
+typedef struct {
+  void* impl_;    // platform-dependent implementation details
+} WebPWorkerLock;
+
+// Initializes the lock. Returns false in case of error.
+WEBP_EXTERN int WebPWorkerLockInit(WebPWorkerLock* const lock);
+// Blocks until the lock is owned by the calling thread.
+WEBP_EXTERN void WebPWorkerLockAcquire(WebPWorkerLock* const lock);
+// Releases a lock owned by the calling thread.
+WEBP_EXTERN void WebPWorkerLockRelease(WebPWorkerLock* const lock);
+// Releases the resources. WebPWorkerLockInit() must be called again before
+// reusing the object.
+WEBP_EXTERN void WebPWorkerLockClear(WebPWorkerLock* const lock);
+
 //------------------------------------------------------------------------------
 
 #ifdef __cplusplus
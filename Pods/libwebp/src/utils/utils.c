@@ -17,6 +17,7 @@
 #include "src/webp/encode.h"
 #include "src/webp/format_constants.h"  // for MAX_PALETTE_SIZE
 #include "src/utils/color_cache_utils.h"
+#include "src/utils/thread_utils.h"
 #include "src/utils/utils.h"
 
 // If PRINT_MEM_INFO is defined, extra info (like total memory used, number of
@@ -164,6 +165,556 @@ static void SubMem(void* ptr) {
 #define SubMem(p)    do {} while (0)
 #endif
 
+//------------------------------------------------------------------------------
+// Allocation functions
+
+static void* DefaultMalloc(size_t size, void* opaque) {
+  (void)opaque;
+  return malloc(size);
+}
+
+static void* DefaultCalloc(size_t nmemb, size_t size, void* opaque) {
+  (void)opaque;
+  return calloc(nmemb, size);
+}
+
+static void DefaultFree(void* ptr, void* opaque) {
+  (void)opaque;
+  free(ptr);
+}
+
+static const WebPMemoryAllocator kDefaultAllocator = {
+  DefaultMalloc, DefaultCalloc, DefaultFree, NULL
+};
+static WebPMemoryAllocator g_allocator = {
+  DefaultMalloc, DefaultCalloc, DefaultFree, NULL
+};
+
+int WebPSetMemoryAllocator(const WebPMemoryAllocator* const allocator) {
+  if (allocator == NULL) {
+    g_allocator = kDefaultAllocator;
+    return 1;
+  }
+  if (allocator->malloc_func == NULL || allocator->free_func == NULL) {
+    return 0;
+  }
+  g_allocator = *allocator;
+  return 1;
+}
+
+static void* RawMalloc(size_t size) {
+  return g_allocator.malloc_func(size, g_allocator.opaque);
+}
+
+static void* RawCalloc(size_t nmemb, size_t size) {
+  void* ptr;
+  if (g_allocator.calloc_func != NULL) {
+    return g_allocator.calloc_func(nmemb, size, g_allocator.opaque);
+  }
+  ptr = g_allocator.malloc_func(nmemb * size, g_allocator.opaque);
+  if (ptr != NULL) memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+static void RawFree(void* ptr) {
+  if (ptr != NULL) g_allocator.free_func(ptr, g_allocator.opaque);
+}
+
+//------------------------------------------------------------------------------
+// Memory accounting
+
+#if defined(_MSC_VER)
+#define WEBP_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)   // also defined by clang
+#define WEBP_THREAD_LOCAL __thread
+#endif
+
+#if defined(WEBP_THREAD_LOCAL)
+
+typedef struct {
+  const void* ptr_;   // NULL for an empty slot
+  size_t size_;
+} AccountBlock;
+
+typedef struct {
+  WebPWorkerLock lock_;
+  AccountBlock* blocks_;   // live blocks, in a linear-probing hash table
+  size_t capacity_;        // size of blocks_[], a power of 2 (or 0)
+  size_t num_blocks_;
+  int dropped_;            // true if the table could not grow
+} AccountImpl;
+
+static WEBP_THREAD_LOCAL WebPMemoryAccount* g_account = NULL;
+
+static size_t AccountHash(const void* const ptr, size_t capacity) {
+  const uint64_t h = (uint64_t)(uintptr_t)ptr * 0x9e3779b97f4a7c15ULL;
+  return (size_t)(h >> 32) & (capacity - 1);
+}
+
+static void AccountInsert(AccountBlock* const blocks, size_t capacity,
+                          const void* const ptr, size_t size) {
+  size_t i = AccountHash(ptr, capacity);
+  while (blocks[i].ptr_ != NULL) i = (i + 1) & (capacity - 1);
+  blocks[i].ptr_ = ptr;
+  blocks[i].size_ = size;
+}
+
+// Doubles the size of the table. Returns false in case of memory error.
+static int AccountGrow(AccountImpl* const impl) {
+  const size_t capacity = (impl->capacity_ == 0) ? 256 : 2 * impl->capacity_;
+  AccountBlock* blocks;
+  size_t i;
+  if (capacity > WEBP_MAX_ALLOCABLE_MEMORY / sizeof(*blocks)) return 0;
+  blocks = (AccountBlock*)RawCalloc(capacity, sizeof(*blocks));
+  if (blocks == NULL) return 0;
+  for (i = 0; i < impl->capacity_; ++i) {
+    const AccountBlock* const b = &impl->blocks_[i];
+    if (b->ptr_ != NULL) AccountInsert(blocks, capacity, b->ptr_, b->size_);
+  }
+  RawFree(impl->blocks_);
+  impl->blocks_ = blocks;
+  impl->capacity_ = capacity;
+  return 1;
+}
+
+// Registers the block. If the table can't grow, the account gives up: it
+// forgets about all the blocks, and its sizes remain those reached so far.
+static void AccountAdd(WebPMemoryAccount* const account,
+                       const void* const ptr, size_t size) {
+  AccountImpl* const impl = (AccountImpl*)account->impl_;
+  WebPWorkerLockAcquire(&impl->lock_);
+  if (!impl->dropped_ && 2 * (impl->num_blocks_ + 1) > impl->capacity_ &&
+      !AccountGrow(impl)) {
+    RawFree(impl->blocks_);
+    impl->blocks_ = NULL;
+    impl->capacity_ = 0;
+    impl->num_blocks_ = 0;
+    impl->dropped_ = 1;
+  }
+  if (!impl->dropped_) {
+    AccountInsert(impl->blocks_, impl->capacity_, ptr, size);
+    ++impl->num_blocks_;
+    account->current_size += size;
+    account->total_size += size;
+    if (account->current_size > account->peak_size) {
+      account->peak_size = account->current_size;
+    }
+  }
+  WebPWorkerLockRelease(&impl->lock_);
+}
+
+// Forgets about the block, if it was registered.
+static void AccountRemove(WebPMemoryAccount* const account,
+                          const void* const ptr) {
+  AccountImpl* const impl = (AccountImpl*)account->impl_;
+  WebPWorkerLockAcquire(&impl->lock_);
+  if (impl->num_blocks_ > 0) {
+    AccountBlock* const blocks = impl->blocks_;
+    const size_t mask = impl->capacity_ - 1;
+    size_t i = AccountHash(ptr, impl->capacity_);
+    while (blocks[i].ptr_ != NULL && blocks[i].ptr_ != ptr) {
+      i = (i + 1) & mask;
+    }
+    if (blocks[i].ptr_ != NULL) {
+      size_t j = i;
+      account->current_size -= blocks[i].size_;
+      --impl->num_blocks_;
+      // Shift the rest of the cluster back into the hole, except the blocks
+      // whose home slot lies (cyclically) between the hole and themselves.
+      while (1) {
+        size_t k;
+        j = (j + 1) & mask;
+        if (blocks[j].ptr_ == NULL) break;
+        k = AccountHash(blocks[j].ptr_, impl->capacity_);
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        blocks[i] = blocks[j];
+        i = j;
+      }
+      blocks[i].ptr_ = NULL;
+    }
+  }
+  WebPWorkerLockRelease(&impl->lock_);
+}
+
+static void UnregisterBlock(const void* const ptr) {
+  WebPMemoryAccount* account;
+  for (account = g_account; account != NULL; account = account->parent_) {
+    if (account->impl_ != NULL) AccountRemove(account, ptr);
+  }
+}
+
+// Registers the block in the recording accounts.
+static void RegisterBlock(const void* const ptr, size_t size) {
+  WebPMemoryAccount* account;
+  for (account = g_account; account != NULL; account = account->parent_) {
+    if (account->impl_ != NULL) AccountAdd(account, ptr, size);
+  }
+}
+
+int WebPMemoryAccountStart(WebPMemoryAccount* const account) {
+  AccountImpl* impl;
+  assert(account != NULL);
+  memset(account, 0, sizeof(*account));
+  impl = (AccountImpl*)RawCalloc(1, sizeof(*impl));
+  if (impl == NULL) return 0;
+  if (!WebPWorkerLockInit(&impl->lock_)) {
+    RawFree(impl);
+    return 0;
+  }
+  account->impl_ = (void*)impl;
+  account->arena_ = (g_account != NULL) ? g_account->arena_ : NULL;
+  account->parent_ = g_account;
+  g_account = account;
+  return 1;
+}
+
+void WebPMemoryAccountStop(WebPMemoryAccount* const account) {
+  AccountImpl* const impl = (AccountImpl*)account->impl_;
+  assert(g_account == account);
+  g_account = account->parent_;
+  if (impl != NULL) {
+    WebPWorkerLockClear(&impl->lock_);
+    RawFree(impl->blocks_);
+    RawFree(impl);
+  }
+  account->impl_ = NULL;
+}
+
+WebPMemoryAccount* WebPGetMemoryAccount(void) {
+  return g_account;
+}
+
+void WebPSetMemoryAccount(WebPMemoryAccount* const account) {
+  g_account = account;
+}
+
+//------------------------------------------------------------------------------
+// Arenas
+//
+// The slabs of an arena are divided into contiguous blocks. Each block starts
+// with a header giving its size and the one of the block before it, so that a
+// released block is merged with its free neighbours. The free blocks are
+// listed by size class, and a slab ends with an empty block in use, so that
+// the merging stops there. A slab which becomes entirely free is given back
+// to the allocator, unless the arena keeps little enough memory in reserve.
+
+#define ARENA_ALIGN 16                    // alignment of the blocks
+#define ARENA_DEFAULT_SLAB_SIZE (1 << 20)
+#define ARENA_MAX_KEPT_SLABS 4            // free slabs kept, in slab sizes
+#define ARENA_NUM_CLASSES 64              // free lists, by power of 2
+
+typedef struct ArenaBlock ArenaBlock;
+struct ArenaBlock {
+  size_t size_;        // size of the block, header included, +1 if in use
+  size_t prev_size_;   // size of the previous block in the slab, 0 if first
+  ArenaBlock* prev_;   // links in the free list, if the block is free
+  ArenaBlock* next_;
+};
+#define BLOCK_HEADER_SIZE \
+    ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define MIN_BLOCK_SIZE (BLOCK_HEADER_SIZE + ARENA_ALIGN)
+#define BLOCK_IN_USE 1
+
+typedef struct ArenaSlab ArenaSlab;
+struct ArenaSlab {
+  ArenaSlab* next_;
+  size_t size_;     // size of the blocks, not counting the final one
+};
+// The slab's blocks follow its header.
+#define SLAB_HEADER_SIZE \
+    ((sizeof(ArenaSlab) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct WebPArena {
+  WebPWorkerLock lock_;   // the arena is shared by the workers of a request
+  size_t slab_size_;      // minimum size of a slab
+  size_t kept_size_;      // size of the free slabs kept in reserve
+  ArenaSlab* slabs_;
+  ArenaBlock* free_[ARENA_NUM_CLASSES];   // free blocks, by size class
+};
+
+static WEBP_THREAD_LOCAL WebPArena* g_arena = NULL;
+
+static WEBP_INLINE size_t BlockSize(const ArenaBlock* const block) {
+  return block->size_ & ~(size_t)BLOCK_IN_USE;
+}
+
+static WEBP_INLINE ArenaBlock* NextBlock(const ArenaBlock* const block) {
+  return (ArenaBlock*)((uint8_t*)block + BlockSize(block));
+}
+
+// Returns true if the free 'block' covers its whole slab.
+static WEBP_INLINE int IsSlabFree(const ArenaBlock* const block) {
+  return (block->prev_size_ == 0 && BlockSize(NextBlock(block)) == 0);
+}
+
+static int SizeClass(size_t size) {
+  const uint64_t s = (uint64_t)size;
+  return (s >> 32) ? 32 + BitsLog2Floor((uint32_t)(s >> 32))
+                   : BitsLog2Floor((uint32_t)s);
+}
+
+static void LinkBlock(WebPArena* const arena, ArenaBlock* const block) {
+  ArenaBlock** const list = &arena->free_[SizeClass(block->size_)];
+  block->prev_ = NULL;
+  block->next_ = *list;
+  if (*list != NULL) (*list)->prev_ = block;
+  *list = block;
+}
+
+static void UnlinkBlock(WebPArena* const arena, ArenaBlock* const block) {
+  if (block->prev_ != NULL) {
+    block->prev_->next_ = block->next_;
+  } else {
+    arena->free_[SizeClass(block->size_)] = block->next_;
+  }
+  if (block->next_ != NULL) block->next_->prev_ = block->prev_;
+}
+
+// Returns a free block of at least 'size' bytes, or NULL.
+static ArenaBlock* FindBlock(const WebPArena* const arena, size_t size) {
+  int c = SizeClass(size);
+  ArenaBlock* block;
+  // Only the first class may hold blocks too small.
+  for (block = arena->free_[c]; block != NULL; block = block->next_) {
+    if (block->size_ >= size) return block;
+  }
+  for (++c; c < ARENA_NUM_CLASSES; ++c) {
+    if (arena->free_[c] != NULL) return arena->free_[c];
+  }
+  return NULL;
+}
+
+// Adds a slab large enough for a block of 'size' bytes, and returns its only
+// block, free but not listed.
+static ArenaBlock* NewSlab(WebPArena* const arena, size_t size) {
+  // Large blocks get a slab of their own.
+  const size_t slab_size = (size > arena->slab_size_ / 2) ? size
+                                                          : arena->slab_size_;
+  ArenaSlab* const slab =
+      (ArenaSlab*)RawMalloc(SLAB_HEADER_SIZE + slab_size + BLOCK_HEADER_SIZE);
+  ArenaBlock* block;
+  if (slab == NULL) return NULL;
+  slab->size_ = slab_size;
+  slab->next_ = arena->slabs_;
+  arena->slabs_ = slab;
+  block = (ArenaBlock*)((uint8_t*)slab + SLAB_HEADER_SIZE);
+  block->size_ = slab_size;
+  block->prev_size_ = 0;
+  NextBlock(block)->size_ = BLOCK_IN_USE;   // final empty block
+  NextBlock(block)->prev_size_ = slab_size;
+  return block;
+}
+
+static void* ArenaMalloc(WebPArena* const arena, size_t size) {
+  const size_t block_size = BLOCK_HEADER_SIZE +
+      ((size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+  ArenaBlock* block;
+  WebPWorkerLockAcquire(&arena->lock_);
+  block = FindBlock(arena, block_size);
+  if (block != NULL) {
+    UnlinkBlock(arena, block);
+    if (IsSlabFree(block)) arena->kept_size_ -= block->size_;
+  } else {
+    block = NewSlab(arena, block_size);
+  }
+  if (block != NULL) {
+    if (block->size_ - block_size >= MIN_BLOCK_SIZE) {   // split it
+      ArenaBlock* const rest = (ArenaBlock*)((uint8_t*)block + block_size);
+      rest->size_ = block->size_ - block_size;
+      rest->prev_size_ = block_size;
+      NextBlock(rest)->prev_size_ = rest->size_;
+      LinkBlock(arena, rest);
+      block->size_ = block_size;
+    }
+    block->size_ |= BLOCK_IN_USE;
+  }
+  WebPWorkerLockRelease(&arena->lock_);
+  return (block != NULL) ? (uint8_t*)block + BLOCK_HEADER_SIZE : NULL;
+}
+
+// Returns false if 'ptr' doesn't belong to the arena.
+static int ArenaFree(WebPArena* const arena, const void* const ptr) {
+  const uintptr_t p = (uintptr_t)ptr;
+  ArenaSlab** slab;
+  ArenaBlock* block;
+  ArenaBlock* next;
+  WebPWorkerLockAcquire(&arena->lock_);
+  for (slab = &arena->slabs_; *slab != NULL; slab = &(*slab)->next_) {
+    const uintptr_t start = (uintptr_t)*slab + SLAB_HEADER_SIZE;
+    if (p >= start && p < start + (*slab)->size_) break;
+  }
+  if (*slab == NULL) {
+    WebPWorkerLockRelease(&arena->lock_);
+    return 0;
+  }
+  block = (ArenaBlock*)((uint8_t*)ptr - BLOCK_HEADER_SIZE);
+  next = NextBlock(block);
+  assert(block->size_ & BLOCK_IN_USE);
+  block->size_ = BlockSize(block);
+  if (!(next->size_ & BLOCK_IN_USE)) {
+    UnlinkBlock(arena, next);
+    block->size_ += next->size_;
+  }
+  if (block->prev_size_ != 0) {
+    ArenaBlock* const prev =
+        (ArenaBlock*)((uint8_t*)block - block->prev_size_);
+    if (!(prev->size_ & BLOCK_IN_USE)) {
+      UnlinkBlock(arena, prev);
+      prev->size_ += block->size_;
+      block = prev;
+    }
+  }
+  NextBlock(block)->prev_size_ = block->size_;
+  if (IsSlabFree(block) &&
+      (uint64_t)arena->kept_size_ + block->size_ >
+          (uint64_t)ARENA_MAX_KEPT_SLABS * arena->slab_size_) {
+    ArenaSlab* const free_slab = *slab;
+    *slab = free_slab->next_;
+    RawFree(free_slab);
+  } else {
+    if (IsSlabFree(block)) arena->kept_size_ += block->size_;
+    LinkBlock(arena, block);
+  }
+  WebPWorkerLockRelease(&arena->lock_);
+  return 1;
+}
+
+WebPArena* WebPArenaNew(size_t slab_size) {
+  WebPMemoryAccount* const account = g_account;
+  WebPArena* const arena = (WebPArena*)RawCalloc(1, sizeof(*arena));
+  int ok;
+  if (arena == NULL) return NULL;
+  g_account = NULL;   // the arena must not be allocated by a request
+  ok = WebPWorkerLockInit(&arena->lock_);
+  g_account = account;
+  if (!ok) {
+    RawFree(arena);
+    return NULL;
+  }
+  if (slab_size == 0) slab_size = ARENA_DEFAULT_SLAB_SIZE;
+  if (slab_size > WEBP_MAX_ALLOCABLE_MEMORY) {
+    slab_size = (size_t)WEBP_MAX_ALLOCABLE_MEMORY;
+  }
+  if (slab_size < MIN_BLOCK_SIZE) slab_size = MIN_BLOCK_SIZE;
+  slab_size = (slab_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  arena->slab_size_ = slab_size;
+  return arena;
+}
+
+void WebPArenaDelete(WebPArena* arena) {
+  if (arena == NULL) return;
+  if (g_arena == arena) g_arena = NULL;
+  while (arena->slabs_ != NULL) {
+    ArenaSlab* const next = arena->slabs_->next_;
+    RawFree(arena->slabs_);
+    arena->slabs_ = next;
+  }
+  WebPWorkerLockClear(&arena->lock_);
+  RawFree(arena);
+}
+
+int WebPSetThreadArena(WebPArena* arena) {
+  g_arena = arena;
+  return 1;
+}
+
+void WebPMemoryRequestStart(WebPMemoryAccount* const request) {
+  assert(request != NULL);
+  memset(request, 0, sizeof(*request));
+  if (g_arena == NULL) return;
+  if (g_account != NULL && g_account->arena_ != NULL) return;   // nested
+  request->arena_ = g_arena;
+  request->parent_ = g_account;
+  g_account = request;
+}
+
+void WebPMemoryRequestEnd(WebPMemoryAccount* const request) {
+  if (request->arena_ == NULL) return;
+  assert(g_account == request);
+  g_account = request->parent_;
+}
+
+//------------------------------------------------------------------------------
+
+static void* AllocateBlock(size_t size, int clear, int use_arena) {
+  WebPArena* const arena =
+      (use_arena && g_account != NULL) ? g_account->arena_ : NULL;
+  void* ptr;
+  if (arena != NULL) {
+    ptr = ArenaMalloc(arena, size);
+    if (ptr != NULL && clear) memset(ptr, 0, size);
+  } else {
+    ptr = clear ? RawCalloc(1, size) : RawMalloc(size);
+  }
+  if (ptr != NULL && g_account != NULL) RegisterBlock(ptr, size);
+  return ptr;
+}
+
+static void ReleaseBlock(void* const ptr) {
+  // Outside of a request, the block may still come from the thread's arena.
+  WebPArena* const arena = (g_account != NULL && g_account->arena_ != NULL)
+                         ? g_account->arena_ : g_arena;
+  if (g_account != NULL) UnregisterBlock(ptr);
+  if (arena != NULL && ArenaFree(arena, ptr)) return;
+  RawFree(ptr);
+}
+
+#else  // !WEBP_THREAD_LOCAL
+
+int WebPMemoryAccountStart(WebPMemoryAccount* const account) {
+  assert(account != NULL);
+  memset(account, 0, sizeof(*account));
+  return 1;
+}
+
+void WebPMemoryAccountStop(WebPMemoryAccount* const account) {
+  (void)account;
+}
+
+WebPMemoryAccount* WebPGetMemoryAccount(void) {
+  return NULL;
+}
+
+void WebPSetMemoryAccount(WebPMemoryAccount* const account) {
+  (void)account;
+}
+
+WebPArena* WebPArenaNew(size_t slab_size) {
+  (void)slab_size;
+  return NULL;
+}
+
+void WebPArenaDelete(WebPArena* arena) {
+  (void)arena;
+}
+
+int WebPSetThreadArena(WebPArena* arena) {
+  (void)arena;
+  return 0;
+}
+
+void WebPMemoryRequestStart(WebPMemoryAccount* const request) {
+  assert(request != NULL);
+  memset(request, 0, sizeof(*request));
+}
+
+void WebPMemoryRequestEnd(WebPMemoryAccount* const request) {
+  (void)request;
+}
+
+static void* AllocateBlock(size_t size, int clear, int use_arena) {
+  (void)use_arena;
+  return clear ? RawCalloc(1, size) : RawMalloc(size);
+}
+
+static void ReleaseBlock(void* const ptr) {
+  RawFree(ptr);
+}
+
+#endif  // WEBP_THREAD_LOCAL
+
+//------------------------------------------------------------------------------
+
 // Returns 0 in case of overflow of nmemb * size.
 static int CheckSizeArgumentsOverflow(uint64_t nmemb, size_t size) {
   const uint64_t total_size = nmemb * size;
@@ -193,7 +744,7 @@ void* WebPSafeMalloc(uint64_t nmemb, size_t size) {
   Increment(&num_malloc_calls);
   if (!CheckSizeArgumentsOverflow(nmemb, size)) return NULL;
   assert(nmemb * size > 0);
-  ptr = malloc((size_t)(nmemb * size));
+  ptr = AllocateBlock((size_t)(nmemb * size), 0, 0);
   AddMem(ptr, (size_t)(nmemb * size));
   return ptr;
 }
@@ -203,7 +754,27 @@ void* WebPSafeCalloc(uint64_t nmemb, size_t size) {
   Increment(&num_calloc_calls);
   if (!CheckSizeArgumentsOverflow(nmemb, size)) return NULL;
   assert(nmemb * size > 0);
-  ptr = calloc((size_t)nmemb, size);
+  ptr = AllocateBlock((size_t)(nmemb * size), 1, 0);
+  AddMem(ptr, (size_t)(nmemb * size));
+  return ptr;
+}
+
+void* WebPSafeMallocTransient(uint64_t nmemb, size_t size) {
+  void* ptr;
+  Increment(&num_malloc_calls);
+  if (!CheckSizeArgumentsOverflow(nmemb, size)) return NULL;
+  assert(nmemb * size > 0);
+  ptr = AllocateBlock((size_t)(nmemb * size), 0, 1);
+  AddMem(ptr, (size_t)(nmemb * size));
+  return ptr;
+}
+
+void* WebPSafeCallocTransient(uint64_t nmemb, size_t size) {
+  void* ptr;
+  Increment(&num_calloc_calls);
+  if (!CheckSizeArgumentsOverflow(nmemb, size)) return NULL;
+  assert(nmemb * size > 0);
+  ptr = AllocateBlock((size_t)(nmemb * size), 1, 1);
   AddMem(ptr, (size_t)(nmemb * size));
   return ptr;
 }
@@ -212,8 +783,8 @@ void WebPSafeFree(void* const ptr) {
   if (ptr != NULL) {
     Increment(&num_free_calls);
     SubMem(ptr);
+    ReleaseBlock(ptr);
   }
-  free(ptr);
 }
 
 // Public API functions.
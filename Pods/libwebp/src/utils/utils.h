@@ -53,9 +53,68 @@ WEBP_EXTERN void* WebPSafeMalloc(uint64_t nmemb, size_t size);
 // in order to favor the "calloc(num_foo, sizeof(foo))" pattern.
 WEBP_EXTERN void* WebPSafeCalloc(uint64_t nmemb, size_t size);
 
+// Same as WebPSafeMalloc() and WebPSafeCalloc(), for the working memory of the
+// encoder and decoder, which is always released before the current request
+// (see below) ends. It is taken from the request's arena, if any. Anything
+// else, in particular the allocations made by the user's callbacks, must use
+// the functions above.
+WEBP_EXTERN void* WebPSafeMallocTransient(uint64_t nmemb, size_t size);
+WEBP_EXTERN void* WebPSafeCallocTransient(uint64_t nmemb, size_t size);
+
 // Companion deallocation function to the above allocations.
 WEBP_EXTERN void WebPSafeFree(void* const ptr);
 
+//------------------------------------------------------------------------------
+// Memory accounting
+
+// Records the memory allocated by the above functions. Once started, an
+// account registers the allocations of the calling thread and of the workers
+// it launches, until it is stopped. Accounts can be nested: each allocation
+// is registered by all the accounts active on the thread.
+// Requests (see below) use the same object to pass their arena to the
+// workers, without registering anything.
+typedef struct WebPMemoryAccount WebPMemoryAccount;
+struct WebPMemoryAccount {
+  WebPMemoryAccount* parent_;   // account active when this one was started
+  void* impl_;                  // live blocks and their lock (NULL if the
+                                // account doesn't register the allocations)
+  WebPArena* arena_;            // arena serving the allocations, or NULL
+  uint64_t current_size;        // memory currently allocated
+  uint64_t peak_size;           // highest value reached by current_size
+  uint64_t total_size;          // cumulated size of all the allocations
+};
+
+// Starts registering the allocations in 'account'. Returns false in case of
+// memory error. If the platform has no thread-local storage, nothing is
+// registered and all sizes remain zero. If the account runs out of memory
+// later on, it stops registering and its sizes remain those reached so far.
+WEBP_EXTERN int WebPMemoryAccountStart(WebPMemoryAccount* const account);
+// Stops registering the allocations. 'account' must be the last account
+// started on the calling thread. Its sizes remain readable afterward.
+WEBP_EXTERN void WebPMemoryAccountStop(WebPMemoryAccount* const account);
+
+// Returns the innermost account active on the calling thread, or NULL.
+WEBP_EXTERN WebPMemoryAccount* WebPGetMemoryAccount(void);
+// Makes 'account' (possibly NULL) the innermost account of the calling thread.
+// Used by the workers to register their allocations in the launching thread's
+// accounts.
+WEBP_EXTERN void WebPSetMemoryAccount(WebPMemoryAccount* const account);
+
+// Starts a request served by the arena attached to the calling thread with
+// WebPSetThreadArena(), if any and if no request is running already. Until
+// WebPMemoryRequestEnd(), the transient blocks allocated by the thread and the
+// workers it launches are taken from the arena, which reuses their memory as
+// soon as they are released.
+WEBP_EXTERN void WebPMemoryRequestStart(WebPMemoryAccount* const request);
+WEBP_EXTERN void WebPMemoryRequestEnd(WebPMemoryAccount* const request);
+
+// Returns 'size' in kilobytes, rounded up and clamped to 32 bits, as reported
+// in the public statistics.
+static WEBP_INLINE uint32_t WebPMemorySizeToKb(uint64_t size) {
+  const uint64_t kb = (size + 1023) >> 10;
+  return (kb > 0xffffffffu) ? 0xffffffffu : (uint32_t)kb;
+}
+
 //------------------------------------------------------------------------------
 // Alignment
 
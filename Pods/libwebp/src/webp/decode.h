@@ -20,7 +20,7 @@
 extern "C" {
 #endif
 
-#define WEBP_DECODER_ABI_VERSION 0x0209    // MAJOR(8b) + MINOR(8b)
+#define WEBP_DECODER_ABI_VERSION 0x020b    // MAJOR(8b) + MINOR(8b)
 
 // Note: forward declaring enumerations is not allowed in (strict) C and C++,
 // the types are left here for reference.
@@ -208,7 +208,11 @@ struct WebPDecBuffer {
     WebPRGBABuffer RGBA;
     WebPYUVABuffer YUVA;
   } u;                       // Nameless union of buffer parameters.
-  uint32_t       pad[4];     // padding for later use
+  uint32_t peak_memory_kb;   // Memory statistics of the WebPDecode() call
+  uint32_t total_memory_kb;  // that filled the buffer, in kilobytes: highest
+                             // amount in use and cumulated allocations. Only
+                             // set if 'options.track_memory' was true.
+  uint32_t       pad[2];     // padding for later use
 
   uint8_t* private_memory;   // Internally allocated memory (only when
                              // is_external_memory is 0). Should not be used
@@ -338,6 +342,23 @@ WEBP_EXTERN VP8StatusCode WebPIAppend(
 WEBP_EXTERN VP8StatusCode WebPIUpdate(
     WebPIDecoder* idec, const uint8_t* data, size_t data_size);
 
+// Hook called by the incremental decoder once it no longer references a
+// segment passed to WebPIAppendSegment().
+typedef void (*WebPISegmentReleaseHook)(const uint8_t* data, size_t data_size,
+                                        void* user_data);
+
+// A variant of WebPIAppend() for input made of separate caller-owned
+// segments, passed in stream order. When possible, the segment is decoded in
+// place instead of being copied, so its memory must stay valid until 'release'
+// is called (with 'user_data'). 'release' can be NULL, and is otherwise called
+// exactly once per segment, at the latest from WebPIDelete(). Lossless
+// and multi-partition lossy bitstreams still need a contiguous copy of the data.
+// Can't be mixed with calls to WebPIAppend() or WebPIUpdate() on the same
+// decoder.
+WEBP_EXTERN VP8StatusCode WebPIAppendSegment(
+    WebPIDecoder* idec, const uint8_t* data, size_t data_size,
+    WebPISegmentReleaseHook release, void* user_data);
+
 // Returns the RGB/A image decoded so far. Returns NULL if output params
 // are not initialized yet. The RGB/A output type corresponds to the colorspace
 // specified during call to WebPINewDecoder() or WebPINewRGB().
@@ -451,12 +472,25 @@ struct WebPDecoderOptions {
   int crop_width, crop_height;        // dimension of the cropping area
   int use_scaling;                    // if true, scaling is applied _afterward_
   int scaled_width, scaled_height;    // final resolution
-  int use_threads;                    // if true, use multi-threaded decoding
+  int use_threads;                    // if true, use multi-threaded decoding.
+                                      // Values above 1 set the number of
+                                      // row workers for lossy decoding.
   int dithering_strength;             // dithering strength (0=Off, 100=full)
   int flip;                           // flip output vertically
   int alpha_dithering_strength;       // alpha dithering strength in [0..100]
-
-  uint32_t pad[5];                    // padding for later use
+  int use_dc_thumbnail;               // if true, lossy pictures scaled down by
+                                      // 8 or more are approximated from their
+                                      // DC coefficients only. All the
+                                      // coefficients are still parsed, but the
+                                      // transforms and loop-filter are skipped:
+                                      // decoding is about twice as fast, for a
+                                      // blurrier result (PSNR of 20 to 30dB
+                                      // against the regular scaled decoding,
+                                      // on detailed pictures).
+  int track_memory;                   // if true, report the memory used by
+                                      // WebPDecode() in 'output'.
+
+  uint32_t pad[3];                    // padding for later use
 };
 
 // Main object storing the configuration for advanced decoding.
@@ -496,6 +530,48 @@ WEBP_EXTERN WebPIDecoder* WebPIDecode(const uint8_t* data, size_t data_size,
 WEBP_EXTERN VP8StatusCode WebPDecode(const uint8_t* data, size_t data_size,
                                      WebPDecoderConfig* config);
 
+//------------------------------------------------------------------------------
+// Decoding of many pictures.
+// A WebPDecoderContext keeps the decoder objects and their internal buffers
+// between pictures, growing them as needed, instead of allocating them anew
+// for each picture. It is released with WebPDeleteDecoderContext().
+//
+//   WebPDecoderContext* const context = WebPNewDecoderContext(4);
+//   for (...) {
+//     ... fill 'data', 'data_size' and 'configs' ...
+//     num_ok = WebPDecodeBatch(context, data, data_size, configs, status, n);
+//   }
+//   WebPDeleteDecoderContext(context);
+
+typedef struct WebPDecoderContext WebPDecoderContext;
+
+// Creates a new decoding context. 'num_threads' is the number of pictures
+// that WebPDecodeBatch() decodes in parallel (<= 1 means sequentially).
+// Returns NULL in case of memory error.
+WEBP_EXTERN WebPDecoderContext* WebPNewDecoderContext(int num_threads);
+
+// Releases the context and all the memory it holds.
+WEBP_EXTERN void WebPDeleteDecoderContext(WebPDecoderContext* context);
+
+// Same as WebPDecode(), reusing the memory held by 'context'.
+// A context must not be used by several threads at the same time.
+WEBP_EXTERN VP8StatusCode WebPDecodeWithContext(WebPDecoderContext* context,
+                                                const uint8_t* data,
+                                                size_t data_size,
+                                                WebPDecoderConfig* config);
+
+// Decodes the 'num_pictures' bitstreams 'data[i]' of size 'data_size[i]',
+// each as WebPDecode() would using 'configs[i]' (the output buffers
+// typically point to external memory). The pictures are spread over the
+// threads of 'context'. If 'status' is not NULL, the decoding status of each
+// picture is stored in 'status[i]'.
+// Returns the number of pictures successfully decoded.
+WEBP_EXTERN int WebPDecodeBatch(WebPDecoderContext* context,
+                                const uint8_t* const data[],
+                                const size_t data_size[],
+                                WebPDecoderConfig configs[],
+                                VP8StatusCode status[], int num_pictures);
+
 #ifdef __cplusplus
 }    // extern "C"
 #endif
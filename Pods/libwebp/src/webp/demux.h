@@ -55,7 +55,7 @@
 extern "C" {
 #endif
 
-#define WEBP_DEMUX_ABI_VERSION 0x0107    // MAJOR(8b) + MINOR(8b)
+#define WEBP_DEMUX_ABI_VERSION 0x010a    // MAJOR(8b) + MINOR(8b)
 
 // Note: forward declaring enumerations is not allowed in (strict) C and C++,
 // the types are left here for reference.
@@ -108,6 +108,19 @@ static WEBP_INLINE WebPDemuxer* WebPDemuxPartial(
   return WebPDemuxInternal(data, 1, state, WEBP_DEMUX_ABI_VERSION);
 }
 
+// Same as WebPDemux(), except that the frames of an animation are only parsed
+// when first accessed, e.g. by WebPDemuxGetFrame(). 'data' must hold the whole
+// file, and is typically a read-only memory mapping of it: only the pages of
+// the frames accessed are then read in. WEBP_FF_FRAME_COUNT is known upfront,
+// from the chunk headers. A parsing error found past the first frame makes the
+// accesses to the frame concerned, to the following frames and to the chunks
+// fail, the frames preceding it remaining accessible.
+// NOTE: unlike other demuxers, such an object is modified by the iteration
+// functions and must not be used from several threads at the same time.
+static WEBP_INLINE WebPDemuxer* WebPDemuxLazy(const WebPData* data) {
+  return WebPDemuxInternal(data, 2, NULL, WEBP_DEMUX_ABI_VERSION);
+}
+
 // Frees memory associated with 'dmux'.
 WEBP_EXTERN void WebPDemuxDelete(WebPDemuxer* dmux);
 
@@ -253,7 +266,15 @@ struct WebPAnimDecoderOptions {
   // MODE_RGBA, MODE_BGRA, MODE_rgbA and MODE_bgrA.
   WEBP_CSP_MODE color_mode;
   int use_threads;           // If true, use multi-threaded decoding.
-  uint32_t padding[7];       // Padding for later use.
+  int snapshot_interval;     // If positive, a copy of the canvas is kept every
+                             // 'snapshot_interval' frames to speed up
+                             // WebPAnimDecoderSeek(), at the cost of memory.
+  int lookahead;             // If positive, up to 'lookahead' frames (max 16)
+                             // are decoded ahead of time on worker threads.
+  int lazy_demux;            // If true, frames are only parsed when decoded
+                             // (see WebPDemuxLazy()), for large memory mapped
+                             // files.
+  uint32_t padding[4];       // Padding for later use.
 };
 
 // Internal, version-checked, entry point.
@@ -340,6 +361,18 @@ WEBP_EXTERN int WebPAnimDecoderHasMoreFrames(const WebPAnimDecoder* dec);
 //   dec - (in/out) decoder instance to be reset
 WEBP_EXTERN void WebPAnimDecoderReset(WebPAnimDecoder* dec);
 
+// Positions 'dec' so that the next call to WebPAnimDecoderGetNext() returns
+// the frame 'frame_index' (starting from 1) with its usual timestamp.
+// Decoding restarts from the closest preceding key-frame or canvas snapshot
+// (see 'snapshot_interval'), unless the current position is closer.
+// Parameters:
+//   dec - (in/out) decoder instance to be positioned.
+//   frame_index - (in) index of the next frame to be returned.
+// Returns:
+//   False if 'dec' is NULL, 'frame_index' is out of range, or in case of
+//   parsing, decoding or memory error. Otherwise, returns true.
+WEBP_EXTERN int WebPAnimDecoderSeek(WebPAnimDecoder* dec, int frame_index);
+
 // Grab the internal demuxer object.
 // Getting the demuxer object can be useful if one wants to use operations only
 // available through demuxer; e.g. to get XMP/EXIF/ICC metadata. The returned
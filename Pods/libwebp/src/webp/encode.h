@@ -20,7 +20,7 @@
 extern "C" {
 #endif
 
-#define WEBP_ENCODER_ABI_VERSION 0x020f    // MAJOR(8b) + MINOR(8b)
+#define WEBP_ENCODER_ABI_VERSION 0x0213    // MAJOR(8b) + MINOR(8b)
 
 // Note: forward declaring enumerations is not allowed in (strict) C and C++,
 // the types are left here for reference.
@@ -136,6 +136,9 @@ struct WebPConfig {
                           // JPEG compression. Generally, the output size will
                           // be similar but the degradation will be lower.
   int thread_level;       // If non-zero, try and use multi-threaded encoding.
+                          // Values above 1 set the number of threads used
+                          // (lossy output then differs slightly from
+                          // thread_level 0 or 1).
   int low_memory;         // If set, reduce memory usage (but increase CPU use).
 
   int near_lossless;      // Near lossless encoding [0 = max loss .. 100 = off
@@ -147,8 +150,14 @@ struct WebPConfig {
 
   int use_delta_palette;  // reserved for future lossless feature
   int use_sharp_yuv;      // if needed, use sharp (and slow) RGB->YUV conversion
-
-  uint32_t pad[2];        // padding for later use
+  int stream_output;      // If true, lossy data is handed to the writer in
+                          // bounded chunks while the token partition is being
+                          // coded, instead of once it is complete. Costs an
+                          // extra pass over the tokens. Only used with the
+                          // token buffer (method >= 3, without low_memory).
+                          // The output is unchanged.
+  int track_memory;       // If true, report the memory used by WebPEncode()
+                          // in picture->stats, if any.
 };
 
 // Enumerate some predefined settings for WebPConfig, depending on the type
@@ -227,7 +236,10 @@ struct WebPAuxStats {
   int lossless_hdr_size;       // lossless header (transform, huffman etc) size
   int lossless_data_size;      // lossless image data size
 
-  uint32_t pad[2];        // padding for later use
+  // memory statistics of the WebPEncode() call, in kilobytes. Only set if
+  // config->track_memory was true.
+  uint32_t peak_memory_kb;     // highest amount of memory in use
+  uint32_t total_memory_kb;    // cumulated size of all the allocations
 };
 
 // Signature for output function. Should return true if writing was successful.
@@ -262,6 +274,13 @@ WEBP_EXTERN int WebPMemoryWrite(const uint8_t* data, size_t data_size,
 // everything is OK.
 typedef int (*WebPProgressHook)(int percent, const WebPPicture* picture);
 
+// Row source, from which the lossy encoder can pull the input samples instead
+// of reading the sample planes (see WebPPicture::row_source). It should store
+// 'num_rows' rows of RGB samples (3 bytes per pixel), starting at row 'y', into
+// 'rgb', with a stride of 'rgb_stride' bytes. Returns false to abort encoding.
+typedef int (*WebPRowSource)(int y, int num_rows, uint8_t* rgb, int rgb_stride,
+                             const WebPPicture* picture);
+
 // Color spaces.
 typedef enum WebPEncCSP {
   // chroma sampling
@@ -346,8 +365,19 @@ struct WebPPicture {
 
   uint32_t pad3[3];       // padding for later use
 
+  // If not NULL, the lossy encoder pulls its input from this row source (with
+  // 'user_data' free to point to the caller's state), and the sample planes
+  // can be left empty. Rows come one macroblock row at a time, along with the
+  // two rows above it, from top to bottom, and again for each analysis or
+  // coding pass. They are converted as by WebPPictureImportRGB(), without
+  // alpha. Memory use then scales with the width of the picture, except for a
+  // few bytes per macroblock and the coded data (with config->low_memory set,
+  // no token buffer is kept). Encoding is single-threaded. Lossless encoding
+  // and the picture tools don't support this mode.
+  WebPRowSource row_source;
+
   // Unused for now
-  uint8_t* pad4, *pad5;
+  uint8_t* pad5;
   uint32_t pad6[8];       // padding for later use
 
   // PRIVATE FIELDS
@@ -451,6 +481,13 @@ WEBP_EXTERN int WebPPictureIsView(const WebPPicture* picture);
 // Returns false in case of error (invalid parameter or insufficient memory).
 WEBP_EXTERN int WebPPictureRescale(WebPPicture* pic, int width, int height);
 
+// Same as WebPPictureRescale(), but with the planes split into bands that are
+// rescaled in parallel over up to 'num_threads' threads. The result does not
+// depend on 'num_threads'.
+WEBP_EXTERN int WebPPictureRescaleThreaded(WebPPicture* pic,
+                                           int width, int height,
+                                           int num_threads);
+
 // Colorspace conversion function to import RGB samples.
 // Previous buffer will be free'd, if any.
 // *rgb buffer should have a size of at least height * rgb_stride.
@@ -391,6 +391,27 @@ WEBP_EXTERN WebPMuxError WebPMuxNumChunks(const WebPMux* mux,
 WEBP_EXTERN WebPMuxError WebPMuxAssemble(WebPMux* mux,
                                          WebPData* assembled_data);
 
+// Same as WebPMuxAssemble(), except that the WebP RIFF data is returned as a
+// list of consecutive segments (e.g. for writev()) instead of being copied
+// into a single buffer. The segments point either to chunk headers generated
+// in the returned array's memory, or directly to the chunk payloads held by
+// 'mux' (or by the caller, for data added with copy_data = 0). They are only
+// valid as long as 'mux' and such data are not modified or released.
+// '*segments' is allocated as a single block which MUST be deallocated by the
+// caller by calling WebPFree(). It is set to NULL in case of error.
+// Parameters:
+//   mux - (in/out) object whose chunks are to be assembled
+//   segments - (out) array of '*num_segments' pieces of the WebP data
+//   num_segments - (out) number of segments
+// Returns:
+//   WEBP_MUX_BAD_DATA - if mux object is invalid.
+//   WEBP_MUX_INVALID_ARGUMENT - if mux, segments or num_segments is NULL.
+//   WEBP_MUX_MEMORY_ERROR - on memory allocation error.
+//   WEBP_MUX_OK - on success.
+WEBP_EXTERN WebPMuxError WebPMuxAssembleSegments(WebPMux* mux,
+                                                 WebPData** segments,
+                                                 int* num_segments);
+
 //------------------------------------------------------------------------------
 // WebPAnimEncoder API
 //
@@ -486,7 +507,9 @@ static WEBP_INLINE WebPAnimEncoder* WebPAnimEncoderNew(
 //                       "timestamp of next frame - timestamp of this frame".
 //                       Hence, timestamps should be in non-decreasing order.
 //   config - (in) encoding options; can be passed NULL to pick
-//            reasonable defaults.
+//            reasonable defaults. If config->thread_level is above 0, the
+//            candidate encodings of the frame run concurrently, and
+//            frame->progress_hook can be called from several threads.
 // Returns:
 //   On error, returns false and frame->error_code is set appropriately.
 //   Otherwise, returns true.
@@ -61,6 +61,52 @@ WEBP_EXTERN void* WebPMalloc(size_t size);
 // Releases memory returned by the WebPDecode*() functions (from decode.h).
 WEBP_EXTERN void WebPFree(void* ptr);
 
+// Set of functions used by the library to allocate and release memory.
+// 'opaque' is passed back to each of them. 'calloc_func' is optional: if
+// NULL, memory obtained from 'malloc_func' is cleared instead.
+typedef struct WebPMemoryAllocator {
+  void* (*malloc_func)(size_t size, void* opaque);
+  void* (*calloc_func)(size_t nmemb, size_t size, void* opaque);
+  void (*free_func)(void* ptr, void* opaque);
+  void* opaque;
+} WebPMemoryAllocator;
+
+// Installs the memory functions used by all the libwebp libraries, instead
+// of the standard malloc(), calloc() and free(). Passing NULL restores the
+// latter. The functions must be thread-safe if libwebp is used from several
+// threads. This function itself is not thread-safe, and should only be called
+// while no memory allocated by libwebp is alive (including the buffers
+// returned to the user, which must then be released with WebPFree()).
+// Returns false in case of invalid functions. This function is made available
+// by the core 'libwebp' library.
+WEBP_EXTERN int WebPSetMemoryAllocator(
+    const WebPMemoryAllocator* const allocator);
+
+// Arena serving the working memory of encoding and decoding calls. It grows
+// by large slabs, and reuses the memory released right away, so that its size
+// follows the memory in use. The slabs freed entirely are given back, except
+// for a few ones (four times the slab size at most) kept for the next calls.
+typedef struct WebPArena WebPArena;
+
+// Creates an arena growing by slabs of at least 'slab_size' bytes (or a
+// default size if 0). Returns NULL in case of memory error, or if arenas are
+// not supported on this platform. This function is made available by the
+// core 'libwebp' library, as are the two below.
+WEBP_EXTERN WebPArena* WebPArenaNew(size_t slab_size);
+
+// Releases the arena and its memory. It must not be in use.
+WEBP_EXTERN void WebPArenaDelete(WebPArena* arena);
+
+// Attaches 'arena' to the calling thread, or detaches the current one if
+// NULL. The subsequent WebPEncode() and one-shot decoding calls (WebPDecode(),
+// WebPDecodeRGBA()...) made from this thread take their working memory from
+// the arena, including the one of their workers. The buffers handed over to
+// the user are allocated as usual, and so are the allocations made by the
+// user's callbacks and the memory kept across calls by incremental decoding,
+// WebPDecoderContext or WebPAnimEncoder. An arena must only be attached to
+// one thread at a time. Returns false if arenas are not supported.
+WEBP_EXTERN int WebPSetThreadArena(WebPArena* arena);
+
 #ifdef __cplusplus
 }    // extern "C"
 #endif